@@ -0,0 +1,238 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <gst/gst.h>
+#include "hyperspectral-autotune.h"
+#include "hyperspectral-dispatch.h"
+#include "hyperspectral-threadpool.h"
+
+/* every candidate is timed in this many rounds, the fastest run counts */
+#define TUNE_RUNS 2
+
+static const guint rows_per_item[] = { 1, 4, 16 };
+
+/* results of all CPUs, the group of this one is cpu_group */
+G_LOCK_DEFINE_STATIC (cache);
+static GKeyFile *cache = NULL;
+static gchar *cache_path = NULL;
+static gchar *cpu_group = NULL;
+static gboolean enabled = TRUE;
+
+static void
+cache_init (void)
+{
+  const gchar *env;
+
+  if ((env = g_getenv (GST_HSPEC_AUTOTUNE_ENV)) && !g_strcmp0 (env, "0"))
+    enabled = FALSE;
+
+  /* results only carry over to the same instruction sets and number of
+   * threads */
+  cpu_group = g_strdup_printf ("%s-%ut",
+      gst_hspec_isa_to_string (gst_hspec_cpu_get_best_isa ()),
+      gst_hspec_thread_pool_get_n_threads ());
+
+  cache = g_key_file_new ();
+  cache_path = g_build_filename (g_get_user_cache_dir (), "gst-hyperspectral",
+      "autotune.ini", NULL);
+  if (g_key_file_load_from_file (cache, cache_path, G_KEY_FILE_NONE, NULL))
+    GST_DEBUG ("loaded tuning results from %s", cache_path);
+}
+
+static void
+ensure_cache (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized)) {
+    cache_init ();
+    g_once_init_leave (&initialized, 1);
+  }
+}
+
+/* stores the result for key in the file as well, results other pipelines
+ * saved meanwhile are merged in first. Call with the cache lock held */
+static void
+save_result (const gchar *key, gint *list)
+{
+  GError *err = NULL;
+  GKeyFile *file;
+  gchar *dir, *data;
+  gsize len;
+
+  g_key_file_set_integer_list (cache, cpu_group, key, list, 2);
+
+  file = g_key_file_new ();
+  g_key_file_load_from_file (file, cache_path, G_KEY_FILE_NONE, NULL);
+  g_key_file_set_integer_list (file, cpu_group, key, list, 2);
+
+  dir = g_path_get_dirname (cache_path);
+  g_mkdir_with_parents (dir, 0755);
+  g_free (dir);
+
+  /* written to a temporary file and renamed over the old one */
+  data = g_key_file_to_data (file, &len, NULL);
+  if (!g_file_set_contents (cache_path, data, len, &err)) {
+    GST_WARNING ("Could not save tuning results to %s: %s", cache_path,
+        err->message);
+    g_error_free (err);
+  }
+  g_free (data);
+  g_key_file_free (file);
+}
+
+/* fills configs with the ways to split an operation worth trying on up to
+ * max_threads threads (0 for the whole pool), the first one is the default
+ * of using all threads. Returns the number of configurations */
+guint
+gst_hspec_autotune_parallel_configs (GstHspecParallelConfig *configs,
+    guint max_threads)
+{
+  guint i, t, n = 0;
+
+  g_return_val_if_fail (configs != NULL, 0);
+
+  if (max_threads == 0 || max_threads > gst_hspec_thread_pool_get_n_threads ())
+    max_threads = gst_hspec_thread_pool_get_n_threads ();
+
+  for (i=0; i<G_N_ELEMENTS (rows_per_item); i++) {
+    configs[n].n_threads = max_threads;
+    configs[n++].rows_per_item = rows_per_item[i];
+  }
+  /* fewer threads can win when the operation is bound by memory */
+  for (t=1; t<max_threads && n<GST_HSPEC_AUTOTUNE_MAX_CONFIGS; t*=2) {
+    for (i=0; i<G_N_ELEMENTS (rows_per_item); i++) {
+      if (n == GST_HSPEC_AUTOTUNE_MAX_CONFIGS)
+        break;
+      configs[n].n_threads = t;
+      configs[n++].rows_per_item = rows_per_item[i];
+    }
+  }
+
+  return n;
+}
+
+/* returns the candidate stored for key, results found for a different
+ * number of candidates are stale */
+gboolean
+gst_hspec_autotune_lookup (const gchar *key, guint n_candidates,
+    guint *candidate)
+{
+  gint *res;
+  gsize len;
+  gboolean found = FALSE;
+
+  g_return_val_if_fail (key != NULL, FALSE);
+  g_return_val_if_fail (candidate != NULL, FALSE);
+
+  ensure_cache ();
+
+  G_LOCK (cache);
+  res = g_key_file_get_integer_list (cache, cpu_group, key, &len, NULL);
+  if (res && len == 2 && res[0] >= 0 && res[0] < (gint) n_candidates &&
+      res[1] == (gint) n_candidates) {
+    *candidate = res[0];
+    found = TRUE;
+  }
+  G_UNLOCK (cache);
+  g_free (res);
+
+  return found;
+}
+
+/* starts tuning the operation named key over n_candidates, a stored result
+ * is used right away */
+void
+gst_hspec_autotune_init (GstHspecAutotune *tune, const gchar *key,
+    guint n_candidates)
+{
+  g_return_if_fail (tune != NULL);
+  g_return_if_fail (key != NULL);
+  g_return_if_fail (n_candidates > 0);
+
+  ensure_cache ();
+
+  tune->key = g_strdup (key);
+  tune->n_candidates = n_candidates;
+  tune->best = 0;
+  tune->next = 0;
+  tune->round = 0;
+  tune->best_time = G_MAXINT64;
+  tune->tuned = !enabled || n_candidates == 1 ||
+      gst_hspec_autotune_lookup (key, n_candidates, &tune->best);
+}
+
+void
+gst_hspec_autotune_clear (GstHspecAutotune *tune)
+{
+  g_return_if_fail (tune != NULL);
+
+  g_free (tune->key);
+  tune->key = NULL;
+  tune->n_candidates = 0;
+  tune->tuned = FALSE;
+}
+
+/* runs the operation once, with the chosen candidate when tuned and with
+ * the next one to time otherwise. func has to give the same output for
+ * every candidate. Returns the candidate that was run */
+guint
+gst_hspec_autotune_run (GstHspecAutotune *tune, GstHspecTuneFunc func,
+    gpointer user_data)
+{
+  guint candidate;
+  gint64 start, elapsed;
+  gint list[2];
+
+  g_return_val_if_fail (tune != NULL, 0);
+  g_return_val_if_fail (tune->n_candidates > 0, 0);
+  g_return_val_if_fail (func != NULL, 0);
+
+  if (tune->tuned) {
+    func (user_data, tune->best);
+    return tune->best;
+  }
+
+  candidate = tune->next;
+  start = g_get_monotonic_time ();
+  func (user_data, candidate);
+  elapsed = g_get_monotonic_time () - start;
+  if (elapsed < tune->best_time) {
+    tune->best_time = elapsed;
+    tune->best = candidate;
+  }
+
+  if (++tune->next < tune->n_candidates)
+    return candidate;
+  tune->next = 0;
+  if (++tune->round < TUNE_RUNS)
+    return candidate;
+
+  tune->tuned = TRUE;
+  GST_DEBUG ("tuned %s: candidate %u of %u, %" G_GINT64_FORMAT " us",
+      tune->key, tune->best, tune->n_candidates, tune->best_time);
+
+  list[0] = tune->best;
+  list[1] = tune->n_candidates;
+  G_LOCK (cache);
+  save_result (tune->key, list);
+  G_UNLOCK (cache);
+
+  return candidate;
+}
@@ -0,0 +1,87 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Runtime selection of the fastest way to run a kernel.
+ *
+ * While an operation on a new (operation, format, geometry) key is not
+ * tuned yet, every run uses the next candidate and is timed on the real
+ * data, so tuning never adds runs of its own. Once all candidates were
+ * timed the fastest one is kept. Results are stored per CPU in
+ * $XDG_CACHE_HOME/gst-hyperspectral/autotune.ini so later pipelines start
+ * with the tuned configuration right away. Setting GST_HSPEC_AUTOTUNE to 0
+ * disables tuning, the first candidate is used then.
+ */
+
+#ifndef __HYPERSPECTRAL_AUTOTUNE_H__
+#define __HYPERSPECTRAL_AUTOTUNE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* environment variable, 0 turns tuning off */
+#define GST_HSPEC_AUTOTUNE_ENV "GST_HSPEC_AUTOTUNE"
+
+/* upper bound of the configurations gst_hspec_autotune_parallel_configs()
+ * generates */
+#define GST_HSPEC_AUTOTUNE_MAX_CONFIGS 32
+
+/* runs the operation once with the given candidate */
+typedef void (*GstHspecTuneFunc) (gpointer user_data, guint candidate);
+
+/* how an operation is split over the thread pool */
+typedef struct {
+  guint n_threads;
+  /* rows handed to gst_hspec_parallel_for() as one item */
+  guint rows_per_item;
+} GstHspecParallelConfig;
+
+/* tuning state of one operation */
+typedef struct {
+  gchar *key;
+  guint n_candidates;
+  gboolean tuned;
+  /* the candidate to use once tuned */
+  guint best;
+
+  /*< private >*/
+  guint next;
+  guint round;
+  gint64 best_time;
+} GstHspecAutotune;
+
+guint    gst_hspec_autotune_parallel_configs (GstHspecParallelConfig *configs,
+                                              guint max_threads);
+
+gboolean gst_hspec_autotune_lookup           (const gchar *key,
+                                              guint n_candidates,
+                                              guint *candidate);
+
+void     gst_hspec_autotune_init             (GstHspecAutotune *tune,
+                                              const gchar *key,
+                                              guint n_candidates);
+void     gst_hspec_autotune_clear            (GstHspecAutotune *tune);
+guint    gst_hspec_autotune_run              (GstHspecAutotune *tune,
+                                              GstHspecTuneFunc func,
+                                              gpointer user_data);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,427 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "hyperspectral-bufferpool.h"
+#include "hyperspectral-meta.h"
+
+void
+gst_buffer_pool_config_set_hyperspectral_alignment (GstStructure *config,
+    guint align, guint padding)
+{
+  g_return_if_fail (config != NULL);
+
+  gst_structure_set (config,
+      "hyperspectral-align", G_TYPE_UINT, align,
+      "hyperspectral-padding", G_TYPE_UINT, padding, NULL);
+}
+
+gboolean
+gst_buffer_pool_config_get_hyperspectral_alignment (GstStructure *config,
+    guint *align, guint *padding)
+{
+  g_return_val_if_fail (config != NULL, FALSE);
+
+  return gst_structure_get (config,
+      "hyperspectral-align", G_TYPE_UINT, align,
+      "hyperspectral-padding", G_TYPE_UINT, padding, NULL);
+}
+
+G_DEFINE_TYPE (GstHyperspectralBufferPool, gst_hyperspectral_buffer_pool,
+    GST_TYPE_BUFFER_POOL);
+
+static const gchar **
+hyperspectral_buffer_pool_get_options (GstBufferPool *pool)
+{
+  static const gchar *options[] = {
+    GST_BUFFER_POOL_OPTION_HYPERSPECTRAL_META,
+    GST_BUFFER_POOL_OPTION_HYPERSPECTRAL_ALIGNMENT,
+    GST_BUFFER_POOL_OPTION_HYPERSPECTRAL_PLANE_MEMORIES,
+    NULL
+  };
+
+  return options;
+}
+
+/* pool configs and allocation queries carry guint sizes, larger cubes are
+ * described by the info of the pool */
+static guint
+config_size (gsize size)
+{
+  return MIN (size, G_MAXUINT);
+}
+
+static gboolean
+hyperspectral_buffer_pool_set_config (GstBufferPool *pool,
+    GstStructure *config)
+{
+  GstHyperspectralBufferPool *hpool = GST_HYPERSPECTRAL_BUFFER_POOL (pool);
+  const GstHyperspectralInfo *cached;
+  GstHyperspectralInfo info;
+  GstAllocator *allocator;
+  GstAllocationParams params;
+  GstCaps *caps;
+  guint size, min_buffers, max_buffers;
+  guint align = 0, padding = 0;
+
+  if (!gst_buffer_pool_config_get_params (config, &caps, &size, &min_buffers,
+          &max_buffers))
+    goto wrong_config;
+
+  if (caps == NULL)
+    goto no_caps;
+
+  if (!(cached = gst_hyperspectral_info_from_caps_cached (caps)))
+    goto wrong_caps;
+  gst_hyperspectral_info_copy (&info, cached);
+  gst_hyperspectral_info_unref (cached);
+
+  if (!gst_buffer_pool_config_get_allocator (config, &allocator, &params))
+    goto wrong_config_info;
+
+  if (gst_buffer_pool_config_has_option (config,
+          GST_BUFFER_POOL_OPTION_HYPERSPECTRAL_ALIGNMENT)) {
+    gst_buffer_pool_config_get_hyperspectral_alignment (config, &align,
+        &padding);
+    if (!gst_hyperspectral_info_align (&info, align, padding))
+      goto wrong_config_info;
+    /* the allocation parameters take the alignment as a mask */
+    if (align > 1)
+      params.align = MAX (params.align, align - 1);
+  }
+
+  GST_DEBUG ("pool %p, %dx%dx%d %s cube of %" G_GSIZE_FORMAT " bytes, "
+      "align %u padding %u", pool, info.width, info.height, info.wavelengths,
+      gst_hspec_format_to_string (info.format), info.cube_size, align, padding);
+
+  gst_hyperspectral_info_clear (&hpool->info);
+  hpool->info = info;
+
+  if (hpool->allocator)
+    gst_object_unref (hpool->allocator);
+  hpool->allocator = allocator ? gst_object_ref (allocator) : NULL;
+  hpool->params = params;
+
+  /* consumers can only find padded planes through the meta */
+  hpool->add_meta = gst_buffer_pool_config_has_option (config,
+      GST_BUFFER_POOL_OPTION_HYPERSPECTRAL_META) ||
+      !gst_hyperspectral_info_is_contiguous (&info);
+  /* buffers with more memories than GStreamer allows get merged on append,
+   * cubes too large for a config size are always split in bands */
+  hpool->plane_memories = (gst_buffer_pool_config_has_option (config,
+      GST_BUFFER_POOL_OPTION_HYPERSPECTRAL_PLANE_MEMORIES) ||
+      info.cube_size > G_MAXUINT) &&
+      info.layout == GST_HSPC_LAYOUT_MULTIPLANE &&
+      info.n_planes <= gst_buffer_get_max_memory ();
+
+  size = MAX (size, config_size (info.cube_size));
+  gst_buffer_pool_config_set_params (config, caps, size, min_buffers,
+      max_buffers);
+  gst_buffer_pool_config_set_allocator (config, allocator, &params);
+
+  return GST_BUFFER_POOL_CLASS (gst_hyperspectral_buffer_pool_parent_class)->
+      set_config (pool, config);
+
+wrong_config:
+  {
+    GST_WARNING ("pool %p, invalid config", pool);
+    return FALSE;
+  }
+no_caps:
+  {
+    GST_WARNING ("pool %p, no caps in config", pool);
+    return FALSE;
+  }
+wrong_caps:
+  {
+    GST_WARNING ("pool %p, failed getting hyperspectral info from caps %"
+        GST_PTR_FORMAT, pool, caps);
+    return FALSE;
+  }
+wrong_config_info:
+  {
+    GST_WARNING ("pool %p, invalid allocator or alignment in config", pool);
+    gst_hyperspectral_info_clear (&info);
+    return FALSE;
+  }
+}
+
+static GstFlowReturn
+hyperspectral_buffer_pool_alloc (GstBufferPool *pool, GstBuffer **buffer,
+    GstBufferPoolAcquireParams *params)
+{
+  GstHyperspectralBufferPool *hpool = GST_HYPERSPECTRAL_BUFFER_POOL (pool);
+  GstHyperspectralInfo *info = &hpool->info;
+  GstHyperspectralMeta *meta;
+  GstMemory *mem;
+  gsize size;
+  guint p;
+
+  if (hpool->plane_memories) {
+    /* planes are placed in increasing order, each memory ends where the
+     * next plane starts */
+    *buffer = gst_buffer_new ();
+    for (p=0; p<info->n_planes; p++) {
+      size = (p + 1 < info->n_planes ? info->offset[p + 1] : info->cube_size) -
+          info->offset[p];
+      mem = gst_allocator_alloc (hpool->allocator, size, &hpool->params);
+      if (!mem)
+        goto no_memory;
+      gst_buffer_append_memory (*buffer, mem);
+    }
+  } else {
+    *buffer = gst_buffer_new_allocate (hpool->allocator, info->cube_size,
+        &hpool->params);
+    if (!*buffer)
+      goto no_buffer;
+  }
+
+  if (hpool->add_meta) {
+    meta = gst_buffer_add_hyperspectral_meta (*buffer, info);
+    /* keep the plane description when the buffer returns to the pool */
+    GST_META_FLAG_SET (meta, GST_META_FLAG_POOLED);
+  }
+
+  return GST_FLOW_OK;
+
+no_memory:
+  {
+    GST_WARNING ("pool %p, can't allocate memory for plane %u", pool, p);
+    gst_buffer_unref (*buffer);
+    *buffer = NULL;
+    return GST_FLOW_ERROR;
+  }
+no_buffer:
+  {
+    GST_WARNING ("pool %p, can't allocate buffer of %" G_GSIZE_FORMAT
+        " bytes", pool, info->cube_size);
+    return GST_FLOW_ERROR;
+  }
+}
+
+/* pooled buffers keep the config size, which is clamped for cubes larger
+ * than 4 GiB, or the default release drops them. They only get the size of
+ * the cube while they are out of the pool */
+static GstFlowReturn
+hyperspectral_buffer_pool_acquire (GstBufferPool *pool, GstBuffer **buffer,
+    GstBufferPoolAcquireParams *params)
+{
+  GstHyperspectralBufferPool *hpool = GST_HYPERSPECTRAL_BUFFER_POOL (pool);
+  GstFlowReturn ret;
+
+  ret = GST_BUFFER_POOL_CLASS (gst_hyperspectral_buffer_pool_parent_class)->
+      acquire_buffer (pool, buffer, params);
+
+  if (ret == GST_FLOW_OK &&
+      gst_buffer_get_size (*buffer) < hpool->info.cube_size)
+    gst_buffer_set_size (*buffer, hpool->info.cube_size);
+
+  return ret;
+}
+
+static void
+gst_hyperspectral_buffer_pool_finalize (GObject *object)
+{
+  GstHyperspectralBufferPool *hpool = GST_HYPERSPECTRAL_BUFFER_POOL (object);
+
+  gst_hyperspectral_info_clear (&hpool->info);
+  if (hpool->allocator)
+    gst_object_unref (hpool->allocator);
+  hpool->allocator = NULL;
+
+  G_OBJECT_CLASS (gst_hyperspectral_buffer_pool_parent_class)->finalize (object);
+}
+
+static void
+gst_hyperspectral_buffer_pool_class_init (GstHyperspectralBufferPoolClass *klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+  GstBufferPoolClass *gstbufferpool_class = (GstBufferPoolClass *) klass;
+
+  gobject_class->finalize = gst_hyperspectral_buffer_pool_finalize;
+
+  gstbufferpool_class->get_options = hyperspectral_buffer_pool_get_options;
+  gstbufferpool_class->set_config = hyperspectral_buffer_pool_set_config;
+  gstbufferpool_class->alloc_buffer = hyperspectral_buffer_pool_alloc;
+  gstbufferpool_class->acquire_buffer = hyperspectral_buffer_pool_acquire;
+}
+
+static void
+gst_hyperspectral_buffer_pool_init (GstHyperspectralBufferPool *pool)
+{
+  gst_hyperspectral_info_init (&pool->info);
+  pool->allocator = NULL;
+  gst_allocation_params_init (&pool->params);
+  pool->add_meta = FALSE;
+  pool->plane_memories = FALSE;
+}
+
+GstBufferPool *
+gst_hyperspectral_buffer_pool_new (void)
+{
+  return g_object_new (GST_TYPE_HYPERSPECTRAL_BUFFER_POOL, NULL);
+}
+
+/* answers an allocation query for hyperspectral caps with a pool holding
+ * min_buffers preallocated cubes, and advertises GstHyperspectralMeta */
+gboolean
+gst_hyperspectral_buffer_pool_propose_allocation (GstQuery *query,
+    guint min_buffers)
+{
+  const GstHyperspectralInfo *info;
+  GstBufferPool *pool;
+  GstStructure *config;
+  GstCaps *caps;
+  gboolean need_pool;
+
+  gst_query_parse_allocation (query, &caps, &need_pool);
+  if (caps == NULL)
+    goto no_caps;
+
+  if (!(info = gst_hyperspectral_info_from_caps_cached (caps)))
+    goto invalid_caps;
+
+  if (need_pool) {
+    pool = gst_hyperspectral_buffer_pool_new ();
+    config = gst_buffer_pool_get_config (pool);
+    gst_buffer_pool_config_set_params (config, caps,
+        config_size (info->cube_size), min_buffers, 0);
+    gst_buffer_pool_config_add_option (config,
+        GST_BUFFER_POOL_OPTION_HYPERSPECTRAL_META);
+    if (!gst_buffer_pool_set_config (pool, config)) {
+      gst_object_unref (pool);
+      gst_hyperspectral_info_unref (info);
+      goto config_failed;
+    }
+    gst_query_add_allocation_pool (query, pool, config_size (info->cube_size),
+        min_buffers, 0);
+    gst_object_unref (pool);
+  }
+
+  gst_query_add_allocation_meta (query, GST_HYPERSPECTRAL_META_API_TYPE, NULL);
+  gst_hyperspectral_info_unref (info);
+  return TRUE;
+
+no_caps:
+  {
+    GST_DEBUG ("no caps specified");
+    return FALSE;
+  }
+invalid_caps:
+  {
+    GST_DEBUG ("invalid caps specified");
+    return FALSE;
+  }
+config_failed:
+  {
+    GST_DEBUG ("failed setting config");
+    return FALSE;
+  }
+}
+
+/* makes the first pool of an answered allocation query a hyperspectral pool
+ * for its caps, a pool proposed downstream is reused when it is one.
+ * Cubes are aligned and padded when align or padding are set */
+gboolean
+gst_hyperspectral_buffer_pool_decide_allocation (GstQuery *query,
+    guint min_buffers, guint align, guint padding)
+{
+  const GstHyperspectralInfo *info;
+  GstBufferPool *pool = NULL;
+  GstAllocator *allocator = NULL;
+  GstAllocationParams params;
+  GstStructure *config;
+  GstCaps *caps;
+  guint size = 0, min = 0, max = 0;
+  gboolean update;
+
+  gst_query_parse_allocation (query, &caps, NULL);
+  if (caps == NULL)
+    goto no_caps;
+
+  if (!(info = gst_hyperspectral_info_from_caps_cached (caps)))
+    goto invalid_caps;
+
+  update = gst_query_get_n_allocation_pools (query) > 0;
+  if (update)
+    gst_query_parse_nth_allocation_pool (query, 0, &pool, &size, &min, &max);
+
+  if (pool && !GST_IS_HYPERSPECTRAL_BUFFER_POOL (pool)) {
+    gst_object_unref (pool);
+    pool = NULL;
+  }
+  if (pool == NULL)
+    pool = gst_hyperspectral_buffer_pool_new ();
+
+  size = MAX (size, config_size (info->cube_size));
+  min = MAX (min, min_buffers);
+  if (max != 0 && max < min)
+    max = min;
+
+  if (gst_query_get_n_allocation_params (query) > 0)
+    gst_query_parse_nth_allocation_param (query, 0, &allocator, &params);
+  else
+    gst_allocation_params_init (&params);
+
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps, size, min, max);
+  gst_buffer_pool_config_set_allocator (config, allocator, &params);
+  gst_buffer_pool_config_add_option (config,
+      GST_BUFFER_POOL_OPTION_HYPERSPECTRAL_META);
+  if (align || padding) {
+    gst_buffer_pool_config_add_option (config,
+        GST_BUFFER_POOL_OPTION_HYPERSPECTRAL_ALIGNMENT);
+    gst_buffer_pool_config_set_hyperspectral_alignment (config, align, padding);
+  }
+  if (allocator)
+    gst_object_unref (allocator);
+  gst_hyperspectral_info_unref (info);
+
+  if (!gst_buffer_pool_set_config (pool, config))
+    goto config_failed;
+
+  /* alignment and padding can grow the buffers */
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_get_params (config, NULL, &size, NULL, NULL);
+  gst_structure_free (config);
+
+  if (update)
+    gst_query_set_nth_allocation_pool (query, 0, pool, size, min, max);
+  else
+    gst_query_add_allocation_pool (query, pool, size, min, max);
+
+  gst_object_unref (pool);
+  return TRUE;
+
+no_caps:
+  {
+    GST_DEBUG ("no caps specified");
+    return FALSE;
+  }
+invalid_caps:
+  {
+    GST_DEBUG ("invalid caps specified");
+    return FALSE;
+  }
+config_failed:
+  {
+    GST_DEBUG ("failed setting config");
+    gst_object_unref (pool);
+    return FALSE;
+  }
+}
@@ -0,0 +1,90 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Buffer pool for hyperspectral cubes.
+ *
+ * The pool is configured from video/hyperspectral-cube caps. Rows and planes
+ * can be aligned and padded, multiplane cubes can be allocated with one
+ * GstMemory per band. Buffers carry a GstHyperspectralMeta describing where
+ * the planes are placed.
+ */
+
+#ifndef __HYPERSPECTRAL_BUFFERPOOL_H__
+#define __HYPERSPECTRAL_BUFFERPOOL_H__
+
+#include <gst/gst.h>
+#include <gst/hyperspectral/hyperspectral-info.h>
+
+G_BEGIN_DECLS
+
+/* buffers carry a GstHyperspectralMeta */
+#define GST_BUFFER_POOL_OPTION_HYPERSPECTRAL_META "GstBufferPoolOptionHyperspectralMeta"
+/* rows and planes are aligned and padded, see
+ * gst_buffer_pool_config_set_hyperspectral_alignment() */
+#define GST_BUFFER_POOL_OPTION_HYPERSPECTRAL_ALIGNMENT "GstBufferPoolOptionHyperspectralAlignment"
+/* every band of a multiplane cube is a separate GstMemory */
+#define GST_BUFFER_POOL_OPTION_HYPERSPECTRAL_PLANE_MEMORIES "GstBufferPoolOptionHyperspectralPlaneMemories"
+
+/* cubes preallocated by the pools the elements set up, one being filled
+ * while the previous one is consumed */
+#define GST_HYPERSPECTRAL_POOL_MIN_BUFFERS 2
+
+void     gst_buffer_pool_config_set_hyperspectral_alignment (GstStructure *config,
+                                                             guint align, guint padding);
+gboolean gst_buffer_pool_config_get_hyperspectral_alignment (GstStructure *config,
+                                                             guint *align, guint *padding);
+
+#define GST_TYPE_HYPERSPECTRAL_BUFFER_POOL      (gst_hyperspectral_buffer_pool_get_type())
+#define GST_IS_HYPERSPECTRAL_BUFFER_POOL(obj)   (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_HYPERSPECTRAL_BUFFER_POOL))
+#define GST_HYPERSPECTRAL_BUFFER_POOL(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_HYPERSPECTRAL_BUFFER_POOL, GstHyperspectralBufferPool))
+
+typedef struct _GstHyperspectralBufferPool GstHyperspectralBufferPool;
+typedef struct _GstHyperspectralBufferPoolClass GstHyperspectralBufferPoolClass;
+
+struct _GstHyperspectralBufferPool
+{
+  GstBufferPool bufferpool;
+
+  GstAllocator *allocator;
+  GstAllocationParams params;
+  GstHyperspectralInfo info;
+  gboolean add_meta;
+  gboolean plane_memories;
+};
+
+struct _GstHyperspectralBufferPoolClass
+{
+  GstBufferPoolClass parent_class;
+};
+
+GType           gst_hyperspectral_buffer_pool_get_type (void);
+
+GstBufferPool * gst_hyperspectral_buffer_pool_new      (void);
+
+gboolean        gst_hyperspectral_buffer_pool_propose_allocation (GstQuery *query,
+                                                                  guint min_buffers);
+gboolean        gst_hyperspectral_buffer_pool_decide_allocation  (GstQuery *query,
+                                                                  guint min_buffers,
+                                                                  guint align,
+                                                                  guint padding);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,526 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include "hyperspectral-convert.h"
+#include "hyperspectral-kernels.h"
+#include "hyperspectral-threadpool.h"
+#include "hyperspectral-autotune.h"
+
+/* samples converted per step through the float path, kept small so the
+ * intermediate stays in L1 */
+#define CONVERT_CHUNK 256
+
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define GRAY16_SWAPPED GST_HSPC_FORMAT_GRAY16_BE
+#else
+#define GRAY16_SWAPPED GST_HSPC_FORMAT_GRAY16_LE
+#endif
+
+typedef void (*ConvertRunFunc) (GstHyperspectralConverter *convert,
+    guint8 *dest, gsize dstride, const guint8 *src, gsize sstride, gsize n);
+
+struct _GstHyperspectralConverter
+{
+  GstHyperspectralInfo in_info;
+  GstHyperspectralInfo out_info;
+
+  /* packed formats are converted through native 16 bit copies of a few
+   * rows at a time, the work infos describe what the conversion runs see */
+  GstHyperspectralInfo in_work;
+  GstHyperspectralInfo out_work;
+  gint block_rows;
+
+  gboolean identity;
+  gfloat mul;
+  gfloat add;
+
+  ConvertRunFunc convert_run;
+
+  /* ways to split a cube over the thread pool, the one to use is tuned
+   * over the first frames */
+  GstHspecParallelConfig configs[GST_HSPEC_AUTOTUNE_MAX_CONFIGS];
+  guint n_configs;
+  GstHspecAutotune tune;
+};
+
+typedef struct {
+  GstHyperspectralConverter *convert;
+  const GstHyperspectralFrame *src;
+  GstHyperspectralFrame *dest;
+  gboolean contiguous;
+  guint rows_per_item;
+} ConvertJob;
+
+/* where the rows of one side of a conversion are, the rows of a packed
+ * side live unpacked in block while they are converted */
+typedef struct {
+  const GstHyperspectralFrame *frame;
+  guint16 *block;
+  gsize row_elems;
+  gint y0;
+  gint rows;
+} ConvertSide;
+
+static gboolean
+get_format_max (GstHyperspectralFormat fmt, gfloat *max)
+{
+  switch (fmt) {
+    case GST_HSPC_FORMAT_GRAY8:
+      *max = G_MAXUINT8;
+      break;
+    case GST_HSPC_FORMAT_GRAY16_LE:
+    case GST_HSPC_FORMAT_GRAY16_BE:
+      *max = G_MAXUINT16;
+      break;
+    case GST_HSPC_FORMAT_F32:
+    case GST_HSPC_FORMAT_F16:
+      *max = 1.0f;
+      break;
+    case GST_HSPC_FORMAT_GRAY10P:
+      *max = 1023;
+      break;
+    case GST_HSPC_FORMAT_GRAY12P:
+      *max = 4095;
+      break;
+    default:
+      GST_ERROR ("Unhandled format type '%s'", gst_hspec_format_to_string (fmt));
+      return FALSE;
+  }
+  return TRUE;
+}
+
+static void
+load_run (GstHyperspectralFormat fmt, gfloat *dest, const guint8 *src,
+    gsize sstride, gsize n)
+{
+  switch (fmt) {
+    case GST_HSPC_FORMAT_GRAY8:
+      gst_hspec_kernel_u8_to_f32 (dest, src, sstride, n);
+      break;
+    case GST_HSPC_FORMAT_F32:
+      gst_hspec_kernel_copy_f32 (dest, 1, (const gfloat *) src, sstride, n);
+      break;
+    case GST_HSPC_FORMAT_F16:
+      gst_hspec_kernel_f16_to_f32 (dest, (const guint16 *) src, sstride, n);
+      break;
+    default:
+      gst_hspec_kernel_u16_to_f32 (dest, (const guint16 *) src, sstride,
+          fmt == GRAY16_SWAPPED, n);
+      break;
+  }
+}
+
+static void
+store_run (GstHyperspectralFormat fmt, guint8 *dest, gsize dstride,
+    const gfloat *src, gsize n)
+{
+  switch (fmt) {
+    case GST_HSPC_FORMAT_GRAY8:
+      gst_hspec_kernel_f32_to_u8 (dest, dstride, src, n);
+      break;
+    case GST_HSPC_FORMAT_F32:
+      gst_hspec_kernel_copy_f32 ((gfloat *) dest, dstride, src, 1, n);
+      break;
+    case GST_HSPC_FORMAT_F16:
+      gst_hspec_kernel_f32_to_f16 ((guint16 *) dest, dstride, src, n);
+      break;
+    default:
+      gst_hspec_kernel_f32_to_u16 ((guint16 *) dest, dstride, src,
+          fmt == GRAY16_SWAPPED, n);
+      break;
+  }
+}
+
+static void
+convert_run_copy_u8 (GstHyperspectralConverter *convert, guint8 *dest,
+    gsize dstride, const guint8 *src, gsize sstride, gsize n)
+{
+  gst_hspec_kernel_copy_u8 (dest, dstride, src, sstride, n);
+}
+
+static void
+convert_run_copy_u16 (GstHyperspectralConverter *convert, guint8 *dest,
+    gsize dstride, const guint8 *src, gsize sstride, gsize n)
+{
+  gst_hspec_kernel_copy_u16 ((guint16 *) dest, dstride,
+      (const guint16 *) src, sstride, n);
+}
+
+static void
+convert_run_copy_f32 (GstHyperspectralConverter *convert, guint8 *dest,
+    gsize dstride, const guint8 *src, gsize sstride, gsize n)
+{
+  gst_hspec_kernel_copy_f32 ((gfloat *) dest, dstride,
+      (const gfloat *) src, sstride, n);
+}
+
+static void
+convert_run_swap_u16 (GstHyperspectralConverter *convert, guint8 *dest,
+    gsize dstride, const guint8 *src, gsize sstride, gsize n)
+{
+  gst_hspec_kernel_swap_u16 ((guint16 *) dest, dstride,
+      (const guint16 *) src, sstride, n);
+}
+
+/* any format to any format through a small float intermediate */
+static void
+convert_run_generic (GstHyperspectralConverter *convert, guint8 *dest,
+    gsize dstride, const guint8 *src, gsize sstride, gsize n)
+{
+  gfloat tmp[CONVERT_CHUNK];
+  gsize i, len;
+  gsize sstep = sstride * convert->in_info.bytesize;
+  gsize dstep = dstride * convert->out_info.bytesize;
+
+  for (i=0; i<n; i+=len) {
+    len = MIN (n - i, CONVERT_CHUNK);
+    load_run (convert->in_info.format, tmp, src + i*sstep, sstride, len);
+    gst_hspec_kernel_scale_f32 (tmp, convert->mul, convert->add, len);
+    store_run (convert->out_info.format, dest + i*dstep, dstride, tmp, len);
+  }
+}
+
+static gsize
+get_row_elems (const GstHyperspectralInfo *info)
+{
+  if (info->layout == GST_HSPC_LAYOUT_MULTIPLANE)
+    return info->width;
+  return (gsize) info->width * info->wavelengths;
+}
+
+/* rows unpacked at a time, enough that every block starts on a whole group
+ * of packed samples */
+static gint
+get_block_rows (const GstHyperspectralInfo *info)
+{
+  gsize row_elems = get_row_elems (info);
+  guint group;
+  gint rows = 1;
+
+  if (!GST_HSPEC_FORMAT_IS_PACKED (info->format))
+    return 1;
+
+  group = info->format == GST_HSPC_FORMAT_GRAY10P ? 4 : 2;
+  while ((rows * row_elems) % group != 0)
+    rows++;
+  return rows;
+}
+
+GstHyperspectralConverter *
+gst_hyperspectral_converter_new (const GstHyperspectralInfo *in_info,
+    const GstHyperspectralInfo *out_info, gdouble scale, gdouble offset)
+{
+  GstHyperspectralConverter *convert;
+  gfloat in_max, out_max;
+  gchar *tune_key;
+
+  g_return_val_if_fail (in_info != NULL, NULL);
+  g_return_val_if_fail (out_info != NULL, NULL);
+
+  if (in_info->width != out_info->width ||
+      in_info->height != out_info->height ||
+      in_info->wavelengths != out_info->wavelengths) {
+    GST_ERROR ("Cube dimensions differ, %dx%dx%d != %dx%dx%d",
+        in_info->width, in_info->height, in_info->wavelengths,
+        out_info->width, out_info->height, out_info->wavelengths);
+    return NULL;
+  }
+
+  if (!get_format_max (in_info->format, &in_max) ||
+      !get_format_max (out_info->format, &out_max))
+    return NULL;
+
+  convert = g_new0 (GstHyperspectralConverter, 1);
+  /* don't keep pointers to memory owned by the caller */
+  gst_hyperspectral_info_copy (&convert->in_info, in_info);
+  gst_hyperspectral_info_copy (&convert->out_info, out_info);
+
+  gst_hyperspectral_info_init_unpacked (&convert->in_work, in_info);
+  gst_hyperspectral_info_init_unpacked (&convert->out_work, out_info);
+  /* group sizes are powers of two, the larger count suits both sides */
+  convert->block_rows = MAX (get_block_rows (in_info),
+      get_block_rows (out_info));
+
+  convert->mul = scale * out_max / in_max;
+  convert->add = offset * out_max;
+  convert->identity = (scale == 1.0 && offset == 0.0);
+
+  if (convert->identity && in_info->format == out_info->format) {
+    if (in_info->bytesize == 1)
+      convert->convert_run = convert_run_copy_u8;
+    else if (in_info->bytesize == 2)
+      convert->convert_run = convert_run_copy_u16;
+    else
+      convert->convert_run = convert_run_copy_f32;
+  } else if (convert->identity &&
+      (in_info->format == GST_HSPC_FORMAT_GRAY16_LE ||
+       in_info->format == GST_HSPC_FORMAT_GRAY16_BE) &&
+      (out_info->format == GST_HSPC_FORMAT_GRAY16_LE ||
+       out_info->format == GST_HSPC_FORMAT_GRAY16_BE)) {
+    convert->convert_run = convert_run_swap_u16;
+  } else {
+    convert->convert_run = convert_run_generic;
+  }
+
+  convert->n_configs = gst_hspec_autotune_parallel_configs (convert->configs, 0);
+  tune_key = g_strdup_printf ("convert:%s/%s:%s/%s:%s:%dx%dx%d:t%u",
+      gst_hspec_format_to_string (in_info->format),
+      gst_hspec_layout_to_string (in_info->layout),
+      gst_hspec_format_to_string (out_info->format),
+      gst_hspec_layout_to_string (out_info->layout),
+      convert->convert_run == convert_run_generic ? "scale" : "copy",
+      in_info->width, in_info->height, in_info->wavelengths,
+      convert->configs[0].n_threads);
+  gst_hspec_autotune_init (&convert->tune, tune_key, convert->n_configs);
+  g_free (tune_key);
+
+  GST_DEBUG ("Converter %s/%s -> %s/%s, mul %f add %f",
+      gst_hspec_format_to_string (in_info->format),
+      gst_hspec_layout_to_string (in_info->layout),
+      gst_hspec_format_to_string (out_info->format),
+      gst_hspec_layout_to_string (out_info->layout),
+      convert->mul, convert->add);
+
+  return convert;
+}
+
+void
+gst_hyperspectral_converter_free (GstHyperspectralConverter *convert)
+{
+  g_return_if_fail (convert != NULL);
+
+  gst_hyperspectral_info_clear (&convert->in_info);
+  gst_hyperspectral_info_clear (&convert->out_info);
+  gst_hyperspectral_info_clear (&convert->in_work);
+  gst_hyperspectral_info_clear (&convert->out_work);
+  gst_hspec_autotune_clear (&convert->tune);
+  g_free (convert);
+}
+
+/* TRUE when the output is a bit exact copy of the input */
+gboolean
+gst_hyperspectral_converter_is_identity (GstHyperspectralConverter *convert)
+{
+  g_return_val_if_fail (convert != NULL, FALSE);
+
+  return convert->identity &&
+      convert->in_info.format == convert->out_info.format &&
+      convert->in_info.layout == convert->out_info.layout;
+}
+
+static guint8 *
+side_row (const ConvertSide *side, guint p, gint y)
+{
+  if (side->block == NULL)
+    return GST_HSPEC_FRAME_ROW_DATA (side->frame, p, y);
+  return (guint8 *) (side->block +
+      ((gsize) p * side->rows + (y - side->y0)) * side->row_elems);
+}
+
+/* the rows [y0, y1) of every plane of a packed side into its block, y0
+ * starts a whole group of samples */
+static void
+unpack_block (const ConvertSide *side, gint y0, gint y1)
+{
+  const GstHyperspectralInfo *info = &side->frame->info;
+  const guint8 *s;
+  guint16 *d;
+  gsize n = (gsize) (y1 - y0) * side->row_elems;
+  guint p;
+
+  for (p=0; p<info->n_planes; p++) {
+    s = GST_HSPEC_FRAME_PLANE_DATA (side->frame, p) +
+        gst_hspec_format_get_size (info->format, (gsize) y0 * side->row_elems);
+    d = (guint16 *) side_row (side, p, y0);
+    if (info->format == GST_HSPC_FORMAT_GRAY10P)
+      gst_hspec_kernel_unpack_10 (d, s, n);
+    else
+      gst_hspec_kernel_unpack_12 (d, s, n);
+  }
+}
+
+static void
+pack_block (const ConvertSide *side, gint y0, gint y1)
+{
+  const GstHyperspectralInfo *info = &side->frame->info;
+  const guint16 *s;
+  guint8 *d;
+  gsize n = (gsize) (y1 - y0) * side->row_elems;
+  guint p;
+
+  for (p=0; p<info->n_planes; p++) {
+    s = (const guint16 *) side_row (side, p, y0);
+    d = GST_HSPEC_FRAME_PLANE_DATA (side->frame, p) +
+        gst_hspec_format_get_size (info->format, (gsize) y0 * side->row_elems);
+    if (info->format == GST_HSPC_FORMAT_GRAY10P)
+      gst_hspec_kernel_pack_10 (d, s, n);
+    else
+      gst_hspec_kernel_pack_12 (d, s, n);
+  }
+}
+
+/* converts the rows [ystart, yend) of every plane */
+static void
+convert_block (ConvertJob *job, const ConvertSide *in_side,
+    const ConvertSide *out_side, gint ystart, gint yend)
+{
+  GstHyperspectralConverter *convert = job->convert;
+  GstHyperspectralInfo *in, *out;
+  const guint8 *s;
+  guint8 *d;
+  gint y, b;
+  guint p;
+
+  in = &convert->in_work;
+  out = &convert->out_work;
+
+  if (in->layout == out->layout) {
+    for (p=0; p<in->n_planes; p++) {
+      /* rows of a contiguous plane follow each other, convert them in one
+       * run */
+      if (job->contiguous) {
+        convert->convert_run (convert, side_row (out_side, p, ystart), 1,
+            side_row (in_side, p, ystart), 1,
+            (gsize) (yend - ystart) * in_side->row_elems);
+        continue;
+      }
+      /* padded rows, convert one row at a time */
+      for (y=ystart; y<yend; y++)
+        convert->convert_run (convert, side_row (out_side, p, y), 1,
+            side_row (in_side, p, y), 1, in_side->row_elems);
+    }
+    return;
+  }
+
+  /* layout change, walk the cube one row at a time so the interleaved
+   * side of the transposition stays in cache while all bands visit it */
+  for (y=ystart; y<yend; y++) {
+    for (b=0; b<in->wavelengths; b++) {
+      if (in->layout == GST_HSPC_LAYOUT_MULTIPLANE) {
+        s = side_row (in_side, b, y);
+        d = side_row (out_side, 0, y) + b * out->bytesize;
+        convert->convert_run (convert, d, out->wavelengths, s, 1, in->width);
+      } else {
+        s = side_row (in_side, 0, y) + b * in->bytesize;
+        d = side_row (out_side, b, y);
+        convert->convert_run (convert, d, 1, s, in->wavelengths, in->width);
+      }
+    }
+  }
+}
+
+/* packed sides are unpacked and packed a block of rows at a time around
+ * the conversion so the samples are only walked once */
+static void
+convert_rows (ConvertJob *job, gint ystart, gint yend)
+{
+  GstHyperspectralConverter *convert = job->convert;
+  ConvertSide in_side, out_side;
+  gsize block_elems;
+  gint y0, y1;
+
+  in_side.frame = job->src;
+  in_side.block = NULL;
+  in_side.row_elems = get_row_elems (&convert->in_work);
+  out_side.frame = job->dest;
+  out_side.block = NULL;
+  out_side.row_elems = get_row_elems (&convert->out_work);
+
+  if (!GST_HSPEC_FORMAT_IS_PACKED (convert->in_info.format) &&
+      !GST_HSPEC_FORMAT_IS_PACKED (convert->out_info.format)) {
+    convert_block (job, &in_side, &out_side, ystart, yend);
+    return;
+  }
+
+  block_elems = (gsize) convert->block_rows * convert->in_work.width *
+      convert->in_work.wavelengths;
+  if (GST_HSPEC_FORMAT_IS_PACKED (convert->in_info.format))
+    in_side.block = g_new (guint16, block_elems);
+  if (GST_HSPEC_FORMAT_IS_PACKED (convert->out_info.format))
+    out_side.block = g_new (guint16, block_elems);
+  in_side.rows = out_side.rows = convert->block_rows;
+
+  for (y0=ystart; y0<yend; y0=y1) {
+    y1 = MIN (y0 + convert->block_rows, yend);
+    in_side.y0 = out_side.y0 = y0;
+    if (in_side.block)
+      unpack_block (&in_side, y0, y1);
+    convert_block (job, &in_side, &out_side, y0, y1);
+    if (out_side.block)
+      pack_block (&out_side, y0, y1);
+  }
+
+  g_free (in_side.block);
+  g_free (out_side.block);
+}
+
+static void
+convert_items (gpointer user_data, guint start, guint end)
+{
+  ConvertJob *job = user_data;
+
+  convert_rows (job, start * job->rows_per_item,
+      MIN (end * job->rows_per_item, (guint) job->convert->in_work.height));
+}
+
+static void
+convert_with_config (gpointer user_data, guint config)
+{
+  ConvertJob *job = user_data;
+  GstHspecParallelConfig *c = &job->convert->configs[config];
+  guint height = job->convert->in_work.height;
+  guint block_rows = job->convert->block_rows;
+
+  /* items have to start on a block of packed rows */
+  job->rows_per_item = (c->rows_per_item + block_rows - 1) / block_rows *
+      block_rows;
+  gst_hspec_parallel_for ((height + job->rows_per_item - 1) / job->rows_per_item,
+      c->n_threads, convert_items, job);
+}
+
+static void
+convert_cube (GstHyperspectralConverter *convert,
+    const GstHyperspectralFrame *src, GstHyperspectralFrame *dest)
+{
+  ConvertJob job;
+
+  job.convert = convert;
+  job.src = src;
+  job.dest = dest;
+  /* the unpacked rows of a packed side always follow each other */
+  job.contiguous =
+      (GST_HSPEC_FORMAT_IS_PACKED (src->info.format) ||
+          gst_hyperspectral_frame_is_contiguous (src)) &&
+      (GST_HSPEC_FORMAT_IS_PACKED (dest->info.format) ||
+          gst_hyperspectral_frame_is_contiguous (dest));
+
+  gst_hspec_autotune_run (&convert->tune, convert_with_config, &job);
+}
+
+void
+gst_hyperspectral_converter_frame (GstHyperspectralConverter *convert,
+    const GstHyperspectralFrame *src, GstHyperspectralFrame *dest)
+{
+  g_return_if_fail (convert != NULL);
+  g_return_if_fail (src != NULL);
+  g_return_if_fail (dest != NULL);
+
+  convert_cube (convert, src, dest);
+}
@@ -0,0 +1,50 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Converts hyperspectral cubes between sample formats and layouts.
+ *
+ * Samples are normalised to [0, 1] using the range of the input format,
+ * multiplied by scale, offset is added and the result is mapped onto the
+ * range of the output format. Format and layout changes are done in the
+ * same pass over the cube.
+ */
+
+#ifndef __HYPERSPECTRAL_CONVERT_H__
+#define __HYPERSPECTRAL_CONVERT_H__
+
+#include <gst/gst.h>
+#include <gst/hyperspectral/hyperspectral-info.h>
+#include <gst/hyperspectral/hyperspectral-frame.h>
+
+typedef struct _GstHyperspectralConverter GstHyperspectralConverter;
+
+GstHyperspectralConverter * gst_hyperspectral_converter_new (
+    const GstHyperspectralInfo *in_info, const GstHyperspectralInfo *out_info,
+    gdouble scale, gdouble offset);
+
+void      gst_hyperspectral_converter_free    (GstHyperspectralConverter *convert);
+
+gboolean  gst_hyperspectral_converter_is_identity (GstHyperspectralConverter *convert);
+
+void      gst_hyperspectral_converter_frame   (GstHyperspectralConverter *convert,
+                                               const GstHyperspectralFrame *src,
+                                               GstHyperspectralFrame *dest);
+
+#endif
@@ -0,0 +1,246 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include "hyperspectral-dispatch.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#define HAVE_CPUID 1
+#endif
+
+#if defined(__arm__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define HAVE_ARM_HWCAP 1
+#endif
+
+static const gchar *isa_names[GST_HSPEC_ISA_LAST] = {
+  "c", "sse2", "ssse3", "sse4.1", "avx2", "neon"
+};
+
+/* bit per GstHspecIsa usable on this CPU */
+static guint isa_flags;
+
+/* registered kernels, never freed */
+G_LOCK_DEFINE_STATIC (registry);
+static GPtrArray *registry = NULL;
+
+const gchar *
+gst_hspec_isa_to_string (GstHspecIsa isa)
+{
+  if (isa < GST_HSPEC_ISA_C || isa >= GST_HSPEC_ISA_LAST)
+    return NULL;
+  return isa_names[isa];
+}
+
+/* returns GST_HSPEC_ISA_LAST for unknown names */
+GstHspecIsa
+gst_hspec_isa_from_string (const gchar *str)
+{
+  gint i;
+
+  for (i=0; i<GST_HSPEC_ISA_LAST; i++) {
+    if (!g_ascii_strcasecmp (str, isa_names[i]))
+      return i;
+  }
+  return GST_HSPEC_ISA_LAST;
+}
+
+#ifdef HAVE_CPUID
+/* AVX registers have to be saved by the OS too */
+static gboolean
+os_saves_ymm (void)
+{
+  guint32 lo, hi;
+
+  __asm__ __volatile__ ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+  return (lo & 0x6) == 0x6;
+}
+#endif
+
+static guint
+probe_isa_flags (void)
+{
+  guint flags = 1 << GST_HSPEC_ISA_C;
+#ifdef HAVE_CPUID
+  guint eax, ebx, ecx, edx;
+
+  if (__get_cpuid (1, &eax, &ebx, &ecx, &edx)) {
+    if (edx & bit_SSE2)
+      flags |= 1 << GST_HSPEC_ISA_SSE2;
+    if (ecx & bit_SSSE3)
+      flags |= 1 << GST_HSPEC_ISA_SSSE3;
+    if (ecx & bit_SSE4_1)
+      flags |= 1 << GST_HSPEC_ISA_SSE4_1;
+    /* the AVX2 kernels use F16C too, no CPU has one without the other */
+    if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX) && (ecx & bit_F16C) &&
+        os_saves_ymm () &&
+        __get_cpuid_count (7, 0, &eax, &ebx, &ecx, &edx) &&
+        (ebx & bit_AVX2))
+      flags |= 1 << GST_HSPEC_ISA_AVX2;
+  }
+#elif defined(__aarch64__)
+  flags |= 1 << GST_HSPEC_ISA_NEON;
+#elif defined(HAVE_ARM_HWCAP)
+  if (getauxval (AT_HWCAP) & HWCAP_NEON)
+    flags |= 1 << GST_HSPEC_ISA_NEON;
+#endif
+  return flags;
+}
+
+static void
+init_isa_flags (void)
+{
+  const gchar *env;
+  GstHspecIsa isa;
+  guint flags = probe_isa_flags ();
+
+  if ((env = g_getenv (GST_HSPEC_FORCE_ISA_ENV))) {
+    isa = gst_hspec_isa_from_string (env);
+    if (isa == GST_HSPEC_ISA_LAST)
+      GST_WARNING ("Unknown instruction set '%s' in " GST_HSPEC_FORCE_ISA_ENV,
+          env);
+    else if (!(flags & (1 << isa))) {
+      GST_WARNING ("Forced instruction set %s is not supported by the CPU, "
+          "using c", env);
+      flags = 1 << GST_HSPEC_ISA_C;
+    } else if (isa == GST_HSPEC_ISA_NEON) {
+      flags &= (1 << GST_HSPEC_ISA_C) | (1 << GST_HSPEC_ISA_NEON);
+    } else {
+      /* the x86 sets follow C in order, each one implies the ones below */
+      flags &= (2 << isa) - 1;
+    }
+  }
+  isa_flags = flags;
+  GST_DEBUG ("usable instruction sets: 0x%x", isa_flags);
+}
+
+static guint
+get_isa_flags (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized)) {
+    init_isa_flags ();
+    g_once_init_leave (&initialized, 1);
+  }
+  return isa_flags;
+}
+
+/* whether kernels for isa may be used, taking GST_HSPEC_FORCE_ISA into
+ * account */
+gboolean
+gst_hspec_cpu_has_isa (GstHspecIsa isa)
+{
+  if (isa < GST_HSPEC_ISA_C || isa >= GST_HSPEC_ISA_LAST)
+    return FALSE;
+  return (get_isa_flags () & (1 << isa)) != 0;
+}
+
+GstHspecIsa
+gst_hspec_cpu_get_best_isa (void)
+{
+  guint flags = get_isa_flags ();
+  gint isa;
+
+  for (isa=GST_HSPEC_ISA_LAST-1; isa>GST_HSPEC_ISA_C; isa--) {
+    if (flags & (1 << isa))
+      break;
+  }
+  return isa;
+}
+
+/* kernels has to stay valid for the lifetime of the process, usually it is
+ * a static table. A kernel registered later replaces an earlier one with the
+ * same key */
+void
+gst_hspec_kernels_register (const GstHspecKernel *kernels, guint n_kernels)
+{
+  guint i;
+
+  for (i=0; i<n_kernels; i++)
+    g_return_if_fail (kernels[i].func != NULL);
+
+  G_LOCK (registry);
+  if (!registry)
+    registry = g_ptr_array_new ();
+  for (i=0; i<n_kernels; i++)
+    g_ptr_array_add (registry, (gpointer) &kernels[i]);
+  G_UNLOCK (registry);
+}
+
+/* returns the registered kernel for the most capable usable instruction set,
+ * or NULL when there is none */
+const GstHspecKernel *
+gst_hspec_kernel_lookup (GstHspecKernelOp op, GstHyperspectralFormat format,
+    GstHyperspectralLayout layout)
+{
+  const GstHspecKernel *kernel, *best = NULL;
+  guint i, flags = get_isa_flags ();
+
+  G_LOCK (registry);
+  for (i=0; registry && i<registry->len; i++) {
+    kernel = g_ptr_array_index (registry, i);
+    if (kernel->op != op || kernel->format != format ||
+        kernel->layout != layout || !(flags & (1 << kernel->isa)))
+      continue;
+    if (!best || kernel->isa >= best->isa)
+      best = kernel;
+  }
+  G_UNLOCK (registry);
+
+  if (best)
+    GST_DEBUG ("selected %s (%s) for %s %s", best->name,
+        gst_hspec_isa_to_string (best->isa), gst_hspec_format_to_string (format),
+        gst_hspec_layout_to_string (layout));
+  return best;
+}
+
+/* fills kernels with the registered kernel of every usable instruction set,
+ * the most capable first, so they can be compared at runtime. Returns the
+ * number of kernels */
+guint
+gst_hspec_kernel_lookup_all (GstHspecKernelOp op, GstHyperspectralFormat format,
+    GstHyperspectralLayout layout, const GstHspecKernel **kernels,
+    guint max_kernels)
+{
+  const GstHspecKernel *by_isa[GST_HSPEC_ISA_LAST] = { NULL, };
+  const GstHspecKernel *kernel;
+  guint i, n = 0, flags = get_isa_flags ();
+  gint isa;
+
+  g_return_val_if_fail (kernels != NULL, 0);
+
+  G_LOCK (registry);
+  for (i=0; registry && i<registry->len; i++) {
+    kernel = g_ptr_array_index (registry, i);
+    if (kernel->op != op || kernel->format != format ||
+        kernel->layout != layout || !(flags & (1 << kernel->isa)))
+      continue;
+    by_isa[kernel->isa] = kernel;
+  }
+  G_UNLOCK (registry);
+
+  for (isa=GST_HSPEC_ISA_LAST - 1; isa>=0 && n<max_kernels; isa--) {
+    if (by_isa[isa])
+      kernels[n++] = by_isa[isa];
+  }
+  return n;
+}
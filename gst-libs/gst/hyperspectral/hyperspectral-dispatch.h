@@ -0,0 +1,129 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Registry of kernel implementations.
+ *
+ * Implementations are registered for an operation, a sample format and a
+ * cube layout, each one built for an instruction set. The CPU is probed once
+ * and lookups return the implementation for the most capable instruction
+ * set the CPU supports. GST_HSPEC_FORCE_ISA from the environment limits the
+ * selection to the given instruction set and the ones below it of the same
+ * architecture, "c" or an instruction set the CPU lacks selects the plain C
+ * implementations.
+ */
+
+#ifndef __HYPERSPECTRAL_DISPATCH_H__
+#define __HYPERSPECTRAL_DISPATCH_H__
+
+#include <gst/gst.h>
+#include <gst/hyperspectral/hyperspectral-format.h>
+
+G_BEGIN_DECLS
+
+#define GST_HSPEC_FORCE_ISA_ENV "GST_HSPEC_FORCE_ISA"
+
+/**
+ * GstHspecIsa:
+ * @GST_HSPEC_ISA_C: portable C, always available
+ * @GST_HSPEC_ISA_SSE2: x86 SSE2
+ * @GST_HSPEC_ISA_SSSE3: x86 SSSE3
+ * @GST_HSPEC_ISA_SSE4_1: x86 SSE4.1
+ * @GST_HSPEC_ISA_AVX2: x86 AVX2 with F16C
+ * @GST_HSPEC_ISA_NEON: ARM NEON (ASIMD on aarch64)
+ *
+ * Instruction sets kernels are built for, later ones are preferred.
+ */
+typedef enum {
+  GST_HSPEC_ISA_C = 0,
+  GST_HSPEC_ISA_SSE2,
+  GST_HSPEC_ISA_SSSE3,
+  GST_HSPEC_ISA_SSE4_1,
+  GST_HSPEC_ISA_AVX2,
+  GST_HSPEC_ISA_NEON,
+  GST_HSPEC_ISA_LAST
+} GstHspecIsa;
+
+/**
+ * GstHspecKernelOp:
+ * @GST_HSPEC_KERNEL_OP_MOSAIC_TO_CUBE: writes rows of a mosaic image into a
+ *    cube, used by hspecenc
+ * @GST_HSPEC_KERNEL_OP_BAND_TO_IMAGE: writes rows of one band of a cube into
+ *    an image, used by hspecdec
+ * @GST_HSPEC_KERNEL_OP_TO_F32: contiguous run of samples to float, registered
+ *    for any layout
+ * @GST_HSPEC_KERNEL_OP_FROM_F32: contiguous run of floats to samples,
+ *    registered for any layout
+ * @GST_HSPEC_KERNEL_OP_UNPACK: packed samples to native 16 bit, registered
+ *    for any layout
+ * @GST_HSPEC_KERNEL_OP_PACK: native 16 bit samples to packed ones,
+ *    registered for any layout
+ * @GST_HSPEC_KERNEL_OP_BASE64: base64 encoding of bytes, registered for
+ *    %GST_HSPC_FORMAT_GRAY8 and any layout
+ *
+ * Operations kernels are registered for. The function signature of an
+ * operation is defined by the code using it, the sample runs are used by
+ * hyperspectral-kernels.c. Kernels for any layout use
+ * %GST_HSPC_LAYOUT_UNKNOWN.
+ */
+typedef enum {
+  GST_HSPEC_KERNEL_OP_MOSAIC_TO_CUBE = 0,
+  GST_HSPEC_KERNEL_OP_BAND_TO_IMAGE,
+  GST_HSPEC_KERNEL_OP_TO_F32,
+  GST_HSPEC_KERNEL_OP_FROM_F32,
+  GST_HSPEC_KERNEL_OP_UNPACK,
+  GST_HSPEC_KERNEL_OP_PACK,
+  GST_HSPEC_KERNEL_OP_BASE64,
+  GST_HSPEC_KERNEL_OP_LAST
+} GstHspecKernelOp;
+
+typedef struct {
+  GstHspecKernelOp op;
+  GstHyperspectralFormat format;
+  GstHyperspectralLayout layout;
+  GstHspecIsa isa;
+  const gchar *name;
+  GCallback func;
+} GstHspecKernel;
+
+/* initializer for a GstHspecKernel, the name is taken from the function */
+#define GST_HSPEC_KERNEL(op,format,layout,isa,func) \
+  { (op), (format), (layout), (isa), #func, G_CALLBACK (func) }
+
+const gchar *  gst_hspec_isa_to_string      (GstHspecIsa isa);
+GstHspecIsa    gst_hspec_isa_from_string    (const gchar *str);
+
+gboolean       gst_hspec_cpu_has_isa        (GstHspecIsa isa);
+GstHspecIsa    gst_hspec_cpu_get_best_isa   (void);
+
+void           gst_hspec_kernels_register   (const GstHspecKernel *kernels,
+                                             guint n_kernels);
+const GstHspecKernel *
+               gst_hspec_kernel_lookup      (GstHspecKernelOp op,
+                                             GstHyperspectralFormat format,
+                                             GstHyperspectralLayout layout);
+guint          gst_hspec_kernel_lookup_all  (GstHspecKernelOp op,
+                                             GstHyperspectralFormat format,
+                                             GstHyperspectralLayout layout,
+                                             const GstHspecKernel **kernels,
+                                             guint max_kernels);
+
+G_END_DECLS
+
+#endif
@@ -45,6 +45,76 @@ gst_hspec_layout_from_string (const gchar * mode)
   return GST_HSPC_LAYOUT_UNKNOWN;
 }
 
+static const gchar *cube_format[] = {
+  "GRAY8",
+  "GRAY16_BE",
+  "GRAY16_LE",
+  "F32",
+  "F16",
+  "GRAY10P",
+  "GRAY12P"
+};
+
+const gchar *
+gst_hspec_format_to_string (GstHyperspectralFormat format)
+{
+  if (((guint) format) >= G_N_ELEMENTS (cube_format))
+    return NULL;
+
+  return cube_format[format];
+}
+
+GstHyperspectralFormat
+gst_hspec_format_from_string (const gchar * format)
+{
+  gint i;
+  for (i = 0; i < G_N_ELEMENTS (cube_format); i++) {
+    if (g_str_equal (cube_format[i], format))
+      return i;
+  }
+  return GST_HSPC_FORMAT_UNKNOWN;
+}
+
+/* video format holding a single band of the cube unchanged, floating
+ * point bands have no video equivalent */
+GstVideoFormat
+gst_hspec_format_to_video_format (GstHyperspectralFormat format)
+{
+  switch (format) {
+    case GST_HSPC_FORMAT_GRAY8:
+      return GST_VIDEO_FORMAT_GRAY8;
+    case GST_HSPC_FORMAT_GRAY16_BE:
+      return GST_VIDEO_FORMAT_GRAY16_BE;
+    case GST_HSPC_FORMAT_GRAY16_LE:
+      return GST_VIDEO_FORMAT_GRAY16_LE;
+    default:
+      return GST_VIDEO_FORMAT_UNKNOWN;
+  }
+}
+
+/* bytes needed to store a run of samples, packed runs are padded to a
+ * whole group of samples */
+gsize
+gst_hspec_format_get_size (GstHyperspectralFormat format, gsize samples)
+{
+  switch (format) {
+    case GST_HSPC_FORMAT_GRAY8:
+      return samples;
+    case GST_HSPC_FORMAT_GRAY16_BE:
+    case GST_HSPC_FORMAT_GRAY16_LE:
+    case GST_HSPC_FORMAT_F16:
+      return samples * 2;
+    case GST_HSPC_FORMAT_F32:
+      return samples * 4;
+    case GST_HSPC_FORMAT_GRAY10P:
+      return (samples + 3) / 4 * 5;
+    case GST_HSPC_FORMAT_GRAY12P:
+      return (samples + 1) / 2 * 3;
+    default:
+      return 0;
+  }
+}
+
 static void
 add_wavelength_list_to_struct (GstStructure * structure,
   gint wavelengthno, gint *wavelengths)
@@ -21,6 +21,7 @@
 #define __GST_HYPERSPECTRAL_FORMAT_H__
 
 #include <gst/gst.h>
+#include <gst/video/video.h>
 
 /**
  * GstHyperspectralCubeFormat:
@@ -42,9 +43,56 @@ typedef enum {
 const gchar *           gst_hspec_layout_to_string (GstHyperspectralLayout mode);
 GstHyperspectralLayout  gst_hspec_layout_from_string (const gchar * mode);
 
+/**
+ * GstHyperspectralFormat:
+ * @GST_HSPC_FORMAT_UNKNOWN: Unknown or unset sample format
+ * @GST_HSPC_FORMAT_GRAY8: 8 bit unsigned samples
+ * @GST_HSPC_FORMAT_GRAY16_BE: 16 bit unsigned big endian samples
+ * @GST_HSPC_FORMAT_GRAY16_LE: 16 bit unsigned little endian samples
+ * @GST_HSPC_FORMAT_F32: 32 bit native endian floating point samples,
+ *    nominally in the range [0, 1] (e.g. calibrated reflectance)
+ * @GST_HSPC_FORMAT_F16: 16 bit native endian IEEE half precision samples,
+ *    same range as @GST_HSPC_FORMAT_F32 at half the storage size
+ * @GST_HSPC_FORMAT_GRAY10P: 10 bit unsigned samples, 4 samples packed
+ *    into 5 bytes, least significant bits first
+ * @GST_HSPC_FORMAT_GRAY12P: 12 bit unsigned samples, 2 samples packed
+ *    into 3 bytes, least significant bits first
+ *
+ * The type of a single sample in a data cube. The integer formats share
+ * their names with the matching #GstVideoFormat.
+ *
+ * Packed formats have no byte address per sample. Each plane of a
+ * multiplane cube starts on a whole group of samples and an interleaved
+ * cube is packed as one run. The bytesize of their #GstHyperspectralInfo
+ * is the size of an unpacked sample, use the wavelength and cube sizes
+ * for memory.
+ */
+
+typedef enum {
+  GST_HSPC_FORMAT_UNKNOWN = -1,
+  GST_HSPC_FORMAT_GRAY8 = 0,
+  GST_HSPC_FORMAT_GRAY16_BE,
+  GST_HSPC_FORMAT_GRAY16_LE,
+  GST_HSPC_FORMAT_F32,
+  GST_HSPC_FORMAT_F16,
+  GST_HSPC_FORMAT_GRAY10P,
+  GST_HSPC_FORMAT_GRAY12P
+} GstHyperspectralFormat;
+
+#define GST_HSPEC_FORMAT_IS_PACKED(format) \
+    ((format) == GST_HSPC_FORMAT_GRAY10P || (format) == GST_HSPC_FORMAT_GRAY12P)
+
+const gchar *           gst_hspec_format_to_string (GstHyperspectralFormat format);
+GstHyperspectralFormat  gst_hspec_format_from_string (const gchar * format);
+GstVideoFormat          gst_hspec_format_to_video_format (GstHyperspectralFormat format);
+gsize                   gst_hspec_format_get_size (GstHyperspectralFormat format,
+                                                   gsize samples);
+
 #define GST_HYPERSPECTRAL_MEDIA_TYPE "video/hyperspectral-cube"
 #define GST_HYPERSPECTRAL_FRACTION_RANGE "(fraction) [ 0, max ]"
-#define GST_HYPERSPECTRAL_FORMATS_ALL "{ GRAY8, GRAY16_BE, GRAY16_LE }"
+#define GST_HYPERSPECTRAL_FORMATS_ALL "{ GRAY8, GRAY16_BE, GRAY16_LE, F32, F16, GRAY10P, GRAY12P }"
+/* formats where every sample can be addressed directly */
+#define GST_HYPERSPECTRAL_FORMATS_UNPACKED "{ GRAY8, GRAY16_BE, GRAY16_LE, F32, F16 }"
 #define GST_HYPERSPECTRAL_CUBE_FORMATS_ALL "{ multiplane, interleaved }"
 
 #define GST_HYPERSPECTRAL_CAPS_MAKE(format)                         \
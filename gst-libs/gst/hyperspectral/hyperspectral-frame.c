@@ -18,41 +18,158 @@
  */
 
 #include "hyperspectral-frame.h"
+#include "hyperspectral-kernels.h"
+#include "hyperspectral-meta.h"
+#include <stdlib.h>
 #include <string.h>
+/* the planes of a frame whose cube starts at data are found from the plane
+ * offsets */
+static void
+set_plane_data (GstHyperspectralFrame *frame, gpointer data)
+{
+  frame->data = data;
+  frame->plane_data = NULL;
+}
+
+static void
+unmap_memories (GstHyperspectralFrame *frame, GstBuffer *buffer)
+{
+  guint i;
+
+  for (i=0; i<GST_HYPERSPECTRAL_FRAME_MAX_MEMORIES; i++) {
+    if (frame->mapped_mems & (1 << i))
+      gst_memory_unmap (gst_buffer_peek_memory (buffer, i), &frame->mem_map[i]);
+  }
+  frame->mapped_mems = 0;
+  g_free (frame->plane_data);
+  frame->plane_data = NULL;
+}
+
+/* maps only the memories holding planes, fails when a plane spans more than
+ * one memory */
+static gboolean
+map_memories (GstHyperspectralFrame *frame, GstBuffer *buffer,
+    GstMapFlags flags)
+{
+  GstMemory *mem;
+  guint p, idx, length;
+  gsize skip;
+
+  if ((flags & GST_MAP_WRITE) && !gst_buffer_is_writable (buffer))
+    return FALSE;
+
+  frame->mapped_mems = 0;
+  frame->plane_data = g_new (guint8 *, frame->info.n_planes);
+  for (p=0; p<frame->info.n_planes; p++) {
+    if (!gst_buffer_find_memory (buffer, frame->info.offset[p],
+        gst_hyperspectral_info_plane_size (&frame->info, p), &idx, &length,
+        &skip) || length != 1)
+      goto spans_memories;
+
+    if (!(frame->mapped_mems & (1 << idx))) {
+      mem = gst_buffer_peek_memory (buffer, idx);
+      if (!gst_memory_map (mem, &frame->mem_map[idx], flags))
+        goto map_failed;
+      frame->mapped_mems |= 1 << idx;
+    }
+    frame->plane_data[p] = frame->mem_map[idx].data + skip;
+  }
+
+  frame->data = NULL;
+  frame->map.flags = flags;
+  return TRUE;
+
+spans_memories:
+  {
+    GST_DEBUG ("plane %u spans several memories, mapping the whole buffer", p);
+    unmap_memories (frame, buffer);
+    return FALSE;
+  }
+map_failed:
+  {
+    GST_ERROR ("failed to map memory %u", idx);
+    unmap_memories (frame, buffer);
+    return FALSE;
+  }
+}
+
 gboolean
 gst_hyperspectral_frame_map (GstHyperspectralFrame *frame,
     GstHyperspectralInfo *info, GstBuffer *buffer, GstMapFlags flags)
 {
+  GstHyperspectralMeta *meta;
+  guint n_mem;
+
   g_return_val_if_fail (frame != NULL, FALSE);
   g_return_val_if_fail (info != NULL, FALSE);
   g_return_val_if_fail (GST_IS_BUFFER (buffer), FALSE);
 
   frame->info = *info;
-  if (!gst_buffer_map (buffer, &frame->map, flags))
-    goto map_failed;
+  frame->mapped_mems = 0;
+  frame->plane_data = NULL;
+  frame->planes = NULL;
 
-  /* do some sanity checks */
-  if (frame->map.size < info->cube_size)
+  /* planes placed by the producer, the cube description has to match the
+   * caps */
+  meta = gst_buffer_get_hyperspectral_meta (buffer);
+  if (meta) {
+    if (meta->format != info->format || meta->layout != info->layout ||
+        meta->width != info->width || meta->height != info->height ||
+        meta->wavelengths != info->wavelengths ||
+        meta->n_planes != info->n_planes)
+      goto meta_mismatch;
+    /* the plane arrays of info are shared, the frame needs its own */
+    frame->planes = g_malloc (info->n_planes * (sizeof (gsize) +
+            sizeof (gint)));
+    frame->info.offset = frame->planes;
+    frame->info.stride = (gint *) (frame->info.offset + info->n_planes);
+    if (!gst_hyperspectral_info_set_planes (&frame->info, meta->offset,
+        meta->stride)) {
+      g_free (frame->planes);
+      return FALSE;
+    }
+  }
+
+  if (gst_buffer_get_size (buffer) < frame->info.cube_size)
     goto invalid_size;
 
-  frame->data = frame->map.data;
+  /* mapping a buffer with several memories as a whole merges them into a
+   * copy, map them one by one when the caller only needs the planes */
+  n_mem = gst_buffer_n_memory (buffer);
+  if (!(flags & GST_HYPERSPECTRAL_FRAME_MAP_FLAG_PLANES) || n_mem < 2 ||
+      n_mem > GST_HYPERSPECTRAL_FRAME_MAX_MEMORIES ||
+      !map_memories (frame, buffer, flags)) {
+    if (!gst_buffer_map (buffer, &frame->map, flags))
+      goto map_failed;
+    set_plane_data (frame, frame->map.data);
+  }
 
   frame->buffer = buffer;
   if ((flags & GST_VIDEO_FRAME_MAP_FLAG_NO_REF) == 0)
     gst_buffer_ref (frame->buffer);
 
   return TRUE;
+meta_mismatch:
+  {
+    GST_ERROR ("hyperspectral meta %s/%s %dx%dx%d does not match caps %s/%s "
+        "%dx%dx%d", gst_hspec_format_to_string (meta->format),
+        gst_hspec_layout_to_string (meta->layout), meta->width, meta->height,
+        meta->wavelengths, gst_hspec_format_to_string (info->format),
+        gst_hspec_layout_to_string (info->layout), info->width, info->height,
+        info->wavelengths);
+    return FALSE;
+  }
 map_failed:
   {
     GST_ERROR ("failed to map buffer");
+    g_free (frame->planes);
     return FALSE;
   }
 invalid_size:
   {
     GST_ERROR ("invalid buffer size %" G_GSIZE_FORMAT " < %" G_GSIZE_FORMAT,
-        frame->map.size, info->cube_size);
-    gst_buffer_unmap (buffer, &frame->map);
-    memset (frame, 0, sizeof (GstHyperspectralFrame));
+        gst_buffer_get_size (buffer), frame->info.cube_size);
+    g_free (frame->planes);
     return FALSE;
   }
 }
@@ -66,9 +183,388 @@ gst_hyperspectral_frame_unmap (GstHyperspectralFrame *frame)
   g_return_if_fail (frame != NULL);
 
   flags = frame->map.flags;
-  gst_buffer_unmap (frame->buffer, &frame->map);
+  if (frame->mapped_mems)
+    unmap_memories (frame, frame->buffer);
+  else
+    gst_buffer_unmap (frame->buffer, &frame->map);
 
   if ((flags & GST_VIDEO_FRAME_MAP_FLAG_NO_REF) == 0)
     gst_buffer_unref (frame->buffer);
 
+  g_free (frame->planes);
+  frame->planes = NULL;
+}
+
+/* describes a cube at data that is not part of a buffer, such as scratch
+ * memory, the frame must not be unmapped */
+void
+gst_hyperspectral_frame_wrap (GstHyperspectralFrame *frame,
+    const GstHyperspectralInfo *info, gpointer data)
+{
+  g_return_if_fail (frame != NULL);
+  g_return_if_fail (info != NULL);
+
+  frame->info = *info;
+  frame->buffer = NULL;
+  frame->mapped_mems = 0;
+  frame->planes = NULL;
+  set_plane_data (frame, data);
+}
+
+/* TRUE when the whole cube can be accessed as one run of samples at data */
+gboolean
+gst_hyperspectral_frame_is_contiguous (const GstHyperspectralFrame *frame)
+{
+  g_return_val_if_fail (frame != NULL, FALSE);
+
+  return frame->data != NULL &&
+      gst_hyperspectral_info_is_contiguous (&frame->info);
+}
+
+/* copies the samples of src into dest, both frames describe the same cube
+ * but may place their planes and rows differently */
+void
+gst_hyperspectral_frame_copy (GstHyperspectralFrame *dest,
+    const GstHyperspectralFrame *src)
+{
+  const GstHyperspectralInfo *info;
+  gsize row_size;
+  guint p;
+  gint y;
+
+  g_return_if_fail (dest != NULL);
+  g_return_if_fail (src != NULL);
+  g_return_if_fail (dest->info.format == src->info.format);
+  g_return_if_fail (dest->info.layout == src->info.layout);
+  g_return_if_fail (dest->info.cube_elems == src->info.cube_elems);
+
+  info = &src->info;
+  if (gst_hyperspectral_frame_is_contiguous (src) &&
+      gst_hyperspectral_frame_is_contiguous (dest)) {
+    memcpy (GST_HSPEC_FRAME_PLANE_DATA (dest, 0),
+        GST_HSPEC_FRAME_PLANE_DATA (src, 0), info->cube_size);
+    return;
+  }
+
+  for (p=0; p<info->n_planes; p++) {
+    /* packed planes are always stored as one run */
+    if (src->info.stride[p] == 0 || dest->info.stride[p] == 0) {
+      memcpy (GST_HSPEC_FRAME_PLANE_DATA (dest, p),
+          GST_HSPEC_FRAME_PLANE_DATA (src, p),
+          gst_hspec_format_get_size (info->format,
+              info->layout == GST_HSPC_LAYOUT_MULTIPLANE ?
+              info->wavelength_elems : info->cube_elems));
+      continue;
+    }
+    row_size = (gsize) info->width * info->bytesize;
+    if (info->layout != GST_HSPC_LAYOUT_MULTIPLANE)
+      row_size *= info->wavelengths;
+    for (y=0; y<info->height; y++)
+      memcpy (GST_HSPEC_FRAME_ROW_DATA (dest, p, y),
+          GST_HSPEC_FRAME_ROW_DATA (src, p, y), row_size);
+  }
+}
+
+static void
+unpack_run (GstHyperspectralFormat format, guint16 *dest, const guint8 *src,
+    gsize n)
+{
+  if (format == GST_HSPC_FORMAT_GRAY10P)
+    gst_hspec_kernel_unpack_10 (dest, src, n);
+  else
+    gst_hspec_kernel_unpack_12 (dest, src, n);
+}
+
+static void
+pack_run (GstHyperspectralFormat format, guint8 *dest, const guint16 *src,
+    gsize n)
+{
+  if (format == GST_HSPC_FORMAT_GRAY10P)
+    gst_hspec_kernel_pack_10 (dest, src, n);
+  else
+    gst_hspec_kernel_pack_12 (dest, src, n);
+}
+
+/* unpacks a packed cube into native 16 bit samples laid out as described
+ * by gst_hyperspectral_info_init_unpacked() */
+void
+gst_hyperspectral_frame_unpack (const GstHyperspectralFrame *frame,
+    guint16 *dest)
+{
+  const GstHyperspectralInfo *info;
+  gint b;
+
+  g_return_if_fail (frame != NULL);
+  g_return_if_fail (GST_HSPEC_FORMAT_IS_PACKED (frame->info.format));
+
+  info = &frame->info;
+  if (info->layout == GST_HSPC_LAYOUT_MULTIPLANE) {
+    for (b=0; b<info->wavelengths; b++)
+      unpack_run (info->format, dest + (gsize) b * info->wavelength_elems,
+          GST_HSPEC_FRAME_WAVELENGTH_DATA_MULTIPLANE (frame, b),
+          info->wavelength_elems);
+  } else {
+    unpack_run (info->format, dest, GST_HSPEC_FRAME_PLANE_DATA (frame, 0),
+        info->cube_elems);
+  }
+}
+
+void
+gst_hyperspectral_frame_pack (GstHyperspectralFrame *frame,
+    const guint16 *src)
+{
+  const GstHyperspectralInfo *info;
+  gint b;
+
+  g_return_if_fail (frame != NULL);
+  g_return_if_fail (GST_HSPEC_FORMAT_IS_PACKED (frame->info.format));
+
+  info = &frame->info;
+  if (info->layout == GST_HSPC_LAYOUT_MULTIPLANE) {
+    for (b=0; b<info->wavelengths; b++)
+      pack_run (info->format, GST_HSPEC_FRAME_WAVELENGTH_DATA_MULTIPLANE (frame, b),
+          src + (gsize) b * info->wavelength_elems, info->wavelength_elems);
+  } else {
+    pack_run (info->format, GST_HSPEC_FRAME_PLANE_DATA (frame, 0), src,
+        info->cube_elems);
+  }
+}
+
+/* describes a window of frame, see GstHyperspectralView */
+gboolean
+gst_hyperspectral_view_init (GstHyperspectralView *view,
+    const GstHyperspectralFrame *frame, gint x, gint y, gint width,
+    gint height, gint first_band, gint n_bands)
+{
+  const GstHyperspectralInfo *info;
+
+  g_return_val_if_fail (view != NULL, FALSE);
+  g_return_val_if_fail (frame != NULL, FALSE);
+
+  info = &frame->info;
+  if (GST_HSPEC_FORMAT_IS_PACKED (info->format))
+    goto packed;
+  if (x < 0 || y < 0 || width <= 0 || height <= 0 ||
+      x > info->width - width || y > info->height - height ||
+      first_band < 0 || n_bands <= 0 ||
+      first_band > info->wavelengths - n_bands)
+    goto out_of_range;
+
+  view->frame = frame;
+  view->x = x;
+  view->y = y;
+  view->width = width;
+  view->height = height;
+  view->first_band = first_band;
+  view->n_bands = n_bands;
+  if (info->layout == GST_HSPC_LAYOUT_MULTIPLANE)
+    view->pixel_stride = info->bytesize;
+  else
+    view->pixel_stride = info->bytesize * info->wavelengths;
+
+  return TRUE;
+
+packed:
+  {
+    GST_ERROR ("can not view %s cubes, their samples are packed",
+        gst_hspec_format_to_string (info->format));
+    return FALSE;
+  }
+out_of_range:
+  {
+    GST_ERROR ("window %dx%d at %d,%d, bands %d+%d is outside of the "
+        "%dx%dx%d cube", width, height, x, y, first_band, n_bands,
+        info->width, info->height, info->wavelengths);
+    return FALSE;
+  }
+}
+
+/* first sample of row y of band in the view */
+guint8 *
+gst_hyperspectral_view_row_data (const GstHyperspectralView *view,
+    gint band, gint y)
+{
+  const GstHyperspectralFrame *frame;
+
+  g_return_val_if_fail (view != NULL, NULL);
+  g_return_val_if_fail (band >= 0 && band < view->n_bands, NULL);
+  g_return_val_if_fail (y >= 0 && y < view->height, NULL);
+
+  frame = view->frame;
+  if (frame->info.layout == GST_HSPC_LAYOUT_MULTIPLANE)
+    return GST_HSPEC_FRAME_ROW_DATA (frame, view->first_band + band,
+        view->y + y) + (gsize) view->x * view->pixel_stride;
+
+  return GST_HSPEC_FRAME_ROW_DATA (frame, 0, view->y + y) +
+      (gsize) view->x * view->pixel_stride +
+      (gsize) (view->first_band + band) * frame->info.bytesize;
+}
+
+/* byte offset of the first sample of band inside the buffer of the frame */
+static gsize
+view_band_offset (const GstHyperspectralView *view, gint band)
+{
+  const GstHyperspectralInfo *info = &view->frame->info;
+
+  if (info->layout == GST_HSPC_LAYOUT_MULTIPLANE)
+    return info->offset[view->first_band + band] +
+        (gsize) view->y * info->stride[view->first_band + band] +
+        (gsize) view->x * view->pixel_stride;
+
+  return info->offset[0] + (gsize) view->y * info->stride[0] +
+      (gsize) view->x * view->pixel_stride +
+      (gsize) (view->first_band + band) * info->bytesize;
+}
+
+/* describes the window as a cube of its own whose planes are placed as in
+ * the frame. offset receives the position of the window in the buffer of
+ * the frame, the plane offsets of info are relative to it. Interleaved
+ * windows have to cover all bands, a subset of the bands of a pixel can not
+ * be described with a row stride */
+gboolean
+gst_hyperspectral_view_get_info (const GstHyperspectralView *view,
+    GstHyperspectralInfo *info, gsize *offset)
+{
+  const GstHyperspectralInfo *finfo;
+  const gint *stride;
+  gsize start = G_MAXSIZE;
+  guint p;
+
+  g_return_val_if_fail (view != NULL, FALSE);
+  g_return_val_if_fail (info != NULL, FALSE);
+
+  finfo = &view->frame->info;
+  if (finfo->layout == GST_HSPC_LAYOUT_INTERLEAVED &&
+      view->n_bands != finfo->wavelengths)
+    goto band_subset;
+
+  *info = *finfo;
+  info->width = view->width;
+  info->height = view->height;
+  info->wavelengths = view->n_bands;
+  info->wavelength_elems = (gsize) view->width * view->height;
+  info->cube_elems = info->wavelength_elems * view->n_bands;
+  info->wavelength_size = gst_hspec_format_get_size (info->format,
+      info->wavelength_elems);
+  info->n_planes = info->layout == GST_HSPC_LAYOUT_MULTIPLANE ?
+      view->n_bands : 1;
+
+  /* offset and stride share one block like in any other info */
+  stride = finfo->stride + (info->layout == GST_HSPC_LAYOUT_MULTIPLANE ?
+      view->first_band : 0);
+  info->offset = g_malloc (info->n_planes * (sizeof (gsize) + sizeof (gint)));
+  info->stride = (gint *) (info->offset + info->n_planes);
+  for (p=0; p<info->n_planes; p++) {
+    info->offset[p] = view_band_offset (view, p);
+    info->stride[p] = stride[p];
+    start = MIN (start, info->offset[p]);
+  }
+  for (p=0; p<info->n_planes; p++)
+    info->offset[p] -= start;
+
+  init_mosaic (&info->mosaic);
+  if (finfo->mosaic.size >= view->first_band + view->n_bands) {
+    info->mosaic.spectras = malloc (view->n_bands * sizeof (gint));
+    memcpy (info->mosaic.spectras, finfo->mosaic.spectras + view->first_band,
+        view->n_bands * sizeof (gint));
+    info->mosaic.size = view->n_bands;
+  }
+
+  /* checks the strides and computes the cube size */
+  if (!gst_hyperspectral_info_set_planes (info, info->offset, info->stride)) {
+    gst_hyperspectral_info_clear (info);
+    return FALSE;
+  }
+
+  if (offset)
+    *offset = start;
+  return TRUE;
+
+band_subset:
+  {
+    GST_ERROR ("interleaved views have to cover all %d bands",
+        finfo->wavelengths);
+    return FALSE;
+  }
+}
+
+/* new buffer sharing the memory of the frame buffer that only holds the
+ * window, the planes are described by a GstHyperspectralMeta */
+GstBuffer *
+gst_hyperspectral_view_to_buffer (const GstHyperspectralView *view)
+{
+  GstHyperspectralInfo info;
+  GstHyperspectralMeta *meta, *parent_meta;
+  GstBuffer *buffer;
+  gsize offset;
+
+  g_return_val_if_fail (view != NULL, NULL);
+  g_return_val_if_fail (view->frame->buffer != NULL, NULL);
+
+  if (!gst_hyperspectral_view_get_info (view, &info, &offset))
+    return NULL;
+
+  /* the parent meta describes the whole cube, it is replaced */
+  buffer = gst_buffer_copy_region (view->frame->buffer,
+      GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS |
+      GST_BUFFER_COPY_MEMORY, offset, info.cube_size);
+  if (!buffer)
+    goto copy_failed;
+
+  meta = gst_buffer_add_hyperspectral_meta (buffer, &info);
+  parent_meta = gst_buffer_get_hyperspectral_meta (view->frame->buffer);
+  if (meta && parent_meta) {
+    meta->exposure = parent_meta->exposure;
+    meta->flags = parent_meta->flags;
+  }
+
+  gst_hyperspectral_info_clear (&info);
+  return buffer;
+
+copy_failed:
+  {
+    GST_ERROR ("failed to share %" G_GSIZE_FORMAT " bytes at %" G_GSIZE_FORMAT,
+        info.cube_size, offset);
+    gst_hyperspectral_info_clear (&info);
+    return NULL;
+  }
+}
+
+void
+gst_hyperspectral_view_iter_init (GstHyperspectralViewIter *iter,
+    const GstHyperspectralView *view)
+{
+  g_return_if_fail (iter != NULL);
+  g_return_if_fail (view != NULL);
+
+  iter->view = view;
+  iter->band = 0;
+  iter->y = 0;
+  iter->data = NULL;
+  iter->pos = 0;
+}
+
+/* moves to the next row, FALSE once all rows of all bands were visited */
+gboolean
+gst_hyperspectral_view_iter_next (GstHyperspectralViewIter *iter)
+{
+  const GstHyperspectralView *view;
+
+  g_return_val_if_fail (iter != NULL, FALSE);
+
+  view = iter->view;
+  if (iter->pos >= (guint) view->n_bands * view->height)
+    return FALSE;
+
+  if (view->frame->info.layout == GST_HSPC_LAYOUT_MULTIPLANE) {
+    iter->band = iter->pos / view->height;
+    iter->y = iter->pos % view->height;
+  } else {
+    iter->band = iter->pos % view->n_bands;
+    iter->y = iter->pos / view->n_bands;
+  }
+  iter->data = gst_hyperspectral_view_row_data (view, iter->band, iter->y);
+  iter->pos++;
+
+  return TRUE;
 }
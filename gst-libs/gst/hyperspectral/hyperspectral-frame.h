@@ -27,6 +27,13 @@
 
 typedef struct _GstHyperspectralFrame GstHyperspectralFrame;
 
+/* map every GstMemory of the buffer on its own instead of merging them,
+ * only the plane accessors can be used and data is NULL when the buffer
+ * has more than one memory */
+#define GST_HYPERSPECTRAL_FRAME_MAP_FLAG_PLANES (GST_VIDEO_FRAME_MAP_FLAG_LAST << 0)
+
+/* GStreamer merges the memories of buffers holding more than this */
+#define GST_HYPERSPECTRAL_FRAME_MAX_MEMORIES 16
 
 struct _GstHyperspectralFrame {
 
@@ -34,16 +41,118 @@ struct _GstHyperspectralFrame {
 
   GstBuffer *buffer;
 
+  /* the whole cube, NULL when the memories are mapped one by one */
   gpointer  data;
   GstMapInfo map;
 
+  /* start of every plane when the memories are mapped one by one, NULL
+   * when the planes are found from data and the plane offsets */
+  guint8 **plane_data;
+
+  /* plane arrays of info when a meta places the planes differently from
+   * the caps, NULL when they are shared with the info passed to map */
+  gpointer planes;
+
+  /* bit i is set when mem_map[i] holds a mapping of memory i */
+  guint mapped_mems;
+  GstMapInfo mem_map[GST_HYPERSPECTRAL_FRAME_MAX_MEMORIES];
+
 };
 
 gboolean  gst_hyperspectral_frame_map     (GstHyperspectralFrame *frame, GstHyperspectralInfo *info,
                                            GstBuffer *buffer, GstMapFlags flags);
 void      gst_hyperspectral_frame_unmap   (GstHyperspectralFrame *frame);
 
-#define GST_HSPEC_FRAME_WAVELENGTH_DATA_MULTIPLANE(frame,b) ((frame)->data + (frame)->info.wavelength_size * b)
+void      gst_hyperspectral_frame_wrap    (GstHyperspectralFrame *frame,
+                                           const GstHyperspectralInfo *info,
+                                           gpointer data);
+
+gboolean  gst_hyperspectral_frame_is_contiguous (const GstHyperspectralFrame *frame);
+
+void      gst_hyperspectral_frame_copy    (GstHyperspectralFrame *dest,
+                                           const GstHyperspectralFrame *src);
+
+void      gst_hyperspectral_frame_unpack  (const GstHyperspectralFrame *frame,
+                                           guint16 *dest);
+void      gst_hyperspectral_frame_pack    (GstHyperspectralFrame *frame,
+                                           const guint16 *src);
+
+#define GST_HSPEC_FRAME_PLANE_DATA(frame,p)   ((frame)->plane_data ? (frame)->plane_data[p] : \
+                                               (guint8 *) (frame)->data + (frame)->info.offset[p])
+#define GST_HSPEC_FRAME_PLANE_STRIDE(frame,p) ((frame)->info.stride[p])
+#define GST_HSPEC_FRAME_ROW_DATA(frame,p,y)   (GST_HSPEC_FRAME_PLANE_DATA (frame, p) + \
+                                               (gsize) (y) * GST_HSPEC_FRAME_PLANE_STRIDE (frame, p))
+
+#define GST_HSPEC_FRAME_WAVELENGTH_DATA_MULTIPLANE(frame,b) GST_HSPEC_FRAME_PLANE_DATA (frame, b)
+
+
+/* a window over the columns [x, x + width), rows [y, y + height) and bands
+ * [first_band, first_band + n_bands) of a mapped frame. Views do not copy any
+ * samples and are only valid as long as the frame stays mapped. Packed
+ * formats have no addressable samples and can not be viewed */
+typedef struct _GstHyperspectralView GstHyperspectralView;
+
+struct _GstHyperspectralView {
+
+  const GstHyperspectralFrame *frame;
+
+  gint x;
+  gint y;
+  gint width;
+  gint height;
+  gint first_band;
+  gint n_bands;
+
+  /* bytes between two pixels of a row of one band */
+  gsize pixel_stride;
+
+};
+
+/* walks the rows of every band of a view in memory order, band after band
+ * for multiplane cubes and row after row for interleaved ones */
+typedef struct _GstHyperspectralViewIter GstHyperspectralViewIter;
+
+struct _GstHyperspectralViewIter {
+
+  const GstHyperspectralView *view;
+
+  /* band (relative to first_band) and row (relative to y) of data */
+  gint band;
+  gint y;
+  /* first sample of the row, the next pixel is view->pixel_stride further */
+  guint8 *data;
+
+  guint pos;
+
+};
+
+gboolean  gst_hyperspectral_view_init     (GstHyperspectralView *view,
+                                           const GstHyperspectralFrame *frame,
+                                           gint x, gint y, gint width, gint height,
+                                           gint first_band, gint n_bands);
+
+guint8 *  gst_hyperspectral_view_row_data (const GstHyperspectralView *view,
+                                           gint band, gint y);
+
+gboolean  gst_hyperspectral_view_get_info (const GstHyperspectralView *view,
+                                           GstHyperspectralInfo *info,
+                                           gsize *offset);
+
+GstBuffer * gst_hyperspectral_view_to_buffer (const GstHyperspectralView *view);
+
+void      gst_hyperspectral_view_iter_init (GstHyperspectralViewIter *iter,
+                                            const GstHyperspectralView *view);
+gboolean  gst_hyperspectral_view_iter_next (GstHyperspectralViewIter *iter);
+
+/* distance between two pixels of a row in samples */
+#define GST_HSPEC_VIEW_PIXEL_STEP(view)       ((view)->pixel_stride / (view)->frame->info.bytesize)
+
+#define GST_HSPEC_VIEW_ROW_U8(view,b,y)       ((guint8 *) gst_hyperspectral_view_row_data (view, b, y))
+#define GST_HSPEC_VIEW_ROW_U16(view,b,y)      ((guint16 *) gst_hyperspectral_view_row_data (view, b, y))
+#define GST_HSPEC_VIEW_ROW_F32(view,b,y)      ((gfloat *) gst_hyperspectral_view_row_data (view, b, y))
 
+#define GST_HSPEC_VIEW_PIXEL_U8(view,b,x,y)   (GST_HSPEC_VIEW_ROW_U8 (view, b, y)[(gsize) (x) * GST_HSPEC_VIEW_PIXEL_STEP (view)])
+#define GST_HSPEC_VIEW_PIXEL_U16(view,b,x,y)  (GST_HSPEC_VIEW_ROW_U16 (view, b, y)[(gsize) (x) * GST_HSPEC_VIEW_PIXEL_STEP (view)])
+#define GST_HSPEC_VIEW_PIXEL_F32(view,b,x,y)  (GST_HSPEC_VIEW_ROW_F32 (view, b, y)[(gsize) (x) * GST_HSPEC_VIEW_PIXEL_STEP (view)])
 
 #endif
\ No newline at end of file
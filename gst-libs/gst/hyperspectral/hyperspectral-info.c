@@ -17,9 +17,34 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include "hyperspectral-info.h"
 
+/* number of caps whose parsed info is kept, negotiation only ever deals with
+ * a handful of caps at a time */
+#define INFO_CACHE_SIZE 8
+
+/* the fields that tell most caps apart, compared before the caps */
+typedef struct {
+  guint format;
+  gint width;
+  gint height;
+  gint wavelengths;
+} CapsKey;
+
+typedef struct {
+  /* first so the info can be handed out and cast back */
+  GstHyperspectralInfo info;
+  gint refcount;
+  GstCaps *caps;
+  CapsKey key;
+} CachedInfo;
+
+G_LOCK_DEFINE_STATIC (info_cache);
+/* most recently used first */
+static CachedInfo *info_cache[INFO_CACHE_SIZE];
+
 void gst_hyperspectral_info_init(GstHyperspectralInfo *info)
 {
   memset(info, 0, sizeof(GstHyperspectralInfo));
@@ -28,34 +53,261 @@ void gst_hyperspectral_info_init(GstHyperspectralInfo *info)
 void gst_hyperspectral_info_clear(GstHyperspectralInfo *info)
 {
   clear_mosaic(&info->mosaic);
+  /* offset and stride share one allocation */
+  g_free(info->offset);
   memset(info, 0, sizeof(GstHyperspectralInfo));
 }
 
+/* allocates the plane arrays of info in a single block, the old ones are
+ * not freed */
+static void
+alloc_planes(GstHyperspectralInfo *info, guint n_planes)
+{
+  info->n_planes = n_planes;
+  info->offset = g_malloc0 (n_planes * (sizeof (gsize) + sizeof (gint)));
+  info->stride = (gint *) (info->offset + n_planes);
+}
+
+/* gives dest its own copy of the plane arrays of src */
+static void
+copy_planes(GstHyperspectralInfo *dest, const GstHyperspectralInfo *src)
+{
+  alloc_planes (dest, src->n_planes);
+  memcpy (dest->offset, src->offset, src->n_planes * sizeof (gsize));
+  memcpy (dest->stride, src->stride, src->n_planes * sizeof (gint));
+}
+
 static gboolean
-get_byte_size_from_format(GstVideoFormat fmt, guint *size)
+get_byte_size_from_format(GstHyperspectralFormat fmt, guint *size)
 {
   switch (fmt) {
-    case GST_VIDEO_FORMAT_GRAY8:
+    case GST_HSPC_FORMAT_GRAY8:
       *size = 1;
       break;
-    case GST_VIDEO_FORMAT_GRAY16_LE:
-    case GST_VIDEO_FORMAT_GRAY16_BE:
+    case GST_HSPC_FORMAT_GRAY16_LE:
+    case GST_HSPC_FORMAT_GRAY16_BE:
+    case GST_HSPC_FORMAT_F16:
+    case GST_HSPC_FORMAT_GRAY10P:
+    case GST_HSPC_FORMAT_GRAY12P:
       *size = 2;
       break;
+    case GST_HSPC_FORMAT_F32:
+      *size = 4;
+      break;
     default:
-      GST_ERROR("Unhandled format type '%s'", gst_video_format_to_string(fmt));
+      GST_ERROR("Unhandled format type '%s'", gst_hspec_format_to_string(fmt));
       return FALSE;
   }
 
   return TRUE;
 }
 
+/* number of elements in a plane and in one row of a plane */
+static void
+get_plane_elems(const GstHyperspectralInfo *info, gsize *plane_elems,
+    gint *row_elems)
+{
+  if (info->layout == GST_HSPC_LAYOUT_MULTIPLANE) {
+    *plane_elems = info->wavelength_elems;
+    *row_elems = info->width;
+  } else {
+    *plane_elems = info->cube_elems;
+    *row_elems = info->width * info->wavelengths;
+  }
+}
+
+/* plane and cube sizes from format, layout and dimensions, the planes are
+ * placed back to back without any row padding */
+static void
+update_sizes(GstHyperspectralInfo *info)
+{
+  gsize plane_elems, plane_size;
+  gint row_elems;
+  guint p;
+
+  get_plane_elems (info, &plane_elems, &row_elems);
+  plane_size = gst_hspec_format_get_size (info->format, plane_elems);
+
+  g_free (info->offset);
+  alloc_planes (info, info->layout == GST_HSPC_LAYOUT_MULTIPLANE ?
+      info->wavelengths : 1);
+  for (p=0; p<info->n_planes; p++) {
+    info->offset[p] = p * plane_size;
+    info->stride[p] = GST_HSPEC_FORMAT_IS_PACKED (info->format) ? 0 :
+        row_elems * info->bytesize;
+  }
+
+  info->wavelength_size = gst_hspec_format_get_size (info->format,
+                    info->wavelength_elems);
+  info->cube_size = plane_size * info->n_planes;
+}
+
+/* describes the cube of info after unpacking it to native 16 bit samples,
+ * the format stays so the sample range is known, the mosaic is not
+ * copied. unpacked has to be cleared with gst_hyperspectral_info_clear */
+void
+gst_hyperspectral_info_init_unpacked(GstHyperspectralInfo *unpacked,
+    const GstHyperspectralInfo *info)
+{
+  gsize plane_elems;
+  gint row_elems;
+  guint p;
+
+  *unpacked = *info;
+  init_mosaic(&unpacked->mosaic);
+  copy_planes(unpacked, info);
+  if (!GST_HSPEC_FORMAT_IS_PACKED (info->format))
+    return;
+
+  get_plane_elems (info, &plane_elems, &row_elems);
+  for (p=0; p<unpacked->n_planes; p++) {
+    unpacked->offset[p] = p * plane_elems * info->bytesize;
+    unpacked->stride[p] = row_elems * info->bytesize;
+  }
+  unpacked->wavelength_size = info->wavelength_elems * info->bytesize;
+  unpacked->cube_size = info->cube_elems * info->bytesize;
+}
+
+/* replaces the default plane placement of info, offset and stride hold
+ * n_planes entries. Strides must fit a row of samples, packed formats only
+ * support contiguous planes (stride 0) */
+gboolean
+gst_hyperspectral_info_set_planes(GstHyperspectralInfo *info,
+    const gsize *offset, const gint *stride)
+{
+  gsize plane_elems, plane_size, cube_size = 0;
+  gint row_elems, row_size;
+  guint p;
+
+  g_return_val_if_fail (info != NULL, FALSE);
+  g_return_val_if_fail (offset != NULL, FALSE);
+  g_return_val_if_fail (stride != NULL, FALSE);
+
+  get_plane_elems (info, &plane_elems, &row_elems);
+  row_size = row_elems * info->bytesize;
+
+  for (p=0; p<info->n_planes; p++) {
+    if (GST_HSPEC_FORMAT_IS_PACKED (info->format)) {
+      if (stride[p] != 0)
+        goto invalid_stride;
+      plane_size = gst_hspec_format_get_size (info->format, plane_elems);
+    } else {
+      if (stride[p] < row_size)
+        goto invalid_stride;
+      /* the last row does not need to be padded */
+      plane_size = (gsize) stride[p] * (info->height - 1) + row_size;
+    }
+    cube_size = MAX (cube_size, offset[p] + plane_size);
+  }
+
+  for (p=0; p<info->n_planes; p++) {
+    info->offset[p] = offset[p];
+    info->stride[p] = stride[p];
+  }
+  info->cube_size = cube_size;
+  return TRUE;
+
+invalid_stride:
+  {
+    GST_ERROR ("invalid stride %d for plane %u of %s cube, row is %d bytes",
+        stride[p], p, gst_hspec_format_to_string (info->format), row_size);
+    return FALSE;
+  }
+}
+
+/* places the planes of info so rows and planes start on multiples of align
+ * bytes and every plane is followed by at least padding bytes. align has to
+ * be a power of two, 0 keeps rows unaligned. Rows of packed formats can not
+ * be addressed, only their planes are aligned */
+gboolean
+gst_hyperspectral_info_align(GstHyperspectralInfo *info, guint align,
+    guint padding)
+{
+  gsize plane_elems, plane_size;
+  gint row_elems, stride;
+  guint p;
+
+  g_return_val_if_fail (info != NULL, FALSE);
+
+  if (align == 0)
+    align = 1;
+  if (align & (align - 1))
+    goto invalid_align;
+
+  get_plane_elems (info, &plane_elems, &row_elems);
+  if (GST_HSPEC_FORMAT_IS_PACKED (info->format)) {
+    stride = 0;
+    plane_size = gst_hspec_format_get_size (info->format, plane_elems);
+  } else {
+    stride = GST_ROUND_UP_N (row_elems * info->bytesize, align);
+    plane_size = (gsize) stride * info->height;
+  }
+  plane_size = GST_ROUND_UP_N (plane_size + padding, (gsize) align);
+
+  for (p=0; p<info->n_planes; p++) {
+    info->offset[p] = p * plane_size;
+    info->stride[p] = stride;
+  }
+  info->cube_size = plane_size * info->n_planes;
+  return TRUE;
+
+invalid_align:
+  {
+    GST_ERROR ("alignment %u is not a power of two", align);
+    return FALSE;
+  }
+}
+
+/* number of bytes plane p of info spans, the last row is not padded */
+gsize
+gst_hyperspectral_info_plane_size(const GstHyperspectralInfo *info, guint p)
+{
+  gsize plane_elems;
+  gint row_elems;
+
+  g_return_val_if_fail (info != NULL, 0);
+  g_return_val_if_fail (p < info->n_planes, 0);
+
+  get_plane_elems (info, &plane_elems, &row_elems);
+  if (info->stride[p] == 0)
+    return gst_hspec_format_get_size (info->format, plane_elems);
+
+  return (gsize) info->stride[p] * (info->height - 1) +
+      row_elems * info->bytesize;
+}
+
+/* TRUE when the planes are back to back without padding, so the cube can
+ * be handled as one run of samples */
+gboolean
+gst_hyperspectral_info_is_contiguous(const GstHyperspectralInfo *info)
+{
+  gsize plane_elems, plane_size;
+  gint row_elems;
+  guint p;
+
+  g_return_val_if_fail (info != NULL, FALSE);
+
+  get_plane_elems (info, &plane_elems, &row_elems);
+  if (GST_HSPEC_FORMAT_IS_PACKED (info->format) && info->stride[0] == 0)
+    plane_size = gst_hspec_format_get_size (info->format, plane_elems);
+  else
+    plane_size = plane_elems * info->bytesize;
+
+  for (p=0; p<info->n_planes; p++) {
+    if (info->offset[p] != p * plane_size)
+      return FALSE;
+    if (info->stride[p] != 0 && info->stride[p] != row_elems * info->bytesize)
+      return FALSE;
+  }
+  return TRUE;
+}
+
 gboolean
 gst_hyperspectral_info_from_caps(GstHyperspectralInfo *info, const GstCaps *caps)
 {
   GstStructure *structure;
   const gchar *s;
-  GstVideoFormat format = GST_VIDEO_FORMAT_UNKNOWN;
+  GstHyperspectralFormat format = GST_HSPC_FORMAT_UNKNOWN;
   GstHyperspectralLayout layout = GST_HSPC_LAYOUT_UNKNOWN;
 
   gint width = 0, height = 0, wavelengths = 0;
@@ -72,8 +324,8 @@ gst_hyperspectral_info_from_caps(GstHyperspectralInfo *info, const GstCaps *caps
     if (!(s = gst_structure_get_string (structure, "format")))
       goto no_format;
 
-    format = gst_video_format_from_string (s);
-    if (format == GST_VIDEO_FORMAT_UNKNOWN)
+    format = gst_hspec_format_from_string (s);
+    if (format == GST_HSPC_FORMAT_UNKNOWN)
       goto unknown_format;
 
     /* retrieve the cube layout */
@@ -97,6 +349,9 @@ gst_hyperspectral_info_from_caps(GstHyperspectralInfo *info, const GstCaps *caps
 
   if (!get_byte_size_from_format(format, &bytesize))
     return FALSE;
+  /* every dimension fits a gint, their product only fits 64 bits */
+  if ((guint64) width * height * wavelengths * bytesize > G_MAXSIZE)
+    goto too_large;
   gst_hyperspectral_info_init(info);
   if (!load_mosaic_from_caps(&info->mosaic, caps))
     return FALSE;
@@ -105,14 +360,11 @@ gst_hyperspectral_info_from_caps(GstHyperspectralInfo *info, const GstCaps *caps
   info->height = height;
   info->wavelengths = wavelengths;
   info->bytesize = bytesize;
-  info->wavelength_elems = info->width * info->height;
-  info->cube_elems = info->width * info->height * info->wavelengths;
-  info->wavelength_size = info->width * info->height *
-                    info->bytesize;
-  info->cube_size = info->width * info->height *
-                    info->wavelengths * info->bytesize;
+  info->wavelength_elems = (gsize) info->width * info->height;
+  info->cube_elems = info->wavelength_elems * info->wavelengths;
   info->format = format;
   info->layout = layout;
+  update_sizes(info);
   return TRUE;
 
 wrong_name:
@@ -156,4 +408,160 @@ no_wavelengths:
     GST_ERROR ("no wavelength property given");
     return FALSE;
   }
-}
\ No newline at end of file
+too_large:
+  {
+    GST_ERROR ("%dx%dx%d cube does not fit in memory", width, height,
+        wavelengths);
+    return FALSE;
+  }
+}
+/* deep copy of src, dest has to be cleared with gst_hyperspectral_info_clear */
+void
+gst_hyperspectral_info_copy(GstHyperspectralInfo *dest,
+    const GstHyperspectralInfo *src)
+{
+  g_return_if_fail (dest != NULL);
+  g_return_if_fail (src != NULL);
+
+  *dest = *src;
+  init_mosaic(&dest->mosaic);
+  copy_planes(dest, src);
+  if (src->mosaic.size) {
+    dest->mosaic.spectras = malloc (src->mosaic.size * sizeof (gint));
+    memcpy (dest->mosaic.spectras, src->mosaic.spectras,
+        src->mosaic.size * sizeof (gint));
+    dest->mosaic.size = src->mosaic.size;
+  }
+}
+
+static void
+caps_key_init(CapsKey *key, const GstCaps *caps)
+{
+  const GstStructure *s;
+  const gchar *format;
+
+  memset (key, 0, sizeof (CapsKey));
+  if (gst_caps_get_size (caps) != 1)
+    return;
+
+  s = gst_caps_get_structure (caps, 0);
+  format = gst_structure_get_string (s, "format");
+  if (format)
+    key->format = g_str_hash (format);
+  gst_structure_get_int (s, "width", &key->width);
+  gst_structure_get_int (s, "height", &key->height);
+  gst_structure_get_int (s, "wavelengths", &key->wavelengths);
+}
+
+/* moves the entry for caps to the front and takes a reference on it, the
+ * cache lock has to be held */
+static CachedInfo *
+info_cache_lookup(const GstCaps *caps, const CapsKey *key)
+{
+  CachedInfo *cached;
+  guint i;
+
+  for (i=0; i<INFO_CACHE_SIZE && info_cache[i]; i++) {
+    if (memcmp (&info_cache[i]->key, key, sizeof (CapsKey)) == 0 &&
+        gst_caps_is_equal (info_cache[i]->caps, caps)) {
+      cached = info_cache[i];
+      memmove (&info_cache[1], &info_cache[0], i * sizeof (CachedInfo *));
+      info_cache[0] = cached;
+      g_atomic_int_inc (&cached->refcount);
+      return cached;
+    }
+  }
+
+  return NULL;
+}
+
+/* looks caps up in the cache and parses them on a miss. Caps are compared
+ * by value, the cache holds a reference on them so a pointer it has seen can
+ * not be reused for different caps */
+const GstHyperspectralInfo *
+gst_hyperspectral_info_from_caps_cached(const GstCaps *caps)
+{
+  CachedInfo *cached, *parsed, *evicted = NULL;
+  CapsKey key;
+
+  g_return_val_if_fail (caps != NULL, NULL);
+
+  caps_key_init (&key, caps);
+  G_LOCK (info_cache);
+  cached = info_cache_lookup (caps, &key);
+  G_UNLOCK (info_cache);
+
+  if (cached)
+    return &cached->info;
+
+  parsed = g_new0 (CachedInfo, 1);
+  if (!gst_hyperspectral_info_from_caps (&parsed->info, caps)) {
+    gst_hyperspectral_info_clear (&parsed->info);
+    g_free (parsed);
+    return NULL;
+  }
+  parsed->caps = gst_caps_ref ((GstCaps *) caps);
+  parsed->key = key;
+  /* one for the cache, one for the caller */
+  parsed->refcount = 2;
+
+  /* another thread may have parsed the same caps meanwhile */
+  G_LOCK (info_cache);
+  if (!(cached = info_cache_lookup (caps, &key))) {
+    cached = parsed;
+    parsed = NULL;
+    evicted = info_cache[INFO_CACHE_SIZE - 1];
+    memmove (&info_cache[1], &info_cache[0],
+        (INFO_CACHE_SIZE - 1) * sizeof (CachedInfo *));
+    info_cache[0] = cached;
+  }
+  G_UNLOCK (info_cache);
+
+  if (parsed) {
+    parsed->refcount = 1;
+    gst_hyperspectral_info_unref (&parsed->info);
+  }
+  if (evicted)
+    gst_hyperspectral_info_unref (&evicted->info);
+
+  return &cached->info;
+}
+
+/* info has to come from gst_hyperspectral_info_from_caps_cached() */
+const GstHyperspectralInfo *
+gst_hyperspectral_info_ref(const GstHyperspectralInfo *info)
+{
+  g_return_val_if_fail (info != NULL, NULL);
+
+  g_atomic_int_inc (&((CachedInfo *) info)->refcount);
+  return info;
+}
+
+void
+gst_hyperspectral_info_unref(const GstHyperspectralInfo *info)
+{
+  CachedInfo *cached = (CachedInfo *) info;
+
+  g_return_if_fail (info != NULL);
+
+  if (g_atomic_int_dec_and_test (&cached->refcount)) {
+    gst_caps_unref (cached->caps);
+    gst_hyperspectral_info_clear (&cached->info);
+    g_free (cached);
+  }
+}
+
+/* drops the references the cache holds, infos still in use stay valid.
+ * Meant for shutdown, before gst_deinit() */
+void
+gst_hyperspectral_info_cache_clear(void)
+{
+  guint i;
+
+  G_LOCK (info_cache);
+  for (i=0; i<INFO_CACHE_SIZE && info_cache[i]; i++) {
+    gst_hyperspectral_info_unref (&info_cache[i]->info);
+    info_cache[i] = NULL;
+  }
+  G_UNLOCK (info_cache);
+}
@@ -37,14 +37,23 @@ struct _GstHyperspectrlInfo {
   gint width;
   gint height;
   gint wavelengths;
-  gint wavelength_elems;
-  gint cube_elems;
+  gsize wavelength_elems;
+  gsize cube_elems;
   gsize wavelength_size;
   gsize cube_size;
   gsize bytesize;
-  GstVideoFormat format;
+  GstHyperspectralFormat format;
   GstHyperspectralLayout layout;
 
+  /* one plane per wavelength for multiplane cubes, a single plane for
+   * interleaved ones. offset is in bytes from the start of the cube, stride
+   * is the size of a row in bytes including padding, 0 for packed formats
+   * whose planes are stored as one contiguous run. Both hold n_planes
+   * entries and are owned by the info */
+  guint n_planes;
+  gsize *offset;
+  gint *stride;
+
   SpectralInfo mosaic;
 
 };
@@ -53,7 +62,36 @@ void        gst_hyperspectral_info_init(GstHyperspectralInfo *info);
 
 void        gst_hyperspectral_info_clear(GstHyperspectralInfo *info);
 
+void        gst_hyperspectral_info_init_unpacked(GstHyperspectralInfo *unpacked,
+    const GstHyperspectralInfo *info);
+
+gboolean    gst_hyperspectral_info_set_planes(GstHyperspectralInfo *info,
+    const gsize *offset, const gint *stride);
+
+gboolean    gst_hyperspectral_info_align(GstHyperspectralInfo *info,
+    guint align, guint padding);
+
+gsize       gst_hyperspectral_info_plane_size(const GstHyperspectralInfo *info,
+    guint p);
+
+gboolean    gst_hyperspectral_info_is_contiguous(const GstHyperspectralInfo *info);
+
 gboolean    gst_hyperspectral_info_from_caps(
     GstHyperspectralInfo *info, const GstCaps *caps);
 
+void        gst_hyperspectral_info_copy(GstHyperspectralInfo *dest,
+    const GstHyperspectralInfo *src);
+
+/* parsed caps are kept in a small cache, the returned info is shared and
+ * must not be modified. It stays valid until gst_hyperspectral_info_unref() */
+const GstHyperspectralInfo *
+            gst_hyperspectral_info_from_caps_cached(const GstCaps *caps);
+
+const GstHyperspectralInfo *
+            gst_hyperspectral_info_ref(const GstHyperspectralInfo *info);
+
+void        gst_hyperspectral_info_unref(const GstHyperspectralInfo *info);
+
+void        gst_hyperspectral_info_cache_clear(void);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,867 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include <math.h>
+#include "hyperspectral-kernels.h"
+#include "hyperspectral-dispatch.h"
+#include "hyperspectral-orc.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#define HSPEC_TARGET(isa) __attribute__ ((target (isa)))
+#endif
+
+typedef union {
+  gfloat f;
+  guint32 u;
+} FloatBits;
+
+void
+gst_hspec_kernel_copy_u8 (guint8 *dest, gsize dstride,
+    const guint8 *src, gsize sstride, gsize n)
+{
+  gsize i;
+
+  if (dstride == 1 && sstride == 1) {
+    memcpy (dest, src, n);
+    return;
+  }
+  for (i=0; i<n; i++)
+    dest[i*dstride] = src[i*sstride];
+}
+
+void
+gst_hspec_kernel_copy_u16 (guint16 *dest, gsize dstride,
+    const guint16 *src, gsize sstride, gsize n)
+{
+  gsize i;
+
+  if (dstride == 1 && sstride == 1) {
+    memcpy (dest, src, n * sizeof (guint16));
+    return;
+  }
+  for (i=0; i<n; i++)
+    dest[i*dstride] = src[i*sstride];
+}
+
+void
+gst_hspec_kernel_copy_f32 (gfloat *dest, gsize dstride,
+    const gfloat *src, gsize sstride, gsize n)
+{
+  gsize i;
+
+  if (dstride == 1 && sstride == 1) {
+    memcpy (dest, src, n * sizeof (gfloat));
+    return;
+  }
+  for (i=0; i<n; i++)
+    dest[i*dstride] = src[i*sstride];
+}
+
+void
+gst_hspec_kernel_copy_2d (guint8 *dest, gsize dstride,
+    const guint8 *src, gsize sstride, gsize row_size, gsize rows)
+{
+  gsize i;
+
+  if (dstride == row_size && sstride == row_size) {
+    memcpy (dest, src, row_size * rows);
+    return;
+  }
+  /* orc takes int strides and sizes */
+  if (dstride <= G_MAXINT && sstride <= G_MAXINT && row_size <= G_MAXINT &&
+      rows <= G_MAXINT) {
+    hspec_orc_memcpy_2d (dest, dstride, src, sstride, row_size, rows);
+    return;
+  }
+  for (i=0; i<rows; i++)
+    memcpy (dest + i*dstride, src + i*sstride, row_size);
+}
+
+void
+gst_hspec_kernel_swap_u16 (guint16 *dest, gsize dstride,
+    const guint16 *src, gsize sstride, gsize n)
+{
+  gsize i, len;
+
+  if (dstride == 1 && sstride == 1) {
+    for (i=0; i<n; i+=len) {
+      len = MIN (n - i, G_MAXINT);
+      hspec_orc_swap_u16 (dest + i, src + i, len);
+    }
+    return;
+  }
+  for (i=0; i<n; i++)
+    dest[i*dstride] = GUINT16_SWAP_LE_BE (src[i*sstride]);
+}
+
+gfloat
+gst_hspec_half_to_float (guint16 h)
+{
+  FloatBits v;
+  guint32 sign = (guint32) (h & 0x8000) << 16;
+  guint32 exp = (h >> 10) & 0x1f;
+  guint32 mant = h & 0x3ff;
+
+  if (exp == 0x1f) {
+    /* inf and nan */
+    v.u = sign | 0x7f800000 | (mant << 13);
+  } else if (exp != 0) {
+    v.u = sign | ((exp + 112) << 23) | (mant << 13);
+  } else {
+    /* zero and subnormals, mant * 2^-24 is exact in float */
+    v.f = mant * (1.0f / 16777216.0f);
+    v.u |= sign;
+  }
+  return v.f;
+}
+
+guint16
+gst_hspec_float_to_half (gfloat f)
+{
+  FloatBits v;
+  guint32 x, sign, r, rem, m, shift;
+
+  v.f = f;
+  sign = (v.u >> 16) & 0x8000;
+  x = v.u & 0x7fffffff;
+
+  if (x >= 0x7f800000)
+    return sign | 0x7c00 | (x > 0x7f800000 ? 0x200 : 0);
+  /* 65520 and above round to infinity */
+  if (x >= 0x477ff000)
+    return sign | 0x7c00;
+
+  if (x < 0x38800000) {
+    /* below the smallest normal half, becomes subnormal or zero */
+    if (x < 0x33000000)
+      return sign;
+    m = (x & 0x7fffff) | 0x800000;
+    shift = 126 - (x >> 23);
+    r = m >> shift;
+    rem = m & ((1 << shift) - 1);
+    if (rem > (1u << (shift - 1)) || (rem == (1u << (shift - 1)) && (r & 1)))
+      r++;
+    return sign | r;
+  }
+
+  /* rebias the exponent, a carry out of the mantissa bumps it correctly */
+  r = (x - 0x38000000) >> 13;
+  rem = x & 0x1fff;
+  if (rem > 0x1000 || (rem == 0x1000 && (r & 1)))
+    r++;
+  return sign | r;
+}
+
+/* rounds to nearest even like the SIMD conversions do */
+static inline gint
+round_clamp (gfloat v, gint max)
+{
+  if (!(v > 0.0f))
+    return 0;
+  if (v >= (gfloat) max)
+    return max;
+  return (gint) lrintf (v);
+}
+
+/* denormals are flushed to zero */
+void
+gst_hspec_kernel_scale_f32 (gfloat *data, gfloat mul, gfloat add, gsize n)
+{
+  gsize i, len;
+
+  for (i=0; i<n; i+=len) {
+    len = MIN (n - i, G_MAXINT);
+    hspec_orc_scale_f32 (data + i, mul, add, len);
+  }
+}
+
+/* Contiguous runs. Every conversion has a C implementation, the SIMD ones
+ * are built with the instruction set as a function target so they exist in
+ * any x86 build, and the registry picks the one the CPU supports on first
+ * use. */
+
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define FORMAT_U16_NATIVE GST_HSPC_FORMAT_GRAY16_LE
+#define FORMAT_U16_SWAPPED GST_HSPC_FORMAT_GRAY16_BE
+#else
+#define FORMAT_U16_NATIVE GST_HSPC_FORMAT_GRAY16_BE
+#define FORMAT_U16_SWAPPED GST_HSPC_FORMAT_GRAY16_LE
+#endif
+
+typedef void (*U8ToF32Func) (gfloat *dest, const guint8 *src, gsize n);
+typedef void (*U16ToF32Func) (gfloat *dest, const guint16 *src, gsize n);
+typedef void (*F32ToU8Func) (guint8 *dest, const gfloat *src, gsize n);
+typedef void (*F32ToU16Func) (guint16 *dest, const gfloat *src, gsize n);
+typedef void (*UnpackFunc) (guint16 *dest, const guint8 *src, gsize n);
+typedef void (*PackFunc) (guint8 *dest, const guint16 *src, gsize n);
+typedef gsize (*Base64Func) (gchar *dest, const guint8 *src, gsize n);
+
+typedef struct {
+  U8ToF32Func u8_to_f32;
+  U16ToF32Func u16_to_f32;
+  U16ToF32Func u16_swap_to_f32;
+  U16ToF32Func f16_to_f32;
+  F32ToU8Func f32_to_u8;
+  F32ToU16Func f32_to_u16;
+  F32ToU16Func f32_to_u16_swap;
+  F32ToU16Func f32_to_f16;
+  UnpackFunc unpack_10;
+  UnpackFunc unpack_12;
+  PackFunc pack_10;
+  PackFunc pack_12;
+  Base64Func base64_encode;
+} SampleRuns;
+
+static void
+u8_to_f32_c (gfloat *dest, const guint8 *src, gsize n)
+{
+  gsize i;
+
+  for (i=0; i<n; i++)
+    dest[i] = src[i];
+}
+
+static void
+u16_to_f32_c (gfloat *dest, const guint16 *src, gsize n)
+{
+  gsize i;
+
+  for (i=0; i<n; i++)
+    dest[i] = src[i];
+}
+
+static void
+u16_swap_to_f32_c (gfloat *dest, const guint16 *src, gsize n)
+{
+  gsize i;
+
+  for (i=0; i<n; i++)
+    dest[i] = GUINT16_SWAP_LE_BE (src[i]);
+}
+
+static void
+f16_to_f32_c (gfloat *dest, const guint16 *src, gsize n)
+{
+  gsize i;
+
+  for (i=0; i<n; i++)
+    dest[i] = gst_hspec_half_to_float (src[i]);
+}
+
+static void
+f32_to_u8_c (guint8 *dest, const gfloat *src, gsize n)
+{
+  gsize i;
+
+  for (i=0; i<n; i++)
+    dest[i] = round_clamp (src[i], G_MAXUINT8);
+}
+
+static void
+f32_to_u16_c (guint16 *dest, const gfloat *src, gsize n)
+{
+  gsize i;
+
+  for (i=0; i<n; i++)
+    dest[i] = round_clamp (src[i], G_MAXUINT16);
+}
+
+static void
+f32_to_u16_swap_c (guint16 *dest, const gfloat *src, gsize n)
+{
+  gsize i;
+  guint16 v;
+
+  for (i=0; i<n; i++) {
+    v = round_clamp (src[i], G_MAXUINT16);
+    dest[i] = GUINT16_SWAP_LE_BE (v);
+  }
+}
+
+static void
+f32_to_f16_c (guint16 *dest, const gfloat *src, gsize n)
+{
+  gsize i;
+
+  for (i=0; i<n; i++)
+    dest[i] = gst_hspec_float_to_half (src[i]);
+}
+
+static void
+unpack_10_c (guint16 *dest, const guint8 *src, gsize n)
+{
+  gsize i, k;
+  guint64 w;
+
+  for (i=0; i<n; i+=4) {
+    w = 0;
+    for (k=0; k<5; k++)
+      w |= (guint64) src[i / 4 * 5 + k] << (8 * k);
+    for (k=0; k<4 && i + k < n; k++)
+      dest[i + k] = (w >> (10 * k)) & 0x3ff;
+  }
+}
+
+static void
+unpack_12_c (guint16 *dest, const guint8 *src, gsize n)
+{
+  gsize i;
+  const guint8 *s;
+
+  for (i=0; i<n; i+=2) {
+    s = src + i / 2 * 3;
+    dest[i] = s[0] | ((s[1] & 0x0f) << 8);
+    if (i + 1 < n)
+      dest[i + 1] = (s[1] >> 4) | (s[2] << 4);
+  }
+}
+
+static void
+pack_10_c (guint8 *dest, const guint16 *src, gsize n)
+{
+  gsize i, k;
+  guint64 w;
+
+  /* one 40 bit word per group, the compiler keeps it in a register */
+  for (i=0; i<n; i+=4) {
+    w = 0;
+    for (k=0; k<4 && i + k < n; k++)
+      w |= (guint64) MIN (src[i + k], 0x3ff) << (10 * k);
+    for (k=0; k<5; k++)
+      dest[i / 4 * 5 + k] = w >> (8 * k);
+  }
+}
+
+static void
+pack_12_c (guint8 *dest, const guint16 *src, gsize n)
+{
+  gsize i;
+  guint16 a, b;
+  guint8 *d;
+
+  for (i=0; i<n; i+=2) {
+    d = dest + i / 2 * 3;
+    a = MIN (src[i], 0xfff);
+    b = i + 1 < n ? MIN (src[i + 1], 0xfff) : 0;
+    d[0] = a & 0xff;
+    d[1] = (a >> 8) | ((b & 0x0f) << 4);
+    d[2] = b >> 4;
+  }
+}
+
+static const gchar base64_alphabet[65] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static gsize
+base64_encode_c (gchar *dest, const guint8 *src, gsize n)
+{
+  gsize i = 0;
+  gchar *d = dest;
+  guint32 w;
+
+  for (; i + 3 <= n; i += 3, d += 4) {
+    w = (src[i] << 16) | (src[i + 1] << 8) | src[i + 2];
+    d[0] = base64_alphabet[w >> 18];
+    d[1] = base64_alphabet[(w >> 12) & 0x3f];
+    d[2] = base64_alphabet[(w >> 6) & 0x3f];
+    d[3] = base64_alphabet[w & 0x3f];
+  }
+  if (i < n) {
+    w = src[i] << 16;
+    if (i + 1 < n)
+      w |= src[i + 1] << 8;
+    d[0] = base64_alphabet[w >> 18];
+    d[1] = base64_alphabet[(w >> 12) & 0x3f];
+    d[2] = i + 1 < n ? base64_alphabet[(w >> 6) & 0x3f] : '=';
+    d[3] = '=';
+    d += 4;
+  }
+
+  return d - dest;
+}
+
+#ifdef HAVE_X86_KERNELS
+HSPEC_TARGET ("sse2") static void
+u8_to_f32_sse2 (gfloat *dest, const guint8 *src, gsize n)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  gsize i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_unpacklo_epi8 (
+        _mm_loadl_epi64 ((const __m128i *) (src + i)), zero);
+    _mm_storeu_ps (dest + i, _mm_cvtepi32_ps (_mm_unpacklo_epi16 (v, zero)));
+    _mm_storeu_ps (dest + i + 4, _mm_cvtepi32_ps (_mm_unpackhi_epi16 (v, zero)));
+  }
+  u8_to_f32_c (dest + i, src + i, n - i);
+}
+
+/* returns the number of samples done, the caller finishes the rest */
+HSPEC_TARGET ("sse2") static inline gsize
+u16_to_f32_sse2_run (gfloat *dest, const guint16 *src, gboolean swap, gsize n)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  gsize i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i));
+    if (swap)
+      v = _mm_or_si128 (_mm_slli_epi16 (v, 8), _mm_srli_epi16 (v, 8));
+    _mm_storeu_ps (dest + i, _mm_cvtepi32_ps (_mm_unpacklo_epi16 (v, zero)));
+    _mm_storeu_ps (dest + i + 4, _mm_cvtepi32_ps (_mm_unpackhi_epi16 (v, zero)));
+  }
+  return i;
+}
+
+HSPEC_TARGET ("sse2") static void
+u16_to_f32_sse2 (gfloat *dest, const guint16 *src, gsize n)
+{
+  gsize i = u16_to_f32_sse2_run (dest, src, FALSE, n);
+
+  u16_to_f32_c (dest + i, src + i, n - i);
+}
+
+HSPEC_TARGET ("sse2") static void
+u16_swap_to_f32_sse2 (gfloat *dest, const guint16 *src, gsize n)
+{
+  gsize i = u16_to_f32_sse2_run (dest, src, TRUE, n);
+
+  u16_swap_to_f32_c (dest + i, src + i, n - i);
+}
+
+HSPEC_TARGET ("sse2") static void
+f32_to_u8_sse2 (guint8 *dest, const gfloat *src, gsize n)
+{
+  const __m128 lo = _mm_setzero_ps ();
+  const __m128 hi = _mm_set1_ps (255.0f);
+  gsize i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m128i a = _mm_cvtps_epi32 (_mm_min_ps (_mm_max_ps (
+            _mm_loadu_ps (src + i), lo), hi));
+    __m128i b = _mm_cvtps_epi32 (_mm_min_ps (_mm_max_ps (
+            _mm_loadu_ps (src + i + 4), lo), hi));
+    __m128i v = _mm_packs_epi32 (a, b);
+    _mm_storel_epi64 ((__m128i *) (dest + i), _mm_packus_epi16 (v, v));
+  }
+  f32_to_u8_c (dest + i, src + i, n - i);
+}
+
+HSPEC_TARGET ("sse2") static inline gsize
+f32_to_u16_sse2_run (guint16 *dest, const gfloat *src, gboolean swap, gsize n)
+{
+  /* SSE2 has no unsigned 32->16 pack, so bias into the signed range,
+   * pack with signed saturation and flip the sign bit back */
+  const __m128 lo = _mm_setzero_ps ();
+  const __m128 hi = _mm_set1_ps (65535.0f);
+  const __m128i bias = _mm_set1_epi32 (32768);
+  const __m128i sign = _mm_set1_epi16 ((gshort) 0x8000);
+  gsize i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m128i a = _mm_sub_epi32 (_mm_cvtps_epi32 (_mm_min_ps (_mm_max_ps (
+            _mm_loadu_ps (src + i), lo), hi)), bias);
+    __m128i b = _mm_sub_epi32 (_mm_cvtps_epi32 (_mm_min_ps (_mm_max_ps (
+            _mm_loadu_ps (src + i + 4), lo), hi)), bias);
+    __m128i r = _mm_xor_si128 (_mm_packs_epi32 (a, b), sign);
+    if (swap)
+      r = _mm_or_si128 (_mm_slli_epi16 (r, 8), _mm_srli_epi16 (r, 8));
+    _mm_storeu_si128 ((__m128i *) (dest + i), r);
+  }
+  return i;
+}
+
+HSPEC_TARGET ("sse2") static void
+f32_to_u16_sse2 (guint16 *dest, const gfloat *src, gsize n)
+{
+  gsize i = f32_to_u16_sse2_run (dest, src, FALSE, n);
+
+  f32_to_u16_c (dest + i, src + i, n - i);
+}
+
+HSPEC_TARGET ("sse2") static void
+f32_to_u16_swap_sse2 (guint16 *dest, const gfloat *src, gsize n)
+{
+  gsize i = f32_to_u16_sse2_run (dest, src, TRUE, n);
+
+  f32_to_u16_swap_c (dest + i, src + i, n - i);
+}
+
+HSPEC_TARGET ("ssse3") static void
+unpack_10_ssse3 (guint16 *dest, const guint8 *src, gsize n)
+{
+  /* 10 bytes hold 8 samples, gather the two bytes each sample starts in,
+   * move its bits to the top of the lane with a per lane multiply and
+   * shift them back down */
+  const __m128i shuf = _mm_setr_epi8 (0, 1, 1, 2, 2, 3, 3, 4,
+      5, 6, 6, 7, 7, 8, 8, 9);
+  const __m128i mul = _mm_setr_epi16 (64, 16, 4, 1, 64, 16, 4, 1);
+  gsize i = 0;
+
+  /* a 16 byte load reads 6 bytes past the 10 in use */
+  for (; i + 8 <= n && (i / 4 * 5 + 16) <= (n + 3) / 4 * 5; i += 8) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i / 4 * 5));
+    v = _mm_mullo_epi16 (_mm_shuffle_epi8 (v, shuf), mul);
+    _mm_storeu_si128 ((__m128i *) (dest + i), _mm_srli_epi16 (v, 6));
+  }
+  unpack_10_c (dest + i, src + i / 4 * 5, n - i);
+}
+
+HSPEC_TARGET ("ssse3") static void
+unpack_12_ssse3 (guint16 *dest, const guint8 *src, gsize n)
+{
+  /* 12 bytes hold 8 samples, same trick as the 10 bit unpack */
+  const __m128i shuf = _mm_setr_epi8 (0, 1, 1, 2, 3, 4, 4, 5,
+      6, 7, 7, 8, 9, 10, 10, 11);
+  const __m128i mul = _mm_setr_epi16 (16, 1, 16, 1, 16, 1, 16, 1);
+  gsize i = 0;
+
+  /* a 16 byte load reads 4 bytes past the 12 in use */
+  for (; i + 8 <= n && (i / 2 * 3 + 16) <= (n + 1) / 2 * 3; i += 8) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i / 2 * 3));
+    v = _mm_mullo_epi16 (_mm_shuffle_epi8 (v, shuf), mul);
+    _mm_storeu_si128 ((__m128i *) (dest + i), _mm_srli_epi16 (v, 4));
+  }
+  unpack_12_c (dest + i, src + i / 2 * 3, n - i);
+}
+
+HSPEC_TARGET ("ssse3") static void
+pack_10_ssse3 (guint8 *dest, const guint16 *src, gsize n)
+{
+  /* saturate to 10 bits, join pairs of samples into 20 bits per 32 bit
+   * lane with a multiply-add, pairs of those into 40 bits per 64 bit lane
+   * and gather the 5 bytes of each lane */
+  const __m128i max = _mm_set1_epi16 (0x3ff);
+  const __m128i mul = _mm_setr_epi16 (1, 1 << 10, 1, 1 << 10,
+      1, 1 << 10, 1, 1 << 10);
+  const __m128i lo = _mm_setr_epi32 (-1, 0, -1, 0);
+  const __m128i shuf = _mm_setr_epi8 (0, 1, 2, 3, 4, 8, 9, 10, 11, 12,
+      -1, -1, -1, -1, -1, -1);
+  gsize i = 0;
+
+  /* a 16 byte store writes 6 bytes past the 10 in use, the next group
+   * overwrites them */
+  for (; i + 8 <= n && (i / 4 * 5 + 16) <= (n + 3) / 4 * 5; i += 8) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i));
+    v = _mm_sub_epi16 (v, _mm_subs_epu16 (v, max));
+    v = _mm_madd_epi16 (v, mul);
+    v = _mm_or_si128 (_mm_and_si128 (v, lo),
+        _mm_slli_epi64 (_mm_srli_epi64 (v, 32), 20));
+    _mm_storeu_si128 ((__m128i *) (dest + i / 4 * 5),
+        _mm_shuffle_epi8 (v, shuf));
+  }
+  pack_10_c (dest + i / 4 * 5, src + i, n - i);
+}
+
+HSPEC_TARGET ("ssse3") static void
+pack_12_ssse3 (guint8 *dest, const guint16 *src, gsize n)
+{
+  /* 24 bits per pair of samples, same trick as the 10 bit pack */
+  const __m128i max = _mm_set1_epi16 (0xfff);
+  const __m128i mul = _mm_setr_epi16 (1, 1 << 12, 1, 1 << 12,
+      1, 1 << 12, 1, 1 << 12);
+  const __m128i shuf = _mm_setr_epi8 (0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14,
+      -1, -1, -1, -1);
+  gsize i = 0;
+
+  /* a 16 byte store writes 4 bytes past the 12 in use */
+  for (; i + 8 <= n && (i / 2 * 3 + 16) <= (n + 1) / 2 * 3; i += 8) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i));
+    v = _mm_sub_epi16 (v, _mm_subs_epu16 (v, max));
+    v = _mm_madd_epi16 (v, mul);
+    _mm_storeu_si128 ((__m128i *) (dest + i / 2 * 3),
+        _mm_shuffle_epi8 (v, shuf));
+  }
+  pack_12_c (dest + i / 2 * 3, src + i, n - i);
+}
+
+HSPEC_TARGET ("ssse3") static gsize
+base64_encode_ssse3 (gchar *dest, const guint8 *src, gsize n)
+{
+  /* 12 bytes become 16 characters: spread every 3 bytes over a 32 bit
+   * lane, move the four 6 bit fields to their own bytes with multiplies
+   * and map each range of values to its characters with an offset looked
+   * up by pshufb */
+  const __m128i shuf = _mm_setr_epi8 (1, 0, 2, 1, 4, 3, 5, 4,
+      7, 6, 8, 7, 10, 9, 11, 10);
+  const __m128i offsets = _mm_setr_epi8 ('a' - 26, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  __m128i v, lo, hi, r;
+  gsize i = 0;
+  gchar *d = dest;
+
+  /* a 16 byte load reads 4 bytes past the 12 in use */
+  for (; i + 16 <= n; i += 12, d += 16) {
+    v = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) (src + i)),
+        shuf);
+    hi = _mm_mulhi_epu16 (_mm_and_si128 (v, _mm_set1_epi32 (0x0fc0fc00)),
+        _mm_set1_epi32 (0x04000040));
+    lo = _mm_mullo_epi16 (_mm_and_si128 (v, _mm_set1_epi32 (0x003f03f0)),
+        _mm_set1_epi32 (0x01000010));
+    v = _mm_or_si128 (hi, lo);
+
+    /* 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12 */
+    r = _mm_subs_epu8 (v, _mm_set1_epi8 (51));
+    r = _mm_or_si128 (r, _mm_and_si128 (_mm_cmpgt_epi8 (_mm_set1_epi8 (26),
+        v), _mm_set1_epi8 (13)));
+    r = _mm_add_epi8 (_mm_shuffle_epi8 (offsets, r), v);
+    _mm_storeu_si128 ((__m128i *) d, r);
+  }
+
+  return (d - dest) + base64_encode_c (d, src + i, n - i);
+}
+
+/* F16C has no instruction set of its own here, every AVX2 CPU has it and
+ * the probe requires both */
+HSPEC_TARGET ("avx2,f16c") static void
+f16_to_f32_f16c (gfloat *dest, const guint16 *src, gsize n)
+{
+  gsize i = 0;
+
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_ps (dest + i, _mm256_cvtph_ps (
+            _mm_loadu_si128 ((const __m128i *) (src + i))));
+  f16_to_f32_c (dest + i, src + i, n - i);
+}
+
+HSPEC_TARGET ("avx2,f16c") static void
+f32_to_f16_f16c (guint16 *dest, const gfloat *src, gsize n)
+{
+  gsize i = 0;
+
+  for (; i + 8 <= n; i += 8)
+    _mm_storeu_si128 ((__m128i *) (dest + i), _mm256_cvtps_ph (
+            _mm256_loadu_ps (src + i), _MM_FROUND_TO_NEAREST_INT));
+  f32_to_f16_c (dest + i, src + i, n - i);
+}
+#endif
+
+#define RUN_KERNEL(op,format,isa,func) \
+  GST_HSPEC_KERNEL (GST_HSPEC_KERNEL_OP_##op, format, \
+      GST_HSPC_LAYOUT_UNKNOWN, GST_HSPEC_ISA_##isa, func)
+
+static const GstHspecKernel run_kernels[] = {
+  RUN_KERNEL (TO_F32, GST_HSPC_FORMAT_GRAY8, C, u8_to_f32_c),
+  RUN_KERNEL (TO_F32, FORMAT_U16_NATIVE, C, u16_to_f32_c),
+  RUN_KERNEL (TO_F32, FORMAT_U16_SWAPPED, C, u16_swap_to_f32_c),
+  RUN_KERNEL (TO_F32, GST_HSPC_FORMAT_F16, C, f16_to_f32_c),
+  RUN_KERNEL (FROM_F32, GST_HSPC_FORMAT_GRAY8, C, f32_to_u8_c),
+  RUN_KERNEL (FROM_F32, FORMAT_U16_NATIVE, C, f32_to_u16_c),
+  RUN_KERNEL (FROM_F32, FORMAT_U16_SWAPPED, C, f32_to_u16_swap_c),
+  RUN_KERNEL (FROM_F32, GST_HSPC_FORMAT_F16, C, f32_to_f16_c),
+  RUN_KERNEL (UNPACK, GST_HSPC_FORMAT_GRAY10P, C, unpack_10_c),
+  RUN_KERNEL (UNPACK, GST_HSPC_FORMAT_GRAY12P, C, unpack_12_c),
+  RUN_KERNEL (PACK, GST_HSPC_FORMAT_GRAY10P, C, pack_10_c),
+  RUN_KERNEL (PACK, GST_HSPC_FORMAT_GRAY12P, C, pack_12_c),
+  RUN_KERNEL (BASE64, GST_HSPC_FORMAT_GRAY8, C, base64_encode_c),
+#ifdef HAVE_X86_KERNELS
+  RUN_KERNEL (TO_F32, GST_HSPC_FORMAT_GRAY8, SSE2, u8_to_f32_sse2),
+  RUN_KERNEL (TO_F32, FORMAT_U16_NATIVE, SSE2, u16_to_f32_sse2),
+  RUN_KERNEL (TO_F32, FORMAT_U16_SWAPPED, SSE2, u16_swap_to_f32_sse2),
+  RUN_KERNEL (TO_F32, GST_HSPC_FORMAT_F16, AVX2, f16_to_f32_f16c),
+  RUN_KERNEL (FROM_F32, GST_HSPC_FORMAT_GRAY8, SSE2, f32_to_u8_sse2),
+  RUN_KERNEL (FROM_F32, FORMAT_U16_NATIVE, SSE2, f32_to_u16_sse2),
+  RUN_KERNEL (FROM_F32, FORMAT_U16_SWAPPED, SSE2, f32_to_u16_swap_sse2),
+  RUN_KERNEL (FROM_F32, GST_HSPC_FORMAT_F16, AVX2, f32_to_f16_f16c),
+  RUN_KERNEL (UNPACK, GST_HSPC_FORMAT_GRAY10P, SSSE3, unpack_10_ssse3),
+  RUN_KERNEL (UNPACK, GST_HSPC_FORMAT_GRAY12P, SSSE3, unpack_12_ssse3),
+  RUN_KERNEL (PACK, GST_HSPC_FORMAT_GRAY10P, SSSE3, pack_10_ssse3),
+  RUN_KERNEL (PACK, GST_HSPC_FORMAT_GRAY12P, SSSE3, pack_12_ssse3),
+  RUN_KERNEL (BASE64, GST_HSPC_FORMAT_GRAY8, SSSE3, base64_encode_ssse3),
+#endif
+};
+
+static SampleRuns runs;
+
+/* there is always a C kernel to fall back to */
+static GCallback
+lookup_run (GstHspecKernelOp op, GstHyperspectralFormat format)
+{
+  return gst_hspec_kernel_lookup (op, format, GST_HSPC_LAYOUT_UNKNOWN)->func;
+}
+
+static const SampleRuns *
+get_runs (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized)) {
+    gst_hspec_kernels_register (run_kernels, G_N_ELEMENTS (run_kernels));
+    runs.u8_to_f32 = (U8ToF32Func) lookup_run (GST_HSPEC_KERNEL_OP_TO_F32,
+        GST_HSPC_FORMAT_GRAY8);
+    runs.u16_to_f32 = (U16ToF32Func) lookup_run (GST_HSPEC_KERNEL_OP_TO_F32,
+        FORMAT_U16_NATIVE);
+    runs.u16_swap_to_f32 = (U16ToF32Func)
+        lookup_run (GST_HSPEC_KERNEL_OP_TO_F32, FORMAT_U16_SWAPPED);
+    runs.f16_to_f32 = (U16ToF32Func) lookup_run (GST_HSPEC_KERNEL_OP_TO_F32,
+        GST_HSPC_FORMAT_F16);
+    runs.f32_to_u8 = (F32ToU8Func) lookup_run (GST_HSPEC_KERNEL_OP_FROM_F32,
+        GST_HSPC_FORMAT_GRAY8);
+    runs.f32_to_u16 = (F32ToU16Func) lookup_run (GST_HSPEC_KERNEL_OP_FROM_F32,
+        FORMAT_U16_NATIVE);
+    runs.f32_to_u16_swap = (F32ToU16Func)
+        lookup_run (GST_HSPEC_KERNEL_OP_FROM_F32, FORMAT_U16_SWAPPED);
+    runs.f32_to_f16 = (F32ToU16Func) lookup_run (GST_HSPEC_KERNEL_OP_FROM_F32,
+        GST_HSPC_FORMAT_F16);
+    runs.unpack_10 = (UnpackFunc) lookup_run (GST_HSPEC_KERNEL_OP_UNPACK,
+        GST_HSPC_FORMAT_GRAY10P);
+    runs.unpack_12 = (UnpackFunc) lookup_run (GST_HSPEC_KERNEL_OP_UNPACK,
+        GST_HSPC_FORMAT_GRAY12P);
+    runs.pack_10 = (PackFunc) lookup_run (GST_HSPEC_KERNEL_OP_PACK,
+        GST_HSPC_FORMAT_GRAY10P);
+    runs.pack_12 = (PackFunc) lookup_run (GST_HSPEC_KERNEL_OP_PACK,
+        GST_HSPC_FORMAT_GRAY12P);
+    runs.base64_encode = (Base64Func) lookup_run (GST_HSPEC_KERNEL_OP_BASE64,
+        GST_HSPC_FORMAT_GRAY8);
+    g_once_init_leave (&initialized, 1);
+  }
+  return &runs;
+}
+
+void
+gst_hspec_kernel_u8_to_f32 (gfloat *dest, const guint8 *src,
+    gsize sstride, gsize n)
+{
+  gsize i;
+
+  if (sstride == 1) {
+    get_runs ()->u8_to_f32 (dest, src, n);
+    return;
+  }
+  for (i=0; i<n; i++)
+    dest[i] = src[i*sstride];
+}
+
+void
+gst_hspec_kernel_u16_to_f32 (gfloat *dest, const guint16 *src,
+    gsize sstride, gboolean swap, gsize n)
+{
+  gsize i;
+
+  if (sstride == 1) {
+    if (swap)
+      get_runs ()->u16_swap_to_f32 (dest, src, n);
+    else
+      get_runs ()->u16_to_f32 (dest, src, n);
+    return;
+  }
+  if (swap) {
+    for (i=0; i<n; i++)
+      dest[i] = GUINT16_SWAP_LE_BE (src[i*sstride]);
+  } else {
+    for (i=0; i<n; i++)
+      dest[i] = src[i*sstride];
+  }
+}
+
+void
+gst_hspec_kernel_f16_to_f32 (gfloat *dest, const guint16 *src,
+    gsize sstride, gsize n)
+{
+  gsize i;
+
+  if (sstride == 1) {
+    get_runs ()->f16_to_f32 (dest, src, n);
+    return;
+  }
+  for (i=0; i<n; i++)
+    dest[i] = gst_hspec_half_to_float (src[i*sstride]);
+}
+
+void
+gst_hspec_kernel_f32_to_f16 (guint16 *dest, gsize dstride,
+    const gfloat *src, gsize n)
+{
+  gsize i;
+
+  if (dstride == 1) {
+    get_runs ()->f32_to_f16 (dest, src, n);
+    return;
+  }
+  for (i=0; i<n; i++)
+    dest[i*dstride] = gst_hspec_float_to_half (src[i]);
+}
+
+void
+gst_hspec_kernel_unpack_10 (guint16 *dest, const guint8 *src, gsize n)
+{
+  get_runs ()->unpack_10 (dest, src, n);
+}
+
+void
+gst_hspec_kernel_unpack_12 (guint16 *dest, const guint8 *src, gsize n)
+{
+  get_runs ()->unpack_12 (dest, src, n);
+}
+
+void
+gst_hspec_kernel_pack_10 (guint8 *dest, const guint16 *src, gsize n)
+{
+  get_runs ()->pack_10 (dest, src, n);
+}
+
+void
+gst_hspec_kernel_pack_12 (guint8 *dest, const guint16 *src, gsize n)
+{
+  get_runs ()->pack_12 (dest, src, n);
+}
+
+void
+gst_hspec_kernel_f32_to_u8 (guint8 *dest, gsize dstride,
+    const gfloat *src, gsize n)
+{
+  gsize i;
+
+  if (dstride == 1) {
+    get_runs ()->f32_to_u8 (dest, src, n);
+    return;
+  }
+  for (i=0; i<n; i++)
+    dest[i*dstride] = round_clamp (src[i], G_MAXUINT8);
+}
+
+void
+gst_hspec_kernel_f32_to_u16 (guint16 *dest, gsize dstride,
+    const gfloat *src, gboolean swap, gsize n)
+{
+  gsize i;
+  guint16 v;
+
+  if (dstride == 1) {
+    if (swap)
+      get_runs ()->f32_to_u16_swap (dest, src, n);
+    else
+      get_runs ()->f32_to_u16 (dest, src, n);
+    return;
+  }
+  for (i=0; i<n; i++) {
+    v = round_clamp (src[i], G_MAXUINT16);
+    dest[i*dstride] = swap ? GUINT16_SWAP_LE_BE (v) : v;
+  }
+}
+
+gsize
+gst_hspec_kernel_base64_encode (gchar *dest, const guint8 *src, gsize n)
+{
+  return get_runs ()->base64_encode (dest, src, n);
+}
@@ -0,0 +1,93 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Sample kernels shared by the hyperspectral elements.
+ *
+ * All kernels work on runs of n samples. Strides are given in samples,
+ * not bytes, so a stride of 1 means a contiguous run (multiplane band
+ * rows) and a stride equal to the number of wavelengths walks a single
+ * band of an interleaved cube. Contiguous runs take SIMD paths picked for
+ * the CPU through the kernel registry (hyperspectral-dispatch.h), the
+ * portable ones are Orc programs (hyperspectral-orc.orc) with a C backup
+ * when Orc is not available.
+ */
+
+#ifndef __HYPERSPECTRAL_KERNELS_H__
+#define __HYPERSPECTRAL_KERNELS_H__
+
+#include <gst/gst.h>
+
+/* plain copies, used for layout only conversions */
+void gst_hspec_kernel_copy_u8       (guint8 *dest, gsize dstride,
+                                     const guint8 *src, gsize sstride, gsize n);
+void gst_hspec_kernel_copy_u16      (guint16 *dest, gsize dstride,
+                                     const guint16 *src, gsize sstride, gsize n);
+void gst_hspec_kernel_copy_f32      (gfloat *dest, gsize dstride,
+                                     const gfloat *src, gsize sstride, gsize n);
+
+/* rows of row_size bytes, strides in bytes, e.g. a band of a multiplane
+ * cube */
+void gst_hspec_kernel_copy_2d       (guint8 *dest, gsize dstride,
+                                     const guint8 *src, gsize sstride,
+                                     gsize row_size, gsize rows);
+
+/* copies with the byte order of each 16 bit sample reversed */
+void gst_hspec_kernel_swap_u16      (guint16 *dest, gsize dstride,
+                                     const guint16 *src, gsize sstride, gsize n);
+
+/* integer to float, dest is always contiguous */
+void gst_hspec_kernel_u8_to_f32     (gfloat *dest, const guint8 *src,
+                                     gsize sstride, gsize n);
+void gst_hspec_kernel_u16_to_f32    (gfloat *dest, const guint16 *src,
+                                     gsize sstride, gboolean swap, gsize n);
+
+/* IEEE half precision, single samples */
+gfloat  gst_hspec_half_to_float     (guint16 h);
+guint16 gst_hspec_float_to_half     (gfloat f);
+
+/* half precision runs, rounding to nearest even when narrowing */
+void gst_hspec_kernel_f16_to_f32    (gfloat *dest, const guint16 *src,
+                                     gsize sstride, gsize n);
+void gst_hspec_kernel_f32_to_f16    (guint16 *dest, gsize dstride,
+                                     const gfloat *src, gsize n);
+
+/* packed 10 and 12 bit runs to and from native 16 bit samples, the packed
+ * side is contiguous and starts on a whole group of samples, a trailing
+ * partial group is zero padded when packing, values above the range
+ * saturate */
+void gst_hspec_kernel_unpack_10     (guint16 *dest, const guint8 *src, gsize n);
+void gst_hspec_kernel_unpack_12     (guint16 *dest, const guint8 *src, gsize n);
+void gst_hspec_kernel_pack_10       (guint8 *dest, const guint16 *src, gsize n);
+void gst_hspec_kernel_pack_12       (guint8 *dest, const guint16 *src, gsize n);
+
+/* data[i] = data[i] * mul + add */
+void gst_hspec_kernel_scale_f32     (gfloat *data, gfloat mul, gfloat add, gsize n);
+
+/* float to integer with rounding and saturation, src is always contiguous */
+void gst_hspec_kernel_f32_to_u8     (guint8 *dest, gsize dstride,
+                                     const gfloat *src, gsize n);
+void gst_hspec_kernel_f32_to_u16    (guint16 *dest, gsize dstride,
+                                     const gfloat *src, gboolean swap, gsize n);
+
+/* base64 with padding (RFC 4648) of n bytes, returns the number of
+ * characters written to dest, 4 for every started 3 bytes */
+gsize gst_hspec_kernel_base64_encode (gchar *dest, const guint8 *src, gsize n);
+
+#endif
@@ -0,0 +1,219 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include "hyperspectral-meta.h"
+
+GType
+gst_hyperspectral_meta_api_get_type (void)
+{
+  static volatile GType type = 0;
+  static const gchar *tags[] = { GST_META_TAG_MEMORY_STR, "hyperspectral",
+    NULL };
+
+  if (g_once_init_enter (&type)) {
+    GType _type = gst_meta_api_type_register ("GstHyperspectralMetaAPI", tags);
+    g_once_init_leave (&type, _type);
+  }
+  return type;
+}
+
+static gboolean
+hyperspectral_meta_init (GstMeta *meta, gpointer params, GstBuffer *buffer)
+{
+  GstHyperspectralMeta *hmeta = (GstHyperspectralMeta *) meta;
+
+  hmeta->buffer = NULL;
+  hmeta->format = GST_HSPC_FORMAT_UNKNOWN;
+  hmeta->layout = GST_HSPC_LAYOUT_UNKNOWN;
+  hmeta->width = hmeta->height = hmeta->wavelengths = 0;
+  hmeta->n_planes = 0;
+  hmeta->offset = NULL;
+  hmeta->stride = NULL;
+  hmeta->n_wavelength_ids = 0;
+  hmeta->wavelength_ids = NULL;
+  hmeta->exposure = GST_CLOCK_TIME_NONE;
+  hmeta->flags = GST_HYPERSPECTRAL_META_FLAG_NONE;
+
+  return TRUE;
+}
+
+static void
+hyperspectral_meta_free (GstMeta *meta, GstBuffer *buffer)
+{
+  GstHyperspectralMeta *hmeta = (GstHyperspectralMeta *) meta;
+
+  /* offset, stride and wavelength_ids share one allocation */
+  g_free (hmeta->offset);
+  hmeta->offset = NULL;
+  hmeta->stride = NULL;
+  hmeta->wavelength_ids = NULL;
+}
+
+/* allocates the plane and wavelength arrays of meta in a single block */
+static void
+hyperspectral_meta_alloc_arrays (GstHyperspectralMeta *meta, guint n_planes,
+    gint n_wavelength_ids)
+{
+  gsize size;
+
+  size = n_planes * sizeof (gsize) + n_planes * sizeof (gint)
+      + n_wavelength_ids * sizeof (gint);
+
+  meta->n_planes = n_planes;
+  meta->n_wavelength_ids = n_wavelength_ids;
+  meta->offset = g_malloc0 (size);
+  meta->stride = (gint *) (meta->offset + n_planes);
+  meta->wavelength_ids = meta->stride + n_planes;
+}
+
+/* number of bytes plane i of meta spans inside the buffer */
+static gsize
+hyperspectral_meta_plane_size (GstHyperspectralMeta *meta, guint i)
+{
+  gsize elems;
+
+  elems = (gsize) meta->width * meta->height;
+  if (meta->layout != GST_HSPC_LAYOUT_MULTIPLANE)
+    elems *= meta->wavelengths;
+  if (meta->stride[i] == 0)
+    return gst_hspec_format_get_size (meta->format, elems);
+
+  /* the last row does not need to be padded */
+  return (gsize) meta->stride[i] * (meta->height - 1) +
+      gst_hspec_format_get_size (meta->format, elems / meta->height);
+}
+
+static gboolean
+hyperspectral_meta_transform (GstBuffer *dest, GstMeta *meta,
+    GstBuffer *buffer, GQuark type, gpointer data)
+{
+  GstHyperspectralMeta *smeta = (GstHyperspectralMeta *) meta;
+  GstHyperspectralMeta *dmeta;
+  GstMetaTransformCopy *copy;
+  gsize shift = 0;
+  guint i;
+
+  if (!GST_META_TRANSFORM_IS_COPY (type))
+    return FALSE;
+
+  copy = data;
+  if (copy->region) {
+    /* only keep the meta if every plane is inside the copied region */
+    for (i=0; i<smeta->n_planes; i++) {
+      if (smeta->offset[i] < copy->offset ||
+          smeta->offset[i] + hyperspectral_meta_plane_size (smeta, i) >
+          copy->offset + copy->size) {
+        GST_DEBUG ("plane %u outside of copied region, dropping meta", i);
+        return TRUE;
+      }
+    }
+    shift = copy->offset;
+  }
+
+  dmeta = (GstHyperspectralMeta *) gst_buffer_add_meta (dest,
+      GST_HYPERSPECTRAL_META_INFO, NULL);
+  if (!dmeta)
+    return FALSE;
+
+  dmeta->buffer = dest;
+  dmeta->format = smeta->format;
+  dmeta->layout = smeta->layout;
+  dmeta->width = smeta->width;
+  dmeta->height = smeta->height;
+  dmeta->wavelengths = smeta->wavelengths;
+  dmeta->exposure = smeta->exposure;
+  dmeta->flags = smeta->flags;
+
+  hyperspectral_meta_alloc_arrays (dmeta, smeta->n_planes,
+      smeta->n_wavelength_ids);
+  for (i=0; i<smeta->n_planes; i++) {
+    dmeta->offset[i] = smeta->offset[i] - shift;
+    dmeta->stride[i] = smeta->stride[i];
+  }
+  if (smeta->n_wavelength_ids)
+    memcpy (dmeta->wavelength_ids, smeta->wavelength_ids,
+        smeta->n_wavelength_ids * sizeof (gint));
+
+  return TRUE;
+}
+
+const GstMetaInfo *
+gst_hyperspectral_meta_get_info (void)
+{
+  static const GstMetaInfo *hyperspectral_meta_info = NULL;
+
+  if (g_once_init_enter ((GstMetaInfo **) & hyperspectral_meta_info)) {
+    const GstMetaInfo *meta =
+        gst_meta_register (GST_HYPERSPECTRAL_META_API_TYPE,
+        "GstHyperspectralMeta", sizeof (GstHyperspectralMeta),
+        hyperspectral_meta_init, hyperspectral_meta_free,
+        hyperspectral_meta_transform);
+    g_once_init_leave ((GstMetaInfo **) & hyperspectral_meta_info,
+        (GstMetaInfo *) meta);
+  }
+  return hyperspectral_meta_info;
+}
+
+/* attaches a meta describing the planes of info */
+GstHyperspectralMeta *
+gst_buffer_add_hyperspectral_meta (GstBuffer *buffer,
+    const GstHyperspectralInfo *info)
+{
+  return gst_buffer_add_hyperspectral_meta_full (buffer, info, info->offset,
+      info->stride);
+}
+
+/* attaches a meta for info to buffer, offset and stride hold one entry per
+ * plane of info */
+GstHyperspectralMeta *
+gst_buffer_add_hyperspectral_meta_full (GstBuffer *buffer,
+    const GstHyperspectralInfo *info, const gsize *offset, const gint *stride)
+{
+  GstHyperspectralMeta *meta;
+  guint i;
+
+  g_return_val_if_fail (GST_IS_BUFFER (buffer), NULL);
+  g_return_val_if_fail (info != NULL, NULL);
+  g_return_val_if_fail (offset != NULL, NULL);
+  g_return_val_if_fail (stride != NULL, NULL);
+
+  meta = (GstHyperspectralMeta *) gst_buffer_add_meta (buffer,
+      GST_HYPERSPECTRAL_META_INFO, NULL);
+  if (!meta)
+    return NULL;
+
+  meta->buffer = buffer;
+  meta->format = info->format;
+  meta->layout = info->layout;
+  meta->width = info->width;
+  meta->height = info->height;
+  meta->wavelengths = info->wavelengths;
+
+  hyperspectral_meta_alloc_arrays (meta, info->n_planes, info->mosaic.size);
+  for (i=0; i<info->n_planes; i++) {
+    meta->offset[i] = offset[i];
+    meta->stride[i] = stride[i];
+  }
+  if (info->mosaic.size)
+    memcpy (meta->wavelength_ids, info->mosaic.spectras,
+        info->mosaic.size * sizeof (gint));
+
+  return meta;
+}
@@ -0,0 +1,89 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Buffer metadata describing the hyperspectral cube stored in a buffer.
+ *
+ * Carries the cube geometry, the position of every plane inside the buffer,
+ * the wavelength table and per frame information (exposure, calibration
+ * state) that can not be expressed in caps.
+ */
+
+#ifndef __HYPERSPECTRAL_META_H__
+#define __HYPERSPECTRAL_META_H__
+
+#include <gst/gst.h>
+#include <gst/hyperspectral/hyperspectral-info.h>
+
+#define GST_HYPERSPECTRAL_META_API_TYPE (gst_hyperspectral_meta_api_get_type())
+#define GST_HYPERSPECTRAL_META_INFO (gst_hyperspectral_meta_get_info())
+
+typedef struct _GstHyperspectralMeta GstHyperspectralMeta;
+
+typedef enum {
+  GST_HYPERSPECTRAL_META_FLAG_NONE            = 0,
+  GST_HYPERSPECTRAL_META_FLAG_DARK_CORRECTED  = (1 << 0),
+  GST_HYPERSPECTRAL_META_FLAG_WHITE_CORRECTED = (1 << 1),
+  GST_HYPERSPECTRAL_META_FLAG_REFLECTANCE     = (1 << 2)
+} GstHyperspectralMetaFlags;
+
+/*
+ * n_planes is the number of wavelengths for multiplane cubes and 1 for
+ * interleaved cubes. offset is in bytes from the start of the buffer, stride
+ * is the size of a row in bytes (0 for packed formats, whose rows are not
+ * byte aligned). wavelength_ids holds n_wavelength_ids entries owned by the
+ * meta.
+ */
+struct _GstHyperspectralMeta {
+  GstMeta meta;
+
+  GstBuffer *buffer;
+
+  GstHyperspectralFormat format;
+  GstHyperspectralLayout layout;
+  gint width;
+  gint height;
+  gint wavelengths;
+
+  guint n_planes;
+  gsize *offset;
+  gint *stride;
+
+  gint n_wavelength_ids;
+  gint *wavelength_ids;
+
+  GstClockTime exposure;
+  GstHyperspectralMetaFlags flags;
+};
+
+GType gst_hyperspectral_meta_api_get_type (void);
+const GstMetaInfo * gst_hyperspectral_meta_get_info (void);
+
+#define gst_buffer_get_hyperspectral_meta(b) \
+  ((GstHyperspectralMeta*)gst_buffer_get_meta((b),GST_HYPERSPECTRAL_META_API_TYPE))
+
+GstHyperspectralMeta * gst_buffer_add_hyperspectral_meta (GstBuffer *buffer,
+                                                const GstHyperspectralInfo *info);
+
+GstHyperspectralMeta * gst_buffer_add_hyperspectral_meta_full (GstBuffer *buffer,
+                                                const GstHyperspectralInfo *info,
+                                                const gsize *offset,
+                                                const gint *stride);
+
+#endif
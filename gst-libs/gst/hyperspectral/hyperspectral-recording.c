@@ -0,0 +1,418 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <glib/gstdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "hyperspectral-recording.h"
+
+#define HEADER_MAGIC "HSPECREC"
+#define RECORD_MAGIC "HSPECFRM"
+#define FOOTER_MAGIC "HSPECIDX"
+#define MAGIC_LEN 8
+
+/* the header up to the caps string */
+#define HEADER_FIXED_SIZE 40
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) / (a) * (a))
+
+struct _GstHspecRecording
+{
+  gchar *path;
+  gint fd;
+  GstCaps *caps;
+  GstHyperspectralInfo info;
+  guint64 header_size;
+  guint64 stride;
+  GstHspecRecordingEntry *entries;
+  guint64 n_frames;
+};
+
+/* writing */
+
+/* distance between the records of two frames holding cubes of cube_size */
+guint64
+gst_hspec_recording_frame_stride (gsize cube_size)
+{
+  return ALIGN_UP (GST_HSPEC_RECORDING_RECORD_SIZE + (guint64) cube_size,
+      GST_HSPEC_RECORDING_RECORD_SIZE);
+}
+
+/* returns the header of a recording of caps in size bytes, free it with
+ * g_free() */
+guint8 *
+gst_hspec_recording_header_new (const GstCaps *caps, gsize cube_size,
+    gsize *size)
+{
+  gchar *str;
+  guint8 *header;
+  gsize caps_len;
+
+  g_return_val_if_fail (caps != NULL, NULL);
+  g_return_val_if_fail (size != NULL, NULL);
+
+  str = gst_caps_to_string (caps);
+  caps_len = strlen (str) + 1;
+  *size = ALIGN_UP (HEADER_FIXED_SIZE + caps_len,
+      GST_HSPEC_RECORDING_HEADER_ALIGN);
+
+  header = g_malloc0 (*size);
+  memcpy (header, HEADER_MAGIC, MAGIC_LEN);
+  GST_WRITE_UINT32_LE (header + 8, GST_HSPEC_RECORDING_VERSION);
+  GST_WRITE_UINT32_LE (header + 12, *size);
+  GST_WRITE_UINT64_LE (header + 16, cube_size);
+  GST_WRITE_UINT64_LE (header + 24, gst_hspec_recording_frame_stride (cube_size));
+  GST_WRITE_UINT32_LE (header + 32, caps_len);
+  memcpy (header + HEADER_FIXED_SIZE, str, caps_len);
+  g_free (str);
+
+  return header;
+}
+
+/* fills the GST_HSPEC_RECORDING_RECORD_SIZE bytes at record written in
+ * front of the cube of entry */
+void
+gst_hspec_recording_fill_record (guint8 *record,
+    const GstHspecRecordingEntry *entry)
+{
+  g_return_if_fail (record != NULL);
+  g_return_if_fail (entry != NULL);
+
+  memset (record, 0, GST_HSPEC_RECORDING_RECORD_SIZE);
+  memcpy (record, RECORD_MAGIC, MAGIC_LEN);
+  GST_WRITE_UINT64_LE (record + 8, entry->number);
+  GST_WRITE_UINT64_LE (record + 16, entry->pts);
+  GST_WRITE_UINT64_LE (record + 24, entry->duration);
+}
+
+/* returns the index and footer closing a recording whose last frame ends at
+ * index_offset in size bytes, free it with g_free() */
+guint8 *
+gst_hspec_recording_index_new (const GstHspecRecordingEntry *entries,
+    guint64 n_entries, guint64 index_offset, gsize *size)
+{
+  guint8 *index, *p;
+  guint64 i;
+
+  g_return_val_if_fail (entries != NULL || n_entries == 0, NULL);
+  g_return_val_if_fail (size != NULL, NULL);
+
+  *size = n_entries * GST_HSPEC_RECORDING_ENTRY_SIZE +
+      GST_HSPEC_RECORDING_FOOTER_SIZE;
+  p = index = g_malloc0 (*size);
+
+  for (i=0; i<n_entries; i++) {
+    GST_WRITE_UINT64_LE (p, entries[i].offset);
+    GST_WRITE_UINT64_LE (p + 8, entries[i].pts);
+    GST_WRITE_UINT64_LE (p + 16, entries[i].duration);
+    GST_WRITE_UINT64_LE (p + 24, entries[i].number);
+    p += GST_HSPEC_RECORDING_ENTRY_SIZE;
+  }
+
+  memcpy (p, FOOTER_MAGIC, MAGIC_LEN);
+  GST_WRITE_UINT64_LE (p + 8, index_offset);
+  GST_WRITE_UINT64_LE (p + 16, n_entries);
+  GST_WRITE_UINT32_LE (p + 24, GST_HSPEC_RECORDING_VERSION);
+
+  return index;
+}
+
+/* reading */
+
+static gboolean
+read_at (gint fd, gpointer dest, gsize size, guint64 offset)
+{
+  guint8 *p = dest;
+  gssize res;
+
+  while (size) {
+    res = pread (fd, p, size, offset);
+    if (res < 0 && errno == EINTR)
+      continue;
+    if (res <= 0) {
+      if (res == 0)
+        errno = EIO;
+      return FALSE;
+    }
+    p += res;
+    size -= res;
+    offset += res;
+  }
+  return TRUE;
+}
+
+static gboolean
+read_header (GstHspecRecording *rec, guint64 file_size)
+{
+  guint8 fixed[HEADER_FIXED_SIZE];
+  guint32 version, caps_len;
+  guint64 cube_size;
+  gchar *str;
+
+  if (!read_at (rec->fd, fixed, HEADER_FIXED_SIZE, 0) ||
+      memcmp (fixed, HEADER_MAGIC, MAGIC_LEN) != 0) {
+    GST_ERROR ("%s is not a hyperspectral recording", rec->path);
+    return FALSE;
+  }
+
+  version = GST_READ_UINT32_LE (fixed + 8);
+  if (version > GST_HSPEC_RECORDING_VERSION) {
+    GST_ERROR ("%s is a version %u recording, only up to %u is supported",
+        rec->path, version, GST_HSPEC_RECORDING_VERSION);
+    return FALSE;
+  }
+
+  rec->header_size = GST_READ_UINT32_LE (fixed + 12);
+  cube_size = GST_READ_UINT64_LE (fixed + 16);
+  rec->stride = GST_READ_UINT64_LE (fixed + 24);
+  caps_len = GST_READ_UINT32_LE (fixed + 32);
+  if (caps_len == 0 || HEADER_FIXED_SIZE + caps_len > rec->header_size ||
+      rec->header_size > file_size ||
+      rec->stride != gst_hspec_recording_frame_stride (cube_size)) {
+    GST_ERROR ("%s has a broken header", rec->path);
+    return FALSE;
+  }
+
+  str = g_malloc (caps_len);
+  if (!read_at (rec->fd, str, caps_len, HEADER_FIXED_SIZE)) {
+    g_free (str);
+    return FALSE;
+  }
+  str[caps_len - 1] = '\0';
+  rec->caps = gst_caps_from_string (str);
+  g_free (str);
+
+  if (!rec->caps || !gst_caps_is_fixed (rec->caps) ||
+      !gst_hyperspectral_info_from_caps (&rec->info, rec->caps) ||
+      rec->info.cube_size != cube_size) {
+    GST_ERROR ("%s has invalid caps %" GST_PTR_FORMAT, rec->path, rec->caps);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+read_index (GstHspecRecording *rec, guint64 file_size)
+{
+  guint8 footer[GST_HSPEC_RECORDING_FOOTER_SIZE], *index, *p;
+  guint64 i, index_offset, n_frames;
+
+  if (file_size < rec->header_size + GST_HSPEC_RECORDING_FOOTER_SIZE ||
+      !read_at (rec->fd, footer, GST_HSPEC_RECORDING_FOOTER_SIZE,
+          file_size - GST_HSPEC_RECORDING_FOOTER_SIZE) ||
+      memcmp (footer, FOOTER_MAGIC, MAGIC_LEN) != 0)
+    return FALSE;
+
+  index_offset = GST_READ_UINT64_LE (footer + 8);
+  n_frames = GST_READ_UINT64_LE (footer + 16);
+  if (index_offset < rec->header_size || index_offset > file_size ||
+      n_frames > (file_size - index_offset) / GST_HSPEC_RECORDING_ENTRY_SIZE ||
+      index_offset + n_frames * GST_HSPEC_RECORDING_ENTRY_SIZE +
+      GST_HSPEC_RECORDING_FOOTER_SIZE != file_size)
+    return FALSE;
+
+  index = g_malloc (n_frames * GST_HSPEC_RECORDING_ENTRY_SIZE);
+  if (!read_at (rec->fd, index, n_frames * GST_HSPEC_RECORDING_ENTRY_SIZE,
+      index_offset)) {
+    g_free (index);
+    return FALSE;
+  }
+
+  rec->entries = g_new (GstHspecRecordingEntry, n_frames);
+  for (i=0, p=index; i<n_frames; i++, p+=GST_HSPEC_RECORDING_ENTRY_SIZE) {
+    rec->entries[i].offset = GST_READ_UINT64_LE (p);
+    rec->entries[i].pts = GST_READ_UINT64_LE (p + 8);
+    rec->entries[i].duration = GST_READ_UINT64_LE (p + 16);
+    rec->entries[i].number = GST_READ_UINT64_LE (p + 24);
+    if (rec->entries[i].offset + rec->info.cube_size > index_offset)
+      break;
+  }
+  g_free (index);
+
+  if (i < n_frames) {
+    g_free (rec->entries);
+    rec->entries = NULL;
+    return FALSE;
+  }
+  rec->n_frames = n_frames;
+  return TRUE;
+}
+
+/* without an index the frames are found from their records, up to the
+ * first missing or incomplete one */
+static void
+recover_index (GstHspecRecording *rec, guint64 file_size)
+{
+  guint8 record[GST_HSPEC_RECORDING_RECORD_SIZE];
+  guint64 i, n, offset;
+
+  n = (file_size - rec->header_size) / rec->stride;
+  rec->entries = g_new (GstHspecRecordingEntry, n);
+
+  for (i=0; i<n; i++) {
+    offset = rec->header_size + i * rec->stride;
+    if (!read_at (rec->fd, record, GST_HSPEC_RECORDING_RECORD_SIZE, offset) ||
+        memcmp (record, RECORD_MAGIC, MAGIC_LEN) != 0)
+      break;
+    rec->entries[i].offset = offset + GST_HSPEC_RECORDING_RECORD_SIZE;
+    rec->entries[i].number = GST_READ_UINT64_LE (record + 8);
+    rec->entries[i].pts = GST_READ_UINT64_LE (record + 16);
+    rec->entries[i].duration = GST_READ_UINT64_LE (record + 24);
+  }
+  rec->n_frames = i;
+
+  GST_WARNING ("%s has no index, recovered %" G_GUINT64_FORMAT " frames",
+      rec->path, rec->n_frames);
+}
+
+/* returns NULL when path is not a readable recording */
+GstHspecRecording *
+gst_hspec_recording_open (const gchar *path)
+{
+  GstHspecRecording *rec;
+  struct stat st;
+
+  g_return_val_if_fail (path != NULL, NULL);
+
+  rec = g_new0 (GstHspecRecording, 1);
+  rec->path = g_strdup (path);
+  gst_hyperspectral_info_init (&rec->info);
+
+  if ((rec->fd = g_open (path, O_RDONLY, 0)) < 0 || fstat (rec->fd, &st) < 0) {
+    GST_ERROR ("Could not open %s: %s", path, g_strerror (errno));
+    goto error;
+  }
+
+  if (!read_header (rec, st.st_size))
+    goto error;
+
+  if (!read_index (rec, st.st_size))
+    recover_index (rec, st.st_size);
+
+  GST_DEBUG ("opened %s with %" G_GUINT64_FORMAT " frames", path,
+      rec->n_frames);
+  return rec;
+
+error:
+  gst_hspec_recording_free (rec);
+  return NULL;
+}
+
+void
+gst_hspec_recording_free (GstHspecRecording *rec)
+{
+  g_return_if_fail (rec != NULL);
+
+  if (rec->fd >= 0)
+    close (rec->fd);
+  if (rec->caps)
+    gst_caps_unref (rec->caps);
+  gst_hyperspectral_info_clear (&rec->info);
+  g_free (rec->entries);
+  g_free (rec->path);
+  g_free (rec);
+}
+
+/* returns a new reference to the caps of the cubes */
+GstCaps *
+gst_hspec_recording_get_caps (GstHspecRecording *rec)
+{
+  g_return_val_if_fail (rec != NULL, NULL);
+
+  return gst_caps_ref (rec->caps);
+}
+
+const GstHyperspectralInfo *
+gst_hspec_recording_get_info (GstHspecRecording *rec)
+{
+  g_return_val_if_fail (rec != NULL, NULL);
+
+  return &rec->info;
+}
+
+guint64
+gst_hspec_recording_get_n_frames (GstHspecRecording *rec)
+{
+  g_return_val_if_fail (rec != NULL, 0);
+
+  return rec->n_frames;
+}
+
+gboolean
+gst_hspec_recording_get_entry (GstHspecRecording *rec, guint64 n,
+    GstHspecRecordingEntry *entry)
+{
+  g_return_val_if_fail (rec != NULL, FALSE);
+  g_return_val_if_fail (entry != NULL, FALSE);
+
+  if (n >= rec->n_frames)
+    return FALSE;
+
+  *entry = rec->entries[n];
+  return TRUE;
+}
+
+/* returns the last frame starting at or before pts, the first one when they
+ * all start later. Frames without a timestamp are never found */
+guint64
+gst_hspec_recording_find_frame (GstHspecRecording *rec, GstClockTime pts)
+{
+  guint64 lo = 0, hi, mid;
+
+  g_return_val_if_fail (rec != NULL, 0);
+
+  /* the first frame after pts is in [lo, hi] */
+  hi = rec->n_frames;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (GST_CLOCK_TIME_IS_VALID (rec->entries[mid].pts) &&
+        rec->entries[mid].pts <= pts)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo ? lo - 1 : 0;
+}
+
+/* copies the cube of frame n to dest, which holds the cube size of the info.
+ * Any number of threads can read at the same time */
+gboolean
+gst_hspec_recording_read_frame (GstHspecRecording *rec, guint64 n,
+    gpointer dest)
+{
+  g_return_val_if_fail (rec != NULL, FALSE);
+  g_return_val_if_fail (dest != NULL, FALSE);
+
+  if (n >= rec->n_frames) {
+    GST_ERROR ("%s has no frame %" G_GUINT64_FORMAT, rec->path, n);
+    return FALSE;
+  }
+
+  if (!read_at (rec->fd, dest, rec->info.cube_size, rec->entries[n].offset)) {
+    GST_ERROR ("Could not read frame %" G_GUINT64_FORMAT " of %s: %s", n,
+        rec->path, g_strerror (errno));
+    return FALSE;
+  }
+  return TRUE;
+}
@@ -0,0 +1,106 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * RAW recordings of hyperspectral cubes.
+ *
+ * All numbers are little endian, the layout of version 1 is
+ *
+ *   header   "HSPECREC", version (u32), header size (u32), cube size (u64),
+ *            frame stride (u64), caps length (u32), reserved (u32) and the
+ *            caps of the cubes as a string, zero padded to header size
+ *   frames   one every frame stride bytes from header size on: a record of
+ *            "HSPECFRM", number, pts, duration (u64 each) padded to
+ *            GST_HSPEC_RECORDING_RECORD_SIZE, the cube and zero padding
+ *   index    an entry of cube offset, pts, duration and number (u64 each)
+ *            per frame
+ *   footer   "HSPECIDX", index offset (u64), number of frames (u64),
+ *            version (u32), reserved (u32)
+ *
+ * The file is only appended to, a recording that was cut short has no index
+ * and footer and its frames are found from their records.
+ */
+
+#ifndef __HYPERSPECTRAL_RECORDING_H__
+#define __HYPERSPECTRAL_RECORDING_H__
+
+#include <gst/gst.h>
+#include "hyperspectral-info.h"
+
+G_BEGIN_DECLS
+
+#define GST_HSPEC_RECORDING_VERSION 1
+
+/* the header is padded to a multiple of this, the frame records and cubes
+ * to a multiple of GST_HSPEC_RECORDING_RECORD_SIZE */
+#define GST_HSPEC_RECORDING_HEADER_ALIGN 4096
+#define GST_HSPEC_RECORDING_RECORD_SIZE 64
+#define GST_HSPEC_RECORDING_ENTRY_SIZE 32
+#define GST_HSPEC_RECORDING_FOOTER_SIZE 32
+
+typedef struct {
+  /* of the cube from the start of the file */
+  guint64 offset;
+  GstClockTime pts;
+  GstClockTime duration;
+  guint64 number;
+} GstHspecRecordingEntry;
+
+typedef struct _GstHspecRecording GstHspecRecording;
+
+/* writing */
+
+guint64     gst_hspec_recording_frame_stride  (gsize cube_size);
+
+guint8 *    gst_hspec_recording_header_new    (const GstCaps *caps,
+                                               gsize cube_size, gsize *size);
+
+void        gst_hspec_recording_fill_record   (guint8 *record,
+                                               const GstHspecRecordingEntry *entry);
+
+guint8 *    gst_hspec_recording_index_new     (const GstHspecRecordingEntry *entries,
+                                               guint64 n_entries,
+                                               guint64 index_offset, gsize *size);
+
+/* reading */
+
+GstHspecRecording *
+            gst_hspec_recording_open          (const gchar *path);
+
+void        gst_hspec_recording_free          (GstHspecRecording *rec);
+
+GstCaps *   gst_hspec_recording_get_caps      (GstHspecRecording *rec);
+
+const GstHyperspectralInfo *
+            gst_hspec_recording_get_info      (GstHspecRecording *rec);
+
+guint64     gst_hspec_recording_get_n_frames  (GstHspecRecording *rec);
+
+gboolean    gst_hspec_recording_get_entry     (GstHspecRecording *rec, guint64 n,
+                                               GstHspecRecordingEntry *entry);
+
+guint64     gst_hspec_recording_find_frame    (GstHspecRecording *rec,
+                                               GstClockTime pts);
+
+gboolean    gst_hspec_recording_read_frame    (GstHspecRecording *rec, guint64 n,
+                                               gpointer dest);
+
+G_END_DECLS
+
+#endif
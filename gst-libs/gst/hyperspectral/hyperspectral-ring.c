@@ -0,0 +1,136 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "hyperspectral-ring.h"
+
+typedef struct {
+  /* equals the position of the next push when the slot is free and that
+   * position + 1 once it holds data */
+  volatile gint seq;
+  gpointer data;
+} Slot;
+
+struct _GstHspecRing
+{
+  guint mask;
+  Slot *slots;
+  /* positions only grow, the difference to a slot sequence is compared
+   * signed so wrapping around is harmless */
+  volatile gint head;
+  volatile gint tail;
+};
+
+/* capacity is rounded up to a power of two */
+GstHspecRing *
+gst_hspec_ring_new (guint capacity)
+{
+  GstHspecRing *ring;
+  guint i, size = 1;
+
+  g_return_val_if_fail (capacity > 0 && capacity <= G_MAXINT / 2, NULL);
+
+  while (size < capacity)
+    size <<= 1;
+
+  ring = g_new0 (GstHspecRing, 1);
+  ring->mask = size - 1;
+  ring->slots = g_new0 (Slot, size);
+  for (i=0; i<size; i++)
+    ring->slots[i].seq = i;
+
+  return ring;
+}
+
+void
+gst_hspec_ring_free (GstHspecRing *ring)
+{
+  g_return_if_fail (ring != NULL);
+
+  g_free (ring->slots);
+  g_free (ring);
+}
+
+guint
+gst_hspec_ring_get_capacity (GstHspecRing *ring)
+{
+  g_return_val_if_fail (ring != NULL, 0);
+
+  return ring->mask + 1;
+}
+
+/* returns FALSE when the ring is full */
+gboolean
+gst_hspec_ring_push (GstHspecRing *ring, gpointer data)
+{
+  Slot *slot;
+  gint pos, diff;
+
+  g_return_val_if_fail (ring != NULL, FALSE);
+
+  pos = g_atomic_int_get (&ring->tail);
+  for (;;) {
+    slot = &ring->slots[pos & ring->mask];
+    diff = (gint) ((guint) g_atomic_int_get (&slot->seq) - (guint) pos);
+    if (diff == 0) {
+      if (g_atomic_int_compare_and_exchange (&ring->tail, pos,
+              (gint) ((guint) pos + 1)))
+        break;
+    } else if (diff < 0) {
+      return FALSE;
+    }
+    pos = g_atomic_int_get (&ring->tail);
+  }
+
+  slot->data = data;
+  /* publishes data to the popping side */
+  g_atomic_int_set (&slot->seq, (gint) ((guint) pos + 1));
+
+  return TRUE;
+}
+
+/* returns NULL when the ring is empty */
+gpointer
+gst_hspec_ring_pop (GstHspecRing *ring)
+{
+  Slot *slot;
+  gpointer data;
+  gint pos, diff;
+
+  g_return_val_if_fail (ring != NULL, NULL);
+
+  pos = g_atomic_int_get (&ring->head);
+  for (;;) {
+    slot = &ring->slots[pos & ring->mask];
+    diff = (gint) ((guint) g_atomic_int_get (&slot->seq) - (guint) pos - 1);
+    if (diff == 0) {
+      if (g_atomic_int_compare_and_exchange (&ring->head, pos,
+              (gint) ((guint) pos + 1)))
+        break;
+    } else if (diff < 0) {
+      return NULL;
+    }
+    pos = g_atomic_int_get (&ring->head);
+  }
+
+  data = slot->data;
+  /* hands the slot back to the push one lap ahead */
+  g_atomic_int_set (&slot->seq, (gint) ((guint) pos + ring->mask + 1));
+
+  return data;
+}
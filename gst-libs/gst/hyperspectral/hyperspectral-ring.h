@@ -0,0 +1,51 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Bounded lock-free queue of pointers.
+ *
+ * Any number of threads can push and pop at the same time, every slot
+ * carries a sequence number telling whether it is free for the next push or
+ * filled for the next pop. Neither call blocks, a full ring refuses pushes
+ * and an empty one returns NULL, waiting for space or data is left to the
+ * caller.
+ */
+
+#ifndef __HYPERSPECTRAL_RING_H__
+#define __HYPERSPECTRAL_RING_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GstHspecRing GstHspecRing;
+
+GstHspecRing * gst_hspec_ring_new          (guint capacity);
+
+void           gst_hspec_ring_free         (GstHspecRing *ring);
+
+guint          gst_hspec_ring_get_capacity (GstHspecRing *ring);
+
+gboolean       gst_hspec_ring_push         (GstHspecRing *ring, gpointer data);
+
+gpointer       gst_hspec_ring_pop          (GstHspecRing *ring);
+
+G_END_DECLS
+
+#endif
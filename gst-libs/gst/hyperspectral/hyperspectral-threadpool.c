@@ -0,0 +1,263 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <gst/gst.h>
+#include "hyperspectral-threadpool.h"
+
+/* upper bound for GST_HSPEC_THREADS */
+#define MAX_THREADS 256
+
+/* items are taken in chunks so that every thread gets several of them and
+ * stealing can even out rows or bands of unequal cost */
+#define CHUNKS_PER_THREAD 8
+
+/* items left to one participant of a job, the owner takes them from the
+ * front and thieves from the back */
+typedef struct {
+  GMutex lock;
+  guint start;
+  guint end;
+} Range;
+
+typedef struct {
+  GstHspecParallelFunc func;
+  gpointer user_data;
+  guint grain;
+
+  /* one range per participant, the caller owns the first one */
+  guint n_ranges;
+  Range *ranges;
+
+  /* protected by the pool lock */
+  guint helpers_wanted;
+  guint helpers_joined;
+
+  GMutex lock;
+  GCond cond;
+  guint helpers_done;
+} Job;
+
+typedef struct {
+  GMutex lock;
+  GCond cond;
+  /* jobs still looking for helpers */
+  GQueue jobs;
+  /* workers plus the calling thread */
+  guint n_threads;
+} ThreadPool;
+
+static ThreadPool pool;
+
+static gboolean
+take_items (Range *range, guint grain, guint *start, guint *end)
+{
+  gboolean res = FALSE;
+
+  g_mutex_lock (&range->lock);
+  if (range->start < range->end) {
+    *start = range->start;
+    *end = range->end - range->start > grain ? range->start + grain :
+        range->end;
+    range->start = *end;
+    res = TRUE;
+  }
+  g_mutex_unlock (&range->lock);
+
+  return res;
+}
+
+/* moves the back half of the items left in victim to the empty range own */
+static gboolean
+steal_items (Range *victim, Range *own)
+{
+  guint start, end;
+
+  g_mutex_lock (&victim->lock);
+  if (victim->start >= victim->end) {
+    g_mutex_unlock (&victim->lock);
+    return FALSE;
+  }
+  end = victim->end;
+  start = end - (end - victim->start + 1) / 2;
+  victim->end = start;
+  g_mutex_unlock (&victim->lock);
+
+  g_mutex_lock (&own->lock);
+  own->start = start;
+  own->end = end;
+  g_mutex_unlock (&own->lock);
+
+  return TRUE;
+}
+
+/* returns once no items are left in any range of the job */
+static void
+run_job (Job *job, guint idx)
+{
+  Range *own = &job->ranges[idx];
+  guint i, start, end;
+
+  for (;;) {
+    while (take_items (own, job->grain, &start, &end))
+      job->func (job->user_data, start, end);
+
+    for (i=1; i<job->n_ranges; i++) {
+      if (steal_items (&job->ranges[(idx + i) % job->n_ranges], own))
+        break;
+    }
+    if (i == job->n_ranges)
+      break;
+  }
+}
+
+static gpointer
+worker_func (gpointer data)
+{
+  Job *job;
+  guint idx;
+
+  g_mutex_lock (&pool.lock);
+  for (;;) {
+    while (!(job = g_queue_peek_head (&pool.jobs)))
+      g_cond_wait (&pool.cond, &pool.lock);
+
+    idx = ++job->helpers_joined;
+    if (job->helpers_joined == job->helpers_wanted)
+      g_queue_pop_head (&pool.jobs);
+    g_mutex_unlock (&pool.lock);
+
+    run_job (job, idx);
+
+    g_mutex_lock (&job->lock);
+    job->helpers_done++;
+    g_cond_signal (&job->cond);
+    g_mutex_unlock (&job->lock);
+
+    g_mutex_lock (&pool.lock);
+  }
+
+  return NULL;
+}
+
+static void
+thread_pool_init (void)
+{
+  const gchar *env;
+  guint i, n_threads;
+  gchar *name;
+
+  n_threads = g_get_num_processors ();
+  if ((env = g_getenv (GST_HSPEC_THREADS_ENV)) && atoi (env) > 0)
+    n_threads = MIN (atoi (env), MAX_THREADS);
+
+  g_mutex_init (&pool.lock);
+  g_cond_init (&pool.cond);
+  g_queue_init (&pool.jobs);
+  pool.n_threads = n_threads;
+
+  /* the workers live as long as the process, the calling thread of a job
+   * takes part in it so one thread less is needed */
+  for (i=1; i<n_threads; i++) {
+    name = g_strdup_printf ("hspec-worker-%u", i);
+    g_thread_unref (g_thread_new (name, worker_func, NULL));
+    g_free (name);
+  }
+
+  GST_DEBUG ("started hyperspectral thread pool with %u threads", n_threads);
+}
+
+/* number of threads working on a job when nothing limits it */
+guint
+gst_hspec_thread_pool_get_n_threads (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized)) {
+    thread_pool_init ();
+    g_once_init_leave (&initialized, 1);
+  }
+
+  return pool.n_threads;
+}
+
+/* calls func for all items in [0, n_items), on at most max_threads threads
+ * including the calling one (0 uses the whole pool). Returns once all items
+ * were processed, func has to be safe to call from several threads on
+ * disjoint items */
+void
+gst_hspec_parallel_for (guint n_items, guint max_threads,
+    GstHspecParallelFunc func, gpointer user_data)
+{
+  Job job;
+  guint i, n_threads, joined;
+
+  g_return_if_fail (func != NULL);
+
+  n_threads = gst_hspec_thread_pool_get_n_threads ();
+  if (max_threads == 0 || max_threads > n_threads)
+    max_threads = n_threads;
+
+  if (max_threads < 2 || n_items < 2) {
+    if (n_items)
+      func (user_data, 0, n_items);
+    return;
+  }
+
+  job.func = func;
+  job.user_data = user_data;
+  job.n_ranges = MIN (max_threads, n_items);
+  job.grain = MAX (n_items / (job.n_ranges * CHUNKS_PER_THREAD), 1);
+  job.ranges = g_newa (Range, job.n_ranges);
+  for (i=0; i<job.n_ranges; i++) {
+    g_mutex_init (&job.ranges[i].lock);
+    job.ranges[i].start = (guint64) n_items * i / job.n_ranges;
+    job.ranges[i].end = (guint64) n_items * (i + 1) / job.n_ranges;
+  }
+  job.helpers_wanted = job.n_ranges - 1;
+  job.helpers_joined = 0;
+  g_mutex_init (&job.lock);
+  g_cond_init (&job.cond);
+  job.helpers_done = 0;
+
+  g_mutex_lock (&pool.lock);
+  g_queue_push_tail (&pool.jobs, &job);
+  g_cond_broadcast (&pool.cond);
+  g_mutex_unlock (&pool.lock);
+
+  run_job (&job, 0);
+
+  /* workers busy with other jobs take their ranges too late, their items
+   * were stolen by now */
+  g_mutex_lock (&pool.lock);
+  if (job.helpers_joined < job.helpers_wanted)
+    g_queue_remove (&pool.jobs, &job);
+  joined = job.helpers_joined;
+  g_mutex_unlock (&pool.lock);
+
+  g_mutex_lock (&job.lock);
+  while (job.helpers_done < joined)
+    g_cond_wait (&job.cond, &job.lock);
+  g_mutex_unlock (&job.lock);
+
+  g_mutex_clear (&job.lock);
+  g_cond_clear (&job.cond);
+  for (i=0; i<job.n_ranges; i++)
+    g_mutex_clear (&job.ranges[i].lock);
+}
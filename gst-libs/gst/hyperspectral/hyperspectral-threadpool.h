@@ -0,0 +1,55 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Process wide worker threads shared by all hyperspectral elements.
+ *
+ * Elements split their work in items (rows, bands, tiles) and hand them to
+ * gst_hspec_parallel_for(). Items are spread over the calling thread and idle
+ * workers, a thread running out of items steals half of the remaining ones
+ * of another thread. The pool is sized by the number of processors or
+ * GST_HSPEC_THREADS from the environment, one less than that since the
+ * caller takes part. The workers are shared, so several elements in a
+ * pipeline only add their own streaming threads: N concurrent callers run
+ * at most pool size + N - 1 threads.
+ */
+
+#ifndef __HYPERSPECTRAL_THREADPOOL_H__
+#define __HYPERSPECTRAL_THREADPOOL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* environment variable overriding the number of threads of the pool */
+#define GST_HSPEC_THREADS_ENV "GST_HSPEC_THREADS"
+
+/* processes the items [start, end) */
+typedef void (*GstHspecParallelFunc) (gpointer user_data, guint start,
+                                      guint end);
+
+guint gst_hspec_thread_pool_get_n_threads (void);
+
+void  gst_hspec_parallel_for              (guint n_items, guint max_threads,
+                                           GstHspecParallelFunc func,
+                                           gpointer user_data);
+
+G_END_DECLS
+
+#endif
@@ -29,6 +29,15 @@
 #include <gst/hyperspectral/hyperspectral-info.h>
 #include <gst/hyperspectral/hyperspectral-frame.h>
 #include <gst/hyperspectral/hyperspectral-format.h>
+#include <gst/hyperspectral/hyperspectral-kernels.h>
+#include <gst/hyperspectral/hyperspectral-dispatch.h>
+#include <gst/hyperspectral/hyperspectral-convert.h>
+#include <gst/hyperspectral/hyperspectral-meta.h>
+#include <gst/hyperspectral/hyperspectral-bufferpool.h>
+#include <gst/hyperspectral/hyperspectral-threadpool.h>
+#include <gst/hyperspectral/hyperspectral-autotune.h>
+#include <gst/hyperspectral/hyperspectral-ring.h>
+#include <gst/hyperspectral/hyperspectral-recording.h>
 
 
 #endif
\ No newline at end of file
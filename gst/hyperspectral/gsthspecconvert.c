@@ -0,0 +1,422 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+/**
+ * SECTION:element-gsthspecconvert
+ *
+ * The hspec-convert element converts hyperspectral cubes between sample
+ * formats (8 bit, 16 bit little and big endian, 32 and 16 bit float) and cube
+ * layouts. Format and layout are converted in a single pass. Integer
+ * samples are mapped onto [0, 1] when converted to float and back.
+ * Sample values can additionally be rescaled with the scale and offset
+ * properties.
+ *
+ * <refsect2>
+ * <title>Example launch line</title>
+ * |[
+ * gst-launch -v v4l2src ! hspecenc ! hspec-convert ! video/hyperspectral-cube,format=GRAY16_BE,layout=interleaved ! hspec-filesink
+ * ]|
+ * Encodes a camera stream into a cube and stores it as big endian,
+ * interleaved samples.
+ * </refsect2>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+#include <gst/base/gstbasetransform.h>
+#include "gsthspecconvert.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_hspec_convert_debug_category);
+#define GST_CAT_DEFAULT gst_hspec_convert_debug_category
+
+/* prototypes */
+
+
+static void gst_hspec_convert_set_property (GObject * object,
+    guint property_id, const GValue * value, GParamSpec * pspec);
+static void gst_hspec_convert_get_property (GObject * object,
+    guint property_id, GValue * value, GParamSpec * pspec);
+static void gst_hspec_convert_finalize (GObject * object);
+
+static GstCaps *gst_hspec_convert_transform_caps (GstBaseTransform * trans,
+    GstPadDirection direction, GstCaps * caps, GstCaps * filter);
+static GstCaps *gst_hspec_convert_fixate_caps (GstBaseTransform * trans,
+    GstPadDirection direction, GstCaps * caps, GstCaps * othercaps);
+static gboolean gst_hspec_convert_set_caps (GstBaseTransform * trans,
+    GstCaps * incaps, GstCaps * outcaps);
+static gboolean gst_hspec_convert_transform_size (GstBaseTransform * trans,
+    GstPadDirection direction, GstCaps * caps, gsize size, GstCaps * othercaps,
+    gsize * othersize);
+static gboolean gst_hspec_convert_stop (GstBaseTransform * trans);
+static gboolean gst_hspec_convert_propose_allocation (GstBaseTransform * trans,
+    GstQuery * decide_query, GstQuery * query);
+static gboolean gst_hspec_convert_decide_allocation (GstBaseTransform * trans,
+    GstQuery * query);
+static GstFlowReturn gst_hspec_convert_transform (GstBaseTransform * trans,
+    GstBuffer * inbuf, GstBuffer * outbuf);
+
+enum
+{
+  PROP_0,
+  PROP_SCALE,
+  PROP_OFFSET,
+};
+
+#define DEFAULT_SCALE 1.0
+#define DEFAULT_OFFSET 0.0
+
+/* pad templates */
+
+static GstStaticPadTemplate gst_hspec_convert_src_template =
+GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_HYPERSPECTRAL_CAPS_MAKE_WITH_ALL_FORMATS())
+    );
+
+static GstStaticPadTemplate gst_hspec_convert_sink_template =
+GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_HYPERSPECTRAL_CAPS_MAKE_WITH_ALL_FORMATS())
+    );
+
+
+/* class initialization */
+
+G_DEFINE_TYPE_WITH_CODE (GstHspecConvert, gst_hspec_convert, GST_TYPE_BASE_TRANSFORM,
+  GST_DEBUG_CATEGORY_INIT (gst_hspec_convert_debug_category, "hspec-convert", 0,
+  "debug category for hspecconvert element"));
+
+static void
+gst_hspec_convert_class_init (GstHspecConvertClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstBaseTransformClass *base_transform_class = GST_BASE_TRANSFORM_CLASS (klass);
+
+  gst_element_class_add_pad_template (GST_ELEMENT_CLASS(klass),
+      gst_static_pad_template_get (&gst_hspec_convert_src_template));
+  gst_element_class_add_pad_template (GST_ELEMENT_CLASS(klass),
+      gst_static_pad_template_get (&gst_hspec_convert_sink_template));
+
+  gst_element_class_set_static_metadata (GST_ELEMENT_CLASS(klass),
+      "Hyperspectral converter", "filter/converter/hyperspectral/Video",
+      "Converts hyperspectral cubes between sample formats and layouts",
+      "Dimitrios Katsaros <patcherwork@gmail.com>");
+
+  gobject_class->set_property = gst_hspec_convert_set_property;
+  gobject_class->get_property = gst_hspec_convert_get_property;
+  gobject_class->finalize = gst_hspec_convert_finalize;
+  base_transform_class->transform_caps = GST_DEBUG_FUNCPTR (gst_hspec_convert_transform_caps);
+  base_transform_class->fixate_caps = GST_DEBUG_FUNCPTR (gst_hspec_convert_fixate_caps);
+  base_transform_class->set_caps = GST_DEBUG_FUNCPTR (gst_hspec_convert_set_caps);
+  base_transform_class->transform_size = GST_DEBUG_FUNCPTR (gst_hspec_convert_transform_size);
+  base_transform_class->stop = GST_DEBUG_FUNCPTR (gst_hspec_convert_stop);
+  base_transform_class->propose_allocation = GST_DEBUG_FUNCPTR (gst_hspec_convert_propose_allocation);
+  base_transform_class->decide_allocation = GST_DEBUG_FUNCPTR (gst_hspec_convert_decide_allocation);
+  base_transform_class->transform = GST_DEBUG_FUNCPTR (gst_hspec_convert_transform);
+
+  g_object_class_install_property (gobject_class, PROP_SCALE,
+      g_param_spec_double ("scale", "Scale",
+          "Factor applied to the normalized sample values",
+          -G_MAXDOUBLE, G_MAXDOUBLE, DEFAULT_SCALE,
+          G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_OFFSET,
+      g_param_spec_double ("offset", "Offset",
+          "Offset added to the normalized sample values after scaling",
+          -G_MAXDOUBLE, G_MAXDOUBLE, DEFAULT_OFFSET,
+          G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+}
+
+static void
+gst_hspec_convert_init (GstHspecConvert *convert)
+{
+  gst_hyperspectral_info_init(&convert->ininfo);
+  gst_hyperspectral_info_init(&convert->outinfo);
+  convert->scale = DEFAULT_SCALE;
+  convert->offset = DEFAULT_OFFSET;
+  convert->convert = NULL;
+}
+
+void
+gst_hspec_convert_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstHspecConvert *convert = GST_HSPEC_CONVERT (object);
+
+  GST_DEBUG_OBJECT (convert, "set_property");
+
+  switch (property_id) {
+    case PROP_SCALE:
+      convert->scale = g_value_get_double (value);
+      break;
+    case PROP_OFFSET:
+      convert->offset = g_value_get_double (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+void
+gst_hspec_convert_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstHspecConvert *convert = GST_HSPEC_CONVERT (object);
+
+  GST_DEBUG_OBJECT (convert, "get_property");
+
+  switch (property_id) {
+    case PROP_SCALE:
+      g_value_set_double (value, convert->scale);
+      break;
+    case PROP_OFFSET:
+      g_value_set_double (value, convert->offset);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+void
+gst_hspec_convert_finalize (GObject * object)
+{
+  GstHspecConvert *convert = GST_HSPEC_CONVERT (object);
+
+  GST_DEBUG_OBJECT (convert, "finalize");
+
+  gst_hyperspectral_info_clear(&convert->ininfo);
+  gst_hyperspectral_info_clear(&convert->outinfo);
+
+  if (convert->convert)
+    gst_hyperspectral_converter_free (convert->convert);
+  convert->convert = NULL;
+
+  G_OBJECT_CLASS (gst_hspec_convert_parent_class)->finalize (object);
+}
+
+/* format and layout can be anything on the other side, everything else
+ * passes through unchanged */
+static GstCaps *
+gst_hspec_convert_transform_caps (GstBaseTransform * trans, GstPadDirection direction,
+    GstCaps * caps, GstCaps * filter)
+{
+  GstCaps *othercaps;
+  GstStructure *structure;
+  gint i;
+
+  GST_DEBUG_OBJECT (trans,
+      "Transforming caps %" GST_PTR_FORMAT " with filter %" GST_PTR_FORMAT " in direction %s", caps, filter,
+      (direction == GST_PAD_SINK) ? "sink" : "src");
+
+  othercaps = gst_caps_new_empty ();
+  for (i=0; i<gst_caps_get_size (caps); i++) {
+    structure = gst_structure_copy (gst_caps_get_structure (caps, i));
+    gst_structure_remove_fields (structure, "format", "layout", NULL);
+    gst_caps_append_structure (othercaps, structure);
+  }
+  othercaps = gst_caps_simplify (othercaps);
+
+  if (filter) {
+    GstCaps *intersect;
+
+    intersect = gst_caps_intersect_full (filter, othercaps,
+        GST_CAPS_INTERSECT_FIRST);
+    gst_caps_unref (othercaps);
+
+    return intersect;
+  } else {
+    return othercaps;
+  }
+}
+
+/* prefer keeping the input format and layout when downstream allows it */
+static GstCaps *
+gst_hspec_convert_fixate_caps (GstBaseTransform * trans, GstPadDirection direction,
+    GstCaps * caps, GstCaps * othercaps)
+{
+  GstStructure *ins, *outs;
+  const gchar *s;
+
+  othercaps = gst_caps_truncate (othercaps);
+  othercaps = gst_caps_make_writable (othercaps);
+
+  ins = gst_caps_get_structure (caps, 0);
+  outs = gst_caps_get_structure (othercaps, 0);
+
+  if ((s = gst_structure_get_string (ins, "format")))
+    gst_structure_fixate_field_string (outs, "format", s);
+  if ((s = gst_structure_get_string (ins, "layout")))
+    gst_structure_fixate_field_string (outs, "layout", s);
+
+  othercaps = gst_caps_fixate (othercaps);
+
+  GST_DEBUG_OBJECT (trans, "fixated to %" GST_PTR_FORMAT, othercaps);
+
+  return othercaps;
+}
+
+static gboolean
+gst_hspec_convert_set_caps (GstBaseTransform * trans, GstCaps * incaps,
+    GstCaps * outcaps)
+{
+  GstHspecConvert *convert = GST_HSPEC_CONVERT (trans);
+
+  gst_hyperspectral_info_clear(&convert->ininfo);
+  gst_hyperspectral_info_clear(&convert->outinfo);
+  if (!gst_hyperspectral_info_from_caps(&convert->ininfo, incaps)) {
+    GST_ERROR("Unable to retrieve input hyperspectral info from caps %" GST_PTR_FORMAT,
+      incaps);
+    return FALSE;
+  }
+  if (!gst_hyperspectral_info_from_caps(&convert->outinfo, outcaps)) {
+    GST_ERROR("Unable to retrieve output hyperspectral info from caps %" GST_PTR_FORMAT,
+      outcaps);
+    return FALSE;
+  }
+
+  if (convert->convert)
+    gst_hyperspectral_converter_free (convert->convert);
+  convert->convert = gst_hyperspectral_converter_new (&convert->ininfo,
+      &convert->outinfo, convert->scale, convert->offset);
+  if (!convert->convert) {
+    GST_ERROR_OBJECT (convert, "Unable to convert from %" GST_PTR_FORMAT
+        " to %" GST_PTR_FORMAT, incaps, outcaps);
+    return FALSE;
+  }
+
+  gst_base_transform_set_passthrough (trans,
+      gst_hyperspectral_converter_is_identity (convert->convert));
+
+  return TRUE;
+}
+
+static gboolean
+gst_hspec_convert_transform_size (GstBaseTransform * trans, GstPadDirection direction,
+    GstCaps * caps, gsize size, GstCaps * othercaps, gsize * othersize)
+{
+  const GstHyperspectralInfo *info;
+
+  info = gst_hyperspectral_info_from_caps_cached (othercaps);
+  if (!info) {
+    GST_ERROR_OBJECT (trans, "Unable to parse caps %" GST_PTR_FORMAT, othercaps);
+    return FALSE;
+  }
+  *othersize = info->cube_size;
+  gst_hyperspectral_info_unref (info);
+
+  return TRUE;
+}
+
+static gboolean
+gst_hspec_convert_stop (GstBaseTransform * trans)
+{
+  GstHspecConvert *convert = GST_HSPEC_CONVERT (trans);
+
+  if (convert->convert)
+    gst_hyperspectral_converter_free (convert->convert);
+  convert->convert = NULL;
+
+  return TRUE;
+}
+
+/* offer upstream a pool of hyperspectral cubes */
+static gboolean
+gst_hspec_convert_propose_allocation (GstBaseTransform * trans,
+    GstQuery * decide_query, GstQuery * query)
+{
+  if (!GST_BASE_TRANSFORM_CLASS (gst_hspec_convert_parent_class)->propose_allocation (trans,
+      decide_query, query))
+    return FALSE;
+
+  /* in passthrough the query has been answered downstream */
+  if (decide_query == NULL)
+    return TRUE;
+
+  return gst_hyperspectral_buffer_pool_propose_allocation (query,
+      GST_HYPERSPECTRAL_POOL_MIN_BUFFERS);
+}
+
+/* output cubes come from a hyperspectral pool */
+static gboolean
+gst_hspec_convert_decide_allocation (GstBaseTransform * trans, GstQuery * query)
+{
+  if (!gst_hyperspectral_buffer_pool_decide_allocation (query,
+      GST_HYPERSPECTRAL_POOL_MIN_BUFFERS, 0, 0))
+    return FALSE;
+
+  return GST_BASE_TRANSFORM_CLASS (gst_hspec_convert_parent_class)->decide_allocation (trans,
+      query);
+}
+
+static GstFlowReturn
+gst_hspec_convert_transform (GstBaseTransform * trans, GstBuffer * inbuf,
+    GstBuffer * outbuf)
+{
+  GstHspecConvert *convert = GST_HSPEC_CONVERT (trans);
+  GstHyperspectralFrame inframe, outframe;
+  GstHyperspectralMeta *inmeta, *outmeta;
+
+  if (!convert->convert) {
+    GST_ERROR_OBJECT (convert, "Converter has not been set! (Caps not negotiated?)");
+    return GST_FLOW_NOT_NEGOTIATED;
+  }
+
+  if (!gst_hyperspectral_frame_map(&inframe, &convert->ininfo,
+    inbuf, GST_MAP_READ | GST_HYPERSPECTRAL_FRAME_MAP_FLAG_PLANES)) {
+    GST_ERROR_OBJECT (convert, "Could not map input hyperspectral frame");
+    return GST_FLOW_ERROR;
+  }
+
+  if (!gst_hyperspectral_frame_map(&outframe, &convert->outinfo,
+    outbuf, GST_MAP_WRITE | GST_HYPERSPECTRAL_FRAME_MAP_FLAG_PLANES)) {
+    GST_ERROR_OBJECT (convert, "Could not map output hyperspectral frame");
+    gst_hyperspectral_frame_unmap(&inframe);
+    return GST_FLOW_ERROR;
+  }
+
+  gst_hyperspectral_converter_frame (convert->convert, &inframe, &outframe);
+
+  gst_hyperspectral_frame_unmap(&outframe);
+  gst_hyperspectral_frame_unmap(&inframe);
+
+  /* the cube description changed, per frame information carries over.
+   * Pooled buffers already carry a meta */
+  outmeta = gst_buffer_get_hyperspectral_meta (outbuf);
+  if (!outmeta)
+    outmeta = gst_buffer_add_hyperspectral_meta (outbuf, &convert->outinfo);
+  inmeta = gst_buffer_get_hyperspectral_meta (inbuf);
+  if (outmeta) {
+    outmeta->exposure = inmeta ? inmeta->exposure : GST_CLOCK_TIME_NONE;
+    outmeta->flags = inmeta ? inmeta->flags : GST_HYPERSPECTRAL_META_FLAG_NONE;
+  }
+  return GST_FLOW_OK;
+}
+
+gboolean
+gst_hspec_convert_plugin_init (GstPlugin * plugin)
+{
+  return gst_element_register (plugin, "hspec-convert", GST_RANK_NONE,
+      GST_TYPE_HSPEC_CONVERT);
+}
@@ -44,8 +44,11 @@
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <byteswap.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include "gsthspecfilesink.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_hspec_file_sink_debug_category);
@@ -63,18 +66,33 @@ static void gst_hspec_file_sink_finalize (GObject * object);
 static gboolean gst_hspec_file_sink_set_caps (GstBaseSink * sink, GstCaps * caps);
 static gboolean gst_hspec_file_sink_start (GstBaseSink * sink);
 static gboolean gst_hspec_file_sink_stop (GstBaseSink * sink);
+static gboolean gst_hspec_file_sink_propose_allocation (GstBaseSink * sink,
+    GstQuery * query);
+static gboolean gst_hspec_file_sink_unlock (GstBaseSink * sink);
+static gboolean gst_hspec_file_sink_unlock_stop (GstBaseSink * sink);
+static gboolean gst_hspec_file_sink_event (GstBaseSink * sink, GstEvent * event);
 
 static GstFlowReturn gst_hspec_file_sink_show_frame (GstVideoSink * video_sink,
     GstBuffer * buf);
 
 
 /* file writer function definitions */
-static gboolean write_raw(GstHspecFileSink * sink, GstHyperspectralFrame * frame);
+static gboolean write_raw(GstHspecFileSink * sink, GstHyperspectralFrame * frame,
+    const gchar * base, gchar ** created);
 static gboolean init_raw(GstHspecFileSink * sink);
 static gboolean cleanup_raw(GstHspecFileSink * sink);
-static gboolean write_gerbil(GstHspecFileSink * sink, GstHyperspectralFrame * frame);
-static gboolean write_csv(GstHspecFileSink * sink, GstHyperspectralFrame * frame);
-static gboolean write_xml(GstHspecFileSink * sink, GstHyperspectralFrame * frame);
+static gboolean finish_raw(GstHspecFileSink * sink);
+static gboolean raw_writer_start(GstHspecFileSink * sink);
+static gboolean raw_writer_stop(GstHspecFileSink * sink);
+static gboolean write_gerbil(GstHspecFileSink * sink, GstHyperspectralFrame * frame,
+    const gchar * base, gchar ** created);
+static gboolean write_csv(GstHspecFileSink * sink, GstHyperspectralFrame * frame,
+    const gchar * base, gchar ** created);
+static gboolean write_xml(GstHspecFileSink * sink, GstHyperspectralFrame * frame,
+    const gchar * base, gchar ** created);
+static gboolean export_start(GstHspecFileSink * sink);
+static gboolean export_stop(GstHspecFileSink * sink);
+static gboolean export_drain(GstHspecFileSink * sink);
 
 /* file writer helper functions and structs */
 
@@ -98,6 +116,72 @@ gst_hspec_file_sink_file_format_get_type (void)
   return file_sink_format_type;
 }
 
+#define GST_TYPE_HSPEC_FILE_SINK_OVERFLOW (gst_hspec_file_sink_overflow_get_type ())
+static GType
+gst_hspec_file_sink_overflow_get_type (void)
+{
+  static GType file_sink_overflow_type = 0;
+  static const GEnumValue policies[] = {
+    {GST_HSPEC_FILE_SINK_OVERFLOW_BLOCK, "Wait for the writer", "block"},
+    {GST_HSPEC_FILE_SINK_OVERFLOW_DROP_OLDEST, "Drop the oldest queued frame",
+      "drop-oldest"},
+    {GST_HSPEC_FILE_SINK_OVERFLOW_DROP_NEWEST, "Drop the incoming frame",
+      "drop-newest"},
+    {0, NULL, NULL}
+  };
+
+  if (!file_sink_overflow_type) {
+    file_sink_overflow_type =
+    g_enum_register_static ("GstHspecFileSinkOverflow", policies);
+  }
+  return file_sink_overflow_type;
+}
+
+#define GST_TYPE_HSPEC_FILE_SINK_IO_MODE (gst_hspec_file_sink_io_mode_get_type ())
+static GType
+gst_hspec_file_sink_io_mode_get_type (void)
+{
+  static GType file_sink_io_mode_type = 0;
+  static const GEnumValue modes[] = {
+    {GST_HSPEC_IO_MODE_STDIO, "Buffered writes through the page cache", "stdio"},
+    {GST_HSPEC_IO_MODE_DIRECT, "O_DIRECT writes bypassing the page cache",
+      "direct"},
+    {GST_HSPEC_IO_MODE_URING, "Direct writes kept in flight with io_uring",
+      "uring"},
+    {GST_HSPEC_IO_MODE_MMAP, "Copies into a preallocated memory mapped file, "
+      "needs max-frames", "mmap"},
+    {0, NULL, NULL}
+  };
+
+  if (!file_sink_io_mode_type) {
+    file_sink_io_mode_type =
+    g_enum_register_static ("GstHspecFileSinkIoMode", modes);
+  }
+  return file_sink_io_mode_type;
+}
+
+#define GST_TYPE_HSPEC_FILE_SINK_MMAP_POLICY (gst_hspec_file_sink_mmap_policy_get_type ())
+static GType
+gst_hspec_file_sink_mmap_policy_get_type (void)
+{
+  static GType file_sink_mmap_policy_type = 0;
+  static const GEnumValue policies[] = {
+    {GST_HSPEC_MMAP_POLICY_NONE, "Leave writeback to the kernel", "none"},
+    {GST_HSPEC_MMAP_POLICY_WRITEBACK,
+      "Start writeback behind the recording and drop written pages",
+      "writeback"},
+    {GST_HSPEC_MMAP_POLICY_MSYNC,
+      "msync written ranges and drop their pages", "msync"},
+    {0, NULL, NULL}
+  };
+
+  if (!file_sink_mmap_policy_type) {
+    file_sink_mmap_policy_type =
+    g_enum_register_static ("GstHspecFileSinkMmapPolicy", policies);
+  }
+  return file_sink_mmap_policy_type;
+}
+
 typedef struct
 {
   GstFileSinkFileFormat format;
@@ -145,13 +229,31 @@ set_write_funcs (GstHspecFileSink *sink) {
 }
 
 
+/* packed cubes are unpacked to host order 16 bit samples for the text and
+ * image writers */
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define GRAY16_NATIVE GST_HSPC_FORMAT_GRAY16_LE
+#else
+#define GRAY16_NATIVE GST_HSPC_FORMAT_GRAY16_BE
+#endif
+
 /* properties */
 enum
 {
   PROP_0,
   PROP_FILE_NAME,
   PROP_FILE_PATH,
-  PROP_FILE_FORMAT
+  PROP_FILE_FORMAT,
+  PROP_N_THREADS,
+  PROP_QUEUE_FRAMES,
+  PROP_QUEUE_BYTES,
+  PROP_OVERFLOW,
+  PROP_STATS_INTERVAL,
+  PROP_IO_MODE,
+  PROP_SYNC_FRAMES,
+  PROP_MAX_FRAMES,
+  PROP_MMAP_POLICY,
+  PROP_EXPORT_THREADS
 };
 
 enum
@@ -162,6 +264,15 @@ enum
 
 #define FILE_PATH_DEFAULT "./\0"
 
+/* one frame on disk while the next one is queued */
+#define DEFAULT_QUEUE_FRAMES 2
+#define MAX_QUEUE_FRAMES 1024
+
+/* files of other formats are mostly waiting for the filesystem, a few
+ * cubes in flight hide its latency */
+#define DEFAULT_EXPORT_THREADS 4
+#define MAX_EXPORT_THREADS 64
+
 static guint gst_hspec_file_sink_signals[LAST_SIGNAL] = { 0 };
 
 /* pad templates */
@@ -204,6 +315,10 @@ gst_hspec_file_sink_class_init (GstHspecFileSinkClass * klass)
   base_sink_class->set_caps = gst_hspec_file_sink_set_caps;
   base_sink_class->start = gst_hspec_file_sink_start;
   base_sink_class->stop = gst_hspec_file_sink_stop;
+  base_sink_class->propose_allocation = gst_hspec_file_sink_propose_allocation;
+  base_sink_class->unlock = gst_hspec_file_sink_unlock;
+  base_sink_class->unlock_stop = gst_hspec_file_sink_unlock_stop;
+  base_sink_class->event = gst_hspec_file_sink_event;
 
   /* signal definition */
   gst_hspec_file_sink_signals[SIGNAL_IMAGE_CREATED] = g_signal_new ("file-image-created",
@@ -228,6 +343,68 @@ gst_hspec_file_sink_class_init (GstHspecFileSinkClass * klass)
         "The format of the files being generated, will set file path to default for category!",
         GST_TYPE_HSPEC_FILE_SINK_FILE_FORMAT,
         GST_FILE_SINK_RAW, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_N_THREADS,
+      g_param_spec_uint ("n-threads", "Number of threads",
+        "Maximum number of threads writing the files of a cube, 0 uses all "
+        "threads of the shared pool (see " GST_HSPEC_THREADS_ENV ")",
+        0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_QUEUE_FRAMES,
+      g_param_spec_uint ("queue-frames", "Queue frames",
+        "Maximum number of RAW frames queued for the writer thread, "
+        "0 writes from the streaming thread",
+        0, MAX_QUEUE_FRAMES, DEFAULT_QUEUE_FRAMES,
+        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_QUEUE_BYTES,
+      g_param_spec_uint64 ("queue-bytes", "Queue bytes",
+        "Maximum number of bytes queued for the writer thread, at least one "
+        "frame is always queued (0 = no limit)",
+        0, G_MAXUINT64, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_OVERFLOW,
+      g_param_spec_enum ("overflow", "Overflow",
+        "What to do with a RAW frame arriving while the writer queue is full",
+        GST_TYPE_HSPEC_FILE_SINK_OVERFLOW, GST_HSPEC_FILE_SINK_OVERFLOW_BLOCK,
+        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+      g_param_spec_uint ("stats-interval", "Statistics interval",
+        "Number of frames written between hspec-filesink-stats element "
+        "messages, 0 only posts them when the writer stops",
+        0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_IO_MODE,
+      g_param_spec_enum ("io-mode", "IO mode",
+        "How RAW recordings are written to disk",
+        GST_TYPE_HSPEC_FILE_SINK_IO_MODE, GST_HSPEC_IO_MODE_STDIO,
+        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_SYNC_FRAMES,
+      g_param_spec_uint ("sync-frames", "Sync frames",
+        "Number of RAW frames between syncs to disk, the end of the recording "
+        "is synced too (0 = never sync)",
+        0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_FRAMES,
+      g_param_spec_uint ("max-frames", "Max frames",
+        "Number of frames in a RAW recording, later frames end the stream. "
+        "The mmap io-mode preallocates the file for them (0 = unlimited)",
+        0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MMAP_POLICY,
+      g_param_spec_enum ("mmap-policy", "Mmap policy",
+        "What happens to the written part of a recording in the mmap io-mode",
+        GST_TYPE_HSPEC_FILE_SINK_MMAP_POLICY, GST_HSPEC_MMAP_POLICY_WRITEBACK,
+        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_EXPORT_THREADS,
+      g_param_spec_uint ("export-threads", "Export threads",
+        "Number of Gerbil, CSV and XML cubes written at the same time, "
+        "0 writes them from the streaming thread",
+        0, MAX_EXPORT_THREADS, DEFAULT_EXPORT_THREADS,
+        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
 /* helper functions */
@@ -323,7 +500,33 @@ gst_hspec_file_sink_init (GstHspecFileSink *sink)
   sink->filename = NULL;
   sink->filename_len = 0;
   sink->orderedspectra = NULL;
+  sink->unpacked = NULL;
+  sink->contiguous = NULL;
   sink->image_counter = 0;
+  sink->n_threads = 0;
+  sink->queue_frames = DEFAULT_QUEUE_FRAMES;
+  sink->queue_bytes = 0;
+  sink->overflow = GST_HSPEC_FILE_SINK_OVERFLOW_BLOCK;
+  sink->stats_interval = 0;
+  sink->io_mode = GST_HSPEC_IO_MODE_STDIO;
+  sink->sync_frames = 0;
+  sink->max_frames = 0;
+  sink->raw_frames = 0;
+  sink->caps = NULL;
+  sink->raw_index = g_array_new (FALSE, FALSE, sizeof (GstHspecRecordingEntry));
+  sink->raw_offset = 0;
+  sink->raw_pts = GST_CLOCK_TIME_NONE;
+  sink->raw_duration = GST_CLOCK_TIME_NONE;
+  sink->mmap_policy = GST_HSPEC_MMAP_POLICY_WRITEBACK;
+  memset (&sink->writer, 0, sizeof (GstHspecRawWriter));
+  g_mutex_init (&sink->writer.lock);
+  g_cond_init (&sink->writer.cond);
+  sink->export_threads = DEFAULT_EXPORT_THREADS;
+  memset (&sink->exporter, 0, sizeof (GstHspecFileExporter));
+  g_mutex_init (&sink->exporter.lock);
+  g_cond_init (&sink->exporter.cond);
+  g_queue_init (&sink->exporter.items);
+  g_queue_init (&sink->exporter.scratch);
   clear_tbuf(&sink->tbuf);
   reset_tbuf(&sink->tbuf);
 
@@ -339,6 +542,8 @@ gst_hspec_file_sink_dispose (GObject * object)
 
   GST_DEBUG_OBJECT (sink, "dispose");
 
+  raw_writer_stop(sink);
+  export_stop(sink);
   gst_hyperspectral_info_clear(&sink->hinfo);
   if (sink->filepath)
     g_string_free(sink->filepath, TRUE);
@@ -347,14 +552,17 @@ gst_hspec_file_sink_dispose (GObject * object)
   if (sink->orderedspectra)
     free (sink->orderedspectra);
   sink->orderedspectra = NULL;
+  g_free (sink->unpacked);
+  sink->unpacked = NULL;
+  g_free (sink->contiguous);
+  sink->contiguous = NULL;
   sink->image_counter = 0;
 
   reset_tbuf(&sink->tbuf);
   set_write_category(sink, GST_FILE_SINK_RAW);
 
-  if (sink->file)
-    fclose(sink->file);
-  sink->file = NULL;
+  finish_raw(sink);
+  gst_caps_replace(&sink->caps, NULL);
 
   G_OBJECT_CLASS (gst_hspec_file_sink_parent_class)->dispose (object);
 }
@@ -380,11 +588,23 @@ gst_hspec_file_sink_finalize (GObject * object)
     free (sink->orderedspectra);
   sink->orderedspectra = NULL;
 
+  g_free (sink->unpacked);
+  sink->unpacked = NULL;
+  g_free (sink->contiguous);
+  sink->contiguous = NULL;
+
   dealloc_tbuf(&sink->tbuf);
 
   if (sink->file)
-    fclose(sink->file);
+    gst_hspec_raw_file_close(sink->file);
   sink->file = NULL;
+  gst_caps_replace(&sink->caps, NULL);
+  g_array_free(sink->raw_index, TRUE);
+
+  g_mutex_clear (&sink->writer.lock);
+  g_cond_clear (&sink->writer.cond);
+  g_mutex_clear (&sink->exporter.lock);
+  g_cond_clear (&sink->exporter.cond);
 
   G_OBJECT_CLASS (gst_hspec_file_sink_parent_class)->finalize (object);
 }
@@ -411,6 +631,36 @@ gst_hspec_file_sink_set_property (GObject * object, guint property_id,
     case PROP_FILE_FORMAT:
       set_write_category(sink, g_value_get_enum(value));
       break;
+    case PROP_N_THREADS:
+      sink->n_threads = g_value_get_uint(value);
+      break;
+    case PROP_QUEUE_FRAMES:
+      sink->queue_frames = g_value_get_uint(value);
+      break;
+    case PROP_QUEUE_BYTES:
+      sink->queue_bytes = g_value_get_uint64(value);
+      break;
+    case PROP_OVERFLOW:
+      sink->overflow = g_value_get_enum(value);
+      break;
+    case PROP_STATS_INTERVAL:
+      sink->stats_interval = g_value_get_uint(value);
+      break;
+    case PROP_IO_MODE:
+      sink->io_mode = g_value_get_enum(value);
+      break;
+    case PROP_SYNC_FRAMES:
+      sink->sync_frames = g_value_get_uint(value);
+      break;
+    case PROP_MAX_FRAMES:
+      sink->max_frames = g_value_get_uint(value);
+      break;
+    case PROP_MMAP_POLICY:
+      sink->mmap_policy = g_value_get_enum(value);
+      break;
+    case PROP_EXPORT_THREADS:
+      sink->export_threads = g_value_get_uint(value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -435,6 +685,36 @@ gst_hspec_file_sink_get_property (GObject * object, guint property_id,
     case PROP_FILE_FORMAT:
       g_value_set_enum(value, sink->file_format);
       break;
+    case PROP_N_THREADS:
+      g_value_set_uint(value, sink->n_threads);
+      break;
+    case PROP_QUEUE_FRAMES:
+      g_value_set_uint(value, sink->queue_frames);
+      break;
+    case PROP_QUEUE_BYTES:
+      g_value_set_uint64(value, sink->queue_bytes);
+      break;
+    case PROP_OVERFLOW:
+      g_value_set_enum(value, sink->overflow);
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint(value, sink->stats_interval);
+      break;
+    case PROP_IO_MODE:
+      g_value_set_enum(value, sink->io_mode);
+      break;
+    case PROP_SYNC_FRAMES:
+      g_value_set_uint(value, sink->sync_frames);
+      break;
+    case PROP_MAX_FRAMES:
+      g_value_set_uint(value, sink->max_frames);
+      break;
+    case PROP_MMAP_POLICY:
+      g_value_set_enum(value, sink->mmap_policy);
+      break;
+    case PROP_EXPORT_THREADS:
+      g_value_set_uint(value, sink->export_threads);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -453,6 +733,12 @@ gst_hspec_file_sink_set_caps (GstBaseSink * sink, GstCaps * caps)
   GstHspecFileSink *fsink = GST_HSPEC_FILE_SINK (sink);
   GST_DEBUG("Caps recieved: %" GST_PTR_FORMAT, caps);
 
+  /* queued frames are written with the old caps */
+  if (!raw_writer_stop(fsink) || !export_stop(fsink))
+    return FALSE;
+  gst_caps_replace(&fsink->caps, caps);
+
+  gst_hyperspectral_info_clear(&fsink->hinfo);
   if (!gst_hyperspectral_info_from_caps(&fsink->hinfo, caps)){
     GST_ERROR("Unable to extract hyperspectral info from caps");
     return FALSE;
@@ -474,8 +760,17 @@ gst_hspec_file_sink_set_caps (GstBaseSink * sink, GstCaps * caps)
   qsort (fsink->orderedspectra, fsink->hinfo.mosaic.size,
     sizeof(gint), compare_func);
 
-  if (fsink->fset.init_file_func)
-    return fsink->fset.init_file_func(fsink);
+  /* scratch memory of the old cube size */
+  g_free (fsink->unpacked);
+  fsink->unpacked = NULL;
+  g_free (fsink->contiguous);
+  fsink->contiguous = NULL;
+
+  if (fsink->fset.init_file_func && !fsink->fset.init_file_func(fsink))
+    return FALSE;
+
+  if (fsink->file_format != GST_FILE_SINK_RAW && fsink->export_threads)
+    return export_start(fsink);
 
   return TRUE;
 
@@ -505,50 +800,157 @@ gst_hspec_file_sink_start (GstBaseSink * sink) {
   return TRUE;
 }
 
-static gboolean gst_hspec_file_sink_stop (GstBaseSink * sink) {
+/* offer upstream a pool of hyperspectral cubes */
+static gboolean
+gst_hspec_file_sink_propose_allocation (GstBaseSink * sink, GstQuery * query)
+{
+  GstHspecFileSink *filesink = GST_HSPEC_FILE_SINK (sink);
+  guint min_buffers = GST_HYPERSPECTRAL_POOL_MIN_BUFFERS;
+
+  /* queued frames keep their buffers */
+  if (filesink->file_format == GST_FILE_SINK_RAW)
+    min_buffers += filesink->queue_frames;
+  else
+    min_buffers += 2 * filesink->export_threads;
+
+  return gst_hyperspectral_buffer_pool_propose_allocation (query, min_buffers);
+}
 
+/* wakes up a streaming thread waiting for room in the writer queues */
+static gboolean
+gst_hspec_file_sink_unlock (GstBaseSink * sink)
+{
   GstHspecFileSink *filesink = GST_HSPEC_FILE_SINK (sink);
 
-  if (filesink->fset.cleanup_file_func)
-    return filesink->fset.cleanup_file_func(filesink);
+  g_mutex_lock (&filesink->writer.lock);
+  filesink->writer.flushing = TRUE;
+  g_cond_broadcast (&filesink->writer.cond);
+  g_mutex_unlock (&filesink->writer.lock);
+
+  g_mutex_lock (&filesink->exporter.lock);
+  filesink->exporter.flushing = TRUE;
+  g_cond_broadcast (&filesink->exporter.cond);
+  g_mutex_unlock (&filesink->exporter.lock);
 
   return TRUE;
 }
 
+static gboolean
+gst_hspec_file_sink_unlock_stop (GstBaseSink * sink)
+{
+  GstHspecFileSink *filesink = GST_HSPEC_FILE_SINK (sink);
+
+  g_mutex_lock (&filesink->writer.lock);
+  filesink->writer.flushing = FALSE;
+  g_mutex_unlock (&filesink->writer.lock);
+
+  g_mutex_lock (&filesink->exporter.lock);
+  filesink->exporter.flushing = FALSE;
+  g_mutex_unlock (&filesink->exporter.lock);
+
+  return TRUE;
+}
+
+static gboolean gst_hspec_file_sink_stop (GstBaseSink * sink) {
+
+  GstHspecFileSink *filesink = GST_HSPEC_FILE_SINK (sink);
+  gboolean res;
+
+  res = export_stop(filesink);
+
+  if (filesink->fset.cleanup_file_func && !filesink->fset.cleanup_file_func(filesink))
+    res = FALSE;
+
+  return res;
+}
+
+/* the files of all cubes are written when EOS goes on */
+static gboolean
+gst_hspec_file_sink_event (GstBaseSink * sink, GstEvent * event)
+{
+  if (GST_EVENT_TYPE (event) == GST_EVENT_EOS &&
+      !export_drain(GST_HSPEC_FILE_SINK (sink))) {
+    gst_event_unref (event);
+    return FALSE;
+  }
+
+  return GST_BASE_SINK_CLASS (gst_hspec_file_sink_parent_class)->event (sink,
+      event);
+}
+
+/* closes the recording after its index */
+static gboolean
+finish_raw(GstHspecFileSink * sink) {
+
+  guint8 *index;
+  gsize size;
+  gboolean res;
+
+  if (!sink->file)
+    return TRUE;
+
+  index = gst_hspec_recording_index_new(
+      (GstHspecRecordingEntry *) sink->raw_index->data, sink->raw_index->len,
+      sink->raw_offset, &size);
+  res = gst_hspec_raw_file_write(sink->file, index, size);
+  g_free(index);
+
+  if (!gst_hspec_raw_file_close(sink->file))
+    res = FALSE;
+  sink->file = NULL;
+  g_array_set_size(sink->raw_index, 0);
+
+  return res;
+}
+
 static gboolean
 init_raw(GstHspecFileSink * sink) {
 
-  int i;
+  guint8 *header;
+  gsize header_size;
+  guint64 stride, reserve = 0;
+  gboolean res;
+
   GST_DEBUG("INIT RAW");
   g_string_append(sink->filepath, sink->filename->str);
-  if (sink->file)
-    fclose(sink->file);
+  finish_raw(sink);
+  sink->raw_frames = 0;
+
+  /* hspec info at the beginning of file */
+  header = gst_hspec_recording_header_new(sink->caps, sink->hinfo.cube_size,
+      &header_size);
+  stride = gst_hspec_recording_frame_stride(sink->hinfo.cube_size);
+
+  /* the frames and index of max_frames frames */
+  if (sink->max_frames)
+    reserve = header_size + (guint64) sink->max_frames *
+        (stride + GST_HSPEC_RECORDING_ENTRY_SIZE) +
+        GST_HSPEC_RECORDING_FOOTER_SIZE;
 
   GST_DEBUG("Opening file: %s", sink->filepath->str);
-  if ((sink->file = g_fopen(sink->filepath->str, "w")) == NULL)  {
+  if ((sink->file = gst_hspec_raw_file_open(sink->filepath->str,
+      sink->io_mode, reserve)) == NULL)  {
     GST_ERROR("An error occured while trying to create file %s", sink->filepath->str);
+    g_free(header);
     goto error;
   }
+  gst_hspec_raw_file_set_mmap_policy(sink->file, sink->mmap_policy);
 
-  /* write hspec info at the beginning of file */
-  g_fprintf(sink->file, "video/hyperspectral-cube, width=(int)%d, height=(int)%d"
-    "wavelengths=(int)%d, format=(string)%s, wavelength_ids=(int)< ",
-      sink->hinfo.width, sink->hinfo.height, sink->hinfo.wavelengths,
-      gst_video_format_to_string(sink->hinfo.format));
+  res = gst_hspec_raw_file_write(sink->file, header, header_size);
+  g_free(header);
+  if (!res)
+    goto error;
+  sink->raw_offset = header_size;
 
-  for (i=0; i<sink->hinfo.wavelengths; i++) {
-    g_fprintf(sink->file, "%d", sink->hinfo.mosaic.spectras[i]);
-    if (i!= (sink->hinfo.wavelengths-1))
-      g_fprintf(sink->file, ", ");
-  }
-  g_fprintf(sink->file, " >\n");
+  if (sink->queue_frames && !raw_writer_start(sink))
+    goto error;
 
   return TRUE;
 
 error:
   {
     if(sink->file) {
-      fclose(sink->file);
+      gst_hspec_raw_file_close(sink->file);
       sink->file = NULL;
     }
     return FALSE;
@@ -557,160 +959,635 @@ error:
 
 static gboolean
 cleanup_raw(GstHspecFileSink * sink) {
+  gboolean res;
+
   GST_DEBUG("RAW CLEANUP");
-  if (sink->file)
-    fclose(sink->file);
-  sink->file = NULL;
-  g_signal_emit (sink, gst_hspec_file_sink_signals[SIGNAL_IMAGE_CREATED],
-    0, sink->filepath->str);
-  return TRUE;
+  res = raw_writer_stop(sink);
+  if (!finish_raw(sink)) {
+    GST_ELEMENT_ERROR (sink, RESOURCE, WRITE, (NULL),
+        ("Could not write the index of %s", sink->filepath->str));
+    res = FALSE;
+  }
+  /* a truncated recording is not announced */
+  if (res)
+    g_signal_emit (sink, gst_hspec_file_sink_signals[SIGNAL_IMAGE_CREATED],
+      0, sink->filepath->str);
+  return res;
 }
 
 static gboolean
-write_raw (GstHspecFileSink * sink, GstHyperspectralFrame * frame) {
+write_raw_frame (GstHspecFileSink * sink, GstHyperspectralFrame * frame,
+    glong counter, GstClockTime pts, GstClockTime duration) {
+
+  static const guint8 padding[GST_HSPEC_RECORDING_RECORD_SIZE] = { 0, };
+  guint8 record[GST_HSPEC_RECORDING_RECORD_SIZE];
+  GstHspecRecordingEntry entry;
+  guint64 stride;
+
+  stride = gst_hspec_recording_frame_stride(frame->info.cube_size);
+
+  entry.offset = sink->raw_offset + GST_HSPEC_RECORDING_RECORD_SIZE;
+  entry.pts = pts;
+  entry.duration = duration;
+  entry.number = counter;
+  gst_hspec_recording_fill_record(record, &entry);
 
   /* write raw data frame to file */
-  g_fprintf(sink->file, "<frame_start_%ld>", sink->image_counter);
-  fwrite(frame->data, frame->info.bytesize, frame->info.cube_elems, sink->file);
-  g_fprintf(sink->file, "<frame_end_%ld>\n", sink->image_counter);
+  if (!gst_hspec_raw_file_write(sink->file, record, sizeof (record)) ||
+      !gst_hspec_raw_file_write(sink->file, frame->data, frame->info.cube_size) ||
+      !gst_hspec_raw_file_write(sink->file, padding,
+          stride - GST_HSPEC_RECORDING_RECORD_SIZE - frame->info.cube_size)) {
+    GST_ERROR("Could not write frame %ld to %s", counter, sink->filepath->str);
+    return FALSE;
+  }
+  sink->raw_offset += stride;
+  g_array_append_val(sink->raw_index, entry);
+
+  /* io_uring links the sync to the last write and carries on */
+  if (sink->sync_frames && (counter + 1) % sink->sync_frames == 0)
+    return gst_hspec_raw_file_sync(sink->file);
 
   return TRUE;
 }
 
-static gboolean write_csv(GstHspecFileSink * sink, GstHyperspectralFrame * frame) {
-  FILE *hspecFile = NULL;
-  gint i, j, z;
-  GString *filepath =  g_string_truncate(sink->filepath, sink->filepath_len);
-  g_string_append(sink->filepath, sink->filename->str);
-  union {
-    guint8 *u8;
-    guint16 *u16;
-    gpointer ptr;
-  } data;
-  data.ptr = frame->data;
-
-  g_string_append(filepath, ".csv");
-  GST_DEBUG("Opening file: %s", filepath->str);
-  if ((hspecFile = g_fopen(filepath->str, "w")) == NULL)  {
-    GST_ERROR("An error occured while trying to create file %s", filepath->str);
-    goto error;
+static gboolean
+write_raw (GstHspecFileSink * sink, GstHyperspectralFrame * frame,
+    const gchar * base, gchar ** created) {
+  return write_raw_frame(sink, frame, sink->image_counter, sink->raw_pts,
+      sink->raw_duration);
+}
+
+/* a buffer waiting for the writer thread */
+typedef struct {
+  GstBuffer *buffer;
+  glong counter;
+} RawItem;
+
+static void
+raw_item_free (RawItem *item)
+{
+  gst_buffer_unref (item->buffer);
+  g_slice_free (RawItem, item);
+}
+
+static void
+post_raw_stats (GstHspecFileSink * sink)
+{
+  GstHspecRawWriter *w = &sink->writer;
+  GstStructure *s;
+
+  s = gst_structure_new ("hspec-filesink-stats",
+      "frames-written", G_TYPE_UINT64, w->frames_written,
+      "bytes-written", G_TYPE_UINT64, w->bytes_written,
+      "frames-dropped", G_TYPE_UINT, (guint) g_atomic_int_get (&w->frames_dropped),
+      "queue-depth", G_TYPE_UINT, (guint) w->depth,
+      "queue-peak", G_TYPE_UINT, (guint) g_atomic_int_get (&w->peak_queued),
+      "max-write-time", G_TYPE_UINT64, (guint64) w->max_write_time * GST_USECOND,
+      NULL);
+  gst_element_post_message (GST_ELEMENT (sink),
+      gst_message_new_element (GST_OBJECT (sink), s));
+}
+
+static gboolean
+write_raw_buffer (GstHspecFileSink * sink, RawItem * item)
+{
+  GstHyperspectralFrame frame, contiguous;
+  gboolean res;
+
+  if (!gst_hyperspectral_frame_map(&frame, &sink->hinfo, item->buffer,
+      GST_MAP_READ | GST_HYPERSPECTRAL_FRAME_MAP_FLAG_PLANES)) {
+    GST_ERROR_OBJECT(sink, "Could not map correctly hyperspectral image");
+    return FALSE;
   }
 
-  g_fprintf(hspecFile, "#HS-CSV image: "
-    "NumFrames: %d FrameWidth: %d FrameHeight: %d Format: %s\n",
-      sink->hinfo.width, sink->hinfo.height, sink->hinfo.wavelengths,
-      gst_video_format_to_string(sink->hinfo.format));
-
-  if (sink->hinfo.format == GST_VIDEO_FORMAT_GRAY8 &&
-      sink->hinfo.layout == GST_HSPC_LAYOUT_MULTIPLANE) {
-    for (i=0; i<frame->info.height; i++) {
-      for (j=0; j<frame->info.width; j++) {
-        for (z=0; z<frame->info.wavelengths; z++) {
-          g_fprintf(hspecFile, "%u,", data.u8[j+(frame->info.width)*i+
-            ((frame)->info.width)*((frame)->info.height)*z]);
-        }
-        fputc('\n', hspecFile);
-      }
-      fputc('\n', hspecFile);
+  /* the streaming thread leaves the copy buffer alone while the writer
+   * runs */
+  if (!gst_hyperspectral_frame_is_contiguous (&frame)) {
+    if (!sink->contiguous)
+      sink->contiguous = g_malloc (sink->hinfo.cube_size);
+    gst_hyperspectral_frame_wrap (&contiguous, &sink->hinfo, sink->contiguous);
+    gst_hyperspectral_frame_copy (&contiguous, &frame);
+    res = write_raw_frame (sink, &contiguous, item->counter,
+        GST_BUFFER_PTS (item->buffer), GST_BUFFER_DURATION (item->buffer));
+  } else {
+    res = write_raw_frame (sink, &frame, item->counter,
+        GST_BUFFER_PTS (item->buffer), GST_BUFFER_DURATION (item->buffer));
+  }
+
+  gst_hyperspectral_frame_unmap(&frame);
+  return res;
+}
+
+static gpointer
+raw_writer_func (gpointer data)
+{
+  GstHspecFileSink *sink = data;
+  GstHspecRawWriter *w = &sink->writer;
+  RawItem *item;
+  gint64 start, elapsed;
+
+  for (;;) {
+    if (!(item = gst_hspec_ring_pop (w->ring))) {
+      g_mutex_lock (&w->lock);
+      g_atomic_int_set (&w->writer_waiting, TRUE);
+      while (!(item = gst_hspec_ring_pop (w->ring)) && !w->stopping)
+        g_cond_wait (&w->cond, &w->lock);
+      g_atomic_int_set (&w->writer_waiting, FALSE);
+      g_mutex_unlock (&w->lock);
+      /* stopping and everything queued is written */
+      if (!item)
+        break;
     }
-  } else if (sink->hinfo.format == GST_VIDEO_FORMAT_GRAY8 &&
-             sink->hinfo.layout == GST_HSPC_LAYOUT_INTERLEAVED) {
-    for (i=0; i<frame->info.height; i++) {
-      for (j=0; j<frame->info.width; j++) {
-        for (z=0; z<frame->info.wavelengths; z++) {
-          g_fprintf(hspecFile, "%u,",
-            data.u8[(j+(frame->info.width)*i)*frame->info.wavelengths + z]);
-        }
-        fputc('\n', hspecFile);
+
+    /* after an error the queue is only drained */
+    if (!g_atomic_int_get (&w->failed)) {
+      start = g_get_monotonic_time ();
+      if (write_raw_buffer (sink, item)) {
+        elapsed = g_get_monotonic_time () - start;
+        w->max_write_time = MAX (w->max_write_time, elapsed);
+        w->frames_written++;
+        w->bytes_written += sink->hinfo.cube_size;
+      } else {
+        g_atomic_int_set (&w->failed, TRUE);
       }
-      fputc('\n', hspecFile);
     }
-  } else if (sink->hinfo.format == GST_VIDEO_FORMAT_GRAY16_LE &&
-             sink->hinfo.layout == GST_HSPC_LAYOUT_MULTIPLANE) {
-    for (i=0; i<frame->info.height; i++) {
-      for (j=0; j<frame->info.width; j++) {
-        for (z=0; z<frame->info.wavelengths; z++) {
-          g_fprintf(hspecFile, "%u,", __bswap_16(data.u16[j+i*frame->info.width+
-            (frame)->info.width*(frame)->info.height*z]));
-        }
-        fputc('\n', hspecFile);
-      }
-      fputc('\n', hspecFile);
+    raw_item_free (item);
+
+    g_atomic_int_add (&w->queued, -1);
+    if (g_atomic_int_get (&w->streaming_waiting)) {
+      g_mutex_lock (&w->lock);
+      g_cond_broadcast (&w->cond);
+      g_mutex_unlock (&w->lock);
     }
-  } else if (sink->hinfo.format == GST_VIDEO_FORMAT_GRAY16_LE &&
-             sink->hinfo.layout == GST_HSPC_LAYOUT_INTERLEAVED) {
-    for (i=0; i<frame->info.height; i++) {
-      for (j=0; j<frame->info.width; j++) {
-        for (z=0; z<frame->info.wavelengths; z++) {
-          g_fprintf(hspecFile, "%u,",
-            __bswap_16(data.u16[(j+(frame->info.width)*i)*frame->info.wavelengths + z]));
-        }
-        fputc('\n', hspecFile);
-      }
-      fputc('\n', hspecFile);
+
+    if (sink->stats_interval && w->frames_written &&
+        w->frames_written % sink->stats_interval == 0)
+      post_raw_stats (sink);
+  }
+
+  return NULL;
+}
+
+static gboolean
+raw_writer_start (GstHspecFileSink * sink)
+{
+  GstHspecRawWriter *w = &sink->writer;
+  GError *err = NULL;
+
+  w->depth = sink->queue_frames;
+  if (sink->queue_bytes)
+    w->depth = CLAMP (sink->queue_bytes / sink->hinfo.cube_size, 1, w->depth);
+
+  w->ring = gst_hspec_ring_new (w->depth);
+  w->queued = 0;
+  w->failed = FALSE;
+  w->writer_waiting = FALSE;
+  w->streaming_waiting = FALSE;
+  w->stopping = FALSE;
+  w->frames_written = 0;
+  w->bytes_written = 0;
+  w->frames_dropped = 0;
+  w->peak_queued = 0;
+  w->max_write_time = 0;
+
+  w->thread = g_thread_try_new ("hspec-raw-writer", raw_writer_func, sink, &err);
+  if (!w->thread) {
+    GST_ERROR("Could not start the RAW writer thread: %s", err->message);
+    g_error_free (err);
+    gst_hspec_ring_free (w->ring);
+    w->ring = NULL;
+    return FALSE;
+  }
+
+  GST_DEBUG("RAW writer queues up to %d frames", w->depth);
+  return TRUE;
+}
+
+/* writes out everything still queued. A failed write only fails the next
+ * queued frame, the error for the last ones is posted here */
+static gboolean
+raw_writer_stop (GstHspecFileSink * sink)
+{
+  GstHspecRawWriter *w = &sink->writer;
+
+  if (!w->thread)
+    return TRUE;
+
+  g_mutex_lock (&w->lock);
+  w->stopping = TRUE;
+  g_cond_broadcast (&w->cond);
+  g_mutex_unlock (&w->lock);
+
+  g_thread_join (w->thread);
+  w->thread = NULL;
+  gst_hspec_ring_free (w->ring);
+  w->ring = NULL;
+
+  post_raw_stats (sink);
+
+  if (g_atomic_int_get (&w->failed)) {
+    GST_ELEMENT_ERROR (sink, RESOURCE, WRITE, (NULL),
+        ("Could not write all frames to %s", sink->filepath->str));
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* hands buf over to the writer thread, applying the overflow policy while
+ * the queue is full */
+static GstFlowReturn
+raw_writer_queue (GstHspecFileSink * sink, GstBuffer * buf, gboolean * queued_buf)
+{
+  GstHspecRawWriter *w = &sink->writer;
+  RawItem *item;
+  gboolean flushing;
+  gint queued;
+
+  *queued_buf = FALSE;
+  while (g_atomic_int_get (&w->queued) >= w->depth) {
+    if (g_atomic_int_get (&w->failed))
+      break;
+
+    if (sink->overflow == GST_HSPEC_FILE_SINK_OVERFLOW_DROP_NEWEST) {
+      GST_DEBUG("RAW writer queue full, dropping frame %ld", sink->image_counter);
+      g_atomic_int_inc (&w->frames_dropped);
+      return GST_FLOW_OK;
     }
-  } else if (sink->hinfo.format == GST_VIDEO_FORMAT_GRAY16_BE &&
-             sink->hinfo.layout == GST_HSPC_LAYOUT_MULTIPLANE) {
-    for (i=0; i<frame->info.height; i++) {
-      for (j=0; j<frame->info.width; j++) {
-        for (z=0; z<frame->info.wavelengths; z++) {
-          g_fprintf(hspecFile, "%u,",
-            data.u16[j+i*frame->info.width+
-             (frame)->info.width*(frame)->info.height*z]);
-        }
-        fputc('\n', hspecFile);
-      }
-      fputc('\n', hspecFile);
+
+    /* the frame being written can't be dropped, wait for it when nothing
+     * else is queued */
+    if (sink->overflow == GST_HSPEC_FILE_SINK_OVERFLOW_DROP_OLDEST &&
+        (item = gst_hspec_ring_pop (w->ring))) {
+      GST_DEBUG("RAW writer queue full, dropping frame %ld", item->counter);
+      raw_item_free (item);
+      g_atomic_int_add (&w->queued, -1);
+      g_atomic_int_inc (&w->frames_dropped);
+      continue;
     }
-  } else if (sink->hinfo.format == GST_VIDEO_FORMAT_GRAY16_BE &&
-             sink->hinfo.layout == GST_HSPC_LAYOUT_INTERLEAVED) {
-    for (i=0; i<frame->info.height; i++) {
-      for (j=0; j<frame->info.width; j++) {
-        for (z=0; z<frame->info.wavelengths; z++) {
-          g_fprintf(hspecFile, "%u,",
-            data.u16[(j+(frame->info.width)*i)*frame->info.wavelengths + z]);
+
+    g_mutex_lock (&w->lock);
+    g_atomic_int_set (&w->streaming_waiting, TRUE);
+    while (g_atomic_int_get (&w->queued) >= w->depth && !w->flushing &&
+        !g_atomic_int_get (&w->failed))
+      g_cond_wait (&w->cond, &w->lock);
+    g_atomic_int_set (&w->streaming_waiting, FALSE);
+    flushing = w->flushing;
+    g_mutex_unlock (&w->lock);
+
+    if (flushing)
+      return GST_FLOW_FLUSHING;
+  }
+
+  if (g_atomic_int_get (&w->failed)) {
+    GST_ERROR("RAW writer failed, not queueing frame %ld", sink->image_counter);
+    return GST_FLOW_ERROR;
+  }
+
+  item = g_slice_new (RawItem);
+  item->buffer = gst_buffer_ref (buf);
+  item->counter = sink->image_counter;
+
+  /* the writer only ever lowers queued, so there is room in the ring */
+  queued = g_atomic_int_add (&w->queued, 1) + 1;
+  if (queued > g_atomic_int_get (&w->peak_queued))
+    g_atomic_int_set (&w->peak_queued, queued);
+  gst_hspec_ring_push (w->ring, item);
+  *queued_buf = TRUE;
+
+  if (g_atomic_int_get (&w->writer_waiting)) {
+    g_mutex_lock (&w->lock);
+    g_cond_broadcast (&w->cond);
+    g_mutex_unlock (&w->lock);
+  }
+
+  return GST_FLOW_OK;
+}
+
+/* "00" to "99", two digits are converted at a time */
+static const gchar digit_pairs[201] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+/* decimal digits of v < 100000 at p, returns the end */
+static inline gchar *
+format_uint(gchar *p, guint v) {
+  if (v >= 10000) {
+    *p++ = '0' + v / 10000;
+    v %= 10000;
+    memcpy(p, digit_pairs + 2 * (v / 100), 2);
+    memcpy(p + 2, digit_pairs + 2 * (v % 100), 2);
+    return p + 4;
+  }
+  if (v >= 1000) {
+    memcpy(p, digit_pairs + 2 * (v / 100), 2);
+    memcpy(p + 2, digit_pairs + 2 * (v % 100), 2);
+    return p + 4;
+  }
+  if (v >= 100) {
+    *p++ = '0' + v / 100;
+    memcpy(p, digit_pairs + 2 * (v % 100), 2);
+    return p + 2;
+  }
+  if (v >= 10) {
+    memcpy(p, digit_pairs + 2 * v, 2);
+    return p + 2;
+  }
+  *p++ = '0' + v;
+  return p;
+}
+
+/* longest text of a sample and its comma, "%g" of floats included */
+#define CSV_SAMPLE_MAX_LEN 16
+/* text formatted before it is written */
+#define CSV_BATCH_SIZE (8 * 1024 * 1024)
+
+/* formats the samples of image row i at p, returns the end */
+static gchar *
+format_csv_row(const GstHyperspectralFrame * frame, gint i, gchar *p) {
+  const GstHyperspectralInfo *info = &frame->info;
+  const guint8 *u8 = frame->data;
+  const guint16 *u16 = frame->data;
+  const gfloat *f32 = frame->data;
+  gsize idx, band_step;
+  gint j, z;
+
+  band_step = info->layout == GST_HSPC_LAYOUT_INTERLEAVED ? 1 :
+      info->wavelength_elems;
+
+  for (j=0; j<info->width; j++) {
+    if (info->layout == GST_HSPC_LAYOUT_INTERLEAVED)
+      idx = (j + (gsize) info->width * i) * info->wavelengths;
+    else
+      idx = j + (gsize) info->width * i;
+
+    switch (info->format) {
+      case GST_HSPC_FORMAT_GRAY8:
+        for (z=0; z<info->wavelengths; z++, idx+=band_step) {
+          p = format_uint(p, u8[idx]);
+          *p++ = ',';
         }
-        fputc('\n', hspecFile);
-      }
-      fputc('\n', hspecFile);
+        break;
+      case GST_HSPC_FORMAT_GRAY16_LE:
+        for (z=0; z<info->wavelengths; z++, idx+=band_step) {
+          p = format_uint(p, GUINT16_FROM_LE(u16[idx]));
+          *p++ = ',';
+        }
+        break;
+      case GST_HSPC_FORMAT_GRAY16_BE:
+        for (z=0; z<info->wavelengths; z++, idx+=band_step) {
+          p = format_uint(p, GUINT16_FROM_BE(u16[idx]));
+          *p++ = ',';
+        }
+        break;
+      case GST_HSPC_FORMAT_F32:
+        for (z=0; z<info->wavelengths; z++, idx+=band_step)
+          p += g_snprintf(p, CSV_SAMPLE_MAX_LEN, "%g,", f32[idx]);
+        break;
+      case GST_HSPC_FORMAT_F16:
+        for (z=0; z<info->wavelengths; z++, idx+=band_step)
+          p += g_snprintf(p, CSV_SAMPLE_MAX_LEN, "%g,",
+              gst_hspec_half_to_float(u16[idx]));
+        break;
+      default:
+        g_assert_not_reached();
+        break;
     }
-  } else
+    *p++ = '\n';
+  }
+  *p++ = '\n';
+  return p;
+}
+
+typedef struct {
+  const GstHyperspectralFrame *frame;
+  gint first_row;
+  /* every row of the batch has row_size bytes of text, row_len are used */
+  gchar *text;
+  gsize row_size;
+  gsize *row_len;
+} CsvJob;
+
+static void
+format_csv_rows(gpointer user_data, guint start, guint end) {
+  CsvJob *job = user_data;
+  gchar *row;
+  guint r;
+
+  for (r=start; r<end; r++) {
+    row = job->text + r * job->row_size;
+    job->row_len[r] = format_csv_row(job->frame, job->first_row + r, row) - row;
+  }
+}
+
+static gboolean write_csv(GstHspecFileSink * sink, GstHyperspectralFrame * frame,
+    const gchar * base, gchar ** created) {
+  FILE *hspecFile = NULL;
+  gint i, rows, batch;
+  CsvJob job;
+  gchar *path = NULL;
+
+  job.text = NULL;
+  job.row_len = NULL;
+
+  if ((frame->info.format != GST_HSPC_FORMAT_GRAY8 &&
+       frame->info.format != GST_HSPC_FORMAT_GRAY16_LE &&
+       frame->info.format != GST_HSPC_FORMAT_GRAY16_BE &&
+       frame->info.format != GST_HSPC_FORMAT_F32 &&
+       frame->info.format != GST_HSPC_FORMAT_F16) ||
+      (frame->info.layout != GST_HSPC_LAYOUT_MULTIPLANE &&
+       frame->info.layout != GST_HSPC_LAYOUT_INTERLEAVED))
     goto layout_error;
 
+  path = g_strconcat(base, ".csv", NULL);
+  GST_DEBUG("Opening file: %s", path);
+  if ((hspecFile = g_fopen(path, "w")) == NULL)  {
+    GST_ERROR("An error occured while trying to create file %s", path);
+    goto error;
+  }
+
+  g_fprintf(hspecFile, "#HS-CSV image: "
+    "NumFrames: %d FrameWidth: %d FrameHeight: %d Format: %s\n",
+      sink->hinfo.width, sink->hinfo.height, sink->hinfo.wavelengths,
+      gst_hspec_format_to_string(sink->hinfo.format));
+
+  /* batches of rows are formatted in parallel into text slots of the
+   * longest possible row and written in order */
+  job.frame = frame;
+  job.row_size = (gsize) frame->info.width *
+      (frame->info.wavelengths * CSV_SAMPLE_MAX_LEN + 1) + 1;
+  batch = CLAMP(CSV_BATCH_SIZE / job.row_size, 1, frame->info.height);
+  job.text = g_malloc(batch * job.row_size);
+  job.row_len = g_new(gsize, batch);
+
+  for (job.first_row=0; job.first_row<frame->info.height;
+      job.first_row+=rows) {
+    rows = MIN(batch, frame->info.height - job.first_row);
+    gst_hspec_parallel_for(rows, sink->n_threads, format_csv_rows, &job);
+    for (i=0; i<rows; i++) {
+      if (fwrite(job.text + i * job.row_size, 1, job.row_len[i], hspecFile)
+          != job.row_len[i]) {
+        GST_ERROR("An error occured while writing to file %s", path);
+        goto error;
+      }
+    }
+  }
+
   for (i=0; i<sink->hinfo.wavelengths; i++)
     g_fprintf(hspecFile, "%d,%d,\n", i, sink->orderedspectra[i]);
 
-  fclose(hspecFile);
-  g_signal_emit (sink, gst_hspec_file_sink_signals[SIGNAL_IMAGE_CREATED],
-    0, sink->filepath->str);
+  g_free(job.text);
+  g_free(job.row_len);
+  if (fclose(hspecFile) != 0) {
+    GST_ERROR("An error occured while writing to file %s", path);
+    g_free(path);
+    return FALSE;
+  }
+  *created = path;
   return TRUE;
 
 error:
   {
+    g_free(job.text);
+    g_free(job.row_len);
+    g_free(path);
     if(hspecFile)
       fclose(hspecFile);
     return FALSE;
   }
 layout_error:
   {
-    if(hspecFile)
-      fclose(hspecFile);
     GST_ERROR("Unhandled combination of layout type %d and format %d",
-      sink->hinfo.layout, sink->hinfo.format);
+      frame->info.layout, frame->info.format);
     return FALSE;
   }
 }
 
-static gboolean write_xml(GstHspecFileSink * sink, GstHyperspectralFrame * frame) {
+/* longest "<frame frame_index=\"%u\">" plus "</frame>" */
+#define XML_FRAME_TAGS_LEN (20 + 10 + 2 + 8)
+/* longest "<pixel index=\"%u\">" plus "</pixel>" */
+#define XML_PIXEL_TAGS_LEN (14 + 10 + 2 + 8)
+
+/* decimal digits of any v at p, returns the end */
+static inline gchar *
+format_index(gchar *p, guint v) {
+  if (v < 100000)
+    return format_uint(p, v);
+  return p + g_snprintf(p, 11, "%u", v);
+}
+
+/* the samples of image row i pixel by pixel with 16 bit integers little
+ * endian, gathered to staging unless the cube holds them that way */
+static const guint8 *
+xml_row_samples(const GstHyperspectralFrame * frame, gint i, guint8 *staging) {
+  const GstHyperspectralInfo *info = &frame->info;
+  gsize row = (gsize) i * info->width;
+  gsize n = (gsize) info->width * info->wavelengths;
+  const guint8 *src;
+  gint z;
+
+  if (info->layout == GST_HSPC_LAYOUT_INTERLEAVED) {
+    src = (const guint8 *) frame->data + row * info->wavelengths * info->bytesize;
+    if (info->format != GST_HSPC_FORMAT_GRAY16_BE)
+      return src;
+    gst_hspec_kernel_swap_u16((guint16 *) staging, 1, (const guint16 *) src,
+        1, n);
+    return staging;
+  }
+
+  for (z=0; z<info->wavelengths; z++) {
+    src = GST_HSPEC_FRAME_WAVELENGTH_DATA_MULTIPLANE(frame, z) +
+        row * info->bytesize;
+    switch (info->format) {
+      case GST_HSPC_FORMAT_GRAY8:
+        gst_hspec_kernel_copy_u8(staging + z, info->wavelengths, src, 1,
+            info->width);
+        break;
+      case GST_HSPC_FORMAT_GRAY16_BE:
+        gst_hspec_kernel_swap_u16((guint16 *) staging + z, info->wavelengths,
+            (const guint16 *) src, 1, info->width);
+        break;
+      case GST_HSPC_FORMAT_F32:
+        gst_hspec_kernel_copy_f32((gfloat *) staging + z, info->wavelengths,
+            (const gfloat *) src, 1, info->width);
+        break;
+      default:
+        gst_hspec_kernel_copy_u16((guint16 *) staging + z, info->wavelengths,
+            (const guint16 *) src, 1, info->width);
+        break;
+    }
+  }
+  return staging;
+}
+
+typedef struct {
+  const GstHyperspectralFrame *frame;
+  gint first_row;
+  /* bytes of the samples of a pixel */
+  gsize pixel_size;
+  /* row_size bytes of text per row of the batch */
+  gchar *text;
+  gsize row_size;
+  gsize *row_len;
+} XmlJob;
+
+static void
+format_xml_rows(gpointer user_data, guint start, guint end) {
+  XmlJob *job = user_data;
+  const GstHyperspectralInfo *info = &job->frame->info;
+  const guint8 *samples;
+  guint8 *staging;
+  gchar *row, *p;
+  guint r;
+  gint j;
+
+  staging = g_malloc(info->width * job->pixel_size);
+  for (r=start; r<end; r++) {
+    samples = xml_row_samples(job->frame, job->first_row + r, staging);
+    row = p = job->text + r * job->row_size;
+    memcpy(p, "<frame frame_index=\"", 20);
+    p = format_index(p + 20, job->first_row + r);
+    *p++ = '"';
+    *p++ = '>';
+    for (j=0; j<info->width; j++) {
+      memcpy(p, "<pixel index=\"", 14);
+      p = format_index(p + 14, j);
+      *p++ = '"';
+      *p++ = '>';
+      p += gst_hspec_kernel_base64_encode(p, samples + j * job->pixel_size,
+          job->pixel_size);
+      memcpy(p, "</pixel>", 8);
+      p += 8;
+    }
+    memcpy(p, "</frame>", 8);
+    job->row_len[r] = p + 8 - row;
+  }
+  g_free(staging);
+}
+
+static gboolean write_xml(GstHspecFileSink * sink, GstHyperspectralFrame * frame,
+    const gchar * base, gchar ** created) {
   FILE *hspecFile = NULL;
-  gint i, j, z;
-  GString *filepath =  g_string_truncate(sink->filepath, sink->filepath_len);
-  g_string_append(sink->filepath, sink->filename->str);
+  gint i, rows, batch;
+  XmlJob job;
+  gchar *path = NULL;
+
+  job.text = NULL;
+  job.row_len = NULL;
+
+  if ((frame->info.format != GST_HSPC_FORMAT_GRAY8 &&
+       frame->info.format != GST_HSPC_FORMAT_GRAY16_LE &&
+       frame->info.format != GST_HSPC_FORMAT_GRAY16_BE &&
+       frame->info.format != GST_HSPC_FORMAT_F32 &&
+       frame->info.format != GST_HSPC_FORMAT_F16) ||
+      (frame->info.layout != GST_HSPC_LAYOUT_MULTIPLANE &&
+       frame->info.layout != GST_HSPC_LAYOUT_INTERLEAVED))
+    goto layout_error;
 
-  g_string_append(filepath, ".xml");
-  GST_DEBUG("Opening file: %s", filepath->str);
-  if ((hspecFile = g_fopen(filepath->str, "w")) == NULL)  {
-    GST_ERROR("An error occured while trying to create file %s", filepath->str);
+  path = g_strconcat(base, ".xml", NULL);
+  GST_DEBUG("Opening file: %s", path);
+  if ((hspecFile = g_fopen(path, "w")) == NULL)  {
+    GST_ERROR("An error occured while trying to create file %s", path);
     goto error;
   }
   /* might need to use fwprintf */
@@ -725,221 +1602,561 @@ static gboolean write_xml(GstHspecFileSink * sink, GstHyperspectralFrame * frame
     g_fprintf(hspecFile, "<wavelength>%d</wavelength>", sink->orderedspectra[i]);
   g_fprintf(hspecFile, "</spectral_line_map>");
 
-  if ((frame->info.format == GST_VIDEO_FORMAT_GRAY8 ||
-       frame->info.format == GST_VIDEO_FORMAT_GRAY16_LE) &&
-      frame->info.layout == GST_HSPC_LAYOUT_MULTIPLANE) {
-    for (i=0; i<frame->info.height; i++) {
-      g_fprintf(hspecFile, "<frame frame_index=\"%d\">", i);
-      for (j=0; j<frame->info.width; j++) {
-        g_fprintf(hspecFile, "<pixel index=\"%d\">", j);
-        for (z=0; z<frame->info.wavelengths; z++) {
-          fwrite(GST_HSPEC_FRAME_WAVELENGTH_DATA_MULTIPLANE(frame, z) +
-            j*frame->info.bytesize + i*frame->info.width*frame->info.bytesize,
-            frame->info.bytesize, 1, hspecFile);
-        }
-        g_fprintf(hspecFile, "</pixel>");
-      }
-      g_fprintf(hspecFile, "</frame>");
-    }
-  } else if ((frame->info.format == GST_VIDEO_FORMAT_GRAY8 ||
-              frame->info.format == GST_VIDEO_FORMAT_GRAY16_LE) &&
-             frame->info.layout == GST_HSPC_LAYOUT_INTERLEAVED) {
-    for (i=0; i<frame->info.height; i++) {
-      g_fprintf(hspecFile, "<frame frame_index=\"%d\">", i);
-      for (j=0; j<frame->info.width; j++) {
-        g_fprintf(hspecFile, "<pixel index=\"%d\">", j);
-        fwrite(frame->data + j*frame->info.bytesize +
-          i*frame->info.width*frame->info.bytesize,
-          frame->info.bytesize, frame->info.wavelength_elems, hspecFile);
-        g_fprintf(hspecFile, "</pixel>");
-      }
-      g_fprintf(hspecFile, "</frame>");
-    }
-  }
-  else if (frame->info.format == GST_VIDEO_FORMAT_GRAY16_BE &&
-      frame->info.layout == GST_HSPC_LAYOUT_MULTIPLANE) {
-    guint8 *data;
-    for (i=0; i<frame->info.height; i++) {
-      g_fprintf(hspecFile, "<frame frame_index=\"%d\">", i);
-      for (j=0; j<frame->info.width; j++) {
-        g_fprintf(hspecFile, "<pixel index=\"%d\">", j);
-        for (z=0; z<frame->info.wavelengths; z++) {
-          data = ((guint8*) (GST_HSPEC_FRAME_WAVELENGTH_DATA_MULTIPLANE(frame, z) +
-                    j*frame->info.bytesize + i*frame->info.width*frame->info.bytesize));
-          fputc(data[1], hspecFile);
-          fputc(data[0], hspecFile);
-        }
-        g_fprintf(hspecFile, "</pixel>");
-      }
-      g_fprintf(hspecFile, "</frame>");
-    }
-  } else if (frame->info.format == GST_VIDEO_FORMAT_GRAY16_BE &&
-             frame->info.layout == GST_HSPC_LAYOUT_INTERLEAVED) {
-    guint8 *data;
-    for (i=0; i<frame->info.height; i++) {
-      g_fprintf(hspecFile, "<frame frame_index=\"%d\">", i);
-      for (j=0; j<frame->info.width; j++) {
-        g_fprintf(hspecFile, "<pixel index=\"%d\">", j);
-        for (z=0; z<frame->info.wavelengths; z++) {
-          data = ((guint8*) (((j + i*frame->info.width)*frame->info.wavelengths
-            + z)*frame->info.bytesize));
-          fputc(data[1], hspecFile);
-          fputc(data[0], hspecFile);
-        }
-        g_fprintf(hspecFile, "</pixel>");
+  /* a pixel is the base64 of its samples, batches of rows are formatted in
+   * parallel and written in order like the CSV rows */
+  job.frame = frame;
+  job.pixel_size = (gsize) frame->info.wavelengths * frame->info.bytesize;
+  job.row_size = XML_FRAME_TAGS_LEN + (gsize) frame->info.width *
+      (XML_PIXEL_TAGS_LEN + (job.pixel_size + 2) / 3 * 4);
+  batch = CLAMP(CSV_BATCH_SIZE / job.row_size, 1, frame->info.height);
+  job.text = g_malloc(batch * job.row_size);
+  job.row_len = g_new(gsize, batch);
+
+  for (job.first_row=0; job.first_row<frame->info.height;
+      job.first_row+=rows) {
+    rows = MIN(batch, frame->info.height - job.first_row);
+    gst_hspec_parallel_for(rows, sink->n_threads, format_xml_rows, &job);
+    for (i=0; i<rows; i++) {
+      if (fwrite(job.text + i * job.row_size, 1, job.row_len[i], hspecFile)
+          != job.row_len[i]) {
+        GST_ERROR("An error occured while writing to file %s", path);
+        goto error;
       }
-      g_fprintf(hspecFile, "</frame>");
     }
-  }
-  else {
-
   }
   g_fprintf(hspecFile, "</hyperspectral_image>");
 
-  fclose(hspecFile);
-
-  g_signal_emit (sink, gst_hspec_file_sink_signals[SIGNAL_IMAGE_CREATED],
-    0, sink->filepath->str);
-
+  g_free(job.text);
+  g_free(job.row_len);
+  if (fclose(hspecFile) != 0) {
+    GST_ERROR("An error occured while writing to file %s", path);
+    g_free(path);
+    return FALSE;
+  }
+  *created = path;
   return TRUE;
 
 error:
   {
+    g_free(job.text);
+    g_free(job.row_len);
+    g_free(path);
     if(hspecFile)
       fclose(hspecFile);
     return FALSE;
   }
+layout_error:
+  {
+    GST_ERROR("Unhandled combination of layout type %d and format %d",
+      frame->info.layout, frame->info.format);
+    return FALSE;
+  }
+}
+
+/* pgm has no floating point samples, [0, 1] covers the full 16 bit range.
+ * Runs of n samples sstride apart are converted to big endian at dest */
+static void
+float_samples_to_pgm(guint16 *dest, const guint8 *src, gsize sstride,
+    GstHyperspectralFormat format, gsize n) {
+  gfloat tmp[1024];
+  gsize j, len;
+
+  for (j=0; j<n; j+=len) {
+    len = MIN(n - j, G_N_ELEMENTS(tmp));
+    if (format == GST_HSPC_FORMAT_F32)
+      gst_hspec_kernel_copy_f32(tmp, 1, (const gfloat *) src + j * sstride,
+          sstride, len);
+    else
+      gst_hspec_kernel_f16_to_f32(tmp, (const guint16 *) src + j * sstride,
+          sstride, len);
+    gst_hspec_kernel_scale_f32(tmp, G_MAXUINT16, 0.0f, len);
+    gst_hspec_kernel_f32_to_u16(dest + j, 1, tmp,
+        G_BYTE_ORDER == G_LITTLE_ENDIAN, len);
+  }
 }
 
+/* writes everything in iov, the first call usually does */
 static gboolean
-write_gerbil(GstHspecFileSink * sink, GstHyperspectralFrame * frame) {
-  FILE *imgFile = NULL, *headerFile = NULL;
-  gint i, j, val, len, maxval;
-  union {
-    guint8 *u8;
-    guint16 *u16;
-    gpointer ptr;
-  } data;
-  GstVideoFormat fmt = frame->info.format;
-  GString *filepath =  g_string_truncate(sink->filepath, sink->filepath_len);
-  g_string_append(sink->filepath, sink->filename->str);
+writev_all(gint fd, struct iovec *iov, gint n) {
+  gssize res;
+
+  while (n) {
+    res = writev(fd, iov, n);
+    if (res < 0) {
+      if (errno == EINTR)
+        continue;
+      return FALSE;
+    }
+    for (; n && (gsize) res >= iov->iov_len; iov++, n--)
+      res -= iov->iov_len;
+    if (n) {
+      iov->iov_base = (guint8 *) iov->iov_base + res;
+      iov->iov_len -= res;
+    }
+  }
+  return TRUE;
+}
+
+/* writes band i of the cube as a pgm image. The samples are staged in big
+ * endian order by the kernels, bands stored that way already are written
+ * as they are, header and samples with a single writev */
+static gboolean
+write_gerbil_band(GstHspecFileSink * sink, GstHyperspectralFrame * frame,
+    gint i, const gchar *path, gint maxval) {
+  const GstHyperspectralInfo *info = &frame->info;
+  gchar header[64];
+  struct iovec iov[2];
+  guint8 *src, *staging = NULL;
+  gsize sstride, n = info->wavelength_elems;
+  gint fd;
+  gboolean ret;
+
+  /* multiplane bands are contiguous, interleaved ones a sample per pixel */
+  if (info->layout == GST_HSPC_LAYOUT_MULTIPLANE) {
+    src = GST_HSPEC_FRAME_WAVELENGTH_DATA_MULTIPLANE(frame, i);
+    sstride = 1;
+  } else if (info->layout == GST_HSPC_LAYOUT_INTERLEAVED) {
+    src = (guint8 *) frame->data + i * info->bytesize;
+    sstride = info->wavelengths;
+  } else {
+    GST_ERROR("Unhandled cube layout type %d", info->layout);
+    return FALSE;
+  }
+
+  iov[1].iov_base = src;
+  switch (info->format) {
+    case GST_HSPC_FORMAT_GRAY8:
+      iov[1].iov_len = n;
+      if (sstride != 1) {
+        iov[1].iov_base = staging = g_malloc(n);
+        gst_hspec_kernel_copy_u8(staging, 1, src, sstride, n);
+      }
+      break;
+    case GST_HSPC_FORMAT_GRAY16_BE:
+      iov[1].iov_len = n * 2;
+      if (sstride != 1) {
+        iov[1].iov_base = staging = g_malloc(n * 2);
+        gst_hspec_kernel_copy_u16((guint16 *) staging, 1,
+            (const guint16 *) src, sstride, n);
+      }
+      break;
+    case GST_HSPC_FORMAT_GRAY16_LE:
+      iov[1].iov_len = n * 2;
+      iov[1].iov_base = staging = g_malloc(n * 2);
+      gst_hspec_kernel_swap_u16((guint16 *) staging, 1, (const guint16 *) src,
+          sstride, n);
+      break;
+    case GST_HSPC_FORMAT_F32:
+    case GST_HSPC_FORMAT_F16:
+      iov[1].iov_len = n * 2;
+      iov[1].iov_base = staging = g_malloc(n * 2);
+      float_samples_to_pgm((guint16 *) staging, src, sstride, info->format, n);
+      break;
+    default:
+      GST_ERROR("Unknown data format when writing to file");
+      return FALSE;
+  }
+
+  iov[0].iov_base = header;
+  iov[0].iov_len = g_snprintf(header, sizeof(header), "P5 %d %d %d ",
+      info->width, info->height, maxval);
+
+  GST_INFO("filename: %s", path);
+  if ((fd = g_open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)  {
+    GST_ERROR("An error occured while trying to create file %s", path);
+    g_free(staging);
+    return FALSE;
+  }
 
-  if (fmt == GST_VIDEO_FORMAT_GRAY8)
+  ret = writev_all(fd, iov, 2);
+  if (close(fd) < 0)
+    ret = FALSE;
+  if (!ret)
+    GST_ERROR("An error occured while writing to file %s: %s", path,
+        g_strerror(errno));
+
+  g_free(staging);
+  return ret;
+}
+
+typedef struct {
+  GstHspecFileSink *sink;
+  GstHyperspectralFrame *frame;
+  /* directory of the band images, ending with '/' */
+  const gchar *dir;
+  gint maxval;
+  gint failed;
+} GerbilJob;
+
+static void
+write_gerbil_bands(gpointer user_data, guint start, guint end) {
+  GerbilJob *job = user_data;
+  gchar *path;
+  guint i;
+
+  for (i=start; i<end && !g_atomic_int_get(&job->failed); i++) {
+    path = g_strdup_printf("%s%d.pgm", job->dir,
+        job->sink->hinfo.mosaic.spectras[i]);
+    if (!write_gerbil_band(job->sink, job->frame, i, path, job->maxval))
+      g_atomic_int_set(&job->failed, TRUE);
+    g_free(path);
+  }
+}
+
+static gboolean
+write_gerbil(GstHspecFileSink * sink, GstHyperspectralFrame * frame,
+    const gchar * base, gchar ** created) {
+  FILE *headerFile = NULL;
+  gint i, maxval;
+  GstHyperspectralFormat fmt = frame->info.format;
+  GerbilJob job;
+  gchar *path = NULL, *dir = NULL;
+
+  if (sink->hinfo.format == GST_HSPC_FORMAT_GRAY10P)
+    maxval = 1023;
+  else if (sink->hinfo.format == GST_HSPC_FORMAT_GRAY12P)
+    maxval = 4095;
+  else if (fmt == GST_HSPC_FORMAT_GRAY8)
     maxval = 255;
-  else if (fmt == GST_VIDEO_FORMAT_GRAY16_LE ||
-           fmt == GST_VIDEO_FORMAT_GRAY16_BE)
+  else if (fmt == GST_HSPC_FORMAT_GRAY16_LE ||
+           fmt == GST_HSPC_FORMAT_GRAY16_BE ||
+           fmt == GST_HSPC_FORMAT_F32 ||
+           fmt == GST_HSPC_FORMAT_F16)
     maxval = 65535;
   else {
     GST_ERROR("Unknown data format");
     return FALSE;
   }
 
-  if (access(filepath->str, F_OK) == -1) {
-    if (mkdir(filepath->str, 0700) == -1) {
-      GST_ERROR("An error occured while trying to create dir %s", filepath->str);
+  if (access(base, F_OK) == -1) {
+    if (mkdir(base, 0700) == -1) {
+      GST_ERROR("An error occured while trying to create dir %s", base);
       GST_ERROR("Reason: %s", g_strerror (errno));
       goto error;
     }
   }
   else {
-    GST_WARNING("File %s already exists, passing", filepath->str);
+    GST_WARNING("File %s already exists, passing", base);
     return TRUE;
   }
-  len = filepath->len;
-  g_string_append(filepath, ".gerbil");
-  GST_DEBUG("Opening file: %s", filepath->str);
-  if ((headerFile = g_fopen(filepath->str, "w")) == NULL)  {
-    GST_ERROR("An error occured while trying to create file %s", filepath->str);
+  path = g_strconcat(base, ".gerbil", NULL);
+  GST_DEBUG("Opening file: %s", path);
+  if ((headerFile = g_fopen(path, "w")) == NULL)  {
+    GST_ERROR("An error occured while trying to create file %s", path);
     goto error;
   }
-  g_string_truncate(filepath, len);
-  g_string_append_c(filepath, '/');
-  g_string_append_c(sink->filename, '/');
-  g_fprintf(headerFile, "%d %s\n", sink->hinfo.wavelengths, sink->filename->str);
-
-  for (i=0; i<sink->hinfo.wavelengths; i++) {
-    g_string_truncate(filepath, len+1);
-    val = sink->hinfo.mosaic.spectras[i];
-    glong_to_string(&sink->tbuf, val);
-    g_string_append(filepath, sink->tbuf.data);
-    g_string_append(filepath, ".pgm");
+  /* the band directory relative to the header */
+  g_fprintf(headerFile, "%d %s/\n", sink->hinfo.wavelengths,
+      base + sink->filepath_len);
+  for (i=0; i<sink->hinfo.wavelengths; i++)
     g_fprintf(headerFile, "%d.pgm %d\n", sink->orderedspectra[i],
       sink->orderedspectra[i]);
-    GST_INFO("filename: %s", filepath->str);
-
-    if ((imgFile = g_fopen(filepath->str, "wb")) == NULL)  {
-      GST_ERROR("An error occured while trying to create file %s", filepath->str);
-      goto error;
-    }
-    g_fprintf(imgFile, "P5 %d %d %d ", sink->hinfo.width, sink->hinfo.height, maxval);
-    if (frame->info.layout == GST_HSPC_LAYOUT_MULTIPLANE) {
-      data.ptr = GST_HSPEC_FRAME_WAVELENGTH_DATA_MULTIPLANE(frame, i);
-
-      for (j=0; j<sink->hinfo.wavelength_elems; j++) {
-        if (frame->info.format == GST_VIDEO_FORMAT_GRAY8)
-          fputc(data.u8[j], imgFile);
-        else if (frame->info.format == GST_VIDEO_FORMAT_GRAY16_LE) {
-          fputc(data.u8[j*2+1], imgFile);
-          fputc(data.u8[j*2], imgFile);
-        }
-        else if (frame->info.format == GST_VIDEO_FORMAT_GRAY16_BE) {
-          fputc(data.u8[j*2], imgFile);
-          fputc(data.u8[j*2+1], imgFile);
-        }
-        else {
-          GST_ERROR("Unknown data format when writing to file");
-          return FALSE;
-        }
-      }
-    } else if (frame->info.layout == GST_HSPC_LAYOUT_INTERLEAVED) {
-      data.ptr = frame->data + i*sink->hinfo.bytesize;
-
-      for (j=0; j<sink->hinfo.wavelength_elems; j++) {
-        if (frame->info.format == GST_VIDEO_FORMAT_GRAY8)
-          fputc(data.u8[j*sink->hinfo.wavelengths], imgFile);
-        else if (frame->info.format == GST_VIDEO_FORMAT_GRAY16_LE) {
-          fputc(data.u8[j*sink->hinfo.wavelengths*2+1], imgFile);
-          fputc(data.u8[j*sink->hinfo.wavelengths*2], imgFile);
-        }
-        else if (frame->info.format == GST_VIDEO_FORMAT_GRAY16_BE) {
-          fputc(data.u8[j*sink->hinfo.wavelengths*2], imgFile);
-          fputc(data.u8[j*sink->hinfo.wavelengths*2+1], imgFile);
-        }
-        else {
-          GST_ERROR("Unknown data format when writing to file");
-          return FALSE;
-        }
-      }
-    } else {
-      GST_ERROR("Unhandled cube layout type %d", frame->info.layout);
-    }
-
-    fclose(imgFile);
-  }
-
   fclose(headerFile);
-  g_string_truncate(filepath, len);
-  g_string_append(filepath, ".gerbil");
+  headerFile = NULL;
+
+  /* every band is a file of its own, they are written in parallel */
+  dir = g_strconcat(base, "/", NULL);
+  job.sink = sink;
+  job.frame = frame;
+  job.dir = dir;
+  job.maxval = maxval;
+  job.failed = FALSE;
+  gst_hspec_parallel_for(sink->hinfo.wavelengths, sink->n_threads,
+    write_gerbil_bands, &job);
+  g_free(dir);
+  if (job.failed)
+    goto error;
 
-  g_signal_emit (sink, gst_hspec_file_sink_signals[SIGNAL_IMAGE_CREATED],
-    0, sink->filepath->str);
+  *created = path;
   return TRUE;
 error:
   {
+    g_free(path);
     if(headerFile)
       fclose(headerFile);
-    if(imgFile)
-      fclose(imgFile);
     return FALSE;
   }
 }
 
+static void
+next_image_counter (GstHspecFileSink * sink)
+{
+  if (sink->image_counter == G_MAXLONG)
+    sink->image_counter = 0;
+  else
+    sink->image_counter++;
+}
+
+/* writes the cube in buf with the write function of the format. Packed
+ * cubes are unpacked to and padded ones copied to the scratch memory in
+ * unpacked and contiguous, allocated on first use */
+static gboolean
+write_cube (GstHspecFileSink * sink, GstBuffer * buf, const gchar * base,
+    gchar ** created, guint16 ** unpacked, guint8 ** contiguous)
+{
+  GstHyperspectralFrame frame;
+  gboolean res;
+
+  if (!gst_hyperspectral_frame_map(&frame, &sink->hinfo, buf,
+      GST_MAP_READ | GST_HYPERSPECTRAL_FRAME_MAP_FLAG_PLANES)) {
+    GST_ERROR_OBJECT(sink, "Could not map correctly hyperspectral image");
+    return FALSE;
+  }
+
+  /* only raw files can store packed samples as they are */
+  if (GST_HSPEC_FORMAT_IS_PACKED (sink->hinfo.format) &&
+      sink->file_format != GST_FILE_SINK_RAW) {
+    GstHyperspectralFrame unpacked_frame;
+    GstHyperspectralInfo info;
+
+    if (!*unpacked)
+      *unpacked = g_malloc (sink->hinfo.cube_elems * sizeof (guint16));
+    gst_hyperspectral_frame_unpack (&frame, *unpacked);
+    gst_hyperspectral_info_init_unpacked (&info, &frame.info);
+    info.format = GRAY16_NATIVE;
+    gst_hyperspectral_frame_wrap (&unpacked_frame, &info, *unpacked);
+    res = sink->fset.write_file_func (sink, &unpacked_frame, base, created);
+    gst_hyperspectral_info_clear (&info);
+  } else if (!gst_hyperspectral_frame_is_contiguous (&frame)) {
+    GstHyperspectralFrame contiguous_frame;
+
+    if (!*contiguous)
+      *contiguous = g_malloc (sink->hinfo.cube_size);
+    gst_hyperspectral_frame_wrap (&contiguous_frame, &sink->hinfo,
+        *contiguous);
+    gst_hyperspectral_frame_copy (&contiguous_frame, &frame);
+    res = sink->fset.write_file_func (sink, &contiguous_frame, base, created);
+  } else {
+    res = sink->fset.write_file_func (sink, &frame, base, created);
+  }
+
+  gst_hyperspectral_frame_unmap(&frame);
+  return res;
+}
+
+/* a cube waiting for or being written by an export thread */
+typedef struct {
+  GstBuffer *buffer;
+  gchar *base;
+  gchar *created;
+  gboolean done;
+} ExportItem;
+
+typedef struct {
+  guint16 *unpacked;
+  guint8 *contiguous;
+} ExportScratch;
+
+static void
+export_item_free (ExportItem *item)
+{
+  if (item->buffer)
+    gst_buffer_unref (item->buffer);
+  g_free (item->base);
+  g_free (item->created);
+  g_slice_free (ExportItem, item);
+}
+
+static void
+export_scratch_free (ExportScratch *scratch)
+{
+  g_free (scratch->unpacked);
+  g_free (scratch->contiguous);
+  g_slice_free (ExportScratch, scratch);
+}
+
+/* writes a cube, then announces the finished cubes at the head of the
+ * queue unless another thread already does */
+static void
+export_func (gpointer data, gpointer user_data)
+{
+  ExportItem *item = data;
+  GstHspecFileSink *sink = user_data;
+  GstHspecFileExporter *e = &sink->exporter;
+  ExportScratch *scratch;
+  gboolean failed;
+
+  g_mutex_lock (&e->lock);
+  scratch = g_queue_pop_head (&e->scratch);
+  failed = e->failed;
+  g_mutex_unlock (&e->lock);
+  if (!scratch)
+    scratch = g_slice_new0 (ExportScratch);
+
+  /* after an error the queued cubes are only dropped */
+  if (!failed && !write_cube (sink, item->buffer, item->base, &item->created,
+      &scratch->unpacked, &scratch->contiguous)) {
+    GST_ERROR("Write function failed for category %s",
+      write_cat_params[sink->file_format].category_name);
+    failed = TRUE;
+  }
+  gst_buffer_unref (item->buffer);
+  item->buffer = NULL;
+
+  g_mutex_lock (&e->lock);
+  g_queue_push_head (&e->scratch, scratch);
+  item->done = TRUE;
+  if (failed)
+    e->failed = TRUE;
+  if (e->announcing) {
+    g_mutex_unlock (&e->lock);
+    return;
+  }
+
+  e->announcing = TRUE;
+  while ((item = g_queue_peek_head (&e->items)) && item->done) {
+    g_queue_pop_head (&e->items);
+    g_mutex_unlock (&e->lock);
+    if (item->created)
+      g_signal_emit (sink, gst_hspec_file_sink_signals[SIGNAL_IMAGE_CREATED],
+        0, item->created);
+    export_item_free (item);
+    g_mutex_lock (&e->lock);
+  }
+  e->announcing = FALSE;
+  g_cond_broadcast (&e->cond);
+  g_mutex_unlock (&e->lock);
+}
+
+static gboolean
+export_start (GstHspecFileSink * sink)
+{
+  GstHspecFileExporter *e = &sink->exporter;
+  GError *err = NULL;
+
+  /* every thread has a cube queued behind the one it writes */
+  e->depth = 2 * sink->export_threads;
+  e->failed = FALSE;
+  e->reported = FALSE;
+  e->pool = g_thread_pool_new (export_func, sink, sink->export_threads, TRUE,
+      &err);
+  if (!e->pool) {
+    GST_ERROR("Could not start the export threads: %s", err->message);
+    g_error_free (err);
+    return FALSE;
+  }
+
+  GST_DEBUG("%d export threads", sink->export_threads);
+  return TRUE;
+}
+
+/* waits until all queued cubes are written and announced, posts an error
+ * for a cube that failed after the last one was queued */
+static gboolean
+export_drain (GstHspecFileSink * sink)
+{
+  GstHspecFileExporter *e = &sink->exporter;
+  gboolean failed, report;
+
+  g_mutex_lock (&e->lock);
+  while (!g_queue_is_empty (&e->items) || e->announcing)
+    g_cond_wait (&e->cond, &e->lock);
+  failed = e->failed;
+  report = failed && !e->reported;
+  if (report)
+    e->reported = TRUE;
+  g_mutex_unlock (&e->lock);
+
+  if (report)
+    GST_ELEMENT_ERROR (sink, RESOURCE, WRITE, (NULL),
+        ("Could not write the files of a %s cube",
+         write_cat_params[sink->file_format].category_name));
+
+  return !failed;
+}
+
+/* writes out everything still queued */
+static gboolean
+export_stop (GstHspecFileSink * sink)
+{
+  GstHspecFileExporter *e = &sink->exporter;
+  ExportScratch *scratch;
+  gboolean res;
+
+  if (!e->pool)
+    return TRUE;
+
+  res = export_drain (sink);
+  g_thread_pool_free (e->pool, FALSE, TRUE);
+  e->pool = NULL;
+
+  while ((scratch = g_queue_pop_head (&e->scratch)))
+    export_scratch_free (scratch);
+
+  return res;
+}
+
+/* hands buf over to the export threads, waiting while the queue is full */
+static GstFlowReturn
+export_queue (GstHspecFileSink * sink, GstBuffer * buf, const gchar * base)
+{
+  GstHspecFileExporter *e = &sink->exporter;
+  ExportItem *item = NULL;
+  gboolean flushing, failed;
+
+  g_mutex_lock (&e->lock);
+  while (g_queue_get_length (&e->items) >= e->depth && !e->flushing &&
+      !e->failed)
+    g_cond_wait (&e->cond, &e->lock);
+  flushing = e->flushing;
+  failed = e->failed;
+  /* the flow error already reports it */
+  if (failed)
+    e->reported = TRUE;
+  if (!flushing && !failed) {
+    item = g_slice_new0 (ExportItem);
+    item->buffer = gst_buffer_ref (buf);
+    item->base = g_strdup (base);
+    g_queue_push_tail (&e->items, item);
+  }
+  g_mutex_unlock (&e->lock);
+
+  if (flushing)
+    return GST_FLOW_FLUSHING;
+  if (failed) {
+    GST_ERROR("Export failed, not queueing frame %ld", sink->image_counter);
+    return GST_FLOW_ERROR;
+  }
+
+  /* the pool takes the cubes in the order they are pushed */
+  g_thread_pool_push (e->pool, item, NULL);
+  return GST_FLOW_OK;
+}
+
 static GstFlowReturn
 gst_hspec_file_sink_show_frame (GstVideoSink * sink, GstBuffer * buf)
 {
   GstHspecFileSink *fsink = GST_HSPEC_FILE_SINK (sink);
-  GstHyperspectralFrame frame;
-  gboolean res = TRUE;
+  GstFlowReturn ret;
+  gchar *created = NULL;
+  gboolean res, queued;
+
+  /* the recording is complete */
+  if (fsink->file_format == GST_FILE_SINK_RAW && fsink->max_frames &&
+      fsink->raw_frames == fsink->max_frames) {
+    GST_DEBUG_OBJECT(sink, "recorded %u frames", fsink->max_frames);
+    return GST_FLOW_EOS;
+  }
+
+  /* RAW frames go to the writer thread as they are, dropped ones don't
+   * count towards max-frames */
+  if (fsink->writer.thread) {
+    ret = raw_writer_queue(fsink, buf, &queued);
+    if (ret == GST_FLOW_OK)
+      next_image_counter(fsink);
+    if (queued)
+      fsink->raw_frames++;
+    return ret;
+  }
+
+  /* the index of RAW recordings keeps the timestamps */
+  fsink->raw_pts = GST_BUFFER_PTS(buf);
+  fsink->raw_duration = GST_BUFFER_DURATION(buf);
+
+  if (!fsink->fset.write_file_func) {
+    GST_ERROR("Write File function not defined!");
+    return GST_FLOW_ERROR;
+  }
 
   /* build file name */
   if(!glong_to_string(&fsink->tbuf, fsink->image_counter))
@@ -948,34 +2165,39 @@ gst_hspec_file_sink_show_frame (GstVideoSink * sink, GstBuffer * buf)
   g_string_truncate(fsink->filename, fsink->filename_len);
   g_string_append(fsink->filename, fsink->tbuf.data);
 
-  if (!gst_hyperspectral_frame_map(&frame, &fsink->hinfo, buf, GST_MAP_READ))
-    goto invalid_buffer;
+  /* the files of other formats are named after the cube, the RAW recording
+   * keeps the path it was opened with */
+  if (fsink->file_format != GST_FILE_SINK_RAW) {
+    g_string_truncate(fsink->filepath, fsink->filepath_len);
+    g_string_append(fsink->filepath, fsink->filename->str);
+  }
 
-  if (!fsink->fset.write_file_func) {
-    GST_ERROR("Write File function not defined!");
-    return GST_FLOW_ERROR;
+  if (fsink->exporter.pool) {
+    ret = export_queue(fsink, buf, fsink->filepath->str);
+    if (ret == GST_FLOW_OK)
+      next_image_counter(fsink);
+    return ret;
   }
-  res = fsink->fset.write_file_func (fsink, &frame);
 
-  if (fsink->image_counter == G_MAXLONG)
-    fsink->image_counter = 0;
-  else
-    fsink->image_counter++;
+  res = write_cube(fsink, buf, fsink->filepath->str, &created,
+      &fsink->unpacked, &fsink->contiguous);
 
-  gst_hyperspectral_frame_unmap(&frame);
+  next_image_counter(fsink);
 
   if (!res) {
     GST_ERROR("Write function failed for category %s",
       write_cat_params[fsink->file_format].category_name);
     return GST_FLOW_ERROR;
   }
-  return GST_FLOW_OK;
+  if (fsink->file_format == GST_FILE_SINK_RAW)
+    fsink->raw_frames++;
 
-invalid_buffer:
-  {
-    GST_ERROR_OBJECT(sink, "Could not map correctly hyperspectral image");
-    return GST_FLOW_ERROR;
+  if (created) {
+    g_signal_emit (fsink, gst_hspec_file_sink_signals[SIGNAL_IMAGE_CREATED],
+      0, created);
+    g_free (created);
   }
+  return GST_FLOW_OK;
 }
 
 gboolean
@@ -24,6 +24,7 @@
 #include <gst/video/gstvideosink.h>
 #include <gst/hyperspectral/hyperspectral.h>
 #include <stdio.h>
+#include "gsthspecrawfile.h"
 
 G_BEGIN_DECLS
 
@@ -40,6 +41,13 @@ typedef enum {
   GST_FILE_SINK_XML,
 } GstFileSinkFileFormat;
 
+/* what happens to a RAW frame arriving while the writer queue is full */
+typedef enum {
+  GST_HSPEC_FILE_SINK_OVERFLOW_BLOCK,
+  GST_HSPEC_FILE_SINK_OVERFLOW_DROP_OLDEST,
+  GST_HSPEC_FILE_SINK_OVERFLOW_DROP_NEWEST,
+} GstHspecFileSinkOverflow;
+
 typedef struct _GstHspecFileSink GstHspecFileSink;
 typedef struct _GstHspecFileSinkClass GstHspecFileSinkClass;
 
@@ -48,8 +56,58 @@ typedef struct {
   glong size;
 } TBuf;
 
+/* thread writing RAW frames so disk stalls don't hold up the streaming
+ * thread, buffers are handed over through a lock-free ring */
+typedef struct {
+  GThread *thread;
+  GstHspecRing *ring;
+  /* frames queued or being written at most */
+  gint depth;
+  volatile gint queued;
+  volatile gint failed;
+
+  /* only taken to sleep on cond, the flags say who is asleep */
+  GMutex lock;
+  GCond cond;
+  volatile gint writer_waiting;
+  volatile gint streaming_waiting;
+  gboolean stopping;
+  gboolean flushing;
+
+  /* statistics */
+  guint64 frames_written;
+  guint64 bytes_written;
+  volatile gint frames_dropped;
+  gint peak_queued;
+  gint64 max_write_time;
+} GstHspecRawWriter;
+
+/* threads writing the cubes of the Gerbil, CSV and XML formats, several
+ * cubes are written at the same time and announced in frame order */
+typedef struct {
+  GThreadPool *pool;
+  /* cubes queued or being written at most */
+  gint depth;
+
+  GMutex lock;
+  GCond cond;
+  /* cubes queued or being written, oldest first */
+  GQueue items;
+  /* a thread is announcing the finished cubes at the head of items */
+  gboolean announcing;
+  /* scratch memory for packed and padded cubes, reused between cubes */
+  GQueue scratch;
+  gboolean failed;
+  /* the failure was posted or returned as a flow error */
+  gboolean reported;
+  gboolean flushing;
+} GstHspecFileExporter;
+
+/* base is the path of the files of the cube without extension, created
+ * is set to the file announced with file-image-created */
 typedef struct {
-  gboolean (*write_file_func) (GstHspecFileSink *sink, GstHyperspectralFrame *frame);
+  gboolean (*write_file_func) (GstHspecFileSink *sink, GstHyperspectralFrame *frame,
+                               const gchar *base, gchar **created);
   gboolean (*init_file_func) (GstHspecFileSink *sink);
   gboolean (*cleanup_file_func) (GstHspecFileSink *sink);
 } func_set;
@@ -65,6 +123,10 @@ struct _GstHspecFileSink
   GString *filename;
   gint filename_len;
   gint * orderedspectra;
+  /* unpacked samples for writers that can't handle packed formats */
+  guint16 *unpacked;
+  /* copy of cubes with padded planes, the writers expect them back to back */
+  guint8 *contiguous;
   glong image_counter;
 
   gchar * tbuff;
@@ -72,10 +134,47 @@ struct _GstHspecFileSink
   TBuf tbuf;
 
   GstFileSinkFileFormat file_format;
+  /* upper limit of threads writing the files of a cube, 0 for the whole
+   * pool */
+  guint n_threads;
 
   func_set fset;
 
-  FILE *file;
+  /* RAW recording */
+  GstHspecRawFile *file;
+  GstCaps *caps;
+  /* GstHspecRecordingEntry of every frame written, the index at the end of
+   * the recording */
+  GArray *raw_index;
+  /* file position of the next frame */
+  guint64 raw_offset;
+  /* timestamps of the frame the streaming thread writes */
+  GstClockTime raw_pts;
+  GstClockTime raw_duration;
+  GstHspecIoMode io_mode;
+  GstHspecMmapPolicy mmap_policy;
+  /* frames between syncs of the recording, 0 never syncs */
+  guint sync_frames;
+  /* length of the recording, frames after it end the stream, 0 records
+   * until EOS */
+  guint max_frames;
+  guint raw_frames;
+
+  /* RAW frames queued for the writer thread, 0 writes them from the
+   * streaming thread */
+  guint queue_frames;
+  /* further limits the queue to this many bytes, 0 for no limit */
+  guint64 queue_bytes;
+  GstHspecFileSinkOverflow overflow;
+  /* frames written between statistics messages, 0 only posts them when
+   * the writer stops */
+  guint stats_interval;
+  GstHspecRawWriter writer;
+
+  /* cubes of the other formats written at the same time, 0 writes them
+   * from the streaming thread */
+  guint export_threads;
+  GstHspecFileExporter exporter;
 };
 
 struct _GstHspecFileSinkClass
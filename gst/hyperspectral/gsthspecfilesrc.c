@@ -0,0 +1,517 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+/**
+ * SECTION:element-gsthspecfilesrc
+ *
+ * The hspec-filesrc element plays back RAW recordings of hspec-filesink.
+ * The recording is memory mapped and every cube is pushed as a read only
+ * buffer wrapping its part of the mapping, nothing is copied. Frames ahead
+ * of the current one are paged in with madvise while downstream works.
+ *
+ * The source works in TIME and only pushes, there is no byte offset to
+ * pull a cube from. Seeking uses the index of the recording, negative rates
+ * play it backwards and trick mode seeks skip frames to keep up with the
+ * rate. With is-live the frames are pushed at the pace they were recorded,
+ * scaled by the rate property.
+ *
+ * <refsect2>
+ * <title>Example launch line</title>
+ * |[
+ * gst-launch -v hspec-filesrc location=recording.raw ! hspec-reducer ! hspecdec ! autovideosink
+ * ]|
+ * Plays back a recording as fast as the downstream elements allow.
+ * </refsect2>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+#include <gst/base/gstpushsrc.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "gsthspecfilesrc.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_hspec_file_src_debug_category);
+#define GST_CAT_DEFAULT gst_hspec_file_src_debug_category
+
+/* prototypes */
+
+
+static void gst_hspec_file_src_set_property (GObject * object,
+    guint property_id, const GValue * value, GParamSpec * pspec);
+static void gst_hspec_file_src_get_property (GObject * object,
+    guint property_id, GValue * value, GParamSpec * pspec);
+static void gst_hspec_file_src_finalize (GObject * object);
+
+static GstCaps *gst_hspec_file_src_get_caps (GstBaseSrc * src,
+    GstCaps * filter);
+static gboolean gst_hspec_file_src_start (GstBaseSrc * src);
+static gboolean gst_hspec_file_src_stop (GstBaseSrc * src);
+static void gst_hspec_file_src_get_times (GstBaseSrc * src, GstBuffer * buffer,
+    GstClockTime * start, GstClockTime * end);
+static gboolean gst_hspec_file_src_is_seekable (GstBaseSrc * src);
+static gboolean gst_hspec_file_src_do_seek (GstBaseSrc * src,
+    GstSegment * segment);
+static GstFlowReturn gst_hspec_file_src_create (GstPushSrc * src,
+    GstBuffer ** buf);
+
+enum
+{
+  PROP_0,
+  PROP_LOCATION,
+  PROP_IS_LIVE,
+  PROP_RATE,
+  PROP_READAHEAD,
+};
+
+#define DEFAULT_IS_LIVE FALSE
+#define DEFAULT_RATE 1.0
+#define DEFAULT_READAHEAD 2
+
+/* pad templates */
+
+static GstStaticPadTemplate gst_hspec_file_src_src_template =
+GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_HYPERSPECTRAL_CAPS_MAKE_WITH_ALL_FORMATS())
+    );
+
+
+/* class initialization */
+
+G_DEFINE_TYPE_WITH_CODE (GstHspecFileSrc, gst_hspec_file_src, GST_TYPE_PUSH_SRC,
+  GST_DEBUG_CATEGORY_INIT (gst_hspec_file_src_debug_category, "hspec-filesrc", 0,
+  "debug category for hspecfilesrc element"));
+
+static void
+gst_hspec_file_src_class_init (GstHspecFileSrcClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstBaseSrcClass *base_src_class = GST_BASE_SRC_CLASS (klass);
+  GstPushSrcClass *push_src_class = GST_PUSH_SRC_CLASS (klass);
+
+  gst_element_class_add_pad_template (GST_ELEMENT_CLASS(klass),
+      gst_static_pad_template_get (&gst_hspec_file_src_src_template));
+
+  gst_element_class_set_static_metadata (GST_ELEMENT_CLASS(klass),
+      "Hyperspectral file source", "Source/File/hyperspectral/Video",
+      "Plays back RAW recordings of hyperspectral cubes",
+      "Dimitrios Katsaros <patcherwork@gmail.com>");
+
+  gobject_class->set_property = gst_hspec_file_src_set_property;
+  gobject_class->get_property = gst_hspec_file_src_get_property;
+  gobject_class->finalize = gst_hspec_file_src_finalize;
+  base_src_class->get_caps = GST_DEBUG_FUNCPTR (gst_hspec_file_src_get_caps);
+  base_src_class->start = GST_DEBUG_FUNCPTR (gst_hspec_file_src_start);
+  base_src_class->stop = GST_DEBUG_FUNCPTR (gst_hspec_file_src_stop);
+  base_src_class->get_times = GST_DEBUG_FUNCPTR (gst_hspec_file_src_get_times);
+  base_src_class->is_seekable = GST_DEBUG_FUNCPTR (gst_hspec_file_src_is_seekable);
+  base_src_class->do_seek = GST_DEBUG_FUNCPTR (gst_hspec_file_src_do_seek);
+  push_src_class->create = GST_DEBUG_FUNCPTR (gst_hspec_file_src_create);
+
+  g_object_class_install_property (gobject_class, PROP_LOCATION,
+      g_param_spec_string ("location", "File Location",
+          "Location of the recording to read", NULL,
+          G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_IS_LIVE,
+      g_param_spec_boolean ("is-live", "Is live",
+          "Push the frames at the pace they were recorded",
+          DEFAULT_IS_LIVE, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_RATE,
+      g_param_spec_double ("rate", "Rate",
+          "Playback speed, the timestamps of the recording are divided by it",
+          0.001, 1000.0, DEFAULT_RATE,
+          G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_READAHEAD,
+      g_param_spec_uint ("readahead", "Readahead",
+          "Number of frames ahead of the current one paged in from disk",
+          0, G_MAXUINT, DEFAULT_READAHEAD,
+          G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+}
+
+static void
+gst_hspec_file_src_init (GstHspecFileSrc *filesrc)
+{
+  filesrc->location = NULL;
+  filesrc->is_live = DEFAULT_IS_LIVE;
+  filesrc->rate = DEFAULT_RATE;
+  filesrc->readahead = DEFAULT_READAHEAD;
+  filesrc->rec = NULL;
+  filesrc->mapped = NULL;
+  filesrc->base_pts = 0;
+  filesrc->position = 0;
+  filesrc->step = 1;
+  filesrc->refill = TRUE;
+
+  gst_base_src_set_format (GST_BASE_SRC (filesrc), GST_FORMAT_TIME);
+  gst_base_src_set_live (GST_BASE_SRC (filesrc), DEFAULT_IS_LIVE);
+}
+
+void
+gst_hspec_file_src_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstHspecFileSrc *filesrc = GST_HSPEC_FILE_SRC (object);
+
+  GST_DEBUG_OBJECT (filesrc, "set_property");
+
+  switch (property_id) {
+    case PROP_LOCATION:
+      g_free (filesrc->location);
+      filesrc->location = g_value_dup_string (value);
+      break;
+    case PROP_IS_LIVE:
+      filesrc->is_live = g_value_get_boolean (value);
+      gst_base_src_set_live (GST_BASE_SRC (filesrc), filesrc->is_live);
+      break;
+    case PROP_RATE:
+      filesrc->rate = g_value_get_double (value);
+      break;
+    case PROP_READAHEAD:
+      filesrc->readahead = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+void
+gst_hspec_file_src_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstHspecFileSrc *filesrc = GST_HSPEC_FILE_SRC (object);
+
+  GST_DEBUG_OBJECT (filesrc, "get_property");
+
+  switch (property_id) {
+    case PROP_LOCATION:
+      g_value_set_string (value, filesrc->location);
+      break;
+    case PROP_IS_LIVE:
+      g_value_set_boolean (value, filesrc->is_live);
+      break;
+    case PROP_RATE:
+      g_value_set_double (value, filesrc->rate);
+      break;
+    case PROP_READAHEAD:
+      g_value_set_uint (value, filesrc->readahead);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+void
+gst_hspec_file_src_finalize (GObject * object)
+{
+  GstHspecFileSrc *filesrc = GST_HSPEC_FILE_SRC (object);
+
+  GST_DEBUG_OBJECT (filesrc, "finalize");
+
+  g_free (filesrc->location);
+  filesrc->location = NULL;
+
+  G_OBJECT_CLASS (gst_hspec_file_src_parent_class)->finalize (object);
+}
+
+/* timestamps of the recording to the output and back */
+
+static GstClockTime
+to_output_time (GstHspecFileSrc * filesrc, GstClockTime pts)
+{
+  if (!GST_CLOCK_TIME_IS_VALID (pts))
+    return GST_CLOCK_TIME_NONE;
+  if (pts < filesrc->base_pts)
+    return 0;
+  return (GstClockTime) ((pts - filesrc->base_pts) / filesrc->rate);
+}
+
+static GstClockTime
+to_recording_time (GstHspecFileSrc * filesrc, GstClockTime time)
+{
+  return filesrc->base_pts + (GstClockTime) (time * filesrc->rate);
+}
+
+static GstCaps *
+gst_hspec_file_src_get_caps (GstBaseSrc * src, GstCaps * filter)
+{
+  GstHspecFileSrc *filesrc = GST_HSPEC_FILE_SRC (src);
+  GstCaps *caps, *tmp;
+
+  if (filesrc->rec)
+    caps = gst_hspec_recording_get_caps (filesrc->rec);
+  else
+    caps = gst_pad_get_pad_template_caps (GST_BASE_SRC_PAD (src));
+
+  if (filter) {
+    tmp = gst_caps_intersect_full (filter, caps, GST_CAPS_INTERSECT_FIRST);
+    gst_caps_unref (caps);
+    caps = tmp;
+  }
+
+  return caps;
+}
+
+static gboolean
+gst_hspec_file_src_start (GstBaseSrc * src)
+{
+  GstHspecFileSrc *filesrc = GST_HSPEC_FILE_SRC (src);
+  GstHspecRecordingEntry first, last;
+  GError *err = NULL;
+  guint64 n_frames;
+
+  GST_DEBUG_OBJECT (filesrc, "start");
+
+  if (!filesrc->location) {
+    GST_ELEMENT_ERROR (filesrc, RESOURCE, NOT_FOUND,
+        ("No recording to read"), ("location property not set"));
+    return FALSE;
+  }
+
+  if (!(filesrc->rec = gst_hspec_recording_open (filesrc->location))) {
+    GST_ELEMENT_ERROR (filesrc, RESOURCE, OPEN_READ,
+        ("Could not read recording \"%s\"", filesrc->location), (NULL));
+    return FALSE;
+  }
+
+  /* the whole file stays mapped, buffers keep a reference to the mapping */
+  filesrc->mapped = g_mapped_file_new (filesrc->location, FALSE, &err);
+  if (!filesrc->mapped) {
+    GST_ELEMENT_ERROR (filesrc, RESOURCE, OPEN_READ,
+        ("Could not map recording \"%s\"", filesrc->location),
+        ("%s", err->message));
+    g_error_free (err);
+    gst_hspec_recording_free (filesrc->rec);
+    filesrc->rec = NULL;
+    return FALSE;
+  }
+
+  filesrc->base_pts = 0;
+  filesrc->position = 0;
+  filesrc->step = 1;
+  filesrc->refill = TRUE;
+
+  n_frames = gst_hspec_recording_get_n_frames (filesrc->rec);
+  if (n_frames && gst_hspec_recording_get_entry (filesrc->rec, 0, &first) &&
+      GST_CLOCK_TIME_IS_VALID (first.pts))
+    filesrc->base_pts = first.pts;
+
+  /* answers duration queries */
+  if (n_frames &&
+      gst_hspec_recording_get_entry (filesrc->rec, n_frames - 1, &last) &&
+      GST_CLOCK_TIME_IS_VALID (last.pts)) {
+    GST_OBJECT_LOCK (filesrc);
+    src->segment.duration = to_output_time (filesrc, last.pts) +
+        (GST_CLOCK_TIME_IS_VALID (last.duration) ?
+        (GstClockTime) (last.duration / filesrc->rate) : 0);
+    GST_OBJECT_UNLOCK (filesrc);
+  }
+
+  GST_DEBUG_OBJECT (filesrc, "playing %" G_GUINT64_FORMAT " frames of %s",
+      n_frames, filesrc->location);
+  return TRUE;
+}
+
+static gboolean
+gst_hspec_file_src_stop (GstBaseSrc * src)
+{
+  GstHspecFileSrc *filesrc = GST_HSPEC_FILE_SRC (src);
+
+  GST_DEBUG_OBJECT (filesrc, "stop");
+
+  /* pushed buffers keep their own reference */
+  if (filesrc->mapped)
+    g_mapped_file_unref (filesrc->mapped);
+  filesrc->mapped = NULL;
+  if (filesrc->rec)
+    gst_hspec_recording_free (filesrc->rec);
+  filesrc->rec = NULL;
+
+  return TRUE;
+}
+
+/* live playback waits for the clock to reach every frame */
+static void
+gst_hspec_file_src_get_times (GstBaseSrc * src, GstBuffer * buffer,
+    GstClockTime * start, GstClockTime * end)
+{
+  GstClockTime timestamp;
+
+  *start = GST_CLOCK_TIME_NONE;
+  *end = GST_CLOCK_TIME_NONE;
+
+  if (!gst_base_src_is_live (src))
+    return;
+
+  timestamp = GST_BUFFER_PTS (buffer);
+  if (GST_CLOCK_TIME_IS_VALID (timestamp)) {
+    *start = timestamp;
+    if (GST_BUFFER_DURATION_IS_VALID (buffer))
+      *end = timestamp + GST_BUFFER_DURATION (buffer);
+  }
+}
+
+/* TIME seeks only, do_seek turns them into a frame of the index */
+static gboolean
+gst_hspec_file_src_is_seekable (GstBaseSrc * src)
+{
+  return !gst_base_src_is_live (src);
+}
+
+static gboolean
+gst_hspec_file_src_do_seek (GstBaseSrc * src, GstSegment * segment)
+{
+  GstHspecFileSrc *filesrc = GST_HSPEC_FILE_SRC (src);
+  GstClockTime target;
+
+  /* the initial seek comes before start */
+  if (!filesrc->rec)
+    return TRUE;
+
+  /* reverse playback starts with the last frame before stop */
+  if (segment->rate < 0) {
+    if (GST_CLOCK_TIME_IS_VALID (segment->stop) && segment->stop > 0) {
+      target = to_recording_time (filesrc, segment->stop - 1);
+      filesrc->position = gst_hspec_recording_find_frame (filesrc->rec, target);
+    } else {
+      filesrc->position = gst_hspec_recording_get_n_frames (filesrc->rec) - 1;
+    }
+  } else {
+    target = to_recording_time (filesrc, segment->start);
+    filesrc->position = gst_hspec_recording_find_frame (filesrc->rec, target);
+  }
+
+  /* trick modes skip frames, every frame is a key frame */
+  filesrc->step = 1;
+  if (segment->flags & GST_SEGMENT_FLAG_TRICKMODE)
+    filesrc->step = MAX (1, (gint64) ABS (segment->rate));
+  if (segment->rate < 0)
+    filesrc->step = -filesrc->step;
+  filesrc->refill = TRUE;
+
+  GST_DEBUG_OBJECT (filesrc, "seek to frame %" G_GINT64_FORMAT ", step %"
+      G_GINT64_FORMAT, filesrc->position, filesrc->step);
+  return TRUE;
+}
+
+/* pages in the frames the next outputs are going to need */
+static void
+readahead_frames (GstHspecFileSrc * filesrc, gint64 first, guint count)
+{
+  const GstHyperspectralInfo *info;
+  GstHspecRecordingEntry entry;
+  gchar *data;
+  gsize page, start;
+  guint i;
+
+  info = gst_hspec_recording_get_info (filesrc->rec);
+  data = g_mapped_file_get_contents (filesrc->mapped);
+  page = sysconf (_SC_PAGESIZE);
+
+  for (i=0; i<count; i++, first+=filesrc->step) {
+    if (first < 0 ||
+        !gst_hspec_recording_get_entry (filesrc->rec, first, &entry))
+      break;
+    start = entry.offset & ~(page - 1);
+    madvise (data + start, entry.offset - start + info->cube_size,
+        MADV_WILLNEED);
+  }
+}
+
+static GstFlowReturn
+gst_hspec_file_src_create (GstPushSrc * src, GstBuffer ** buf)
+{
+  GstHspecFileSrc *filesrc = GST_HSPEC_FILE_SRC (src);
+  const GstHyperspectralInfo *info;
+  GstHspecRecordingEntry entry;
+  GstSegment *segment = &GST_BASE_SRC (src)->segment;
+  GstClockTime pts, duration;
+  GstBuffer *buffer;
+  gchar *data;
+
+  if (filesrc->position < 0 ||
+      !gst_hspec_recording_get_entry (filesrc->rec, filesrc->position, &entry))
+    return GST_FLOW_EOS;
+
+  info = gst_hspec_recording_get_info (filesrc->rec);
+  if (entry.offset + info->cube_size >
+      g_mapped_file_get_length (filesrc->mapped)) {
+    GST_ELEMENT_ERROR (filesrc, RESOURCE, READ, (NULL),
+        ("frame %" G_GINT64_FORMAT " lies past the end of %s",
+            filesrc->position, filesrc->location));
+    return GST_FLOW_ERROR;
+  }
+
+  pts = to_output_time (filesrc, entry.pts);
+  duration = GST_CLOCK_TIME_IS_VALID (entry.duration) ?
+      (GstClockTime) (entry.duration / filesrc->rate) : GST_CLOCK_TIME_NONE;
+
+  /* the segment ends at stop going forward and at start going backwards */
+  if (GST_CLOCK_TIME_IS_VALID (pts)) {
+    if (segment->rate >= 0 && GST_CLOCK_TIME_IS_VALID (segment->stop) &&
+        pts >= segment->stop)
+      return GST_FLOW_EOS;
+    if (segment->rate < 0 && GST_CLOCK_TIME_IS_VALID (duration) &&
+        pts + duration <= segment->start)
+      return GST_FLOW_EOS;
+  }
+
+  data = g_mapped_file_get_contents (filesrc->mapped);
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY,
+      data + entry.offset, info->cube_size, 0, info->cube_size,
+      g_mapped_file_ref (filesrc->mapped),
+      (GDestroyNotify) g_mapped_file_unref);
+
+  GST_BUFFER_PTS (buffer) = pts;
+  GST_BUFFER_DTS (buffer) = pts;
+  GST_BUFFER_DURATION (buffer) = duration;
+  GST_BUFFER_OFFSET (buffer) = entry.number;
+  GST_BUFFER_OFFSET_END (buffer) = entry.number + 1;
+  gst_buffer_add_hyperspectral_meta (buffer, info);
+
+  /* after a seek the whole window is missing, later only its far end */
+  if (filesrc->readahead) {
+    if (filesrc->refill)
+      readahead_frames (filesrc, filesrc->position + filesrc->step,
+          filesrc->readahead);
+    else
+      readahead_frames (filesrc,
+          filesrc->position + filesrc->step * filesrc->readahead, 1);
+  }
+  filesrc->refill = FALSE;
+  filesrc->position += filesrc->step;
+
+  *buf = buffer;
+  return GST_FLOW_OK;
+}
+
+gboolean
+gst_hspec_file_src_plugin_init (GstPlugin * plugin)
+{
+  return gst_element_register (plugin, "hspec-filesrc", GST_RANK_NONE,
+      GST_TYPE_HSPEC_FILE_SRC);
+}
@@ -0,0 +1,73 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_HSPEC_FILE_SRC_H_
+#define _GST_HSPEC_FILE_SRC_H_
+
+#include <gst/base/gstpushsrc.h>
+#include <gst/hyperspectral/hyperspectral.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_HSPEC_FILE_SRC   (gst_hspec_file_src_get_type())
+#define GST_HSPEC_FILE_SRC(obj)   (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_HSPEC_FILE_SRC,GstHspecFileSrc))
+#define GST_HSPEC_FILE_SRC_CLASS(klass)   (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_HSPEC_FILE_SRC,GstHspecFileSrcClass))
+#define GST_IS_HSPEC_FILE_SRC(obj)   (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_HSPEC_FILE_SRC))
+#define GST_IS_HSPEC_FILE_SRC_CLASS(obj)   (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_HSPEC_FILE_SRC))
+
+typedef struct _GstHspecFileSrc GstHspecFileSrc;
+typedef struct _GstHspecFileSrcClass GstHspecFileSrcClass;
+
+struct _GstHspecFileSrc
+{
+  GstPushSrc base_hspecfilesrc;
+
+  gchar *location;
+  gboolean is_live;
+  /* playback speed, scales the timestamps of the recording */
+  gdouble rate;
+  /* frames ahead of the current one paged in with madvise */
+  guint readahead;
+
+  GstHspecRecording *rec;
+  GMappedFile *mapped;
+  /* timestamp of the first frame, the output starts at 0 */
+  GstClockTime base_pts;
+
+  /* next frame to output, negative or past the end at the end of the
+   * segment */
+  gint64 position;
+  /* frames between two outputs, negative for reverse playback */
+  gint64 step;
+  /* the whole readahead window has to be paged in again */
+  gboolean refill;
+};
+
+struct _GstHspecFileSrcClass
+{
+  GstPushSrcClass base_hspecfilesrc_class;
+};
+
+GType gst_hspec_file_src_get_type (void);
+
+gboolean gst_hspec_file_src_plugin_init (GstPlugin * plugin);
+
+G_END_DECLS
+
+#endif
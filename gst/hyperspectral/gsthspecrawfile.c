@@ -0,0 +1,753 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* O_DIRECT */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <gst/gst.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "gsthspecrawfile.h"
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+/* O_DIRECT transfers have to start and end on multiples of the logical
+ * block size of the device, 4096 covers all current disks */
+#define DIRECT_ALIGN 4096
+/* data collected before it is written with O_DIRECT */
+#define DIRECT_STAGING_SIZE (8 * 1024 * 1024)
+
+/* io_uring writes in flight at most, each from its own registered buffer */
+#define URING_BUFFERS 4
+#define URING_BUFFER_SIZE (4 * 1024 * 1024)
+/* room for the writes and the syncs between them */
+#define URING_ENTRIES (2 * URING_BUFFERS)
+
+/* a memory mapped recording is handed to the kernel in ranges of this size,
+ * a multiple of the page size */
+#define MMAP_WINDOW (32 * 1024 * 1024)
+
+struct _GstHspecRawFile
+{
+  GstHspecIoMode mode;
+  gchar *path;
+
+  gboolean (*write) (GstHspecRawFile *file, const guint8 *data, gsize size);
+  gboolean (*sync) (GstHspecRawFile *file);
+  gboolean (*close) (GstHspecRawFile *file);
+  /* closing syncs too once the file was synced */
+  gboolean synced;
+
+  /* GST_HSPEC_IO_MODE_STDIO */
+  FILE *fp;
+
+  /* GST_HSPEC_IO_MODE_DIRECT and GST_HSPEC_IO_MODE_URING */
+  gint fd;
+  guint8 *staging;
+  gsize fill;
+  /* GST_HSPEC_IO_MODE_URING and GST_HSPEC_IO_MODE_MMAP, file position of
+   * the next write */
+  guint64 offset;
+
+  /* GST_HSPEC_IO_MODE_MMAP */
+  guint8 *map;
+  guint64 reserve;
+  GstHspecMmapPolicy policy;
+  /* everything before it was handed to the kernel or synced */
+  guint64 released;
+  guint64 synced_to;
+
+#ifdef HAVE_LIBURING
+  /* GST_HSPEC_IO_MODE_URING, staging is the buffer being filled */
+  struct io_uring ring;
+  struct iovec iov[URING_BUFFERS];
+  /* bytes being written from every buffer, 0 once it is free */
+  gsize len[URING_BUFFERS];
+  gboolean registered;
+  guint cur;
+  guint in_flight;
+  /* first failure of a completed request, a negative errno */
+  gint error;
+#endif
+};
+
+/* stdio */
+
+static gboolean
+stdio_write (GstHspecRawFile *file, const guint8 *data, gsize size)
+{
+  return fwrite (data, 1, size, file->fp) == size;
+}
+
+static gboolean
+stdio_sync (GstHspecRawFile *file)
+{
+  return fflush (file->fp) == 0 && fdatasync (fileno (file->fp)) == 0;
+}
+
+static gboolean
+stdio_close (GstHspecRawFile *file)
+{
+  gboolean res = TRUE;
+
+  if (file->synced && !stdio_sync (file))
+    res = FALSE;
+  if (fclose (file->fp) != 0)
+    res = FALSE;
+  return res;
+}
+
+static gboolean
+stdio_open (GstHspecRawFile *file)
+{
+  if ((file->fp = g_fopen (file->path, "w")) == NULL)
+    return FALSE;
+
+  file->write = stdio_write;
+  file->sync = stdio_sync;
+  file->close = stdio_close;
+  return TRUE;
+}
+
+/* O_DIRECT */
+
+static gboolean
+write_all (gint fd, const guint8 *data, gsize size)
+{
+  gssize res;
+
+  while (size) {
+    res = write (fd, data, size);
+    if (res < 0) {
+      if (errno == EINTR)
+        continue;
+      return FALSE;
+    }
+    data += res;
+    size -= res;
+  }
+  return TRUE;
+}
+
+static gboolean
+direct_write (GstHspecRawFile *file, const guint8 *data, gsize size)
+{
+  gsize len;
+
+  while (size) {
+    /* aligned memory at an aligned file offset goes to the disk as it is */
+    if (file->fill == 0 && size >= DIRECT_ALIGN &&
+        ((guintptr) data % DIRECT_ALIGN) == 0) {
+      len = size & ~((gsize) DIRECT_ALIGN - 1);
+      if (!write_all (file->fd, data, len))
+        return FALSE;
+      data += len;
+      size -= len;
+      continue;
+    }
+
+    len = MIN (size, DIRECT_STAGING_SIZE - file->fill);
+    memcpy (file->staging + file->fill, data, len);
+    file->fill += len;
+    data += len;
+    size -= len;
+
+    if (file->fill == DIRECT_STAGING_SIZE) {
+      if (!write_all (file->fd, file->staging, file->fill))
+        return FALSE;
+      file->fill = 0;
+    }
+  }
+  return TRUE;
+}
+
+/* the staged part short of a block stays in memory */
+static gboolean
+direct_sync (GstHspecRawFile *file)
+{
+  gsize aligned;
+
+  aligned = file->fill & ~((gsize) DIRECT_ALIGN - 1);
+  if (aligned) {
+    if (!write_all (file->fd, file->staging, aligned))
+      return FALSE;
+    memmove (file->staging, file->staging + aligned, file->fill - aligned);
+    file->fill -= aligned;
+  }
+  return fdatasync (file->fd) == 0;
+}
+
+/* the tail of the recording is rarely a whole block, it is written after
+ * switching the descriptor back to buffered io */
+static gboolean
+write_tail (gint fd, const guint8 *data, gsize size)
+{
+  gint flags;
+
+  flags = fcntl (fd, F_GETFL);
+  if (flags < 0 || fcntl (fd, F_SETFL, flags & ~O_DIRECT) < 0)
+    return FALSE;
+  return write_all (fd, data, size);
+}
+
+static gboolean
+direct_close (GstHspecRawFile *file)
+{
+  gboolean res = TRUE;
+  gsize aligned;
+
+  aligned = file->fill & ~((gsize) DIRECT_ALIGN - 1);
+  if (aligned && !write_all (file->fd, file->staging, aligned))
+    res = FALSE;
+
+  if (res && file->fill > aligned &&
+      !write_tail (file->fd, file->staging + aligned, file->fill - aligned))
+    res = FALSE;
+
+  if (res && file->synced && fdatasync (file->fd) < 0)
+    res = FALSE;
+
+  free (file->staging);
+  if (close (file->fd) < 0)
+    res = FALSE;
+  return res;
+}
+
+static gboolean
+direct_open (GstHspecRawFile *file)
+{
+#ifdef O_DIRECT
+  file->fd = g_open (file->path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+  if (file->fd < 0) {
+    /* tmpfs and some network filesystems refuse O_DIRECT */
+    if (errno != EINVAL)
+      return FALSE;
+    GST_WARNING ("%s does not support direct io, using buffered io",
+        file->path);
+    file->mode = GST_HSPEC_IO_MODE_STDIO;
+    return stdio_open (file);
+  }
+
+  if (posix_memalign ((void **) &file->staging, DIRECT_ALIGN,
+      DIRECT_STAGING_SIZE) != 0) {
+    close (file->fd);
+    errno = ENOMEM;
+    return FALSE;
+  }
+  file->fill = 0;
+
+  file->write = direct_write;
+  file->sync = direct_sync;
+  file->close = direct_close;
+  return TRUE;
+#else
+  GST_WARNING ("Direct io is not available, using buffered io");
+  file->mode = GST_HSPEC_IO_MODE_STDIO;
+  return stdio_open (file);
+#endif
+}
+
+/* io_uring */
+
+#ifdef HAVE_LIBURING
+static gboolean
+uring_failed (GstHspecRawFile *file)
+{
+  if (!file->error)
+    return FALSE;
+  errno = -file->error;
+  return TRUE;
+}
+
+/* waits for one request to complete */
+static gboolean
+uring_reap (GstHspecRawFile *file)
+{
+  struct io_uring_cqe *cqe;
+  guint idx;
+  gint res;
+
+  do {
+    res = io_uring_wait_cqe (&file->ring, &cqe);
+  } while (res == -EINTR);
+  if (res < 0) {
+    errno = -res;
+    return FALSE;
+  }
+
+  /* writes carry the index of their buffer + 1, syncs 0 */
+  idx = GPOINTER_TO_UINT (io_uring_cqe_get_data (cqe));
+  if (cqe->res < 0) {
+    if (!file->error)
+      file->error = cqe->res;
+  } else if (idx && (gsize) cqe->res != file->len[idx - 1]) {
+    if (!file->error)
+      file->error = -EIO;
+  }
+  if (idx)
+    file->len[idx - 1] = 0;
+  file->in_flight--;
+  io_uring_cqe_seen (&file->ring, cqe);
+
+  return TRUE;
+}
+
+/* queues len bytes of the current buffer, a linked sync is only started
+ * once all earlier requests are done */
+static gboolean
+uring_submit (GstHspecRawFile *file, gsize len, gboolean sync)
+{
+  struct io_uring_sqe *sqe;
+  guint idx = file->cur;
+  gint res;
+
+  if (!len && !sync)
+    return TRUE;
+
+  while (file->in_flight + 2 > URING_ENTRIES) {
+    if (!uring_reap (file))
+      return FALSE;
+  }
+
+  if (len) {
+    sqe = io_uring_get_sqe (&file->ring);
+    if (file->registered)
+      io_uring_prep_write_fixed (sqe, file->fd, file->iov[idx].iov_base, len,
+          file->offset, idx);
+    else
+      io_uring_prep_write (sqe, file->fd, file->iov[idx].iov_base, len,
+          file->offset);
+    io_uring_sqe_set_data (sqe, GUINT_TO_POINTER (idx + 1));
+    if (sync)
+      io_uring_sqe_set_flags (sqe, IOSQE_IO_LINK | IOSQE_IO_DRAIN);
+    file->len[idx] = len;
+    file->offset += len;
+    file->in_flight++;
+  }
+
+  if (sync) {
+    sqe = io_uring_get_sqe (&file->ring);
+    io_uring_prep_fsync (sqe, file->fd, IORING_FSYNC_DATASYNC);
+    io_uring_sqe_set_data (sqe, NULL);
+    if (!len)
+      io_uring_sqe_set_flags (sqe, IOSQE_IO_DRAIN);
+    file->in_flight++;
+  }
+
+  if ((res = io_uring_submit (&file->ring)) < 0) {
+    errno = -res;
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* writes the whole blocks of the current buffer and carries the rest over
+ * to the next one, waiting for it to be free */
+static gboolean
+uring_flush (GstHspecRawFile *file, gboolean sync)
+{
+  gsize aligned;
+  guint next;
+
+  aligned = file->fill & ~((gsize) DIRECT_ALIGN - 1);
+  if (!uring_submit (file, aligned, sync))
+    return FALSE;
+  if (!aligned)
+    return !uring_failed (file);
+
+  next = (file->cur + 1) % URING_BUFFERS;
+  while (file->len[next]) {
+    if (!uring_reap (file))
+      return FALSE;
+  }
+  memcpy (file->iov[next].iov_base, file->staging + aligned,
+      file->fill - aligned);
+  file->fill -= aligned;
+  file->cur = next;
+  file->staging = file->iov[next].iov_base;
+
+  return !uring_failed (file);
+}
+
+static gboolean
+uring_write (GstHspecRawFile *file, const guint8 *data, gsize size)
+{
+  gsize len;
+
+  while (size) {
+    len = MIN (size, URING_BUFFER_SIZE - file->fill);
+    memcpy (file->staging + file->fill, data, len);
+    file->fill += len;
+    data += len;
+    size -= len;
+
+    if (file->fill == URING_BUFFER_SIZE && !uring_flush (file, FALSE))
+      return FALSE;
+  }
+  return !uring_failed (file);
+}
+
+/* returns once the sync is queued, failures show up on later calls */
+static gboolean
+uring_sync (GstHspecRawFile *file)
+{
+  return uring_flush (file, TRUE);
+}
+
+static void
+uring_free (GstHspecRawFile *file)
+{
+  guint i;
+
+  if (file->registered)
+    io_uring_unregister_buffers (&file->ring);
+  io_uring_queue_exit (&file->ring);
+  for (i=0; i<URING_BUFFERS; i++)
+    free (file->iov[i].iov_base);
+}
+
+static gboolean
+uring_close (GstHspecRawFile *file)
+{
+  gboolean res;
+
+  res = uring_flush (file, FALSE);
+  while (file->in_flight) {
+    if (!uring_reap (file)) {
+      res = FALSE;
+      break;
+    }
+  }
+  if (uring_failed (file))
+    res = FALSE;
+
+  if (res && file->fill) {
+    if (lseek (file->fd, file->offset, SEEK_SET) < 0 ||
+        !write_tail (file->fd, file->staging, file->fill) ||
+        (file->synced && fdatasync (file->fd) < 0))
+      res = FALSE;
+  }
+
+  uring_free (file);
+  if (close (file->fd) < 0)
+    res = FALSE;
+  return res;
+}
+#endif
+
+static gboolean
+uring_open (GstHspecRawFile *file)
+{
+#ifdef HAVE_LIBURING
+  gint flags = O_WRONLY | O_CREAT | O_TRUNC;
+  gint i, res;
+
+  file->fd = g_open (file->path, flags | O_DIRECT, 0666);
+  if (file->fd < 0 && errno == EINVAL)
+    file->fd = g_open (file->path, flags, 0666);
+  if (file->fd < 0)
+    return FALSE;
+
+  if ((res = io_uring_queue_init (URING_ENTRIES, &file->ring, 0)) < 0) {
+    GST_WARNING ("io_uring is not available (%s), using direct io",
+        g_strerror (-res));
+    close (file->fd);
+    file->mode = GST_HSPEC_IO_MODE_DIRECT;
+    return direct_open (file);
+  }
+
+  for (i=0; i<URING_BUFFERS; i++) {
+    if (posix_memalign (&file->iov[i].iov_base, DIRECT_ALIGN,
+        URING_BUFFER_SIZE) != 0) {
+      uring_free (file);
+      close (file->fd);
+      errno = ENOMEM;
+      return FALSE;
+    }
+    file->iov[i].iov_len = URING_BUFFER_SIZE;
+  }
+
+  /* registering pins the buffers, RLIMIT_MEMLOCK may not allow it */
+  res = io_uring_register_buffers (&file->ring, file->iov, URING_BUFFERS);
+  file->registered = res == 0;
+  if (!file->registered)
+    GST_DEBUG ("Could not register io_uring buffers: %s", g_strerror (-res));
+
+  file->staging = file->iov[0].iov_base;
+  file->fill = 0;
+
+  file->write = uring_write;
+  file->sync = uring_sync;
+  file->close = uring_close;
+  return TRUE;
+#else
+  GST_WARNING ("Built without io_uring support, using direct io");
+  file->mode = GST_HSPEC_IO_MODE_DIRECT;
+  return direct_open (file);
+#endif
+}
+
+/* mmap */
+
+/* hands the written range [start, start + MMAP_WINDOW) to the kernel */
+static gboolean
+mmap_release (GstHspecRawFile *file, guint64 start)
+{
+  switch (file->policy) {
+    case GST_HSPEC_MMAP_POLICY_WRITEBACK:
+#ifdef SYNC_FILE_RANGE_WRITE
+      /* writeback of this range starts now, the one before it had a whole
+       * window of time to finish and is dropped */
+      if (sync_file_range (file->fd, start, MMAP_WINDOW,
+          SYNC_FILE_RANGE_WRITE) < 0)
+        return FALSE;
+      if (start < MMAP_WINDOW)
+        return TRUE;
+      start -= MMAP_WINDOW;
+      if (sync_file_range (file->fd, start, MMAP_WINDOW,
+          SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+          SYNC_FILE_RANGE_WAIT_AFTER) < 0)
+        return FALSE;
+      break;
+#endif
+    case GST_HSPEC_MMAP_POLICY_MSYNC:
+      if (msync (file->map + start, MMAP_WINDOW, MS_SYNC) < 0)
+        return FALSE;
+      break;
+    default:
+      return TRUE;
+  }
+
+  /* the pages are clean, neither the mapping nor the page cache has to keep
+   * them */
+  madvise (file->map + start, MMAP_WINDOW, MADV_DONTNEED);
+  posix_fadvise (file->fd, start, MMAP_WINDOW, POSIX_FADV_DONTNEED);
+  return TRUE;
+}
+
+static gboolean
+mmap_write (GstHspecRawFile *file, const guint8 *data, gsize size)
+{
+  if (size > file->reserve - file->offset) {
+    errno = ENOSPC;
+    return FALSE;
+  }
+
+  memcpy (file->map + file->offset, data, size);
+  file->offset += size;
+
+  while (file->offset - file->released >= MMAP_WINDOW) {
+    if (!mmap_release (file, file->released))
+      return FALSE;
+    file->released += MMAP_WINDOW;
+  }
+  return TRUE;
+}
+
+static gboolean
+mmap_sync (GstHspecRawFile *file)
+{
+  if (msync (file->map + file->synced_to, file->offset - file->synced_to,
+      MS_SYNC) < 0)
+    return FALSE;
+  /* msync starts on a page boundary */
+  file->synced_to = file->offset & ~((guint64) sysconf (_SC_PAGESIZE) - 1);
+  return TRUE;
+}
+
+static gboolean
+mmap_close (GstHspecRawFile *file)
+{
+  gboolean res = TRUE;
+
+  if (file->synced && !mmap_sync (file))
+    res = FALSE;
+  if (munmap (file->map, file->reserve) < 0)
+    res = FALSE;
+
+  /* gives back what the recording did not use */
+  if (ftruncate (file->fd, file->offset) < 0)
+    res = FALSE;
+  if (res && file->synced && fdatasync (file->fd) < 0)
+    res = FALSE;
+
+  if (close (file->fd) < 0)
+    res = FALSE;
+  return res;
+}
+
+static gboolean
+mmap_open (GstHspecRawFile *file)
+{
+  gint res;
+
+  if (file->reserve == 0 || file->reserve > G_MAXSIZE) {
+    GST_WARNING ("The size of %s is not known, using buffered io",
+        file->path);
+    file->mode = GST_HSPEC_IO_MODE_STDIO;
+    return stdio_open (file);
+  }
+
+  /* mapping for writing needs read access to the file */
+  file->fd = g_open (file->path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (file->fd < 0)
+    return FALSE;
+
+  /* allocates all blocks up front so the copies never fault on a full disk,
+   * filesystems without fallocate get a sparse file */
+#ifdef FALLOC_FL_KEEP_SIZE
+  if (fallocate (file->fd, 0, 0, file->reserve) < 0 && errno != EOPNOTSUPP)
+    goto error;
+#endif
+  if (ftruncate (file->fd, file->reserve) < 0)
+    goto error;
+
+  file->map = mmap (NULL, file->reserve, PROT_READ | PROT_WRITE, MAP_SHARED,
+      file->fd, 0);
+  if (file->map == MAP_FAILED)
+    goto error;
+  madvise (file->map, file->reserve, MADV_SEQUENTIAL);
+
+  file->offset = 0;
+  file->released = 0;
+  file->synced_to = 0;
+
+  file->write = mmap_write;
+  file->sync = mmap_sync;
+  file->close = mmap_close;
+  return TRUE;
+
+error:
+  res = errno;
+  close (file->fd);
+  g_unlink (file->path);
+  errno = res;
+  return FALSE;
+}
+
+/* creates or truncates path, returns NULL on errors. reserve is the size of
+ * the whole recording, the mmap mode preallocates it and fails writes past
+ * it, the other modes ignore it */
+GstHspecRawFile *
+gst_hspec_raw_file_open (const gchar *path, GstHspecIoMode mode,
+    guint64 reserve)
+{
+  GstHspecRawFile *file;
+  gboolean res;
+
+  g_return_val_if_fail (path != NULL, NULL);
+
+  file = g_new0 (GstHspecRawFile, 1);
+  file->mode = mode;
+  file->path = g_strdup (path);
+  file->fd = -1;
+  file->reserve = reserve;
+
+  switch (mode) {
+    case GST_HSPEC_IO_MODE_DIRECT:
+      res = direct_open (file);
+      break;
+    case GST_HSPEC_IO_MODE_URING:
+      res = uring_open (file);
+      break;
+    case GST_HSPEC_IO_MODE_MMAP:
+      res = mmap_open (file);
+      break;
+    default:
+      res = stdio_open (file);
+      break;
+  }
+
+  if (!res) {
+    GST_ERROR ("Could not open %s: %s", path, g_strerror (errno));
+    g_free (file->path);
+    g_free (file);
+    return NULL;
+  }
+
+  return file;
+}
+
+/* only used by the mmap mode, set it before the first write */
+void
+gst_hspec_raw_file_set_mmap_policy (GstHspecRawFile *file,
+    GstHspecMmapPolicy policy)
+{
+  g_return_if_fail (file != NULL);
+
+  file->policy = policy;
+}
+
+gboolean
+gst_hspec_raw_file_write (GstHspecRawFile *file, gconstpointer data,
+    gsize size)
+{
+  g_return_val_if_fail (file != NULL, FALSE);
+
+  if (!file->write (file, data, size)) {
+    GST_ERROR ("Could not write to %s: %s", file->path, g_strerror (errno));
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* makes everything written so far durable, the last partial block of the
+ * direct modes excepted */
+gboolean
+gst_hspec_raw_file_sync (GstHspecRawFile *file)
+{
+  g_return_val_if_fail (file != NULL, FALSE);
+
+  file->synced = TRUE;
+  if (!file->sync (file)) {
+    GST_ERROR ("Could not sync %s: %s", file->path, g_strerror (errno));
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* flushes everything written and frees file */
+gboolean
+gst_hspec_raw_file_close (GstHspecRawFile *file)
+{
+  gboolean res;
+
+  g_return_val_if_fail (file != NULL, FALSE);
+
+  if (!(res = file->close (file)))
+    GST_ERROR ("Could not finish %s: %s", file->path, g_strerror (errno));
+
+  g_free (file->path);
+  g_free (file);
+  return res;
+}
@@ -0,0 +1,75 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+/*
+ * Output file of RAW recordings.
+ *
+ * Recordings are written sequentially, how the bytes reach the disk depends
+ * on the io mode the file was opened with.
+ */
+
+#ifndef _GST_HSPEC_RAW_FILE_H_
+#define _GST_HSPEC_RAW_FILE_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  /* buffered stdio through the page cache */
+  GST_HSPEC_IO_MODE_STDIO,
+  /* O_DIRECT writes from aligned staging memory, bypassing the page cache */
+  GST_HSPEC_IO_MODE_DIRECT,
+  /* like direct, with several writes from registered buffers in flight
+   * through io_uring, falls back to direct without liburing */
+  GST_HSPEC_IO_MODE_URING,
+  /* copies into a preallocated, memory mapped file, needs the size of the
+   * recording up front */
+  GST_HSPEC_IO_MODE_MMAP,
+} GstHspecIoMode;
+
+/* what happens to the written part of a memory mapped recording */
+typedef enum {
+  /* left to the kernel, stays in the page cache */
+  GST_HSPEC_MMAP_POLICY_NONE,
+  /* writeback is started behind the write position and written ranges are
+   * dropped from memory */
+  GST_HSPEC_MMAP_POLICY_WRITEBACK,
+  /* like writeback, waiting for every range with msync */
+  GST_HSPEC_MMAP_POLICY_MSYNC,
+} GstHspecMmapPolicy;
+
+typedef struct _GstHspecRawFile GstHspecRawFile;
+
+GstHspecRawFile * gst_hspec_raw_file_open   (const gchar *path, GstHspecIoMode mode,
+                                             guint64 reserve);
+
+void              gst_hspec_raw_file_set_mmap_policy (GstHspecRawFile *file,
+                                                      GstHspecMmapPolicy policy);
+
+gboolean          gst_hspec_raw_file_write  (GstHspecRawFile *file,
+                                             gconstpointer data, gsize size);
+
+gboolean          gst_hspec_raw_file_sync   (GstHspecRawFile *file);
+
+gboolean          gst_hspec_raw_file_close  (GstHspecRawFile *file);
+
+G_END_DECLS
+
+#endif
@@ -67,6 +67,10 @@ static gboolean gst_hspec_reducer_transform_size (GstBaseTransform * trans,
     GstPadDirection direction, GstCaps * caps, gsize size, GstCaps * othercaps,
     gsize * othersize);
 static gboolean gst_hspec_reducer_start (GstBaseTransform * trans);
+static gboolean gst_hspec_reducer_propose_allocation (GstBaseTransform * trans,
+    GstQuery * decide_query, GstQuery * query);
+static gboolean gst_hspec_reducer_decide_allocation (GstBaseTransform * trans,
+    GstQuery * query);
 static GstFlowReturn gst_hspec_reducer_transform (GstBaseTransform * trans,
     GstBuffer * inbuf, GstBuffer * outbuf);
 
@@ -75,6 +79,7 @@ enum
   PROP_0,
   PROP_INCLUSION_STR,
   PROP_EXCLUSION_STR,
+  PROP_N_THREADS,
 };
 
 /* pad templates */
@@ -83,14 +88,14 @@ static GstStaticPadTemplate gst_hspec_reducer_src_template =
 GST_STATIC_PAD_TEMPLATE ("src",
     GST_PAD_SRC,
     GST_PAD_ALWAYS,
-    GST_STATIC_CAPS (GST_HYPERSPECTRAL_CAPS_MAKE_WITH_ALL_FORMATS())
+    GST_STATIC_CAPS (GST_HYPERSPECTRAL_CAPS_MAKE(GST_HYPERSPECTRAL_FORMATS_UNPACKED))
     );
 
 static GstStaticPadTemplate gst_hspec_reducer_sink_template =
 GST_STATIC_PAD_TEMPLATE ("sink",
     GST_PAD_SINK,
     GST_PAD_ALWAYS,
-    GST_STATIC_CAPS (GST_HYPERSPECTRAL_CAPS_MAKE_WITH_ALL_FORMATS())
+    GST_STATIC_CAPS (GST_HYPERSPECTRAL_CAPS_MAKE(GST_HYPERSPECTRAL_FORMATS_UNPACKED))
     );
 
 
@@ -126,6 +131,8 @@ gst_hspec_reducer_class_init (GstHspecReducerClass * klass)
   base_transform_class->set_caps = GST_DEBUG_FUNCPTR (gst_hspec_reducer_set_caps);
   base_transform_class->transform_size = GST_DEBUG_FUNCPTR (gst_hspec_reducer_transform_size);
   base_transform_class->start = GST_DEBUG_FUNCPTR (gst_hspec_reducer_start);
+  base_transform_class->propose_allocation = GST_DEBUG_FUNCPTR (gst_hspec_reducer_propose_allocation);
+  base_transform_class->decide_allocation = GST_DEBUG_FUNCPTR (gst_hspec_reducer_decide_allocation);
   base_transform_class->transform = GST_DEBUG_FUNCPTR (gst_hspec_reducer_transform);
 #if 0
   g_object_class_install_property (gobject_class, PROP_INCLUSION_LIST,
@@ -162,6 +169,11 @@ gst_hspec_reducer_class_init (GstHspecReducerClass * klass)
           "Either an inclusion or an exclusion can be defined but not both.",
           "", G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
 
+  g_object_class_install_property (gobject_class, PROP_N_THREADS,
+      g_param_spec_uint ("n-threads", "Number of threads",
+          "Maximum number of threads reducing a cube, 0 uses all threads of "
+          "the shared pool (see " GST_HSPEC_THREADS_ENV ")",
+          0, G_MAXUINT, 0, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
 }
 
 static void
@@ -174,6 +186,7 @@ gst_hspec_reducer_init (GstHspecReducer *hspecreducer)
   hspecreducer->exclist = NULL;
   hspecreducer->inclist = NULL;
   hspecreducer->wavelength_pos = NULL;
+  hspecreducer->n_threads = 0;
 }
 
 void
@@ -213,6 +226,9 @@ gst_hspec_reducer_set_property (GObject * object, guint property_id,
         g_string_free(hspecreducer->excstr, TRUE);
       hspecreducer->excstr = g_string_new(g_value_get_string(value));
       break;
+    case PROP_N_THREADS:
+      hspecreducer->n_threads = g_value_get_uint(value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -240,6 +256,9 @@ gst_hspec_reducer_get_property (GObject * object, guint property_id,
       else
         g_value_set_string(value, "");
       break;
+    case PROP_N_THREADS:
+      g_value_set_uint(value, hspecreducer->n_threads);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -340,6 +359,34 @@ gst_hspec_reducer_transform_caps (GstBaseTransform * trans, GstPadDirection dire
   }
 }
 
+/* the mosaic of caps, from the caps cache for fixed cube caps. Other caps
+ * only have their wavelengths loaded to tmp. Release it with
+ * release_mosaic() */
+static const SpectralInfo *
+get_mosaic (GstCaps * caps, const GstHyperspectralInfo ** info,
+    SpectralInfo * tmp)
+{
+  init_mosaic (tmp);
+  *info = NULL;
+  if (gst_caps_is_fixed (caps) &&
+      (*info = gst_hyperspectral_info_from_caps_cached (caps)))
+    return &(*info)->mosaic;
+
+  if (load_mosaic_from_caps (tmp, caps))
+    return tmp;
+  clear_mosaic (tmp);
+  return NULL;
+}
+
+static void
+release_mosaic (const GstHyperspectralInfo * info, SpectralInfo * tmp)
+{
+  if (info)
+    gst_hyperspectral_info_unref (info);
+  else
+    clear_mosaic (tmp);
+}
+
 static GstCaps *
 gst_hspec_reducer_fixate_caps (GstBaseTransform * trans, GstPadDirection direction,
     GstCaps * caps, GstCaps * othercaps)
@@ -351,9 +398,11 @@ gst_hspec_reducer_fixate_caps (GstBaseTransform * trans, GstPadDirection directi
   GValue value = { 0 };
   /* reduce the target wavelengths for downstream */
 
-  SpectralInfo inmos;
-  init_mosaic(&inmos);
-  if (!load_mosaic_from_caps(&inmos, caps)) {
+  const GstHyperspectralInfo *ininfo;
+  const SpectralInfo *inmos;
+  SpectralInfo tmp;
+
+  if (!(inmos = get_mosaic (caps, &ininfo, &tmp))) {
     GST_ERROR("Unable to load mosaic from caps %" GST_PTR_FORMAT, caps);
     return NULL;
   }
@@ -362,11 +411,11 @@ gst_hspec_reducer_fixate_caps (GstBaseTransform * trans, GstPadDirection directi
     if (hspecreducer->inclist) {
       /* calculate the wavelengths. scan over input wavelengths and check which ones we keep */
       g_value_init(&array, GST_TYPE_ARRAY);
-      for (i=0; i<inmos.size; i++) {
+      for (i=0; i<inmos->size; i++) {
         for (j=0; j<hspecreducer->inclist->len; j++) {
-          if (inmos.spectras[i] == g_array_index(hspecreducer->inclist, gint, j)) {
+          if (inmos->spectras[i] == g_array_index(hspecreducer->inclist, gint, j)) {
             g_value_init (&value, G_TYPE_INT);
-            g_value_set_int (&value, inmos.spectras[i]);
+            g_value_set_int (&value, inmos->spectras[i]);
             gst_value_array_append_value (&array, &value);
             g_value_unset (&value);
             wavelengths++;
@@ -383,17 +432,17 @@ gst_hspec_reducer_fixate_caps (GstBaseTransform * trans, GstPadDirection directi
       /* calculate the wavelengths. scan over input wavelengths and check which ones we keep */
       gboolean res;
       g_value_init(&array, GST_TYPE_ARRAY);
-      for (i=0; i<inmos.size; i++) {
+      for (i=0; i<inmos->size; i++) {
         res = TRUE;
         for (j=0; j<hspecreducer->exclist->len; j++) {
-          if (inmos.spectras[i] == g_array_index(hspecreducer->exclist, gint, j)) {
+          if (inmos->spectras[i] == g_array_index(hspecreducer->exclist, gint, j)) {
             res = FALSE;
             break;
           }
         }
         if (res) {
           g_value_init (&value, G_TYPE_INT);
-          g_value_set_int (&value, inmos.spectras[i]);
+          g_value_set_int (&value, inmos->spectras[i]);
           gst_value_array_append_value (&array, &value);
           g_value_unset (&value);
           wavelengths++;
@@ -405,7 +454,7 @@ gst_hspec_reducer_fixate_caps (GstBaseTransform * trans, GstPadDirection directi
       gst_structure_take_value (outs, "wavelengths", &value);
     }
   }
-  clear_mosaic(&inmos);
+  release_mosaic (ininfo, &tmp);
   othercaps = gst_caps_fixate (othercaps);
 
   GST_DEBUG_OBJECT (trans, "fixated to %" GST_PTR_FORMAT, othercaps);
@@ -419,14 +468,14 @@ gst_hspec_reducer_accept_caps (GstBaseTransform * trans, GstPadDirection directi
 {
   GstHspecReducer *hspecreducer = GST_HSPEC_REDUCER (trans);
   gint i, j;
-  SpectralInfo mos;
+  const GstHyperspectralInfo *info;
+  const SpectralInfo *mos;
+  SpectralInfo tmp;
   gboolean res = FALSE;
 
   GST_DEBUG ("Checking caps acceptibility: %" GST_PTR_FORMAT, caps);
-  init_mosaic (&mos);
-  if (!load_mosaic_from_caps(&mos, caps)) {
+  if (!(mos = get_mosaic (caps, &info, &tmp))) {
     GST_WARNING("Unable to load mosaic from caps");
-    clear_mosaic (&mos);
     return FALSE;
   }
 
@@ -434,8 +483,8 @@ gst_hspec_reducer_accept_caps (GstBaseTransform * trans, GstPadDirection directi
   if (hspecreducer->inclist) {
     for (j=0; j<hspecreducer->inclist->len; j++){
       res = FALSE;
-      for (i=0; i<mos.size; i++) {
-        if(mos.spectras[i] == g_array_index(hspecreducer->inclist,
+      for (i=0; i<mos->size; i++) {
+        if(mos->spectras[i] == g_array_index(hspecreducer->inclist,
             gint, j)) {
           res = TRUE;
           break;
@@ -451,8 +500,8 @@ gst_hspec_reducer_accept_caps (GstBaseTransform * trans, GstPadDirection directi
   else if (hspecreducer->exclist) {
     for (j=0; j<hspecreducer->exclist->len; j++) {
       res = FALSE;
-      for (i=0; i<mos.size; i++) {
-        if (mos.spectras[i] == g_array_index(hspecreducer->exclist,
+      for (i=0; i<mos->size; i++) {
+        if (mos->spectras[i] == g_array_index(hspecreducer->exclist,
             gint, j)) {
           res = TRUE;
           break;
@@ -468,7 +517,7 @@ gst_hspec_reducer_accept_caps (GstBaseTransform * trans, GstPadDirection directi
   else
     res = TRUE;
 
-  clear_mosaic (&mos);
+  release_mosaic (info, &tmp);
   return res;
 }
 
@@ -478,6 +527,8 @@ gst_hspec_reducer_set_caps (GstBaseTransform * trans, GstCaps * incaps,
 {
   GstHspecReducer *hspecreducer = GST_HSPEC_REDUCER (trans);
   gint i, j;
+  gst_hyperspectral_info_clear(&hspecreducer->ininfo);
+  gst_hyperspectral_info_clear(&hspecreducer->outinfo);
   if (!gst_hyperspectral_info_from_caps(&hspecreducer->ininfo, incaps)) {
     GST_ERROR("Unable to retrieve input hyperspectral info from caps %" GST_PTR_FORMAT,
       incaps);
@@ -628,6 +679,79 @@ gst_hspec_reducer_start (GstBaseTransform * trans)
   return TRUE;
 }
 
+/* offer upstream a pool of hyperspectral cubes */
+static gboolean
+gst_hspec_reducer_propose_allocation (GstBaseTransform * trans,
+    GstQuery * decide_query, GstQuery * query)
+{
+  if (!GST_BASE_TRANSFORM_CLASS (gst_hspec_reducer_parent_class)->propose_allocation (trans,
+      decide_query, query))
+    return FALSE;
+
+  /* in passthrough the query has been answered downstream */
+  if (decide_query == NULL)
+    return TRUE;
+
+  return gst_hyperspectral_buffer_pool_propose_allocation (query,
+      GST_HYPERSPECTRAL_POOL_MIN_BUFFERS);
+}
+
+/* output cubes come from a hyperspectral pool */
+static gboolean
+gst_hspec_reducer_decide_allocation (GstBaseTransform * trans, GstQuery * query)
+{
+  if (!gst_hyperspectral_buffer_pool_decide_allocation (query,
+      GST_HYPERSPECTRAL_POOL_MIN_BUFFERS, 0, 0))
+    return FALSE;
+
+  return GST_BASE_TRANSFORM_CLASS (gst_hspec_reducer_parent_class)->decide_allocation (trans,
+      query);
+}
+
+typedef struct {
+  GstHspecReducer *hsred;
+  GstHyperspectralFrame *inframe;
+  GstHyperspectralFrame *outframe;
+} ReduceJob;
+
+/* copies the selected wavelengths of the rows [start, end) */
+static void
+reduce_rows (gpointer user_data, guint start, guint end)
+{
+  ReduceJob *job = user_data;
+  GstHyperspectralFrame *inframe = job->inframe;
+  GstHyperspectralFrame *outframe = job->outframe;
+  GArray *wavelength_pos = job->hsred->wavelength_pos;
+  gint bytesize = inframe->info.bytesize;
+  guint8 *inrow, *outrow;
+  gsize row_size;
+  gint i, j, y, index;
+
+  row_size = inframe->info.width * bytesize;
+  if (inframe->info.layout == GST_HSPC_LAYOUT_MULTIPLANE) {
+    for (i=0; i<wavelength_pos->len; i++){
+      index = g_array_index (wavelength_pos, gint, i);
+      gst_hspec_kernel_copy_2d (GST_HSPEC_FRAME_ROW_DATA(outframe, i, start),
+          GST_HSPEC_FRAME_PLANE_STRIDE(outframe, i),
+          GST_HSPEC_FRAME_ROW_DATA(inframe, index, start),
+          GST_HSPEC_FRAME_PLANE_STRIDE(inframe, index), row_size, end - start);
+    }
+  } else {
+    for (y=start; y<end; y++) {
+      inrow = GST_HSPEC_FRAME_ROW_DATA(inframe, 0, y);
+      outrow = GST_HSPEC_FRAME_ROW_DATA(outframe, 0, y);
+      for (i=0; i<wavelength_pos->len; i++) {
+        index = g_array_index (wavelength_pos, gint, i);
+        for (j=0; j<inframe->info.width; j++) {
+          memcpy (outrow+(j*outframe->info.wavelengths+i)*bytesize,
+                  inrow+(j*inframe->info.wavelengths+index)*bytesize,
+                  bytesize);
+        }
+      }
+    }
+  }
+}
+
 /* transform */
 static GstFlowReturn
 gst_hspec_reducer_transform (GstBaseTransform * trans, GstBuffer * inbuf,
@@ -635,43 +759,48 @@ gst_hspec_reducer_transform (GstBaseTransform * trans, GstBuffer * inbuf,
 {
   GstHspecReducer *hsred = GST_HSPEC_REDUCER (trans);
   GstHyperspectralFrame inframe, outframe;
-  gint i, j, index;
+  GstHyperspectralMeta *inmeta, *outmeta;
+  ReduceJob job;
 
   if (!gst_hyperspectral_frame_map(&inframe, &hsred->ininfo,
-    inbuf, GST_MAP_READ)) {
+    inbuf, GST_MAP_READ | GST_HYPERSPECTRAL_FRAME_MAP_FLAG_PLANES)) {
     GST_ERROR_OBJECT (hsred, "Could not map input hyperspectral frame");
     return GST_FLOW_ERROR;
   }
 
   if (!gst_hyperspectral_frame_map(&outframe, &hsred->outinfo,
-    outbuf, GST_MAP_WRITE)) {
+    outbuf, GST_MAP_WRITE | GST_HYPERSPECTRAL_FRAME_MAP_FLAG_PLANES)) {
     GST_ERROR_OBJECT (hsred, "Could not map output hyperspectral frame");
     return GST_FLOW_ERROR;
   }
 
-  if (hsred->ininfo.layout == GST_HSPC_LAYOUT_MULTIPLANE) {
-    for (i=0; i<hsred->wavelength_pos->len; i++){
-      memcpy(GST_HSPEC_FRAME_WAVELENGTH_DATA_MULTIPLANE(&outframe, i),
-             GST_HSPEC_FRAME_WAVELENGTH_DATA_MULTIPLANE(&inframe,
-              g_array_index (hsred->wavelength_pos, gint, i)),
-             inframe.info.wavelength_size);
-    }
-  } else if (hsred->ininfo.layout == GST_HSPC_LAYOUT_INTERLEAVED) {
-    for (i=0; i<hsred->wavelength_pos->len; i++) {
-      index = g_array_index (hsred->wavelength_pos, gint, i);
-      for (j=0; j<inframe.info.wavelength_elems; j++) {
-        memcpy (outframe.data+(j*outframe.info.wavelengths+i)*inframe.info.bytesize,
-                inframe.data+(j*inframe.info.wavelengths+index)*inframe.info.bytesize,
-                inframe.info.bytesize);
-      }
-    }
-  } else {
+  if (hsred->ininfo.layout != GST_HSPC_LAYOUT_MULTIPLANE &&
+      hsred->ininfo.layout != GST_HSPC_LAYOUT_INTERLEAVED) {
     GST_ERROR("Unhandled spectral layout %d", hsred->ininfo.layout);
+    gst_hyperspectral_frame_unmap(&outframe);
+    gst_hyperspectral_frame_unmap(&inframe);
     return GST_FLOW_ERROR;
   }
 
+  job.hsred = hsred;
+  job.inframe = &inframe;
+  job.outframe = &outframe;
+  gst_hspec_parallel_for (inframe.info.height, hsred->n_threads,
+      reduce_rows, &job);
+
   gst_hyperspectral_frame_unmap(&outframe);
   gst_hyperspectral_frame_unmap(&inframe);
+
+  /* the cube description changed, per frame information carries over.
+   * Pooled buffers already carry a meta */
+  outmeta = gst_buffer_get_hyperspectral_meta (outbuf);
+  if (!outmeta)
+    outmeta = gst_buffer_add_hyperspectral_meta (outbuf, &hsred->outinfo);
+  inmeta = gst_buffer_get_hyperspectral_meta (inbuf);
+  if (outmeta) {
+    outmeta->exposure = inmeta ? inmeta->exposure : GST_CLOCK_TIME_NONE;
+    outmeta->flags = inmeta ? inmeta->flags : GST_HYPERSPECTRAL_META_FLAG_NONE;
+  }
   return GST_FLOW_OK;
 }
 
@@ -50,6 +50,9 @@ struct _GstHspecReducer
   /* list of input wavelength positions that should be copied */
   GArray *wavelength_pos;
 
+  /* upper limit of threads reducing a cube, 0 for the whole pool */
+  guint n_threads;
+
   /* flag to ensure that transform_size calls dont happen before setting the size */
   gboolean size_set;
 };
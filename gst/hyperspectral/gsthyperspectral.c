@@ -26,7 +26,9 @@
 #include "gsthyperspectralenc.h"
 #include "gsthyperspectraldec.h"
 #include "gsthspecfilesink.h"
+#include "gsthspecfilesrc.h"
 #include "gsthspecreducer.h"
+#include "gsthspecconvert.h"
 
 static gboolean
 plugin_init (GstPlugin * plugin)
@@ -37,8 +39,12 @@ plugin_init (GstPlugin * plugin)
     return FALSE;
   if (!gst_hspec_file_sink_plugin_init (plugin))
     return FALSE;
+  if (!gst_hspec_file_src_plugin_init (plugin))
+    return FALSE;
   if (!gst_hspec_reducer_plugin_init (plugin))
     return FALSE;
+  if (!gst_hspec_convert_plugin_init (plugin))
+    return FALSE;
   return TRUE;
 }
 
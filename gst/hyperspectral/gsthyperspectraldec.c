@@ -57,13 +57,16 @@ static void gst_hyperspectraldec_finalize (GObject * object);
 static gboolean gst_hyperspectraldec_src_event (GstVideoDecoder *decoder, GstEvent * event);
 static gboolean gst_hyperspectraldec_set_format (GstVideoDecoder * decoder,
     GstVideoCodecState * state);
+static gboolean gst_hyperspectraldec_propose_allocation (GstVideoDecoder * decoder,
+    GstQuery * query);
 static GstFlowReturn gst_hyperspectraldec_handle_frame (GstVideoDecoder * decoder,
     GstVideoCodecFrame * frame);
 
 enum
 {
   PROP_0,
-  PROP_WAVELENGTHID
+  PROP_WAVELENGTHID,
+  PROP_N_THREADS
 };
 
 /* pad templates */
@@ -72,7 +75,7 @@ static GstStaticPadTemplate gst_hyperspectraldec_sink_template =
 GST_STATIC_PAD_TEMPLATE ("sink",
     GST_PAD_SINK,
     GST_PAD_ALWAYS,
-    GST_STATIC_CAPS (GST_HYPERSPECTRAL_CAPS_MAKE_WITH_ALL_FORMATS())
+    GST_STATIC_CAPS (GST_HYPERSPECTRAL_CAPS_MAKE(GST_HYPERSPECTRAL_FORMATS_UNPACKED))
     );
 
 static GstStaticPadTemplate gst_hyperspectraldec_src_template =
@@ -112,12 +115,19 @@ gst_hyperspectraldec_class_init (GstHyperspectraldecClass * klass)
   video_decoder_class->src_event = GST_DEBUG_FUNCPTR (gst_hyperspectraldec_src_event);
   video_decoder_class->set_format = GST_DEBUG_FUNCPTR (gst_hyperspectraldec_set_format);
   video_decoder_class->handle_frame = GST_DEBUG_FUNCPTR (gst_hyperspectraldec_handle_frame);
+  video_decoder_class->propose_allocation = GST_DEBUG_FUNCPTR (gst_hyperspectraldec_propose_allocation);
   video_decoder_class->transform_meta = NULL;
 
   g_object_class_install_property (gobject_class, PROP_WAVELENGTHID,
       g_param_spec_int ("wavelengthid", "Wavelength ID",
           "Sets the number of the wavelength id to be shown", 0, G_MAXINT,
           0, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_N_THREADS,
+      g_param_spec_uint ("n-threads", "Number of threads",
+          "Maximum number of threads decoding a frame, 0 uses all threads of "
+          "the shared pool (see " GST_HSPEC_THREADS_ENV ")", 0, G_MAXUINT,
+          0, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
 }
 
 static void
@@ -128,6 +138,7 @@ gst_hyperspectraldec_init (GstHyperspectraldec *dec)
   dec->writefunc = NULL;
   dec->wavelengthpos = 0;
   dec->wavelengthid = 0;
+  dec->n_threads = 0;
 }
 
 void
@@ -142,6 +153,9 @@ gst_hyperspectraldec_set_property (GObject * object, guint property_id,
     case PROP_WAVELENGTHID:
       hyperspectraldec->wavelengthid = g_value_get_int (value);
       break;
+    case PROP_N_THREADS:
+      hyperspectraldec->n_threads = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -160,6 +174,9 @@ gst_hyperspectraldec_get_property (GObject * object, guint property_id,
     case PROP_WAVELENGTHID:
       g_value_set_int(value, hyperspectraldec->wavelengthid);
       break;
+    case PROP_N_THREADS:
+      g_value_set_uint(value, hyperspectraldec->n_threads);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -261,77 +278,177 @@ gst_hyperspectraldec_src_event (GstVideoDecoder *decoder, GstEvent * event)
   return GST_VIDEO_DECODER_CLASS (gst_hyperspectraldec_parent_class)->src_event (decoder, event);
 }
 
-/* performs unpacking of hyperspectral cube to a 2d image */
+/* offer upstream a pool of hyperspectral cubes */
+static gboolean
+gst_hyperspectraldec_propose_allocation (GstVideoDecoder * decoder, GstQuery * query)
+{
+  if (!gst_hyperspectral_buffer_pool_propose_allocation (query,
+      GST_HYPERSPECTRAL_POOL_MIN_BUFFERS))
+    return FALSE;
+
+  return GST_VIDEO_DECODER_CLASS (gst_hyperspectraldec_parent_class)->propose_allocation (decoder, query);
+}
+
+/* performs unpacking of the rows [ystart, yend) of hyperspectral cube to a 2d
+ * image */
 static void
-from_cube_to_image_1byte_multiplanar(GstHyperspectraldec *dec, GstHyperspectralFrame *inframe, GstVideoFrame *outframe)
+from_cube_to_image_1byte_multiplanar(GstHyperspectraldec *dec, GstHyperspectralFrame *inframe, GstVideoFrame *outframe,
+    gint ystart, gint yend)
 {
-  guint8 *restrict src = (guint8*) GST_HSPEC_FRAME_WAVELENGTH_DATA_MULTIPLANE(inframe, dec->wavelengthpos);
-  guint8 *restrict target = (guint8*) GST_VIDEO_FRAME_PLANE_DATA (outframe, 0);
-  gint stride = GST_VIDEO_FRAME_PLANE_STRIDE(outframe,0);
-  gint i, j;
-  for (j=0; j<outframe->info.height; j++) {
-    for (i=0; i<outframe->info.width; i++) {
-      target[i + j*stride] = src[i + j*outframe->info.width];
-    }
-  }
+  gst_hspec_kernel_copy_2d (
+    (guint8*) GST_VIDEO_FRAME_PLANE_DATA (outframe, 0) +
+      ystart*GST_VIDEO_FRAME_PLANE_STRIDE(outframe,0),
+    GST_VIDEO_FRAME_PLANE_STRIDE(outframe,0),
+    GST_HSPEC_FRAME_ROW_DATA(inframe, dec->wavelengthpos, ystart),
+    GST_HSPEC_FRAME_PLANE_STRIDE(inframe, dec->wavelengthpos),
+    outframe->info.width, yend - ystart);
 }
 
 static void
-from_cube_to_image_1byte_interleaved(GstHyperspectraldec *dec, GstHyperspectralFrame *inframe, GstVideoFrame *outframe)
+from_cube_to_image_1byte_interleaved(GstHyperspectraldec *dec, GstHyperspectralFrame *inframe, GstVideoFrame *outframe,
+    gint ystart, gint yend)
 {
-  guint8 *restrict src = (guint8*) (inframe->data + dec->wavelengthpos);
+  guint8 *restrict src = (guint8*) (GST_HSPEC_FRAME_PLANE_DATA(inframe, 0) + dec->wavelengthpos);
   guint8 *restrict target = (guint8*) GST_VIDEO_FRAME_PLANE_DATA(outframe, 0);
   gint stride = GST_VIDEO_FRAME_PLANE_STRIDE(outframe,0);
+  gint sstride = GST_HSPEC_FRAME_PLANE_STRIDE(inframe, 0);
   gint i, j;
-  for (j=0; j<outframe->info.height; j++) {
+  for (j=ystart; j<yend; j++) {
     for (i=0; i<outframe->info.width; i++) {
-      target[i + j*stride] = src[(i + j*outframe->info.width)*inframe->info.wavelengths];
+      target[i + j*stride] = src[i*inframe->info.wavelengths + (gsize) j*sstride];
     }
   }
 }
 
 static void
-from_cube_to_image_2byte_multiplanar(GstHyperspectraldec *dec, GstHyperspectralFrame *inframe, GstVideoFrame *outframe)
+from_cube_to_image_2byte_multiplanar(GstHyperspectraldec *dec, GstHyperspectralFrame *inframe, GstVideoFrame *outframe,
+    gint ystart, gint yend)
+{
+  gst_hspec_kernel_copy_2d (
+    (guint8*) GST_VIDEO_FRAME_PLANE_DATA (outframe, 0) +
+      ystart*GST_VIDEO_FRAME_PLANE_STRIDE(outframe,0),
+    GST_VIDEO_FRAME_PLANE_STRIDE(outframe,0),
+    GST_HSPEC_FRAME_ROW_DATA(inframe, dec->wavelengthpos, ystart),
+    GST_HSPEC_FRAME_PLANE_STRIDE(inframe, dec->wavelengthpos),
+    outframe->info.width * 2, yend - ystart);
+}
+
+static void
+from_cube_to_image_2byte_interleaved(GstHyperspectraldec *dec, GstHyperspectralFrame *inframe, GstVideoFrame *outframe,
+    gint ystart, gint yend)
 {
-  guint16 *restrict src = (guint16*) GST_HSPEC_FRAME_WAVELENGTH_DATA_MULTIPLANE(inframe, dec->wavelengthpos);
+  guint16 *restrict src = (guint16*) (GST_HSPEC_FRAME_PLANE_DATA(inframe, 0) + dec->wavelengthpos*2);
   guint16 *restrict target = (guint16*) GST_VIDEO_FRAME_PLANE_DATA (outframe, 0);
   gint stride = GST_VIDEO_FRAME_PLANE_STRIDE(outframe,0)/2;
+  gint sstride = GST_HSPEC_FRAME_PLANE_STRIDE(inframe, 0)/2;
   gint i, j;
-  for (j=0; j<outframe->info.height; j++) {
+  for (j=ystart; j<yend; j++) {
     for (i=0; i<outframe->info.width; i++) {
-      target[i + j*stride] = src[i + j*outframe->info.width];
+      target[i + j*stride] = src[i*inframe->info.wavelengths + (gsize) j*sstride];
     }
   }
 }
 
+/* floating point bands are shown as 16 bit images, [0, 1] maps onto the
+ * full range and anything outside of it saturates */
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define FLOAT_OUTPUT_FORMAT GST_VIDEO_FORMAT_GRAY16_LE
+#else
+#define FLOAT_OUTPUT_FORMAT GST_VIDEO_FORMAT_GRAY16_BE
+#endif
+
+#define FLOAT_CHUNK 256
+
+/* band is a view of a single band of the cube */
 static void
-from_cube_to_image_2byte_interleaved(GstHyperspectraldec *dec, GstHyperspectralFrame *inframe, GstVideoFrame *outframe)
+from_float_band_to_image(GstHyperspectraldec *dec, const GstHyperspectralView *band,
+    GstVideoFrame *outframe, gint ystart, gint yend)
 {
-  guint16 *restrict src = (guint16*) (inframe->data + dec->wavelengthpos*2);
-  guint16 *restrict target = (guint16*) GST_VIDEO_FRAME_PLANE_DATA (outframe, 0);
+  gfloat tmp[FLOAT_CHUNK];
+  guint16 *target = (guint16*) GST_VIDEO_FRAME_PLANE_DATA (outframe, 0);
   gint stride = GST_VIDEO_FRAME_PLANE_STRIDE(outframe,0)/2;
-  gint i, j;
-  for (j=0; j<outframe->info.height; j++) {
-    for (i=0; i<outframe->info.width; i++) {
-      target[i + j*stride] = src[(i + j*outframe->info.width)*inframe->info.wavelengths];
+  gsize sstep = GST_HSPEC_VIEW_PIXEL_STEP (band);
+  gint i, j, len;
+  for (j=ystart; j<yend; j++) {
+    for (i=0; i<outframe->info.width; i+=len) {
+      len = MIN (outframe->info.width - i, FLOAT_CHUNK);
+      if (dec->hinfo.format == GST_HSPC_FORMAT_F16)
+        gst_hspec_kernel_f16_to_f32 (tmp,
+            GST_HSPEC_VIEW_ROW_U16 (band, 0, j) + i*sstep, sstep, len);
+      else
+        gst_hspec_kernel_copy_f32 (tmp, 1,
+            GST_HSPEC_VIEW_ROW_F32 (band, 0, j) + i*sstep, sstep, len);
+      gst_hspec_kernel_scale_f32 (tmp, G_MAXUINT16, 0.0f, len);
+      gst_hspec_kernel_f32_to_u16 (target + i + j*stride, 1, tmp, FALSE, len);
     }
   }
 }
 
+static void
+from_cube_to_image_float(GstHyperspectraldec *dec, GstHyperspectralFrame *inframe, GstVideoFrame *outframe,
+    gint ystart, gint yend)
+{
+  GstHyperspectralView band;
+
+  if (gst_hyperspectral_view_init (&band, inframe, 0, 0, inframe->info.width,
+      inframe->info.height, dec->wavelengthpos, 1))
+    from_float_band_to_image (dec, &band, outframe, ystart, yend);
+}
+
+#define DEC_KERNEL(format,layout,func) \
+  GST_HSPEC_KERNEL (GST_HSPEC_KERNEL_OP_BAND_TO_IMAGE, GST_HSPC_FORMAT_##format, \
+    GST_HSPC_LAYOUT_##layout, GST_HSPEC_ISA_C, func)
+
+static const GstHspecKernel write_kernels[] = {
+  DEC_KERNEL (GRAY8, MULTIPLANE, from_cube_to_image_1byte_multiplanar),
+  DEC_KERNEL (GRAY8, INTERLEAVED, from_cube_to_image_1byte_interleaved),
+  DEC_KERNEL (GRAY16_LE, MULTIPLANE, from_cube_to_image_2byte_multiplanar),
+  DEC_KERNEL (GRAY16_LE, INTERLEAVED, from_cube_to_image_2byte_interleaved),
+  DEC_KERNEL (GRAY16_BE, MULTIPLANE, from_cube_to_image_2byte_multiplanar),
+  DEC_KERNEL (GRAY16_BE, INTERLEAVED, from_cube_to_image_2byte_interleaved),
+  /* both layouts are read through a view of the band */
+  DEC_KERNEL (F32, MULTIPLANE, from_cube_to_image_float),
+  DEC_KERNEL (F32, INTERLEAVED, from_cube_to_image_float),
+  DEC_KERNEL (F16, MULTIPLANE, from_cube_to_image_float),
+  DEC_KERNEL (F16, INTERLEAVED, from_cube_to_image_float),
+};
+
+typedef struct {
+  GstHyperspectraldec *dec;
+  GstHyperspectralFrame *inframe;
+  GstVideoFrame *outframe;
+} DecodeJob;
+
+static void
+decode_rows(gpointer user_data, guint start, guint end)
+{
+  DecodeJob *job = user_data;
+
+  job->dec->writefunc(job->dec, job->inframe, job->outframe, start, end);
+}
+
 static gboolean
 gst_hyperspectraldec_set_format (GstVideoDecoder * decoder, GstVideoCodecState * state)
 {
   GstHyperspectraldec *dec = GST_HYPERSPECTRALDEC (decoder);
+  GstVideoFormat outformat;
+  const GstHspecKernel *kernel;
   int i;
   gboolean res = FALSE;
 
   GST_DEBUG("Hyperspectral caps: %" GST_PTR_FORMAT, state->caps);
+  gst_hyperspectral_info_clear(&dec->hinfo);
   if(!gst_hyperspectral_info_from_caps(&dec->hinfo, state->caps))
     return FALSE;
+  if (dec->hinfo.format == GST_HSPC_FORMAT_F32 ||
+      dec->hinfo.format == GST_HSPC_FORMAT_F16)
+    outformat = FLOAT_OUTPUT_FORMAT;
+  else
+    outformat = gst_hspec_format_to_video_format (dec->hinfo.format);
   if (dec->output_state)
     gst_video_codec_state_unref (dec->output_state);
   dec->output_state = gst_video_decoder_set_output_state(decoder,
-    dec->hinfo.format, dec->hinfo.width, dec->hinfo.height, state);
+    outformat, dec->hinfo.width, dec->hinfo.height, state);
 
   dec->output_state->caps = gst_video_info_to_caps (&dec->output_state->info);
   /* check if wavelength id is within range of availabe wavelengths */
@@ -351,40 +468,18 @@ gst_hyperspectraldec_set_format (GstVideoDecoder * decoder, GstVideoCodecState *
     GST_DEBUG("Selected wavelength id '%d'",
       dec->hinfo.mosaic.spectras[dec->wavelengthpos]);
   /* select function for copying*/
-  switch (dec->hinfo.format) {
-    case GST_VIDEO_FORMAT_GRAY8:
-      if (dec->hinfo.layout == GST_HSPC_LAYOUT_MULTIPLANE) {
-        GST_DEBUG("Selecting 'from_cube_to_image_1byte_multiplanar' writefunc for %s",
-          gst_video_format_to_string(dec->hinfo.format));
-        dec->writefunc = from_cube_to_image_1byte_multiplanar;
-      } else if (dec->hinfo.layout == GST_HSPC_LAYOUT_INTERLEAVED) {
-        GST_DEBUG("Selecting 'from_cube_to_image_1byte_interleaved' writefunc for %s",
-          gst_video_format_to_string(dec->hinfo.format));
-        dec->writefunc = from_cube_to_image_1byte_interleaved;
-      } else {
-        GST_ERROR("Unknown layout '%s'", gst_hspec_layout_to_string(dec->hinfo.layout));
-        return FALSE;
-      }
-      break;
-    case GST_VIDEO_FORMAT_GRAY16_BE:
-    case GST_VIDEO_FORMAT_GRAY16_LE:
-      if (dec->hinfo.layout == GST_HSPC_LAYOUT_MULTIPLANE) {
-        GST_DEBUG("Selecting 'from_cube_to_image_2byte_multiplanar' writefunc for %s",
-          gst_video_format_to_string(dec->hinfo.format));
-        dec->writefunc = from_cube_to_image_2byte_multiplanar;
-      } else if (dec->hinfo.layout == GST_HSPC_LAYOUT_INTERLEAVED) {
-        GST_DEBUG("Selecting 'from_cube_to_image_2byte_interleaved' writefunc for %s",
-          gst_video_format_to_string(dec->hinfo.format));
-        dec->writefunc = from_cube_to_image_2byte_interleaved;
-      } else {
-        GST_ERROR("Unknown layout '%s'", gst_hspec_layout_to_string(dec->hinfo.layout));
-        return FALSE;
-      }
-      break;
-    default:
-      GST_ERROR("Unhandled format of type %s", gst_video_format_to_string(dec->hinfo.format));
-      return FALSE;
+  kernel = gst_hspec_kernel_lookup (GST_HSPEC_KERNEL_OP_BAND_TO_IMAGE,
+    dec->hinfo.format, dec->hinfo.layout);
+  if (!kernel) {
+    GST_ERROR("No writefunc for %s cubes with layout '%s'",
+      gst_hspec_format_to_string(dec->hinfo.format),
+      gst_hspec_layout_to_string(dec->hinfo.layout));
+    return FALSE;
   }
+  GST_DEBUG("Selecting '%s' writefunc (%s) for %s", kernel->name,
+    gst_hspec_isa_to_string(kernel->isa),
+    gst_hspec_format_to_string(dec->hinfo.format));
+  dec->writefunc = (GstHyperspectraldecWriteFunc) kernel->func;
   GST_DEBUG("Calculated caps: %" GST_PTR_FORMAT, dec->output_state->caps);
   return TRUE;
 }
@@ -396,10 +491,11 @@ gst_hyperspectraldec_handle_frame (GstVideoDecoder * decoder, GstVideoCodecFrame
 
   GstHyperspectralFrame hframe;
   GstVideoFrame outframe;
+  DecodeJob job;
   GstFlowReturn ret;
 
   if (!gst_hyperspectral_frame_map(&hframe, &dec->hinfo, frame->input_buffer,
-    GST_MAP_READ)) {
+    GST_MAP_READ | GST_HYPERSPECTRAL_FRAME_MAP_FLAG_PLANES)) {
     GST_ERROR_OBJECT (dec, "Could not map hyperspectral frame");
     gst_video_codec_frame_unref (frame);
     return GST_FLOW_ERROR;
@@ -434,7 +530,10 @@ gst_hyperspectraldec_handle_frame (GstVideoDecoder * decoder, GstVideoCodecFrame
   }
 
   /* at this point everything should be set and I can now perform processing */
-  dec->writefunc(dec, &hframe, &outframe);
+  job.dec = dec;
+  job.inframe = &hframe;
+  job.outframe = &outframe;
+  gst_hspec_parallel_for(outframe.info.height, dec->n_threads, decode_rows, &job);
   /* processing is complete, send the buffer */
   gst_video_decoder_finish_frame(decoder, frame);
   gst_video_frame_unmap (&outframe);
@@ -446,6 +545,8 @@ gst_hyperspectraldec_handle_frame (GstVideoDecoder * decoder, GstVideoCodecFrame
 gboolean
 gst_hyperspectraldec_plugin_init (GstPlugin * plugin)
 {
+  gst_hspec_kernels_register (write_kernels, G_N_ELEMENTS (write_kernels));
+
   return gst_element_register (plugin, "hspecdec", GST_RANK_NONE,
       GST_TYPE_HYPERSPECTRALDEC);
 }
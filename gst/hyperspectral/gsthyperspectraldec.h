@@ -34,17 +34,25 @@ G_BEGIN_DECLS
 typedef struct _GstHyperspectraldec GstHyperspectraldec;
 typedef struct _GstHyperspectraldecClass GstHyperspectraldecClass;
 
+/* writes the rows [ystart, yend) of the output frame, registered as
+ * GST_HSPEC_KERNEL_OP_BAND_TO_IMAGE kernels */
+typedef void (*GstHyperspectraldecWriteFunc) (GstHyperspectraldec *dec,
+    GstHyperspectralFrame *inframe, GstVideoFrame *outframe,
+    gint ystart, gint yend);
+
 struct _GstHyperspectraldec
 {
   GstVideoDecoder base_hyperspectraldec;
   GstHyperspectralInfo hinfo;
 
   GstVideoCodecState *output_state;
-  void (*writefunc) (GstHyperspectraldec *dec,
-    GstHyperspectralFrame *inframe, GstVideoFrame *outframe);
+  /* kernel selected for the negotiated format and layout */
+  GstHyperspectraldecWriteFunc writefunc;
 
   gint wavelengthid;
   gint wavelengthpos;
+  /* upper limit of threads decoding a frame, 0 for the whole pool */
+  guint n_threads;
 };
 
 struct _GstHyperspectraldecClass
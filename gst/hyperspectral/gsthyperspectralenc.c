@@ -59,6 +59,8 @@ static void gst_hyperspectralenc_dispose (GObject * object);
 static void gst_hyperspectralenc_finalize (GObject * object);
 
 static gboolean gst_hyperspectralenc_set_format (GstVideoEncoder *encoder, GstVideoCodecState *state);
+static gboolean gst_hyperspectralenc_decide_allocation (GstVideoEncoder *encoder, GstQuery *query);
+static gboolean gst_hyperspectralenc_stop (GstVideoEncoder *encoder);
 static GstFlowReturn gst_hyperspectralenc_handle_raw_buffer (GstVideoEncoder *encoder, GstVideoCodecFrame *frame);
 static GstFlowReturn gst_hyperspectralenc_handle_video_frame (GstVideoEncoder *encoder, GstVideoCodecFrame *frame);
 
@@ -66,11 +68,13 @@ enum
 {
   PROP_0,
   PROP_MOSAIC_STR,
-  PROP_MOSAIC_PATH
+  PROP_MOSAIC_PATH,
+  PROP_N_THREADS
 };
 
 /* defaults */
 
+#define DEFAULT_N_THREADS 0
 #define DEFAULT_LAYOUT GST_HSPC_LAYOUT_MULTIPLANE
 
 /* pad templates */
@@ -78,7 +82,7 @@ static GstStaticPadTemplate gst_hyperspectralenc_src_template =
 GST_STATIC_PAD_TEMPLATE ("src",
     GST_PAD_SRC,
     GST_PAD_ALWAYS,
-    GST_STATIC_CAPS (GST_HYPERSPECTRAL_CAPS_MAKE_WITH_ALL_FORMATS())
+    GST_STATIC_CAPS (GST_HYPERSPECTRAL_CAPS_MAKE(GST_HYPERSPECTRAL_FORMATS_UNPACKED))
     );
 
 
@@ -150,6 +154,8 @@ gst_hyperspectralenc_class_init (GstHyperspectralencClass * klass)
 
   video_encoder_class->handle_frame = GST_DEBUG_FUNCPTR (gst_hyperspectralenc_handle_video_frame);
   video_encoder_class->set_format = GST_DEBUG_FUNCPTR (gst_hyperspectralenc_set_format);
+  video_encoder_class->decide_allocation = GST_DEBUG_FUNCPTR (gst_hyperspectralenc_decide_allocation);
+  video_encoder_class->stop = GST_DEBUG_FUNCPTR (gst_hyperspectralenc_stop);
   video_encoder_class->transform_meta = NULL;
 
   g_object_class_install_property (gobject_class, PROP_MOSAIC_STR,
@@ -169,6 +175,13 @@ gst_hyperspectralenc_class_init (GstHyperspectralencClass * klass)
           "The file format is the same as that of the mosaicstr parameter", "None",
           G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
 
+  g_object_class_install_property (gobject_class, PROP_N_THREADS,
+      g_param_spec_uint ("n-threads", "Number of threads",
+          "Maximum number of threads encoding a frame, 0 uses all threads of "
+          "the shared pool (see " GST_HSPEC_THREADS_ENV ")",
+          0, G_MAXUINT, DEFAULT_N_THREADS,
+          G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
 
 }
 
@@ -182,7 +195,12 @@ gst_hyperspectralenc_init (GstHyperspectralenc *enc)
   enc->data_wavelength_elems = 0;
   enc->data_cube_size = 0;
   enc->frame_elems = 0;
+  enc->src_byte_size = 0;
   enc->data_byte_size = 0;
+  enc->src_swap = FALSE;
+  enc->format = GST_HSPC_FORMAT_UNKNOWN;
+  gst_hyperspectral_info_init(&enc->hinfo);
+  enc->pool = NULL;
 
   enc->input_state = NULL;
   enc->writefunc = NULL;
@@ -190,6 +208,9 @@ gst_hyperspectralenc_init (GstHyperspectralenc *enc)
   enc->mosaic_path = NULL;
 
   enc->layout = DEFAULT_LAYOUT;
+  enc->n_threads = DEFAULT_N_THREADS;
+  enc->n_kernels = 0;
+  enc->n_configs = 0;
 }
 
 void
@@ -223,6 +244,9 @@ gst_hyperspectralenc_set_property (GObject * object, guint property_id,
         enc->mosaic_path = str;
       }
       break;
+    case PROP_N_THREADS:
+      enc->n_threads = g_value_get_uint(value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -250,11 +274,24 @@ gst_hyperspectralenc_get_property (GObject * object, guint property_id,
       else
         g_value_set_string(value, "");
       break;
+    case PROP_N_THREADS:
+      g_value_set_uint(value, enc->n_threads);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
   }
 }
+static void
+release_pool (GstHyperspectralenc *enc)
+{
+  if (!enc->pool)
+    return;
+  gst_buffer_pool_set_active (enc->pool, FALSE);
+  gst_object_unref (enc->pool);
+  enc->pool = NULL;
+}
+
 void
 gst_hyperspectralenc_dispose (GObject * object)
 {
@@ -269,9 +306,15 @@ gst_hyperspectralenc_dispose (GObject * object)
   enc->data_wavelength_elems = 0;
   enc->data_cube_size = 0;
   enc->frame_elems = 0;
+  enc->src_byte_size = 0;
   enc->data_byte_size = 0;
+  enc->src_swap = FALSE;
+  enc->format = GST_HSPC_FORMAT_UNKNOWN;
+  gst_hyperspectral_info_clear(&enc->hinfo);
+  release_pool(enc);
   enc->writefunc = NULL;
   enc->layout = DEFAULT_LAYOUT;
+  gst_hspec_autotune_clear (&enc->tune);
 
   if (enc->input_state)
     gst_video_codec_state_unref (enc->input_state);
@@ -295,6 +338,8 @@ gst_hyperspectralenc_finalize (GObject * object)
   GST_DEBUG_OBJECT (enc, "finalizing...");
 
   clear_mosaic(&enc->mosaic);
+  gst_hyperspectral_info_clear(&enc->hinfo);
+  release_pool(enc);
   if (enc->input_state)
     gst_video_codec_state_unref (enc->input_state);
 
@@ -309,66 +354,268 @@ gst_hyperspectralenc_finalize (GObject * object)
 
 static void
 write_cube_to_buffer_1byte_multiplanar(GstHyperspectralenc *enc, gpointer input_buffer, gpointer output_buffer,
-  gint width, gint height, gint stride) {
+  gint width, gint ystart, gint yend, gint stride) {
   guint8 *restrict inp = (guint8*) input_buffer;
   guint8 *restrict outp = (guint8*) output_buffer;
   gint i, j, wavelengthid;
 
-  for (j=0; j<height; j++) {
+  for (j=ystart; j<yend; j++) {
     for (i=0; i<width; i++) {
       wavelengthid = i%enc->mosaic_width + (j%enc->mosaic_height)*enc->mosaic_width;
       outp[wavelengthid*enc->data_wavelength_elems +  i/enc->mosaic_width +
-        (j/enc->mosaic_height)*enc->data_cube_width] = inp[i + j*stride];
+        (j/enc->mosaic_height)*enc->data_cube_width] = inp[i + (gsize) j*stride];
     }
   }
 }
 
 static void
 write_cube_to_buffer_1byte_interleaved(GstHyperspectralenc *enc, gpointer input_buffer, gpointer output_buffer,
-  gint width, gint height, gint stride) {
+  gint width, gint ystart, gint yend, gint stride) {
   guint8 *restrict inp = (guint8*) input_buffer;
   guint8 *restrict outp = (guint8*) output_buffer;
   gint i, j;
 
-  for (j=0; j<height; j++) {
+  for (j=ystart; j<yend; j++) {
     for (i=0; i<width; i++) {
-      outp[(i/enc->mosaic_width + (j/enc->mosaic_height)*enc->data_cube_width)*enc->data_cube_wavelengths +
-            i%enc->mosaic_width + (j%enc->mosaic_height)*enc->mosaic_width] = inp[i + j*stride];
+      outp[(i/enc->mosaic_width + (gsize) (j/enc->mosaic_height)*enc->data_cube_width)*enc->data_cube_wavelengths +
+            i%enc->mosaic_width + (j%enc->mosaic_height)*enc->mosaic_width] = inp[i + (gsize) j*stride];
     }
   }
 }
 
 static void
 write_cube_to_buffer_2byte_multiplanar(GstHyperspectralenc *enc, gpointer input_buffer, gpointer output_buffer,
-  gint width, gint height, gint stride) {
+  gint width, gint ystart, gint yend, gint stride) {
   guint16 *restrict inp = (guint16*) input_buffer;
   guint16 *restrict outp = (guint16*) output_buffer;
   gint i, j, wavelengthid;
 
-  for (j=0; j<height; j++) {
+  for (j=ystart; j<yend; j++) {
     for (i=0; i<width; i++) {
       wavelengthid = i%enc->mosaic_width + (j%enc->mosaic_height)*enc->mosaic_width;
       outp[wavelengthid*enc->data_wavelength_elems +  i/enc->mosaic_width +
-        (j/enc->mosaic_height)*enc->data_cube_width] = inp[i + j*stride];
+        (j/enc->mosaic_height)*enc->data_cube_width] = inp[i + (gsize) j*stride];
     }
   }
 }
 
 static void
 write_cube_to_buffer_2byte_interleaved(GstHyperspectralenc *enc, gpointer input_buffer, gpointer output_buffer,
-  gint width, gint height, gint stride) {
+  gint width, gint ystart, gint yend, gint stride) {
   guint16 *restrict inp = (guint16*) input_buffer;
   guint16 *restrict outp = (guint16*) output_buffer;
   gint i, j;
 
   for (i=0; i<width; i++) {
-    for (j=0; j<height; j++) {
-      outp[(i/enc->mosaic_width + (j/enc->mosaic_height)*enc->data_cube_width)*enc->data_cube_wavelengths +
-            i%enc->mosaic_width + (j%enc->mosaic_height)*enc->mosaic_width] = inp[i + j*stride];
+    for (j=ystart; j<yend; j++) {
+      outp[(i/enc->mosaic_width + (gsize) (j/enc->mosaic_height)*enc->data_cube_width)*enc->data_cube_wavelengths +
+            i%enc->mosaic_width + (j%enc->mosaic_height)*enc->mosaic_width] = inp[i + (gsize) j*stride];
     }
   }
 }
 
+/* integer input samples normalized to [0, 1] */
+static inline gfloat
+read_sample_f32(GstHyperspectralenc *enc, gpointer input_buffer, gsize pos) {
+  guint16 v;
+
+  if (enc->src_byte_size == 1)
+    return ((guint8*) input_buffer)[pos] / (gfloat) G_MAXUINT8;
+
+  v = ((guint16*) input_buffer)[pos];
+  if (enc->src_swap)
+    v = GUINT16_SWAP_LE_BE (v);
+  return v / (gfloat) G_MAXUINT16;
+}
+
+static void
+write_cube_to_buffer_f32_multiplanar(GstHyperspectralenc *enc, gpointer input_buffer, gpointer output_buffer,
+  gint width, gint ystart, gint yend, gint stride) {
+  gfloat *restrict outp = (gfloat*) output_buffer;
+  gint i, j, wavelengthid;
+
+  for (j=ystart; j<yend; j++) {
+    for (i=0; i<width; i++) {
+      wavelengthid = i%enc->mosaic_width + (j%enc->mosaic_height)*enc->mosaic_width;
+      outp[wavelengthid*enc->data_wavelength_elems +  i/enc->mosaic_width +
+        (j/enc->mosaic_height)*enc->data_cube_width] = read_sample_f32(enc, input_buffer, i + (gsize) j*stride);
+    }
+  }
+}
+
+static void
+write_cube_to_buffer_f32_interleaved(GstHyperspectralenc *enc, gpointer input_buffer, gpointer output_buffer,
+  gint width, gint ystart, gint yend, gint stride) {
+  gfloat *restrict outp = (gfloat*) output_buffer;
+  gint i, j;
+
+  for (j=ystart; j<yend; j++) {
+    for (i=0; i<width; i++) {
+      outp[(i/enc->mosaic_width + (gsize) (j/enc->mosaic_height)*enc->data_cube_width)*enc->data_cube_wavelengths +
+            i%enc->mosaic_width + (j%enc->mosaic_height)*enc->mosaic_width] = read_sample_f32(enc, input_buffer, i + (gsize) j*stride);
+    }
+  }
+}
+
+#define FLOAT_CHUNK 256
+
+/* the n samples of the input at pos, pos + mosaic_width, ... as half
+ * floats, staged as floats a chunk at a time */
+static void
+write_column_f16(GstHyperspectralenc *enc, gpointer input_buffer, gsize pos,
+  guint16 *outp, gsize dstride, gsize n) {
+  gfloat tmp[FLOAT_CHUNK];
+  gsize k, len;
+
+  for (k=0; k<n; k+=len) {
+    len = MIN (n - k, FLOAT_CHUNK);
+    if (enc->src_byte_size == 1) {
+      gst_hspec_kernel_u8_to_f32 (tmp, (guint8*) input_buffer + pos + k*enc->mosaic_width,
+          enc->mosaic_width, len);
+      gst_hspec_kernel_scale_f32 (tmp, 1.0f / G_MAXUINT8, 0.0f, len);
+    } else {
+      gst_hspec_kernel_u16_to_f32 (tmp, (guint16*) input_buffer + pos + k*enc->mosaic_width,
+          enc->mosaic_width, enc->src_swap, len);
+      gst_hspec_kernel_scale_f32 (tmp, 1.0f / G_MAXUINT16, 0.0f, len);
+    }
+    gst_hspec_kernel_f32_to_f16 (outp + k*dstride, dstride, tmp, len);
+  }
+}
+
+static void
+write_cube_to_buffer_f16_multiplanar(GstHyperspectralenc *enc, gpointer input_buffer, gpointer output_buffer,
+  gint width, gint ystart, gint yend, gint stride) {
+  guint16 *restrict outp = (guint16*) output_buffer;
+  gint i, j, wavelengthid;
+
+  /* every mosaic column of a row lands in its own band */
+  for (j=ystart; j<yend; j++) {
+    for (i=0; i<MIN (width, enc->mosaic_width); i++) {
+      wavelengthid = i + (j%enc->mosaic_height)*enc->mosaic_width;
+      write_column_f16 (enc, input_buffer, i + (gsize) j*stride,
+          outp + wavelengthid*enc->data_wavelength_elems + (j/enc->mosaic_height)*enc->data_cube_width,
+          1, (width - i + enc->mosaic_width - 1) / enc->mosaic_width);
+    }
+  }
+}
+
+static void
+write_cube_to_buffer_f16_interleaved(GstHyperspectralenc *enc, gpointer input_buffer, gpointer output_buffer,
+  gint width, gint ystart, gint yend, gint stride) {
+  guint16 *restrict outp = (guint16*) output_buffer;
+  gint i, j;
+
+  for (j=ystart; j<yend; j++) {
+    for (i=0; i<MIN (width, enc->mosaic_width); i++) {
+      write_column_f16 (enc, input_buffer, i + (gsize) j*stride,
+          outp + (gsize) (j/enc->mosaic_height)*enc->data_cube_width*enc->data_cube_wavelengths +
+            i + (j%enc->mosaic_height)*enc->mosaic_width,
+          enc->data_cube_wavelengths, (width - i + enc->mosaic_width - 1) / enc->mosaic_width);
+    }
+  }
+}
+
+#define ENC_KERNEL(format,layout,func) \
+  GST_HSPEC_KERNEL (GST_HSPEC_KERNEL_OP_MOSAIC_TO_CUBE, GST_HSPC_FORMAT_##format, \
+    GST_HSPC_LAYOUT_##layout, GST_HSPEC_ISA_C, func)
+
+/* keyed by the cube format, integer cubes have the format of the source */
+static const GstHspecKernel write_kernels[] = {
+  ENC_KERNEL (GRAY8, MULTIPLANE, write_cube_to_buffer_1byte_multiplanar),
+  ENC_KERNEL (GRAY8, INTERLEAVED, write_cube_to_buffer_1byte_interleaved),
+  ENC_KERNEL (GRAY16_LE, MULTIPLANE, write_cube_to_buffer_2byte_multiplanar),
+  ENC_KERNEL (GRAY16_LE, INTERLEAVED, write_cube_to_buffer_2byte_interleaved),
+  ENC_KERNEL (GRAY16_BE, MULTIPLANE, write_cube_to_buffer_2byte_multiplanar),
+  ENC_KERNEL (GRAY16_BE, INTERLEAVED, write_cube_to_buffer_2byte_interleaved),
+  ENC_KERNEL (F32, MULTIPLANE, write_cube_to_buffer_f32_multiplanar),
+  ENC_KERNEL (F32, INTERLEAVED, write_cube_to_buffer_f32_interleaved),
+  ENC_KERNEL (F16, MULTIPLANE, write_cube_to_buffer_f16_multiplanar),
+  ENC_KERNEL (F16, INTERLEAVED, write_cube_to_buffer_f16_interleaved),
+};
+
+typedef struct {
+  GstHyperspectralenc *enc;
+  GstHyperspectralencWriteFunc writefunc;
+  gpointer input_buffer;
+  gpointer output_buffer;
+  gint width;
+  gint height;
+  gint stride;
+  /* rows of mosaics in one item */
+  guint rows_per_item;
+} WriteCubeJob;
+
+/* every item is a run of mosaic rows, so that threads never write to the
+ * same row of the cube */
+static void
+write_cube_rows(gpointer user_data, guint start, guint end) {
+  WriteCubeJob *job = user_data;
+  gint mh = job->enc->mosaic_height * job->rows_per_item;
+
+  job->writefunc(job->enc, job->input_buffer, job->output_buffer,
+    job->width, start*mh, MIN((gint) end*mh, job->height), job->stride);
+}
+
+/* candidates are numbered kernel by kernel */
+static void
+write_cube_with_config(gpointer user_data, guint candidate) {
+  WriteCubeJob *job = user_data;
+  GstHspecParallelConfig *c = &job->enc->configs[candidate % job->enc->n_configs];
+  gint mh = job->enc->mosaic_height * c->rows_per_item;
+
+  job->writefunc = (GstHyperspectralencWriteFunc)
+    job->enc->kernels[candidate / job->enc->n_configs]->func;
+  job->rows_per_item = c->rows_per_item;
+  gst_hspec_parallel_for((job->height + mh - 1) / mh, c->n_threads,
+    write_cube_rows, job);
+}
+
+static void
+write_cube(GstHyperspectralenc *enc, gpointer input_buffer, gpointer output_buffer,
+  gint width, gint height, gint stride) {
+  WriteCubeJob job = { enc, enc->writefunc, input_buffer, output_buffer,
+    width, height, stride, 1 };
+
+  gst_hspec_autotune_run(&enc->tune, write_cube_with_config, &job);
+}
+
+static gboolean
+value_accepts_string (const GValue *value, const gchar *str)
+{
+  guint i;
+
+  if (G_VALUE_TYPE (value) == G_TYPE_STRING)
+    return g_str_equal (g_value_get_string (value), str);
+
+  if (G_VALUE_TYPE (value) == GST_TYPE_LIST) {
+    for (i=0; i<gst_value_list_get_size (value); i++) {
+      if (value_accepts_string (gst_value_list_get_value (value, i), str))
+        return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/* keep the samples as they are when downstream accepts them, otherwise
+ * fall back to float cubes, full precision first */
+static GstHyperspectralFormat
+select_cube_format (GstStructure *peerstruct, const gchar *fmtstr)
+{
+  const GValue *value = NULL;
+
+  if (peerstruct)
+    value = gst_structure_get_value (peerstruct, "format");
+
+  if (value && !value_accepts_string (value, fmtstr)) {
+    if (value_accepts_string (value, gst_hspec_format_to_string (GST_HSPC_FORMAT_F32)))
+      return GST_HSPC_FORMAT_F32;
+    if (value_accepts_string (value, gst_hspec_format_to_string (GST_HSPC_FORMAT_F16)))
+      return GST_HSPC_FORMAT_F16;
+  }
+
+  return gst_hspec_format_from_string (fmtstr);
+}
+
 static gboolean gst_hyperspectralenc_set_format (GstVideoEncoder *encoder, GstVideoCodecState *state)
 {
   GstHyperspectralenc *enc = GST_HYPERSPECTRALENC (encoder);
@@ -383,9 +630,20 @@ static gboolean gst_hyperspectralenc_set_format (GstVideoEncoder *encoder, GstVi
   const GValue *value;
   GstHyperspectralLayout layout;
   GstCaps *peercaps, *generated_caps;
+  const GstHspecKernel *kernel;
+  gchar *tune_key;
 
   GST_DEBUG("Video frame caps: %" GST_PTR_FORMAT, state->caps);
 
+  /* bayer input is 8 bit for every color */
+  instruct = gst_caps_get_structure (state->caps, 0);
+  if (gst_structure_has_name (instruct, "video/x-raw"))
+    fmtstr = gst_video_format_to_string (GST_VIDEO_INFO_FORMAT (info));
+  else
+    fmtstr = gst_video_format_to_string (GST_VIDEO_FORMAT_GRAY8);
+  enc->format = gst_hspec_format_from_string (fmtstr);
+  enc->src_swap = FALSE;
+
   /* get caps from peer to determine cube layout */
   peercaps = gst_pad_peer_query_caps (encoder->srcpad, NULL);
   /* this handles both fixated and non fixated layout*/
@@ -431,6 +689,7 @@ static gboolean gst_hyperspectralenc_set_format (GstVideoEncoder *encoder, GstVi
       /* get a static scring so we can unref the caps */
       layoutstr = gst_hspec_layout_to_string (enc->layout);
     }
+    enc->format = select_cube_format (peerstruct, fmtstr);
     gst_caps_unref (peercaps);
   }
   else {
@@ -440,40 +699,18 @@ static gboolean gst_hyperspectralenc_set_format (GstVideoEncoder *encoder, GstVi
   GST_DEBUG("Layout selected: %s", layoutstr);
 
   /* set the format for the output caps */
-  instruct = gst_caps_get_structure (state->caps, 0);
   if (gst_structure_has_name (instruct, "video/x-raw")) {
     klass->handle_frame = GST_DEBUG_FUNCPTR (gst_hyperspectralenc_handle_video_frame);
     switch (GST_VIDEO_INFO_FORMAT (info)) {
       case GST_VIDEO_FORMAT_GRAY8:
-        enc->data_byte_size = 1;
-        if (enc->layout == GST_HSPC_LAYOUT_MULTIPLANE) {
-          GST_DEBUG("Selecting 'write_cube_to_buffer_1byte_multiplanar' writefunc for %s",
-            GST_VIDEO_INFO_NAME(info));
-          enc->writefunc = write_cube_to_buffer_1byte_multiplanar;
-        } else if (enc->layout == GST_HSPC_LAYOUT_INTERLEAVED) {
-          GST_DEBUG("Selecting 'write_cube_to_buffer_1byte_interleaved' writefunc for %s",
-            GST_VIDEO_INFO_NAME(info));
-          enc->writefunc = write_cube_to_buffer_1byte_interleaved;
-        } else {
-          GST_ERROR("Unknown layout '%s'", layoutstr);
-          return FALSE;
-        }
+        enc->src_byte_size = 1;
         break;
       case GST_VIDEO_FORMAT_GRAY16_BE:
       case GST_VIDEO_FORMAT_GRAY16_LE:
-        enc->data_byte_size = 2;
-        if (enc->layout == GST_HSPC_LAYOUT_MULTIPLANE) {
-          GST_DEBUG("Selecting 'write_cube_to_buffer_2byte_multiplanar' writefunc for %s",
-            GST_VIDEO_INFO_NAME(info));
-          enc->writefunc = write_cube_to_buffer_2byte_multiplanar;
-        } else if (enc->layout == GST_HSPC_LAYOUT_INTERLEAVED) {
-          GST_DEBUG("Selecting 'write_cube_to_buffer_2byte_interleaved' writefunc for %s",
-            GST_VIDEO_INFO_NAME(info));
-          enc->writefunc = write_cube_to_buffer_2byte_interleaved;
-        } else {
-          GST_ERROR("Unknown layout '%s'", layoutstr);
-          return FALSE;
-        }
+        enc->src_byte_size = 2;
+        enc->src_swap = GST_VIDEO_INFO_FORMAT (info) !=
+          (G_BYTE_ORDER == G_LITTLE_ENDIAN ? GST_VIDEO_FORMAT_GRAY16_LE :
+           GST_VIDEO_FORMAT_GRAY16_BE);
         break;
       case GST_VIDEO_FORMAT_UNKNOWN:
         GST_ERROR("Unknown format detected");
@@ -483,24 +720,11 @@ static gboolean gst_hyperspectralenc_set_format (GstVideoEncoder *encoder, GstVi
         return FALSE;
     }
     defaultid = SPECTRA_DEFAULT_5x5;
-    fmtstr = gst_video_format_to_string (GST_VIDEO_INFO_FORMAT (info));
   }
   else if (gst_structure_has_name (instruct, "video/x-bayer")) {
     klass->handle_frame = GST_DEBUG_FUNCPTR (gst_hyperspectralenc_handle_raw_buffer);
-    enc->data_byte_size = 1;
+    enc->src_byte_size = 1;
     fmtstr =  gst_structure_get_string (instruct, "format");
-    if (enc->layout == GST_HSPC_LAYOUT_MULTIPLANE) {
-      GST_DEBUG("Selecting 'write_cube_to_buffer_1byte_multiplanar' writefunc for %s",
-        fmtstr);
-      enc->writefunc = write_cube_to_buffer_1byte_multiplanar;
-    } else if (enc->layout == GST_HSPC_LAYOUT_INTERLEAVED) {
-      GST_DEBUG("Selecting 'write_cube_to_buffer_1byte_interleaved' writefunc for %s",
-        fmtstr);
-      enc->writefunc = write_cube_to_buffer_1byte_interleaved;
-    } else {
-      GST_ERROR("Unknown layout '%s'", layoutstr);
-      return FALSE;
-    }
     if (g_str_equal (fmtstr, "bggr")) {
       defaultid = SPECTRA_DEFAULT_BGGR;
     } else if (g_str_equal (fmtstr, "gbrg")) {
@@ -513,14 +737,31 @@ static gboolean gst_hyperspectralenc_set_format (GstVideoEncoder *encoder, GstVi
       GST_ERROR("Unknown bayer format '%s'", fmtstr);
       return FALSE;
     }
-    /*setting output format to gray8 since bayer formats are in 8 bit for every color*/
-    fmtstr = gst_video_format_to_string (GST_VIDEO_FORMAT_GRAY8);
   }
   else {
     GST_ERROR("Unhandled video format type %s", gst_structure_get_name (instruct));
     return FALSE;
   }
 
+  if (enc->format == GST_HSPC_FORMAT_F32)
+    enc->data_byte_size = 4;
+  else if (enc->format == GST_HSPC_FORMAT_F16)
+    enc->data_byte_size = 2;
+  else
+    enc->data_byte_size = enc->src_byte_size;
+  fmtstr = gst_hspec_format_to_string (enc->format);
+
+  enc->n_kernels = gst_hspec_kernel_lookup_all (GST_HSPEC_KERNEL_OP_MOSAIC_TO_CUBE,
+    enc->format, enc->layout, enc->kernels, G_N_ELEMENTS (enc->kernels));
+  if (enc->n_kernels == 0) {
+    GST_ERROR("No writefunc for %s cubes with layout '%s'", fmtstr, layoutstr);
+    return FALSE;
+  }
+  kernel = enc->kernels[0];
+  GST_DEBUG("Selecting '%s' writefunc (%s)", kernel->name,
+    gst_hspec_isa_to_string (kernel->isa));
+  enc->writefunc = (GstHyperspectralencWriteFunc) kernel->func;
+
   /*if the mosaic has not been defined use the default*/
   if (!enc->mosaic.spectras) {
     set_mosaic_to_default(&enc->mosaic, defaultid,
@@ -539,10 +780,20 @@ static gboolean gst_hyperspectralenc_set_format (GstVideoEncoder *encoder, GstVi
   enc->data_cube_width = srcwidth / enc->mosaic_width;
   enc->data_cube_height = srcheight / enc->mosaic_height;
   enc->data_cube_wavelengths = enc->mosaic_width * enc->mosaic_height;
-  enc->data_wavelength_elems = enc->data_cube_width * enc->data_cube_height;
-  enc->data_cube_size = enc->data_cube_width * enc->data_cube_height *
-                        enc->data_cube_wavelengths * enc->data_byte_size;
-  enc->frame_elems = info->size/enc->data_byte_size;
+  enc->data_wavelength_elems = (gsize) enc->data_cube_width * enc->data_cube_height;
+  enc->data_cube_size = enc->data_wavelength_elems * enc->data_cube_wavelengths *
+                        enc->data_byte_size;
+  enc->frame_elems = info->size/enc->src_byte_size;
+
+  enc->n_configs = gst_hspec_autotune_parallel_configs(enc->configs, enc->n_threads);
+  tune_key = g_strdup_printf("mosaic-to-cube:%s/%s:%dx%d:%dx%dx%d:t%u:k%u",
+    fmtstr, layoutstr,
+    enc->mosaic_width, enc->mosaic_height, enc->data_cube_width,
+    enc->data_cube_height, enc->data_cube_wavelengths, enc->configs[0].n_threads,
+    enc->n_kernels);
+  gst_hspec_autotune_clear(&enc->tune);
+  gst_hspec_autotune_init(&enc->tune, tune_key, enc->n_kernels * enc->n_configs);
+  g_free(tune_key);
   if (enc->input_state)
     gst_video_codec_state_unref (enc->input_state);
   enc->input_state = gst_video_codec_state_ref (state);
@@ -550,6 +801,13 @@ static gboolean gst_hyperspectralenc_set_format (GstVideoEncoder *encoder, GstVi
   generated_caps = gst_hspec_build_caps (enc->data_cube_width,
     enc->data_cube_height, enc->data_cube_wavelengths,
     fmtstr, layoutstr, enc->mosaic.size, enc->mosaic.spectras);
+  gst_hyperspectral_info_clear(&enc->hinfo);
+  if (!gst_hyperspectral_info_from_caps(&enc->hinfo, generated_caps)) {
+    GST_ERROR_OBJECT (enc, "Unable to parse generated caps %" GST_PTR_FORMAT,
+      generated_caps);
+    gst_caps_unref (generated_caps);
+    return FALSE;
+  }
   output_state = gst_video_encoder_set_output_state (encoder,
         generated_caps, state);
 
@@ -561,6 +819,71 @@ static gboolean gst_hyperspectralenc_set_format (GstVideoEncoder *encoder, GstVi
   return TRUE;
 }
 
+static gboolean
+gst_hyperspectralenc_decide_allocation (GstVideoEncoder *encoder, GstQuery *query)
+{
+  GstHyperspectralenc *enc = GST_HYPERSPECTRALENC (encoder);
+  GstBufferPool *pool = NULL;
+
+  if (!GST_VIDEO_ENCODER_CLASS (gst_hyperspectralenc_parent_class)->decide_allocation (encoder, query))
+    return FALSE;
+
+  release_pool (enc);
+  if (!gst_hyperspectral_buffer_pool_decide_allocation (query,
+      GST_HYPERSPECTRAL_POOL_MIN_BUFFERS, 0, 0)) {
+    GST_WARNING_OBJECT (enc, "Unable to set up a hyperspectral pool, allocating cubes per frame");
+    return TRUE;
+  }
+
+  gst_query_parse_nth_allocation_pool (query, 0, &pool, NULL, NULL, NULL);
+  /* the write functions fill tightly packed cubes */
+  if (!gst_hyperspectral_info_is_contiguous (&GST_HYPERSPECTRAL_BUFFER_POOL (pool)->info)) {
+    GST_WARNING_OBJECT (enc, "Negotiated pool pads its cubes, allocating cubes per frame");
+    gst_object_unref (pool);
+    return TRUE;
+  }
+  if (!gst_buffer_pool_set_active (pool, TRUE)) {
+    GST_ERROR_OBJECT (enc, "Unable to activate buffer pool");
+    gst_object_unref (pool);
+    return FALSE;
+  }
+  enc->pool = pool;
+  return TRUE;
+}
+
+static gboolean
+gst_hyperspectralenc_stop (GstVideoEncoder *encoder)
+{
+  release_pool (GST_HYPERSPECTRALENC (encoder));
+  return TRUE;
+}
+
+/* cubes come from the negotiated pool, without one the base class
+ * allocates them */
+static GstFlowReturn
+allocate_output_cube (GstHyperspectralenc *henc, GstVideoCodecFrame *frame)
+{
+  if (henc->pool)
+    return gst_buffer_pool_acquire_buffer (henc->pool, &frame->output_buffer, NULL);
+  return gst_video_encoder_allocate_output_frame (GST_VIDEO_ENCODER (henc),
+    frame, henc->data_cube_size);
+}
+
+/* the cube description, pooled buffers already carry one */
+static void
+attach_cube_meta (GstHyperspectralenc *henc, GstBuffer *buffer)
+{
+  GstHyperspectralMeta *meta;
+
+  meta = gst_buffer_get_hyperspectral_meta (buffer);
+  if (!meta)
+    meta = gst_buffer_add_hyperspectral_meta (buffer, &henc->hinfo);
+  if (meta) {
+    meta->exposure = GST_CLOCK_TIME_NONE;
+    meta->flags = GST_HYPERSPECTRAL_META_FLAG_NONE;
+  }
+}
+
 static GstFlowReturn
 gst_hyperspectralenc_handle_video_frame (GstVideoEncoder *encoder, GstVideoCodecFrame *frame)
 {
@@ -569,8 +892,7 @@ gst_hyperspectralenc_handle_video_frame (GstVideoEncoder *encoder, GstVideoCodec
   GstMapInfo outbuffinfo;
   GstFlowReturn ret;
 
-  if(gst_video_encoder_allocate_output_frame (encoder,
-    frame, henc->data_cube_size) != GST_FLOW_OK) {
+  if (allocate_output_cube (henc, frame) != GST_FLOW_OK) {
     GST_ERROR_OBJECT (encoder, "Could not allocate buffer");
     gst_video_codec_frame_unref (frame);
     return GST_FLOW_ERROR;
@@ -600,12 +922,13 @@ gst_hyperspectralenc_handle_video_frame (GstVideoEncoder *encoder, GstVideoCodec
     return GST_FLOW_ERROR;
   }
 
-  henc->writefunc(henc, GST_VIDEO_FRAME_PLANE_DATA (&vframe, 0), outbuffinfo.data,
+  write_cube(henc, GST_VIDEO_FRAME_PLANE_DATA (&vframe, 0), outbuffinfo.data,
     GST_VIDEO_INFO_WIDTH (&henc->input_state->info),
     GST_VIDEO_INFO_HEIGHT (&henc->input_state->info),
-    GST_VIDEO_INFO_COMP_STRIDE(&henc->input_state->info, 0)/henc->data_byte_size);
+    GST_VIDEO_INFO_COMP_STRIDE(&henc->input_state->info, 0)/henc->src_byte_size);
   gst_buffer_unmap (frame->output_buffer, &outbuffinfo);
   gst_video_frame_unmap (&vframe);
+  attach_cube_meta (henc, frame->output_buffer);
 
   ret = gst_video_encoder_finish_frame (encoder, frame);
 
@@ -613,7 +936,7 @@ gst_hyperspectralenc_handle_video_frame (GstVideoEncoder *encoder, GstVideoCodec
 
 invalid_size:
   {
-    GST_ERROR_OBJECT (encoder, "Error in data buffer size, %" G_GSIZE_FORMAT " < %d",
+    GST_ERROR_OBJECT (encoder, "Error in data buffer size, %" G_GSIZE_FORMAT " < %" G_GSIZE_FORMAT,
       outbuffinfo.size, henc->data_cube_size);
     gst_buffer_unmap (frame->output_buffer, &outbuffinfo);
     gst_video_frame_unmap (&vframe);
@@ -629,8 +952,7 @@ gst_hyperspectralenc_handle_raw_buffer (GstVideoEncoder *encoder, GstVideoCodecF
   GstMapInfo inbuffinfo, outbuffinfo;
   GstFlowReturn ret;
 
-  if(gst_video_encoder_allocate_output_frame (encoder,
-    frame, henc->data_cube_size) != GST_FLOW_OK) {
+  if (allocate_output_cube (henc, frame) != GST_FLOW_OK) {
     GST_ERROR_OBJECT (encoder, "Could not allocate buffer");
     gst_video_codec_frame_unref (frame);
     return GST_FLOW_ERROR;
@@ -660,17 +982,18 @@ gst_hyperspectralenc_handle_raw_buffer (GstVideoEncoder *encoder, GstVideoCodecF
     return GST_FLOW_ERROR;
   }
 
-  henc->writefunc(henc, inbuffinfo.data, outbuffinfo.data,
+  write_cube(henc, inbuffinfo.data, outbuffinfo.data,
     henc->srcwidth, henc->srcheight, henc->srcwidth);
   gst_buffer_unmap (frame->output_buffer, &outbuffinfo);
   gst_buffer_unmap (frame->input_buffer, &inbuffinfo);
+  attach_cube_meta (henc, frame->output_buffer);
   ret = gst_video_encoder_finish_frame (encoder, frame);
 
   return ret;
 
 invalid_size:
   {
-    GST_ERROR_OBJECT (encoder, "Error in data buffer size, %" G_GSIZE_FORMAT " < %d",
+    GST_ERROR_OBJECT (encoder, "Error in data buffer size, %" G_GSIZE_FORMAT " < %" G_GSIZE_FORMAT,
       outbuffinfo.size, henc->data_cube_size);
     gst_buffer_unmap (frame->output_buffer, &outbuffinfo);
     gst_buffer_unmap (frame->input_buffer, &inbuffinfo);
@@ -682,6 +1005,7 @@ invalid_size:
 gboolean
 gst_hyperspectralenc_plugin_init (GstPlugin * plugin)
 {
+  gst_hspec_kernels_register (write_kernels, G_N_ELEMENTS (write_kernels));
 
   return gst_element_register (plugin, "hspecenc", GST_RANK_NONE,
       GST_TYPE_HYPERSPECTRALENC);
@@ -42,6 +42,12 @@ enum
 typedef struct _GstHyperspectralenc GstHyperspectralenc;
 typedef struct _GstHyperspectralencClass GstHyperspectralencClass;
 
+/* writes the source rows [ystart, yend) to the sink frame, registered as
+ * GST_HSPEC_KERNEL_OP_MOSAIC_TO_CUBE kernels */
+typedef void (*GstHyperspectralencWriteFunc) (GstHyperspectralenc *enc,
+    gpointer input_buffer, gpointer output_buffer,
+    gint width, gint ystart, gint yend, gint stride);
+
 struct _GstHyperspectralenc
 {
   GstVideoEncoder base_hyperspectralenc;
@@ -49,13 +55,18 @@ struct _GstHyperspectralenc
   GString *mosaic_path;
   GString *mosaic_str;
   SpectralInfo mosaic;
+  /* sample size of the input frames and of the generated cube */
+  gint src_byte_size;
   gint data_byte_size;
+  /* input samples are 16 bit and not in host byte order */
+  gboolean src_swap;
+  GstHyperspectralFormat format;
   gint data_cube_width;
   gint data_cube_height;
   gint data_cube_wavelengths;
-  gint data_wavelength_elems;
-  gint data_cube_size;
-  gint frame_elems;
+  gsize data_wavelength_elems;
+  gsize data_cube_size;
+  gsize frame_elems;
 
   gint mosaic_width;
   gint mosaic_height;
@@ -64,12 +75,27 @@ struct _GstHyperspectralenc
   gint srcheight;
 
   GstHyperspectralLayout layout;
+  /* description of the generated cube, attached to every output buffer */
+  GstHyperspectralInfo hinfo;
+  /* pool the output cubes are acquired from, NULL when none was negotiated */
+  GstBufferPool *pool;
 
   GstVideoCodecState *input_state;
 
-  /* vfunc for writing data from source frame to sink frame */
-  void (*writefunc) (GstHyperspectralenc *enc, gpointer input_buffer, gpointer output_buffer,
-    gint width, gint height, gint stride);
+  /* upper limit of threads encoding a frame, 0 for the whole pool */
+  guint n_threads;
+
+  /* kernel selected for the negotiated format and layout */
+  GstHyperspectralencWriteFunc writefunc;
+
+  /* the kernels usable for the negotiated format and layout and the ways
+   * to split a frame over the thread pool, every pair is a candidate tuned
+   * over the first frames */
+  const GstHspecKernel *kernels[GST_HSPEC_ISA_LAST];
+  guint n_kernels;
+  GstHspecParallelConfig configs[GST_HSPEC_AUTOTUNE_MAX_CONFIGS];
+  guint n_configs;
+  GstHspecAutotune tune;
 };
 
 struct _GstHyperspectralencClass
@@ -0,0 +1,256 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include <gst/check/gstcheck.h>
+#include <gst/hyperspectral/hyperspectral-kernels.h>
+#include <gst/hyperspectral/hyperspectral-dispatch.h>
+
+/* run lengths up to this are checked, covering every partial group and
+ * tail of the vector loops */
+#define MAX_SAMPLES 100
+/* bytes after the output that must stay untouched */
+#define GUARD 32
+#define GUARD_BYTE 0xa5
+
+typedef void (*UnpackFunc) (guint16 *dest, const guint8 *src, gsize n);
+typedef void (*PackFunc) (guint8 *dest, const guint16 *src, gsize n);
+typedef gsize (*Base64Func) (gchar *dest, const guint8 *src, gsize n);
+
+/* every iteration of a loop test runs in its own process, the instruction
+ * set is only picked once per process. Returns FALSE when the CPU lacks
+ * isa, nothing is left to compare then */
+static gboolean
+force_isa (gint isa)
+{
+  g_setenv (GST_HSPEC_FORCE_ISA_ENV, gst_hspec_isa_to_string (isa), TRUE);
+  if (!gst_hspec_cpu_has_isa (isa)) {
+    GST_INFO ("CPU lacks %s, skipping", gst_hspec_isa_to_string (isa));
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* the C kernel, the one the others have to match */
+static GCallback
+lookup_c (GstHspecKernelOp op, GstHyperspectralFormat format)
+{
+  const GstHspecKernel *kernels[GST_HSPEC_ISA_LAST];
+  guint i, n;
+
+  n = gst_hspec_kernel_lookup_all (op, format, GST_HSPC_LAYOUT_UNKNOWN,
+      kernels, G_N_ELEMENTS (kernels));
+  for (i=0; i<n; i++) {
+    if (kernels[i]->isa == GST_HSPEC_ISA_C)
+      return kernels[i]->func;
+  }
+  fail ("no C kernel for operation %d", op);
+  return NULL;
+}
+
+static void
+check_unpack (GstHyperspectralFormat format, gint isa)
+{
+  guint8 src[MAX_SAMPLES * 2];
+  guint16 dest[MAX_SAMPLES + GUARD], expected[MAX_SAMPLES + GUARD];
+  UnpackFunc unpack_c;
+  GRand *rand;
+  gsize n, i;
+
+  if (!force_isa (isa))
+    return;
+
+  rand = g_rand_new_with_seed (isa);
+  for (i=0; i<sizeof (src); i++)
+    src[i] = g_rand_int (rand);
+  g_rand_free (rand);
+
+  /* the first call registers the kernels */
+  if (format == GST_HSPC_FORMAT_GRAY10P)
+    gst_hspec_kernel_unpack_10 (dest, src, 0);
+  else
+    gst_hspec_kernel_unpack_12 (dest, src, 0);
+  unpack_c = (UnpackFunc) lookup_c (GST_HSPEC_KERNEL_OP_UNPACK, format);
+
+  for (n=0; n<=MAX_SAMPLES; n++) {
+    memset (dest, GUARD_BYTE, sizeof (dest));
+    memset (expected, GUARD_BYTE, sizeof (expected));
+    if (format == GST_HSPC_FORMAT_GRAY10P)
+      gst_hspec_kernel_unpack_10 (dest, src, n);
+    else
+      gst_hspec_kernel_unpack_12 (dest, src, n);
+    unpack_c (expected, src, n);
+    fail_unless (memcmp (dest, expected, sizeof (dest)) == 0,
+        "%s unpack of %" G_GSIZE_FORMAT " samples differs from C",
+        gst_hspec_isa_to_string (isa), n);
+  }
+}
+
+static void
+check_pack (GstHyperspectralFormat format, gint isa)
+{
+  guint16 src[MAX_SAMPLES];
+  guint8 dest[MAX_SAMPLES * 2 + GUARD], expected[MAX_SAMPLES * 2 + GUARD];
+  PackFunc pack_c;
+  GRand *rand;
+  gsize n, i;
+
+  if (!force_isa (isa))
+    return;
+
+  /* values above the range of the format have to saturate the same way */
+  rand = g_rand_new_with_seed (isa);
+  for (i=0; i<G_N_ELEMENTS (src); i++)
+    src[i] = g_rand_int (rand) >> (i % 3 == 0 ? 16 : 20);
+  g_rand_free (rand);
+
+  if (format == GST_HSPC_FORMAT_GRAY10P)
+    gst_hspec_kernel_pack_10 (dest, src, 0);
+  else
+    gst_hspec_kernel_pack_12 (dest, src, 0);
+  pack_c = (PackFunc) lookup_c (GST_HSPEC_KERNEL_OP_PACK, format);
+
+  for (n=0; n<=MAX_SAMPLES; n++) {
+    memset (dest, GUARD_BYTE, sizeof (dest));
+    memset (expected, GUARD_BYTE, sizeof (expected));
+    if (format == GST_HSPC_FORMAT_GRAY10P)
+      gst_hspec_kernel_pack_10 (dest, src, n);
+    else
+      gst_hspec_kernel_pack_12 (dest, src, n);
+    pack_c (expected, src, n);
+    fail_unless (memcmp (dest, expected, sizeof (dest)) == 0,
+        "%s pack of %" G_GSIZE_FORMAT " samples differs from C",
+        gst_hspec_isa_to_string (isa), n);
+    for (i=gst_hspec_format_get_size (format, n); i<sizeof (dest); i++)
+      fail_unless_equals_int (dest[i], GUARD_BYTE);
+  }
+}
+
+GST_START_TEST (test_unpack_10)
+{
+  check_unpack (GST_HSPC_FORMAT_GRAY10P, __i__);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_unpack_12)
+{
+  check_unpack (GST_HSPC_FORMAT_GRAY12P, __i__);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_pack_10)
+{
+  check_pack (GST_HSPC_FORMAT_GRAY10P, __i__);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_pack_12)
+{
+  check_pack (GST_HSPC_FORMAT_GRAY12P, __i__);
+}
+
+GST_END_TEST;
+
+/* a packed round trip gives back the samples that fit the format */
+GST_START_TEST (test_pack_round_trip)
+{
+  guint16 src[MAX_SAMPLES], dest[MAX_SAMPLES];
+  guint8 packed[MAX_SAMPLES * 2];
+  gsize i;
+
+  if (!force_isa (__i__))
+    return;
+
+  for (i=0; i<MAX_SAMPLES; i++)
+    src[i] = (i * 37) & 0x3ff;
+  gst_hspec_kernel_pack_10 (packed, src, MAX_SAMPLES);
+  gst_hspec_kernel_unpack_10 (dest, packed, MAX_SAMPLES);
+  fail_unless (memcmp (src, dest, sizeof (src)) == 0);
+
+  for (i=0; i<MAX_SAMPLES; i++)
+    src[i] = (i * 131) & 0xfff;
+  gst_hspec_kernel_pack_12 (packed, src, MAX_SAMPLES);
+  gst_hspec_kernel_unpack_12 (dest, packed, MAX_SAMPLES);
+  fail_unless (memcmp (src, dest, sizeof (src)) == 0);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_base64)
+{
+  guint8 src[MAX_SAMPLES];
+  gchar dest[MAX_SAMPLES * 2 + GUARD], expected[MAX_SAMPLES * 2 + GUARD];
+  gchar *glib;
+  Base64Func base64_c;
+  GRand *rand;
+  gsize n, i, len;
+
+  if (!force_isa (__i__))
+    return;
+
+  rand = g_rand_new_with_seed (__i__);
+  for (i=0; i<sizeof (src); i++)
+    src[i] = g_rand_int (rand);
+  g_rand_free (rand);
+
+  gst_hspec_kernel_base64_encode (dest, src, 0);
+  base64_c = (Base64Func) lookup_c (GST_HSPEC_KERNEL_OP_BASE64,
+      GST_HSPC_FORMAT_GRAY8);
+
+  for (n=0; n<=MAX_SAMPLES; n++) {
+    memset (dest, GUARD_BYTE, sizeof (dest));
+    memset (expected, GUARD_BYTE, sizeof (expected));
+    len = gst_hspec_kernel_base64_encode (dest, src, n);
+    fail_unless_equals_uint64 (len, (n + 2) / 3 * 4);
+    fail_unless_equals_uint64 (base64_c (expected, src, n), len);
+    fail_unless (memcmp (dest, expected, sizeof (dest)) == 0,
+        "%s base64 of %" G_GSIZE_FORMAT " bytes differs from C",
+        gst_hspec_isa_to_string (__i__), n);
+
+    /* and both are plain base64 */
+    glib = g_base64_encode (src, n);
+    fail_unless (strlen (glib) == len && memcmp (dest, glib, len) == 0);
+    g_free (glib);
+  }
+}
+
+GST_END_TEST;
+
+static Suite *
+hspec_kernels_suite (void)
+{
+  Suite *s = suite_create ("hspec-kernels");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  /* the loop index is the instruction set to force */
+  tcase_add_loop_test (tc_chain, test_unpack_10, 0, GST_HSPEC_ISA_LAST);
+  tcase_add_loop_test (tc_chain, test_unpack_12, 0, GST_HSPEC_ISA_LAST);
+  tcase_add_loop_test (tc_chain, test_pack_10, 0, GST_HSPEC_ISA_LAST);
+  tcase_add_loop_test (tc_chain, test_pack_12, 0, GST_HSPEC_ISA_LAST);
+  tcase_add_loop_test (tc_chain, test_pack_round_trip, 0, GST_HSPEC_ISA_LAST);
+  tcase_add_loop_test (tc_chain, test_base64, 0, GST_HSPEC_ISA_LAST);
+
+  return s;
+}
+
+GST_CHECK_MAIN (hspec_kernels);
@@ -0,0 +1,328 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <gst/check/gstcheck.h>
+#include <gst/hyperspectral/hyperspectral-format.h>
+#include <gst/hyperspectral/hyperspectral-recording.h>
+
+#define WIDTH 4
+#define HEIGHT 3
+#define BANDS 2
+#define CUBE_SIZE (WIDTH * HEIGHT * BANDS)
+#define N_FRAMES 5
+#define FRAME_DURATION (10 * GST_MSECOND)
+
+static GstCaps *
+create_caps (void)
+{
+  gint ids[BANDS] = { 450, 550 };
+
+  return gst_hspec_build_caps (WIDTH, HEIGHT, BANDS, "GRAY8", "multiplane",
+      BANDS, ids);
+}
+
+static guint8
+cube_sample (guint64 frame, gsize i)
+{
+  return (guint8) (frame * 31 + i);
+}
+
+/* writes a recording of N_FRAMES frames the way hspecfilesink does and
+ * returns it in data */
+static guint8 *
+create_recording (gsize *size, guint64 *index_offset)
+{
+  GstHspecRecordingEntry entries[N_FRAMES];
+  GstCaps *caps;
+  guint8 *header, *index, *data, *p;
+  gsize header_size, index_size;
+  guint64 stride, i;
+  gsize j;
+
+  caps = create_caps ();
+  header = gst_hspec_recording_header_new (caps, CUBE_SIZE, &header_size);
+  gst_caps_unref (caps);
+  stride = gst_hspec_recording_frame_stride (CUBE_SIZE);
+  fail_unless (stride >= GST_HSPEC_RECORDING_RECORD_SIZE + CUBE_SIZE);
+
+  *index_offset = header_size + N_FRAMES * stride;
+  for (i=0; i<N_FRAMES; i++) {
+    entries[i].offset = header_size + i * stride +
+        GST_HSPEC_RECORDING_RECORD_SIZE;
+    entries[i].pts = i * FRAME_DURATION;
+    entries[i].duration = FRAME_DURATION;
+    entries[i].number = i;
+  }
+  index = gst_hspec_recording_index_new (entries, N_FRAMES, *index_offset,
+      &index_size);
+
+  *size = *index_offset + index_size;
+  data = g_malloc0 (*size);
+  memcpy (data, header, header_size);
+  for (i=0; i<N_FRAMES; i++) {
+    p = data + header_size + i * stride;
+    gst_hspec_recording_fill_record (p, &entries[i]);
+    for (j=0; j<CUBE_SIZE; j++)
+      p[GST_HSPEC_RECORDING_RECORD_SIZE + j] = cube_sample (i, j);
+  }
+  memcpy (data + *index_offset, index, index_size);
+
+  g_free (header);
+  g_free (index);
+  return data;
+}
+
+/* saves the first size bytes of data to a new file and opens it */
+static GstHspecRecording *
+open_recording (const guint8 *data, gsize size, gchar **path)
+{
+  GstHspecRecording *rec;
+  gint fd;
+
+  fd = g_file_open_tmp ("hspec-recording-XXXXXX", path, NULL);
+  fail_unless (fd >= 0);
+  close (fd);
+  fail_unless (g_file_set_contents (*path, (const gchar *) data, size, NULL));
+
+  rec = gst_hspec_recording_open (*path);
+  return rec;
+}
+
+static void
+close_recording (GstHspecRecording *rec, gchar *path)
+{
+  if (rec)
+    gst_hspec_recording_free (rec);
+  g_unlink (path);
+  g_free (path);
+}
+
+static void
+check_frames (GstHspecRecording *rec, guint64 n_frames)
+{
+  GstHspecRecordingEntry entry;
+  guint8 cube[CUBE_SIZE];
+  guint64 i;
+  gsize j;
+
+  fail_unless_equals_uint64 (gst_hspec_recording_get_n_frames (rec),
+      n_frames);
+  for (i=0; i<n_frames; i++) {
+    fail_unless (gst_hspec_recording_get_entry (rec, i, &entry));
+    fail_unless_equals_uint64 (entry.number, i);
+    fail_unless_equals_uint64 (entry.pts, i * FRAME_DURATION);
+    fail_unless_equals_uint64 (entry.duration, FRAME_DURATION);
+
+    fail_unless (gst_hspec_recording_read_frame (rec, i, cube));
+    for (j=0; j<CUBE_SIZE; j++)
+      fail_unless_equals_int (cube[j], cube_sample (i, j));
+  }
+  fail_if (gst_hspec_recording_get_entry (rec, n_frames, &entry));
+}
+
+GST_START_TEST (test_round_trip)
+{
+  const GstHyperspectralInfo *info;
+  GstHspecRecording *rec;
+  GstCaps *caps, *expected;
+  guint64 index_offset;
+  guint8 *data;
+  gchar *path;
+  gsize size;
+
+  data = create_recording (&size, &index_offset);
+  rec = open_recording (data, size, &path);
+  fail_unless (rec != NULL);
+
+  caps = gst_hspec_recording_get_caps (rec);
+  expected = create_caps ();
+  fail_unless (gst_caps_is_equal (caps, expected));
+  gst_caps_unref (caps);
+  gst_caps_unref (expected);
+
+  info = gst_hspec_recording_get_info (rec);
+  fail_unless_equals_int (info->width, WIDTH);
+  fail_unless_equals_int (info->height, HEIGHT);
+  fail_unless_equals_int (info->wavelengths, BANDS);
+  fail_unless_equals_uint64 (info->cube_size, CUBE_SIZE);
+
+  check_frames (rec, N_FRAMES);
+
+  close_recording (rec, path);
+  g_free (data);
+}
+
+GST_END_TEST;
+
+/* a recording that was cut short has its frames found from their records */
+GST_START_TEST (test_recover_index)
+{
+  GstHspecRecording *rec;
+  guint64 index_offset, stride;
+  guint8 *data;
+  gchar *path;
+  gsize size;
+
+  data = create_recording (&size, &index_offset);
+  stride = gst_hspec_recording_frame_stride (CUBE_SIZE);
+
+  /* part of the footer missing */
+  rec = open_recording (data, size - 1, &path);
+  fail_unless (rec != NULL);
+  check_frames (rec, N_FRAMES);
+  close_recording (rec, path);
+
+  /* neither index nor footer */
+  rec = open_recording (data, index_offset, &path);
+  fail_unless (rec != NULL);
+  check_frames (rec, N_FRAMES);
+  close_recording (rec, path);
+
+  /* the cube of the last frame incomplete */
+  rec = open_recording (data, index_offset - stride / 2, &path);
+  fail_unless (rec != NULL);
+  check_frames (rec, N_FRAMES - 1);
+  close_recording (rec, path);
+
+  /* only the header */
+  rec = open_recording (data, index_offset - N_FRAMES * stride, &path);
+  fail_unless (rec != NULL);
+  check_frames (rec, 0);
+  close_recording (rec, path);
+
+  g_free (data);
+}
+
+GST_END_TEST;
+
+/* a footer that does not describe the file is not trusted */
+GST_START_TEST (test_bad_index)
+{
+  GstHspecRecording *rec;
+  guint64 index_offset;
+  guint8 *data, *footer;
+  gchar *path;
+  gsize size;
+
+  data = create_recording (&size, &index_offset);
+  footer = data + size - GST_HSPEC_RECORDING_FOOTER_SIZE;
+
+  /* more frames than the index holds */
+  GST_WRITE_UINT64_LE (footer + 16, N_FRAMES + 1);
+  rec = open_recording (data, size, &path);
+  fail_unless (rec != NULL);
+  check_frames (rec, N_FRAMES);
+  close_recording (rec, path);
+  GST_WRITE_UINT64_LE (footer + 16, N_FRAMES);
+
+  /* index in the header */
+  GST_WRITE_UINT64_LE (footer + 8, 0);
+  rec = open_recording (data, size, &path);
+  fail_unless (rec != NULL);
+  check_frames (rec, N_FRAMES);
+  close_recording (rec, path);
+  GST_WRITE_UINT64_LE (footer + 8, index_offset);
+
+  /* an entry pointing past the frames */
+  GST_WRITE_UINT64_LE (data + index_offset, index_offset);
+  rec = open_recording (data, size, &path);
+  fail_unless (rec != NULL);
+  check_frames (rec, N_FRAMES);
+  close_recording (rec, path);
+
+  g_free (data);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_not_a_recording)
+{
+  GstHspecRecording *rec;
+  guint64 index_offset;
+  guint8 *data;
+  gchar *path;
+  gsize size;
+
+  data = create_recording (&size, &index_offset);
+
+  /* header cut short */
+  rec = open_recording (data, 16, &path);
+  fail_unless (rec == NULL);
+  close_recording (rec, path);
+
+  data[0] = 'X';
+  rec = open_recording (data, size, &path);
+  fail_unless (rec == NULL);
+  close_recording (rec, path);
+
+  g_free (data);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_find_frame)
+{
+  GstHspecRecording *rec;
+  guint64 index_offset, i;
+  guint8 *data;
+  gchar *path;
+  gsize size;
+
+  data = create_recording (&size, &index_offset);
+  rec = open_recording (data, size, &path);
+  fail_unless (rec != NULL);
+
+  for (i=0; i<N_FRAMES; i++) {
+    fail_unless_equals_uint64 (gst_hspec_recording_find_frame (rec,
+            i * FRAME_DURATION), i);
+    fail_unless_equals_uint64 (gst_hspec_recording_find_frame (rec,
+            i * FRAME_DURATION + FRAME_DURATION / 2), i);
+  }
+  /* anything after the last frame finds the last one */
+  fail_unless_equals_uint64 (gst_hspec_recording_find_frame (rec,
+          N_FRAMES * FRAME_DURATION * 2), N_FRAMES - 1);
+  fail_unless_equals_uint64 (gst_hspec_recording_find_frame (rec,
+          GST_CLOCK_TIME_NONE - 1), N_FRAMES - 1);
+
+  close_recording (rec, path);
+  g_free (data);
+}
+
+GST_END_TEST;
+
+static Suite *
+hspec_recording_suite (void)
+{
+  Suite *s = suite_create ("hspec-recording");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_round_trip);
+  tcase_add_test (tc_chain, test_recover_index);
+  tcase_add_test (tc_chain, test_bad_index);
+  tcase_add_test (tc_chain, test_not_a_recording);
+  tcase_add_test (tc_chain, test_find_frame);
+
+  return s;
+}
+
+GST_CHECK_MAIN (hspec_recording);